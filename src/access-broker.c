@@ -34,6 +34,7 @@
 #include "access-broker.h"
 #include "tcti.h"
 #include "tpm2-command.h"
+#include "tpm2-header.h"
 #include "tpm2-response.h"
 #include "util.h"
 
@@ -130,8 +131,17 @@ access_broker_dispose (GObject *obj)
     AccessBroker *self = ACCESS_BROKER (obj);
 
     if (self->sapi_context != NULL) {
+        g_info ("AccessBroker resent %" PRIu64 " commands %" PRIu64 " times "
+                "over %" PRId64 " us, %" PRIu64 " still failed",
+                self->retry_stats.commands, self->retry_stats.retries,
+                self->retry_stats.time_us, self->retry_stats.exhausted);
         Tss2_Sys_Finalize (self->sapi_context);
     }
+    if (self->random_pool != NULL) {
+        secure_zero (self->random_pool, self->random_pool_size);
+        g_clear_pointer (&self->random_pool, g_free);
+        self->random_pool_count = 0;
+    }
     g_clear_pointer (&self->sapi_context, g_free);
     g_clear_object (&self->tcti);
     G_OBJECT_CLASS (access_broker_parent_class)->dispose (obj);
@@ -452,6 +462,107 @@ access_broker_get_response (AccessBroker *broker,
 
     return rc;
 }
+/*
+ * Returns TRUE for the response codes telling us the TPM expects the
+ * command to be sent again.
+ */
+static gboolean
+access_broker_rc_is_retry (TSS2_RC rc)
+{
+    switch (rc) {
+    case TPM2_RC_RETRY:
+    case TPM2_RC_YIELDED:
+    case TPM2_RC_TESTING:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+/*
+ * Sleep before resending a command for the 'attempt'th time. The delay
+ * doubles with each attempt. Returns FALSE without sleeping if the time
+ * since 'start' (from g_get_monotonic_time) plus the delay would exceed
+ * ACCESS_BROKER_RETRY_TIME_MAX_USEC.
+ */
+static gboolean
+access_broker_retry_wait (guint  attempt,
+                          gint64 start)
+{
+    gint64 delay;
+
+    delay = (gint64)ACCESS_BROKER_RETRY_DELAY_MIN_USEC << MIN (attempt, 16);
+    delay = MIN (delay, ACCESS_BROKER_RETRY_DELAY_MAX_USEC);
+    if (g_get_monotonic_time () - start + delay >
+        ACCESS_BROKER_RETRY_TIME_MAX_USEC)
+    {
+        return FALSE;
+    }
+    g_usleep (delay);
+    return TRUE;
+}
+/*
+ * Send the command to the TPM and get the response. If the TPM responds
+ * with one of the retry codes the command is sent again with increasing
+ * delay. Resending here rather than in the client saves a round trip
+ * through the daemon per retry and the command doesn't go to the back of
+ * the queue. We keep the lock while waiting since the TPM is busy anyway.
+ * The caller MUST hold the lock.
+ */
+static TSS2_RC
+access_broker_transceive (AccessBroker *broker,
+                          Tpm2Command  *command,
+                          uint8_t     **buffer,
+                          size_t       *buffer_size)
+{
+    TSS2_RC rc, response_code;
+    gint64 start = 0;
+    guint attempt;
+
+    for (attempt = 0; ; ++attempt) {
+        rc = access_broker_send_cmd (broker, command);
+        if (rc != TSS2_RC_SUCCESS)
+            break;
+        rc = access_broker_get_response (broker, buffer, buffer_size);
+        if (rc != TSS2_RC_SUCCESS || *buffer_size < TPM_HEADER_SIZE)
+            break;
+        response_code = get_response_code (*buffer);
+        if (!access_broker_rc_is_retry (response_code))
+            break;
+        if (start == 0)
+            start = g_get_monotonic_time ();
+        if (!access_broker_retry_wait (attempt, start)) {
+            g_warning ("%s: command code 0x%" PRIx32 " still got RC 0x%"
+                       PRIx32 " after %u retries", __func__,
+                       tpm2_command_get_code (command), response_code,
+                       attempt);
+            ++broker->retry_stats.exhausted;
+            break;
+        }
+        g_debug ("%s: resending command code 0x%" PRIx32 " after RC 0x%"
+                 PRIx32, __func__, tpm2_command_get_code (command),
+                 response_code);
+        ++broker->retry_stats.retries;
+        free (*buffer);
+        *buffer = NULL;
+    }
+    if (start != 0) {
+        ++broker->retry_stats.commands;
+        broker->retry_stats.time_us += g_get_monotonic_time () - start;
+    }
+    return rc;
+}
+/*
+ * Copy the retry counters into 'stats'.
+ */
+void
+access_broker_get_retry_stats (AccessBroker                *broker,
+                               access_broker_retry_stats_t *stats)
+{
+    g_assert_nonnull (stats);
+    access_broker_lock (broker);
+    *stats = broker->retry_stats;
+    access_broker_unlock (broker);
+}
 /**
  * In the most simple case the caller will want to send just a single
  * command represented by a Tpm2Command object. The response is passed
@@ -478,10 +589,7 @@ access_broker_send_command (AccessBroker  *broker,
              " Tpm2Command: 0x%" PRIxPTR, (uintptr_t)broker,
              (uintptr_t)command);
     access_broker_lock (broker);
-    *rc = access_broker_send_cmd (broker, command);
-    if (*rc != TSS2_RC_SUCCESS)
-        goto unlock_out;
-    *rc = access_broker_get_response (broker, &buffer, &buffer_size);
+    *rc = access_broker_transceive (broker, command, &buffer, &buffer_size);
     if (*rc != TSS2_RC_SUCCESS) {
         if (buffer != NULL)
             free (buffer);
@@ -528,6 +636,71 @@ access_broker_new (Tcti *tcti)
                                           NULL));
     return broker;
 }
+/*
+ * Returns TRUE if every property in 'id' is present in 'properties' with the
+ * same value.
+ */
+static gboolean
+access_broker_properties_match_id (TPMS_CAPABILITY_DATA const *id,
+                                   TPMS_CAPABILITY_DATA const *properties)
+{
+    TPML_TAGGED_TPM_PROPERTY const *id_props = &id->data.tpmProperties;
+    TPML_TAGGED_TPM_PROPERTY const *props = &properties->data.tpmProperties;
+    unsigned int i, j;
+
+    if (id->capability != TPM2_CAP_TPM_PROPERTIES ||
+        properties->capability != TPM2_CAP_TPM_PROPERTIES ||
+        id_props->count == 0)
+    {
+        return FALSE;
+    }
+    for (i = 0; i < id_props->count; ++i) {
+        for (j = 0; j < props->count; ++j) {
+            if (props->tpmProperty [j].property ==
+                id_props->tpmProperty [i].property)
+            {
+                break;
+            }
+        }
+        if (j == props->count ||
+            props->tpmProperty [j].value != id_props->tpmProperty [i].value)
+        {
+            g_debug ("%s: TPM property 0x%" PRIx32 " doesn't match",
+                     __func__, id_props->tpmProperty [i].property);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+/*
+ * Query the TPM for the fixed properties that identify it: the
+ * manufacturer, vendor strings and firmware version. This is a single
+ * small GetCapability and is used to decide whether previously cached
+ * fixed properties can be trusted. The caller MUST hold the sapi_mutex
+ * lock or be the only user of the AccessBroker.
+ */
+static TSS2_RC
+access_broker_get_tpm_id (TSS2_SYS_CONTEXT     *sapi_context,
+                          TPMS_CAPABILITY_DATA *capability_data)
+{
+    TSS2_RC rc;
+    TPMI_YES_NO more_data;
+
+    rc = Tss2_Sys_GetCapability (sapi_context,
+                                 NULL,
+                                 TPM2_CAP_TPM_PROPERTIES,
+                                 TPM2_PT_MANUFACTURER,
+                                 TPM2_PT_FIRMWARE_VERSION_2 -
+                                 TPM2_PT_MANUFACTURER + 1,
+                                 &more_data,
+                                 capability_data,
+                                 NULL);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("Failed to GetCapability: TPM2_CAP_TPM_PROPERTIES, "
+                   "TPM2_PT_MANUFACTURER: 0x%" PRIx32, rc);
+    }
+    return rc;
+}
 /*
  * Initialize the AccessBroker. This is all about initializing internal data
  * that normally we would want to do in a constructor. But since this
@@ -539,9 +712,27 @@ access_broker_new (Tcti *tcti)
 TSS2_RC
 access_broker_init_tpm (AccessBroker *broker)
 {
+    return access_broker_init_tpm_cached (broker, NULL, NULL);
+}
+/*
+ * Initialize the AccessBroker using previously cached fixed TPM properties.
+ * Instead of querying the TPM for all fixed properties we query only those
+ * that identify the TPM (manufacturer and firmware version). If these match
+ * the cached properties, the cached properties are used and 'cache_hit' is
+ * set to TRUE. Otherwise we fall back to querying the TPM for all of them.
+ * If 'properties_fixed' is NULL this is the same as access_broker_init_tpm.
+ */
+TSS2_RC
+access_broker_init_tpm_cached (AccessBroker               *broker,
+                               TPMS_CAPABILITY_DATA const *properties_fixed,
+                               gboolean                   *cache_hit)
+{
+    TPMS_CAPABILITY_DATA id = TPMS_CAPABILITY_DATA_ZERO_INIT;
     TSS2_RC rc;
 
     g_debug ("access_broker_init_tpm: 0x%" PRIxPTR, (uintptr_t)broker);
+    if (cache_hit != NULL)
+        *cache_hit = FALSE;
     if (broker->initialized)
         return TSS2_RC_SUCCESS;
     pthread_mutex_init (&broker->sapi_mutex, NULL);
@@ -549,6 +740,17 @@ access_broker_init_tpm (AccessBroker *broker)
     if (rc != TSS2_RC_SUCCESS) {
         g_warning ("access_broker_sent_tpm_startup failed: 0x%x", rc);
     }
+    if (properties_fixed != NULL &&
+        access_broker_get_tpm_id (broker->sapi_context, &id) == TSS2_RC_SUCCESS &&
+        access_broker_properties_match_id (&id, properties_fixed))
+    {
+        g_info ("Using cached fixed TPM properties");
+        broker->properties_fixed = *properties_fixed;
+        broker->initialized = true;
+        if (cache_hit != NULL)
+            *cache_hit = TRUE;
+        return TSS2_RC_SUCCESS;
+    }
     rc = access_broker_get_tpm_properties_fixed (broker->sapi_context,
                                                  &broker->properties_fixed);
     if (rc != TSS2_RC_SUCCESS) {
@@ -559,6 +761,435 @@ access_broker_init_tpm (AccessBroker *broker)
 out:
     return rc;
 }
+/*
+ * Thin wrapper around the TPM2_GetCapability command for callers that
+ * don't hold the AccessBroker lock. Unlike the functions used during
+ * initialization a failure here is never fatal.
+ */
+TSS2_RC
+access_broker_get_capability (AccessBroker         *broker,
+                              TPM2_CAP              capability,
+                              UINT32                property,
+                              UINT32                count,
+                              TPMS_CAPABILITY_DATA *capability_data)
+{
+    TSS2_SYS_CONTEXT *sapi_context;
+    TPMI_YES_NO more_data;
+    TSS2_RC rc;
+
+    g_assert_nonnull (broker);
+    g_assert_nonnull (capability_data);
+    sapi_context = access_broker_lock_sapi (broker);
+    rc = Tss2_Sys_GetCapability (sapi_context,
+                                 NULL,
+                                 capability,
+                                 property,
+                                 count,
+                                 &more_data,
+                                 capability_data,
+                                 NULL);
+    access_broker_unlock (broker);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: GetCapability 0x%" PRIx32 " failed: 0x%" PRIx32,
+                   __func__, capability, rc);
+    }
+    return rc;
+}
+/*
+ * Populate the capability cache used by access_broker_get_capability_cached
+ * with the algorithms and commands implemented by the TPM. These never
+ * change while the TPM is running. The command attributes may be provided
+ * by the caller (e.g. from the startup cache), otherwise we query the TPM.
+ * If the TPM has more data than fits in a single response the capability
+ * isn't cached. Must be called before the AccessBroker is shared with
+ * other threads.
+ */
+TSS2_RC
+access_broker_init_cap_cache (AccessBroker               *broker,
+                              TPMS_CAPABILITY_DATA const *commands)
+{
+    TSS2_SYS_CONTEXT *sapi_context;
+    TPMI_YES_NO more_data = NO;
+    TSS2_RC rc;
+
+    g_assert_nonnull (broker);
+    sapi_context = access_broker_lock_sapi (broker);
+    rc = Tss2_Sys_GetCapability (sapi_context,
+                                 NULL,
+                                 TPM2_CAP_ALGS,
+                                 TPM2_ALG_FIRST,
+                                 TPM2_MAX_CAP_ALGS,
+                                 &more_data,
+                                 &broker->algs,
+                                 NULL);
+    if (rc != TSS2_RC_SUCCESS || more_data == YES) {
+        g_warning ("%s: not caching TPM2_CAP_ALGS, rc: 0x%" PRIx32,
+                   __func__, rc);
+        broker->algs.data.algorithms.count = 0;
+        goto out;
+    }
+    if (commands != NULL) {
+        broker->commands = *commands;
+        goto out;
+    }
+    rc = Tss2_Sys_GetCapability (sapi_context,
+                                 NULL,
+                                 TPM2_CAP_COMMANDS,
+                                 TPM2_CC_FIRST,
+                                 TPM2_MAX_CAP_CC,
+                                 &more_data,
+                                 &broker->commands,
+                                 NULL);
+    if (rc != TSS2_RC_SUCCESS || more_data == YES) {
+        g_warning ("%s: not caching TPM2_CAP_COMMANDS, rc: 0x%" PRIx32,
+                   __func__, rc);
+        broker->commands.data.command.count = 0;
+    }
+out:
+    access_broker_unlock (broker);
+    return rc;
+}
+/*
+ * Replace the fixed TPM properties and commands cached by the AccessBroker.
+ * This is used when the startup cache they were taken from turns out to be
+ * stale. The cache is swapped under the AccessBroker lock so readers see
+ * either the old or the new data.
+ */
+void
+access_broker_update_cap_cache (AccessBroker               *broker,
+                                TPMS_CAPABILITY_DATA const *properties_fixed,
+                                TPMS_CAPABILITY_DATA const *commands)
+{
+    g_assert_nonnull (broker);
+    access_broker_lock (broker);
+    broker->properties_fixed = *properties_fixed;
+    broker->commands = *commands;
+    access_broker_unlock (broker);
+}
+/*
+ * Answer a capability query from the cache. The caller MUST hold the
+ * AccessBroker lock.
+ */
+static gboolean
+access_broker_get_capability_cached_locked (AccessBroker         *broker,
+                                            TPM2_CAP              capability,
+                                            UINT32                property,
+                                            UINT32                count,
+                                            TPMI_YES_NO          *more_data,
+                                            TPMS_CAPABILITY_DATA *capability_data)
+{
+    TPML_TAGGED_TPM_PROPERTY const *props = &broker->properties_fixed.data.tpmProperties;
+    TPML_ALG_PROPERTY const *algs = &broker->algs.data.algorithms;
+    TPML_CCA const *commands = &broker->commands.data.command;
+    UINT32 i, cc;
+
+    memset (capability_data, 0, sizeof (*capability_data));
+    capability_data->capability = capability;
+    *more_data = NO;
+    switch (capability) {
+    case TPM2_CAP_ALGS:
+        if (algs->count == 0) {
+            return FALSE;
+        }
+        count = MIN (count, TPM2_MAX_CAP_ALGS);
+        for (i = 0; i < algs->count; ++i) {
+            if (algs->algProperties [i].alg < property) {
+                continue;
+            }
+            if (capability_data->data.algorithms.count == count) {
+                *more_data = YES;
+                break;
+            }
+            capability_data->data.algorithms.algProperties
+                [capability_data->data.algorithms.count++] =
+                algs->algProperties [i];
+        }
+        return TRUE;
+    case TPM2_CAP_COMMANDS:
+        if (commands->count == 0) {
+            return FALSE;
+        }
+        count = MIN (count, TPM2_MAX_CAP_CC);
+        for (i = 0; i < commands->count; ++i) {
+            cc = commands->commandAttributes [i] &
+                 (TPMA_CC_COMMANDINDEX_MASK | TPMA_CC_V);
+            if (cc < property) {
+                continue;
+            }
+            if (capability_data->data.command.count == count) {
+                *more_data = YES;
+                break;
+            }
+            capability_data->data.command.commandAttributes
+                [capability_data->data.command.count++] =
+                commands->commandAttributes [i];
+        }
+        return TRUE;
+    case TPM2_CAP_TPM_PROPERTIES:
+        if (props->count == 0 || property >= TPM2_PT_VAR) {
+            return FALSE;
+        }
+        count = MIN (count, TPM2_MAX_TPM_PROPERTIES);
+        for (i = 0; i < props->count; ++i) {
+            if (props->tpmProperty [i].property < property ||
+                props->tpmProperty [i].property >= TPM2_PT_VAR)
+            {
+                continue;
+            }
+            if (capability_data->data.tpmProperties.count == count) {
+                *more_data = YES;
+                return TRUE;
+            }
+            capability_data->data.tpmProperties.tpmProperty
+                [capability_data->data.tpmProperties.count++] =
+                props->tpmProperty [i];
+        }
+        /* the TPM would go on to the variable properties */
+        return FALSE;
+    default:
+        return FALSE;
+    }
+}
+/*
+ * Answer a TPM2_GetCapability query from the data cached by the
+ * AccessBroker: the fixed TPM properties, algorithms and commands. The
+ * result is what the TPM would return: entries starting from 'property'
+ * with at most 'count' of them and 'more_data' set if there are more.
+ * Returns FALSE if the query can't be answered from the cache. This is the
+ * case for queries of fixed properties that run into the variable ones
+ * since the TPM continues from the fixed to the variable group. The cache
+ * is read under the AccessBroker lock since it may be replaced by
+ * access_broker_update_cap_cache.
+ */
+gboolean
+access_broker_get_capability_cached (AccessBroker         *broker,
+                                     TPM2_CAP              capability,
+                                     UINT32                property,
+                                     UINT32                count,
+                                     TPMI_YES_NO          *more_data,
+                                     TPMS_CAPABILITY_DATA *capability_data)
+{
+    gboolean ret;
+
+    if (count == 0) {
+        return FALSE;
+    }
+    access_broker_lock (broker);
+    ret = access_broker_get_capability_cached_locked (broker,
+                                                      capability,
+                                                      property,
+                                                      count,
+                                                      more_data,
+                                                      capability_data);
+    access_broker_unlock (broker);
+    return ret;
+}
+/*
+ * Run TPM2_IncrementalSelfTest for each algorithm in 'algs'. Without this
+ * the TPM tests an algorithm the first time a command uses it, and the
+ * client that happens to send that command waits for the test. We test
+ * one algorithm per command and take the lock for each one so that client
+ * commands get the TPM in between. Algorithms the TPM doesn't implement
+ * are skipped. Only errors below the TPM (e.g. in the TCTI) are returned.
+ */
+TSS2_RC
+access_broker_self_test (AccessBroker   *broker,
+                         TPML_ALG const *algs)
+{
+    TSS2_SYS_CONTEXT *sapi_context;
+    TPML_ALG to_test = { .count = 1, }, to_do = { 0, };
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+    gint64 start;
+    guint i, attempt;
+
+    g_assert_nonnull (broker);
+    g_assert_nonnull (algs);
+    for (i = 0; i < algs->count; ++i) {
+        to_test.algorithms [0] = algs->algorithms [i];
+        start = g_get_monotonic_time ();
+        for (attempt = 0; ; ++attempt) {
+            sapi_context = access_broker_lock_sapi (broker);
+            rc = Tss2_Sys_IncrementalSelfTest (sapi_context,
+                                               NULL,
+                                               &to_test,
+                                               &to_do,
+                                               NULL);
+            access_broker_unlock (broker);
+            if (!access_broker_rc_is_retry (rc) ||
+                !access_broker_retry_wait (attempt, start))
+            {
+                break;
+            }
+        }
+        if ((rc & TSS2_RC_LAYER_MASK) != TSS2_TPM_RC_LAYER) {
+            g_warning ("%s: IncrementalSelfTest failed: 0x%" PRIx32,
+                       __func__, rc);
+            return rc;
+        }
+        g_debug ("%s: algorithm 0x%" PRIx16 " RC: 0x%" PRIx32,
+                 __func__, to_test.algorithms [0], rc);
+    }
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Allocate a pool of 'size' bytes for TPM randomness. The pool is filled
+ * with access_broker_random_pool_fill while the TPM is idle and drained by
+ * access_broker_random_pool_get to answer TPM2_GetRandom. The pool isn't
+ * locked: after this it must only be used from a single thread (the
+ * ResourceManager).
+ */
+void
+access_broker_random_pool_init (AccessBroker *broker,
+                                size_t        size)
+{
+    g_assert_nonnull (broker);
+    g_assert_null (broker->random_pool);
+    broker->random_pool = g_malloc0 (size);
+    broker->random_pool_size = size;
+    broker->random_pool_count = 0;
+}
+gboolean
+access_broker_random_pool_needs_fill (AccessBroker *broker)
+{
+    g_assert_nonnull (broker);
+    return broker->random_pool_count < broker->random_pool_size;
+}
+/*
+ * Add the output from a single TPM2_GetRandom command to the pool. The TPM
+ * returns at most the size of its largest digest per command so filling
+ * the pool takes many calls. We do one at a time so that the caller can
+ * stop as soon as a client command is waiting. The number of bytes added
+ * to the pool is returned through 'added', 0 if there was no room or on
+ * error.
+ */
+TSS2_RC
+access_broker_random_pool_fill (AccessBroker *broker,
+                                size_t       *added)
+{
+    TSS2_SYS_CONTEXT *sapi_context;
+    TPM2B_DIGEST random = { .size = 0, };
+    size_t count;
+    TSS2_RC rc;
+
+    g_assert_nonnull (broker);
+    g_assert_nonnull (added);
+    *added = 0;
+    if (!access_broker_random_pool_needs_fill (broker)) {
+        return TSS2_RC_SUCCESS;
+    }
+    count = MIN (broker->random_pool_size - broker->random_pool_count,
+                 sizeof (random.buffer));
+    sapi_context = access_broker_lock_sapi (broker);
+    rc = Tss2_Sys_GetRandom (sapi_context,
+                             NULL,
+                             (UINT16)count,
+                             &random,
+                             NULL);
+    access_broker_unlock (broker);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: GetRandom failed: 0x%" PRIx32, __func__, rc);
+        return rc;
+    }
+    if (random.size == 0 || random.size > count) {
+        g_warning ("%s: GetRandom returned %" PRIu16 " bytes, requested %zu",
+                   __func__, random.size, count);
+        secure_zero (&random, sizeof (random));
+        return TSS2_RESMGR_RC_GENERAL_FAILURE;
+    }
+    memcpy (&broker->random_pool [broker->random_pool_count],
+            random.buffer,
+            random.size);
+    broker->random_pool_count += random.size;
+    *added = random.size;
+    /* the TPM returns all bytes requested up to this size */
+    broker->random_max = MAX (broker->random_max, random.size);
+    secure_zero (&random, sizeof (random));
+    g_debug ("%s: %zu of %zu bytes in pool", __func__,
+             broker->random_pool_count, broker->random_pool_size);
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Take 'count' bytes from the pool and copy them to 'dest'. The bytes are
+ * zeroed in the pool so each is handed out only once. Returns FALSE if the
+ * pool doesn't hold enough bytes, or if 'count' is more than the TPM has
+ * returned from a single GetRandom: the TPM would return fewer bytes than
+ * requested and we don't know how many.
+ */
+gboolean
+access_broker_random_pool_get (AccessBroker *broker,
+                               guint8       *dest,
+                               size_t        count)
+{
+    guint8 *src;
+
+    g_assert_nonnull (broker);
+    g_assert_nonnull (dest);
+    if (count == 0 ||
+        count > broker->random_max ||
+        count > broker->random_pool_count)
+    {
+        return FALSE;
+    }
+    broker->random_pool_count -= count;
+    src = &broker->random_pool [broker->random_pool_count];
+    memcpy (dest, src, count);
+    secure_zero (src, count);
+    return TRUE;
+}
+/*
+ * Start an unbound, unsalted session with the provided parameters. The
+ * session key of such a session is empty, so nonceCaller only has to be
+ * a size the TPM accepts: we send zeros the size of the authHash digest.
+ */
+TSS2_RC
+access_broker_start_auth_session (AccessBroker       *broker,
+                                  TPM2_SE             session_type,
+                                  TPMT_SYM_DEF const *symmetric,
+                                  TPMI_ALG_HASH       auth_hash,
+                                  TPM2_HANDLE        *handle,
+                                  TPM2B_NONCE        *nonce_tpm)
+{
+    TSS2_SYS_CONTEXT *sapi_context;
+    TPM2B_NONCE nonce_caller = { .size = 0, };
+    TPM2B_ENCRYPTED_SECRET salt = { .size = 0, };
+    TPMT_SYM_DEF sym = *symmetric;
+    TSS2_RC rc;
+
+    g_assert_nonnull (broker);
+    g_assert_nonnull (handle);
+    g_assert_nonnull (nonce_tpm);
+    switch (auth_hash) {
+    case TPM2_ALG_SHA1:
+        nonce_caller.size = TPM2_SHA1_DIGEST_SIZE;
+        break;
+    case TPM2_ALG_SHA256:
+        nonce_caller.size = TPM2_SHA256_DIGEST_SIZE;
+        break;
+    case TPM2_ALG_SHA384:
+        nonce_caller.size = TPM2_SHA384_DIGEST_SIZE;
+        break;
+    default:
+        return TSS2_RESMGR_RC_BAD_VALUE;
+    }
+    sapi_context = access_broker_lock_sapi (broker);
+    rc = Tss2_Sys_StartAuthSession (sapi_context,
+                                    TPM2_RH_NULL,
+                                    TPM2_RH_NULL,
+                                    NULL,
+                                    &nonce_caller,
+                                    &salt,
+                                    session_type,
+                                    &sym,
+                                    auth_hash,
+                                    handle,
+                                    nonce_tpm,
+                                    NULL);
+    access_broker_unlock (broker);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: StartAuthSession failed: 0x%" PRIx32, __func__, rc);
+    }
+    return rc;
+}
 /*
  * Query the TPM for the current number of loaded transient objects.
  */
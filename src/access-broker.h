@@ -37,17 +37,67 @@
 
 G_BEGIN_DECLS
 
+/*
+ * When the TPM responds with TPM2_RC_RETRY, TPM2_RC_YIELDED or
+ * TPM2_RC_TESTING the command wasn't executed (or not to completion) and
+ * the TPM expects it to be sent again. The AccessBroker does this itself.
+ * The delay before the first resend is ACCESS_BROKER_RETRY_DELAY_MIN_USEC
+ * and doubles with each resend up to ACCESS_BROKER_RETRY_DELAY_MAX_USEC.
+ * Once a command has been retried for ACCESS_BROKER_RETRY_TIME_MAX_USEC
+ * the response code is passed back to the caller.
+ */
+#define ACCESS_BROKER_RETRY_DELAY_MIN_USEC 1000
+#define ACCESS_BROKER_RETRY_DELAY_MAX_USEC 100000
+#define ACCESS_BROKER_RETRY_TIME_MAX_USEC  2000000
+/*
+ * Algorithms tested by access_broker_self_test when the daemon is started
+ * with --self-test. These cover the algorithms used by most applications.
+ */
+/*
+ * Upper bound on the size of the pool of TPM randomness used to answer
+ * TPM2_GetRandom (see access_broker_random_pool_init).
+ */
+#define ACCESS_BROKER_RANDOM_POOL_MAX 65536
+#define ACCESS_BROKER_SELF_TEST_ALGS_DEFAULT { \
+    .count = 8, \
+    .algorithms = { \
+        TPM2_ALG_SHA1, TPM2_ALG_SHA256, TPM2_ALG_SHA384, TPM2_ALG_HMAC, \
+        TPM2_ALG_AES, TPM2_ALG_CFB, TPM2_ALG_RSA, TPM2_ALG_ECC, \
+    }, \
+}
+
 typedef struct _AccessBrokerClass {
     GObjectClass      parent;
 } AccessBrokerClass;
 
+/*
+ * Counters for the commands the AccessBroker resent. 'commands' is the
+ * number of commands resent at least once, 'retries' the total number of
+ * resends, 'exhausted' the number of commands still failing with a retry
+ * code when we gave up and 'time_us' the total time from the first retry
+ * code to the final response.
+ */
+typedef struct {
+    guint64 commands;
+    guint64 retries;
+    guint64 exhausted;
+    gint64  time_us;
+} access_broker_retry_stats_t;
+
 typedef struct _AccessBroker {
     GObject                 parent_instance;
     pthread_mutex_t         sapi_mutex;
     TSS2_SYS_CONTEXT       *sapi_context;
     Tcti                   *tcti;
     TPMS_CAPABILITY_DATA    properties_fixed;
+    TPMS_CAPABILITY_DATA    algs;
+    TPMS_CAPABILITY_DATA    commands;
     gboolean                initialized;
+    access_broker_retry_stats_t retry_stats;
+    guint8                 *random_pool;
+    size_t                  random_pool_size;
+    size_t                  random_pool_count;
+    UINT16                  random_max;
 } AccessBroker;
 
 #include "tpm2-command.h"
@@ -62,6 +112,37 @@ typedef struct _AccessBroker {
 GType              access_broker_get_type       (void);
 AccessBroker*      access_broker_new            (Tcti            *tcti);
 TSS2_RC            access_broker_init_tpm       (AccessBroker    *broker);
+TSS2_RC            access_broker_init_tpm_cached (AccessBroker   *broker,
+                                                  TPMS_CAPABILITY_DATA const *properties_fixed,
+                                                  gboolean       *cache_hit);
+TSS2_RC            access_broker_get_capability (AccessBroker    *broker,
+                                                 TPM2_CAP         capability,
+                                                 UINT32           property,
+                                                 UINT32           count,
+                                                 TPMS_CAPABILITY_DATA *capability_data);
+TSS2_RC            access_broker_init_cap_cache (AccessBroker    *broker,
+                                                 TPMS_CAPABILITY_DATA const *commands);
+void               access_broker_update_cap_cache (AccessBroker  *broker,
+                                                   TPMS_CAPABILITY_DATA const *properties_fixed,
+                                                   TPMS_CAPABILITY_DATA const *commands);
+gboolean           access_broker_get_capability_cached (AccessBroker         *broker,
+                                                        TPM2_CAP              capability,
+                                                        UINT32                property,
+                                                        UINT32                count,
+                                                        TPMI_YES_NO          *more_data,
+                                                        TPMS_CAPABILITY_DATA *capability_data);
+TSS2_RC            access_broker_self_test      (AccessBroker    *broker,
+                                                 TPML_ALG const  *algs);
+void               access_broker_random_pool_init (AccessBroker  *broker,
+                                                   size_t         size);
+gboolean           access_broker_random_pool_needs_fill (AccessBroker *broker);
+TSS2_RC            access_broker_random_pool_fill (AccessBroker  *broker,
+                                                   size_t        *added);
+gboolean           access_broker_random_pool_get  (AccessBroker  *broker,
+                                                   guint8        *dest,
+                                                   size_t         count);
+void               access_broker_get_retry_stats (AccessBroker   *broker,
+                                                  access_broker_retry_stats_t *stats);
 void               access_broker_lock           (AccessBroker    *broker);
 void               access_broker_unlock         (AccessBroker    *broker);
 Tpm2Response*      access_broker_send_command   (AccessBroker    *broker,
@@ -87,6 +168,12 @@ TSS2_RC            access_broker_context_saveflush      (AccessBroker *broker,
 TSS2_RC            access_broker_context_save           (AccessBroker *broker,
                                                          TPM2_HANDLE    handle,
                                                          TPMS_CONTEXT *context);
+TSS2_RC            access_broker_start_auth_session     (AccessBroker *broker,
+                                                         TPM2_SE       session_type,
+                                                         TPMT_SYM_DEF const *symmetric,
+                                                         TPMI_ALG_HASH auth_hash,
+                                                         TPM2_HANDLE  *handle,
+                                                         TPM2B_NONCE  *nonce_tpm);
 void               access_broker_flush_all_context      (AccessBroker *broker);
 
 G_END_DECLS
@@ -86,7 +86,6 @@ command_attrs_init_tpm (CommandAttrs *attrs,
     TPMS_CAPABILITY_DATA  capability_data;
     TSS2_SYS_CONTEXT     *sapi_context;
     TPMI_YES_NO           more;
-    unsigned int          i;
 
     rc = access_broker_get_max_command (broker, &attrs->count);
     if (rc != TSS2_RC_SUCCESS || attrs->count == 0) {
@@ -115,8 +114,26 @@ command_attrs_init_tpm (CommandAttrs *attrs,
         return -1;
     }
 
-    attrs->count = capability_data.data.command.count;
+    return command_attrs_init_capability (attrs, &capability_data);
+}
+/*
+ * Initialize the CommandAttrs from the TPM2_CAP_COMMANDS capability data.
+ * This is used directly when the capability data comes from somewhere
+ * other than the TPM (e.g. the startup cache).
+ */
+gint
+command_attrs_init_capability (CommandAttrs               *attrs,
+                               TPMS_CAPABILITY_DATA const *capability_data)
+{
+    unsigned int i;
+
+    if (capability_data->data.command.count == 0) {
+        g_warning ("%s: no command attributes in capability data", __func__);
+        return -1;
+    }
+    attrs->count = capability_data->data.command.count;
     g_debug ("got attributes for 0x%" PRIx32 " commands", attrs->count);
+    g_clear_pointer (&attrs->command_attrs, g_free);
     attrs->command_attrs = (TPMA_CC*) calloc (1, sizeof (TPMA_CC) * attrs->count);
     if (attrs->command_attrs == NULL) {
         g_warning ("Failed to allocate memory for TPMA_CC: %s\n",
@@ -124,7 +141,7 @@ command_attrs_init_tpm (CommandAttrs *attrs,
         return -1;
     }
     for (i = 0; i < attrs->count; ++i)
-        attrs->command_attrs[i] = capability_data.data.command.commandAttributes[i];
+        attrs->command_attrs[i] = capability_data->data.command.commandAttributes[i];
 
     return 0;
 }
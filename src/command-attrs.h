@@ -59,6 +59,8 @@ GType            command_attrs_get_type    (void);
 CommandAttrs*    command_attrs_new         (void);
 gint             command_attrs_init_tpm    (CommandAttrs     *attrs,
                                             AccessBroker     *broker);
+gint             command_attrs_init_capability (CommandAttrs *attrs,
+                                                TPMS_CAPABILITY_DATA const *capability_data);
 TPMA_CC          command_attrs_from_cc     (CommandAttrs     *attrs,
                                             TPM2_CC            command_code);
 
@@ -36,6 +36,8 @@
 #include "connection-manager.h"
 #include "command-source.h"
 #include "source-interface.h"
+#include "tabrmd.h"
+#include "tpm2-batch.h"
 #include "tpm2-command.h"
 #include "tpm2-header.h"
 #include "util.h"
@@ -45,6 +47,8 @@ enum {
     PROP_COMMAND_ATTRS,
     PROP_CONNECTION_MANAGER,
     PROP_SINK,
+    PROP_TRACE,
+    PROP_PIPELINE_DEPTH,
     N_PROPERTIES
 };
 static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
@@ -98,6 +102,7 @@ command_source_init (CommandSource *source)
 {
     source->main_context = g_main_context_new ();
     source->main_loop = g_main_loop_new (source->main_context, FALSE);
+    source->pipeline_depth = TABRMD_PIPELINE_DEPTH_DEFAULT;
     /*
      * GHashTable mapping a GSocket to an instance of the source_data_t
      * structure. The socket is the I/O mechanism for communicating with a
@@ -149,6 +154,15 @@ command_source_set_property (GObject       *object,
         g_object_ref (self->sink);
         g_debug ("  sink: 0x%" PRIxPTR, (uintptr_t)self->sink);
         break;
+    case PROP_TRACE:
+        g_clear_object (&self->trace);
+        self->trace = g_value_dup_object (value);
+        g_debug ("  trace: 0x%" PRIxPTR, (uintptr_t)self->trace);
+        break;
+    case PROP_PIPELINE_DEPTH:
+        self->pipeline_depth = g_value_get_uint (value);
+        g_debug ("  pipeline_depth: %u", self->pipeline_depth);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -174,11 +188,53 @@ command_source_get_property (GObject      *object,
     case PROP_SINK:
         g_value_set_object (value, self->sink);
         break;
+    case PROP_TRACE:
+        g_value_set_object (value, self->trace);
+        break;
+    case PROP_PIPELINE_DEPTH:
+        g_value_set_uint (value, self->pipeline_depth);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
     }
 }
+/*
+ * Turn a batch frame into a Tpm2Batch and pass it down the pipeline as a
+ * single message so the ResourceManager executes the commands back to
+ * back. Each command is recorded in the trace like a single command.
+ * Returns FALSE if the frame is malformed.
+ */
+static gboolean
+command_source_batch_ready (CommandSource *self,
+                            Connection    *connection,
+                            uint8_t       *buf,
+                            size_t         buf_size)
+{
+    Tpm2Batch *batch;
+    guint i;
+
+    batch = tpm2_batch_new_from_buffer (connection,
+                                        self->command_attrs,
+                                        buf,
+                                        buf_size);
+    if (batch == NULL) {
+        return FALSE;
+    }
+    g_debug ("%s: batch of %u commands from connection 0x%" PRIxPTR,
+             __func__, tpm2_batch_get_command_count (batch),
+             (uintptr_t)connection);
+    if (self->trace != NULL) {
+        for (i = 0; i < tpm2_batch_get_command_count (batch); ++i) {
+            trace_record_command (self->trace,
+                                  tpm2_batch_get_command (batch, i));
+        }
+    }
+    connection_command_received (connection);
+    sink_enqueue (self->sink, G_OBJECT (batch));
+    g_object_unref (batch);
+    return TRUE;
+}
 /*
  * This function is invoked by the GMainLoop thread when a client GSocket has
  * data ready. This is what makes the CommandSource a source (of Tpm2Commands).
@@ -201,6 +257,7 @@ command_source_on_input_ready (GInputStream *istream,
     TPMA_CC        attributes = { 0 };
     uint8_t       *buf;
     size_t         buf_size;
+    int            error = 0;
 
     g_debug ("%s: GInputStream: 0x%" PRIxPTR ", CommandSource: 0x%" PRIxPTR,
              __func__, (uintptr_t)istream, (uintptr_t)data->self);
@@ -215,20 +272,53 @@ command_source_on_input_ready (GInputStream *istream,
                  ", connection: 0x%" PRIxPTR, (uintptr_t)istream,
                  (uintptr_t)connection);
     }
-    buf = read_tpm_buffer_alloc (istream, &buf_size);
+    if (connection_is_seqpacket (connection)) {
+        buf = read_tpm_message_alloc (connection_get_socket (connection),
+                                      TABRMD_BATCH_SIZE_MAX,
+                                      &buf_size,
+                                      &error);
+        /* woken up without a message waiting, keep watching the client */
+        if (buf == NULL && error == EAGAIN) {
+            g_object_unref (connection);
+            return G_SOURCE_CONTINUE;
+        }
+    } else {
+        buf = read_tpm_buffer_alloc (istream, &buf_size);
+    }
     if (buf == NULL) {
         goto fail_out;
     }
+    if (get_command_tag (buf) == TABRMD_BATCH_TAG) {
+        if (!command_source_batch_ready (data->self, connection, buf, buf_size)) {
+            goto fail_out;
+        }
+        g_free (buf);
+        goto pause_check;
+    }
     attributes = command_attrs_from_cc (data->self->command_attrs,
                                         get_command_code (buf));
     command = tpm2_command_new (connection, buf, buf_size, attributes);
     if (command != NULL) {
+        if (data->self->trace != NULL) {
+            trace_record_command (data->self->trace, command);
+        }
+        connection_command_received (connection);
         sink_enqueue (data->self->sink, G_OBJECT (command));
         /* the sink now owns this message */
         g_object_unref (command);
     } else {
         goto fail_out;
     }
+pause_check:
+    /*
+     * Stop watching the client once it has 'pipeline_depth' commands
+     * waiting for a response. The GSource is recreated when the
+     * Connection emits the "resume" signal.
+     */
+    if (connection_pause (connection, data->self->pipeline_depth)) {
+        g_object_unref (connection);
+        return G_SOURCE_REMOVE;
+    }
     g_object_unref (connection);
     return G_SOURCE_CONTINUE;
 fail_out:
@@ -257,6 +347,78 @@ fail_out:
     g_hash_table_remove (data->self->istream_to_source_data_map, istream);
     return G_SOURCE_REMOVE;
 }
+/*
+ * Create a GSource to monitor 'istream' for the G_IO_IN condition and
+ * attach it to our GMainContext.
+ */
+static void
+command_source_watch (CommandSource        *self,
+                      source_data_t        *data,
+                      GPollableInputStream *istream)
+{
+    data->source = g_pollable_input_stream_create_source (istream,
+                                                          data->cancellable);
+    /* we ignore the ID returned since we keep a reference to the source around */
+    g_source_attach (data->source, self->main_context);
+    g_source_set_callback (data->source,
+                           (GSourceFunc)command_source_on_input_ready,
+                           data,
+                           NULL);
+}
+typedef struct {
+    CommandSource *self;
+    Connection    *connection;
+} resume_data_t;
+
+static void
+resume_data_free (gpointer user_data)
+{
+    resume_data_t *resume = (resume_data_t*)user_data;
+
+    g_object_unref (resume->connection);
+    g_free (resume);
+}
+/*
+ * Runs in the GMainContext of the CommandSource: start watching a client
+ * again after a response brought it under the pipeline depth. The
+ * connection may have been removed in the meantime.
+ */
+static gboolean
+command_source_resume (gpointer user_data)
+{
+    resume_data_t *resume = (resume_data_t*)user_data;
+    GPollableInputStream *istream;
+    source_data_t *data;
+
+    istream = connection_key_istream (resume->connection);
+    data = g_hash_table_lookup (resume->self->istream_to_source_data_map,
+                                istream);
+    if (data != NULL && g_source_is_destroyed (data->source)) {
+        g_debug ("%s: watching connection 0x%" PRIxPTR " again", __func__,
+                 (uintptr_t)resume->connection);
+        g_source_unref (data->source);
+        command_source_watch (resume->self, data, istream);
+    }
+    return G_SOURCE_REMOVE;
+}
+/*
+ * Handler for the "resume" signal from a Connection. This is emitted from
+ * the ResponseSink thread so we hand the work to our own GMainContext.
+ */
+static void
+command_source_on_resume (Connection    *connection,
+                          CommandSource *self)
+{
+    resume_data_t *resume = g_new0 (resume_data_t, 1);
+
+    resume->self = self;
+    resume->connection = g_object_ref (connection);
+    g_main_context_invoke_full (self->main_context,
+                                G_PRIORITY_DEFAULT,
+                                command_source_resume,
+                                resume,
+                                resume_data_free);
+}
 /*
  * This is a callback function invoked by the ConnectionManager when a new
  * Connection object is added to it. It creates and sets up the GIO
@@ -282,15 +444,12 @@ command_source_on_new_connection (ConnectionManager   *connection_manager,
     g_object_ref (istream);
     data = g_malloc0 (sizeof (source_data_t));
     data->cancellable = g_cancellable_new ();
-    data->source = g_pollable_input_stream_create_source (istream,
-                                                          data->cancellable);
-    /* we ignore the ID returned since we keep a reference to the source around */
-    g_source_attach (data->source, self->main_context);
     data->self = self;
-    g_source_set_callback (data->source,
-                           (GSourceFunc)command_source_on_input_ready,
-                           data,
-                           NULL);
+    command_source_watch (self, data, istream);
+    g_signal_connect (connection,
+                      "resume",
+                      (GCallback) command_source_on_resume,
+                      self);
     /*
      * To stop watching this socket for G_IO_IN condition use this GHashTable
      * to look up the GCancellable object. The hash table takes ownership of
@@ -330,6 +489,7 @@ command_source_dispose (GObject *object) {
     CommandSource *self = COMMAND_SOURCE (object);
 
     g_clear_object (&self->sink);
+    g_clear_object (&self->trace);
     g_clear_object (&self->connection_manager);
     g_clear_object (&self->command_attrs);
     /* cancel all outstanding G_IO_IN condition GSources and destroy them */
@@ -421,6 +581,20 @@ command_source_class_init (CommandSourceClass *klass)
                              "Reference to a Sink object.",
                              G_TYPE_OBJECT,
                              G_PARAM_READWRITE);
+    obj_properties [PROP_TRACE] =
+        g_param_spec_object ("trace",
+                             "Trace",
+                             "Trace recording commands received from clients.",
+                             TYPE_TRACE,
+                             G_PARAM_READWRITE);
+    obj_properties [PROP_PIPELINE_DEPTH] =
+        g_param_spec_uint ("pipeline-depth",
+                           "pipeline depth",
+                           "Maximum number of unanswered commands per client.",
+                           1,
+                           TABRMD_PIPELINE_DEPTH_MAX,
+                           TABRMD_PIPELINE_DEPTH_DEFAULT,
+                           G_PARAM_READWRITE);
     g_object_class_install_properties (object_class,
                                        N_PROPERTIES,
                                        obj_properties);
@@ -35,6 +35,7 @@
 #include "connection-manager.h"
 #include "sink-interface.h"
 #include "thread.h"
+#include "trace.h"
 
 G_BEGIN_DECLS
 
@@ -55,6 +56,8 @@ typedef struct _CommandSource {
     GMainLoop         *main_loop;
     GHashTable        *istream_to_source_data_map;
     Sink              *sink;
+    Trace             *trace;
+    guint              pipeline_depth;
 } CommandSource;
 
 #define TYPE_COMMAND_SOURCE              (command_source_get_type   ())
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "connection-pool.h"
+#include "util.h"
+
+G_DEFINE_TYPE (ConnectionPool, connection_pool, G_TYPE_OBJECT);
+
+enum {
+    PROP_0,
+    PROP_SIZE,
+    PROP_MAX_TRANSIENTS,
+    N_PROPERTIES
+};
+static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+
+static void
+connection_pool_set_property (GObject      *object,
+                              guint         property_id,
+                              GValue const *value,
+                              GParamSpec   *pspec)
+{
+    ConnectionPool *self = CONNECTION_POOL (object);
+
+    switch (property_id) {
+    case PROP_SIZE:
+        self->size = g_value_get_uint (value);
+        g_debug ("%s: ConnectionPool 0x%" PRIxPTR " size: %u", __func__,
+                 (uintptr_t)self, self->size);
+        break;
+    case PROP_MAX_TRANSIENTS:
+        self->max_transients = g_value_get_uint (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+connection_pool_get_property (GObject    *object,
+                              guint       property_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+    ConnectionPool *self = CONNECTION_POOL (object);
+
+    switch (property_id) {
+    case PROP_SIZE:
+        g_value_set_uint (value, self->size);
+        break;
+    case PROP_MAX_TRANSIENTS:
+        g_value_set_uint (value, self->max_transients);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+connection_pool_init (ConnectionPool *self)
+{
+    g_mutex_init (&self->mutex);
+    g_queue_init (&self->entries);
+}
+static void
+connection_pool_entry_free (gpointer data)
+{
+    connection_pool_entry_t *entry = (connection_pool_entry_t*)data;
+
+    close (entry->client_fd);
+    g_clear_object (&entry->iostream);
+    g_clear_object (&entry->handle_map);
+    g_free (entry);
+}
+/*
+ * Remove a pending refill and free all pooled entries. The client end of
+ * each pooled socket is closed here since it was never handed to a client.
+ */
+static void
+connection_pool_dispose (GObject *object)
+{
+    ConnectionPool *self = CONNECTION_POOL (object);
+
+    if (self->refill_source != NULL) {
+        g_source_destroy (self->refill_source);
+        g_clear_pointer (&self->refill_source, g_source_unref);
+    }
+    g_mutex_lock (&self->mutex);
+    g_queue_clear_full (&self->entries, connection_pool_entry_free);
+    g_mutex_unlock (&self->mutex);
+    G_OBJECT_CLASS (connection_pool_parent_class)->dispose (object);
+}
+static void
+connection_pool_finalize (GObject *object)
+{
+    ConnectionPool *self = CONNECTION_POOL (object);
+
+    g_debug ("%s: 0x%" PRIxPTR " hits: %" PRIu64 ", misses: %" PRIu64,
+             __func__, (uintptr_t)self, self->hits, self->misses);
+    g_mutex_clear (&self->mutex);
+    G_OBJECT_CLASS (connection_pool_parent_class)->finalize (object);
+}
+static void
+connection_pool_class_init (ConnectionPoolClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    if (connection_pool_parent_class == NULL)
+        connection_pool_parent_class = g_type_class_peek_parent (klass);
+    object_class->dispose      = connection_pool_dispose;
+    object_class->finalize     = connection_pool_finalize;
+    object_class->get_property = connection_pool_get_property;
+    object_class->set_property = connection_pool_set_property;
+
+    obj_properties [PROP_SIZE] =
+        g_param_spec_uint ("size",
+                           "pool size",
+                           "Number of connections to prepare in advance",
+                           0,
+                           CONNECTION_POOL_SIZE_MAX,
+                           0,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_MAX_TRANSIENTS] =
+        g_param_spec_uint ("max-transients",
+                           "max transient objects",
+                           "Size of the HandleMap created for each connection",
+                           0,
+                           MAX_ENTRIES_MAX,
+                           MAX_ENTRIES_DEFAULT,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_properties (object_class,
+                                       N_PROPERTIES,
+                                       obj_properties);
+}
+ConnectionPool*
+connection_pool_new (guint size,
+                     guint max_transients)
+{
+    return CONNECTION_POOL (g_object_new (TYPE_CONNECTION_POOL,
+                                          "size", size,
+                                          "max-transients", max_transients,
+                                          NULL));
+}
+/*
+ * Create the socket pair and HandleMap for a single connection. This is
+ * what the CreateConnection D-Bus method did inline before the pool
+ * existed.
+ */
+static connection_pool_entry_t*
+connection_pool_entry_new (ConnectionPool *pool)
+{
+    connection_pool_entry_t *entry;
+
+    entry = g_new0 (connection_pool_entry_t, 1);
+    entry->handle_map = handle_map_new (TPM2_HT_TRANSIENT,
+                                        pool->max_transients);
+    if (entry->handle_map == NULL)
+        g_error ("Failed to allocate new HandleMap");
+    entry->iostream = create_connection_iostream (&entry->client_fd);
+
+    return entry;
+}
+/*
+ * Top up the pool to 'size' entries. The entries are created without
+ * holding the mutex so that a concurrent take isn't blocked on socket
+ * creation. Returns the number of entries added.
+ */
+guint
+connection_pool_fill (ConnectionPool *pool)
+{
+    connection_pool_entry_t *entry;
+    guint count = 0, length;
+
+    g_assert_nonnull (pool);
+    do {
+        g_mutex_lock (&pool->mutex);
+        length = g_queue_get_length (&pool->entries);
+        g_mutex_unlock (&pool->mutex);
+        if (length >= pool->size) {
+            break;
+        }
+        entry = connection_pool_entry_new (pool);
+        g_mutex_lock (&pool->mutex);
+        g_queue_push_tail (&pool->entries, entry);
+        g_mutex_unlock (&pool->mutex);
+        ++count;
+    } while (TRUE);
+    g_debug ("%s: added %u entries to ConnectionPool 0x%" PRIxPTR,
+             __func__, count, (uintptr_t)pool);
+
+    return count;
+}
+static gboolean
+connection_pool_refill_cb (gpointer user_data)
+{
+    ConnectionPool *pool = CONNECTION_POOL (user_data);
+
+    g_clear_pointer (&pool->refill_source, g_source_unref);
+    connection_pool_fill (pool);
+
+    return G_SOURCE_REMOVE;
+}
+/*
+ * Take the state for a new connection from the pool. The caller owns the
+ * returned GIOStream, the HandleMap returned through 'handle_map' and the
+ * client end of the socket pair returned through 'client_fd'.
+ *
+ * If the pool is empty the state is created on the spot. Either way a
+ * refill is scheduled on the thread default GMainContext so that the pool
+ * is topped up after the caller has responded to its client. Both this
+ * function and the refill callback must run on the thread that owns that
+ * context.
+ */
+GIOStream*
+connection_pool_take (ConnectionPool *pool,
+                      gint           *client_fd,
+                      HandleMap     **handle_map)
+{
+    connection_pool_entry_t *entry;
+    GIOStream *iostream;
+
+    g_assert_nonnull (pool);
+    g_assert_nonnull (client_fd);
+    g_assert_nonnull (handle_map);
+    g_mutex_lock (&pool->mutex);
+    entry = g_queue_pop_head (&pool->entries);
+    if (entry != NULL) {
+        ++pool->hits;
+    } else {
+        ++pool->misses;
+    }
+    g_mutex_unlock (&pool->mutex);
+    if (entry == NULL) {
+        entry = connection_pool_entry_new (pool);
+    }
+    if (pool->size > 0 && pool->refill_source == NULL) {
+        pool->refill_source = g_idle_source_new ();
+        g_source_set_priority (pool->refill_source, G_PRIORITY_LOW);
+        g_source_set_callback (pool->refill_source,
+                               connection_pool_refill_cb,
+                               pool,
+                               NULL);
+        g_source_attach (pool->refill_source,
+                         g_main_context_get_thread_default ());
+    }
+    iostream = entry->iostream;
+    *client_fd = entry->client_fd;
+    *handle_map = entry->handle_map;
+    g_free (entry);
+
+    return iostream;
+}
+guint
+connection_pool_length (ConnectionPool *pool)
+{
+    guint length;
+
+    g_mutex_lock (&pool->mutex);
+    length = g_queue_get_length (&pool->entries);
+    g_mutex_unlock (&pool->mutex);
+
+    return length;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-object.h>
+
+#include "handle-map.h"
+
+G_BEGIN_DECLS
+
+#define CONNECTION_POOL_SIZE_MAX 100
+
+/*
+ * The per-connection state that can be created before we know who the
+ * connection is for: the socket pair used to exchange commands / responses
+ * with the client and the HandleMap for the client's transient objects.
+ */
+typedef struct {
+    GIOStream  *iostream;
+    gint        client_fd;
+    HandleMap  *handle_map;
+} connection_pool_entry_t;
+
+typedef struct _ConnectionPoolClass {
+    GObjectClass      parent;
+} ConnectionPoolClass;
+
+typedef struct _ConnectionPool {
+    GObject           parent_instance;
+    GMutex            mutex;
+    GQueue            entries;
+    guint             size;
+    guint             max_transients;
+    GSource          *refill_source;
+    guint64           hits;
+    guint64           misses;
+} ConnectionPool;
+
+#define TYPE_CONNECTION_POOL              (connection_pool_get_type   ())
+#define CONNECTION_POOL(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj),   TYPE_CONNECTION_POOL, ConnectionPool))
+#define CONNECTION_POOL_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST    ((klass), TYPE_CONNECTION_POOL, ConnectionPoolClass))
+#define IS_CONNECTION_POOL(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj),   TYPE_CONNECTION_POOL))
+#define IS_CONNECTION_POOL_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE    ((klass), TYPE_CONNECTION_POOL))
+#define CONNECTION_POOL_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_CONNECTION_POOL, ConnectionPoolClass))
+
+GType           connection_pool_get_type  (void);
+ConnectionPool* connection_pool_new       (guint            size,
+                                           guint            max_transients);
+guint           connection_pool_fill      (ConnectionPool  *pool);
+GIOStream*      connection_pool_take      (ConnectionPool  *pool,
+                                           gint            *client_fd,
+                                           HandleMap      **handle_map);
+guint           connection_pool_length    (ConnectionPool  *pool);
+
+G_END_DECLS
+#endif /* CONNECTION_POOL_H */
@@ -46,6 +46,13 @@ enum {
 };
 static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
 
+enum {
+    SIGNAL_0,
+    SIGNAL_RESUME,
+    N_SIGNALS,
+};
+static guint signals [N_SIGNALS] = { 0, };
+
 static void
 connection_set_property (GObject       *object,
                          guint          property_id,
@@ -136,6 +143,21 @@ connection_class_init (ConnectionClass *klass)
     object_class->dispose      = connection_dispose;
     object_class->get_property = connection_get_property;
     object_class->set_property = connection_set_property;
+    /*
+     * Emitted by connection_response_sent when a response goes out to a
+     * client that the CommandSource stopped reading from. It's emitted
+     * from the thread sending the response.
+     */
+    signals [SIGNAL_RESUME] =
+        g_signal_new ("resume",
+                      G_TYPE_FROM_CLASS (object_class),
+                      G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS,
+                      0,
+                      NULL,
+                      NULL,
+                      NULL,
+                      G_TYPE_NONE,
+                      0);
 
     obj_properties [PROP_ID] =
         g_param_spec_uint64 ("id",
@@ -195,6 +217,38 @@ connection_key_id (Connection *connection)
 {
     return &connection->id;
 }
+
+guint64
+connection_get_id (Connection *connection)
+{
+    return connection->id;
+}
+/*
+ * Return the GSocket under the connection's GIOStream or NULL if the
+ * GIOStream isn't a GSocketConnection. The caller does not own the
+ * reference returned.
+ */
+GSocket*
+connection_get_socket (Connection *connection)
+{
+    if (!G_IS_SOCKET_CONNECTION (connection->iostream)) {
+        return NULL;
+    }
+    return g_socket_connection_get_socket (
+        G_SOCKET_CONNECTION (connection->iostream));
+}
+/*
+ * TRUE if the client talks to us over a SOCK_SEQPACKET socket. Each read
+ * from a socket like this must take a whole message.
+ */
+gboolean
+connection_is_seqpacket (Connection *connection)
+{
+    GSocket *socket = connection_get_socket (connection);
+
+    return socket != NULL &&
+        g_socket_get_socket_type (socket) == G_SOCKET_TYPE_SEQPACKET;
+}
 /*
  * Return a reference to the HandleMap for transient handles to the caller.
  * We increment the reference count on this object before returning it. The
@@ -207,3 +261,60 @@ connection_get_trans_map (Connection *connection)
     g_object_ref (connection->transient_handle_map);
     return connection->transient_handle_map;
 }
+/*
+ * Called by the CommandSource for each command / batch read from the
+ * client before it's passed down the pipeline.
+ */
+void
+connection_command_received (Connection *connection)
+{
+    g_atomic_int_inc (&connection->outstanding);
+}
+/*
+ * Called by the CommandSource after reading from the client. Returns TRUE
+ * if the number of unanswered commands has reached 'depth' and the
+ * CommandSource must stop reading from the client until the "resume"
+ * signal. A response sent while we set the 'paused' flag either sees the
+ * flag and emits "resume", or we see the lower count and clear the flag
+ * ourselves: the compare and exchange lets exactly one side clear it.
+ */
+gboolean
+connection_pause (Connection *connection,
+                  guint       depth)
+{
+    if (connection_get_outstanding (connection) < depth) {
+        return FALSE;
+    }
+    g_atomic_int_set (&connection->paused, TRUE);
+    if (connection_get_outstanding (connection) < depth &&
+        g_atomic_int_compare_and_exchange (&connection->paused, TRUE, FALSE))
+    {
+        return FALSE;
+    }
+    g_debug ("%s: Connection 0x%" PRIxPTR " has %u commands outstanding, "
+             "pipeline depth is %u", __func__, (uintptr_t)connection,
+             connection_get_outstanding (connection), depth);
+    return TRUE;
+}
+/*
+ * Called by the ResponseSink after writing a response to the client.
+ * Emits the "resume" signal if the CommandSource stopped reading from the
+ * client.
+ */
+void
+connection_response_sent (Connection *connection)
+{
+    g_atomic_int_add (&connection->outstanding, -1);
+    if (g_atomic_int_compare_and_exchange (&connection->paused, TRUE, FALSE)) {
+        g_debug ("%s: resuming Connection 0x%" PRIxPTR,
+                 __func__, (uintptr_t)connection);
+        g_signal_emit (connection, signals [SIGNAL_RESUME], 0);
+    }
+}
+guint
+connection_get_outstanding (Connection *connection)
+{
+    gint outstanding = g_atomic_int_get (&connection->outstanding);
+
+    return outstanding > 0 ? (guint)outstanding : 0;
+}
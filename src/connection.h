@@ -39,11 +39,20 @@ typedef struct _ConnectionClass {
     GObjectClass        parent;
 } ConnectionClass;
 
+/*
+ * 'outstanding' counts the commands (or batches) read from the client that
+ * haven't been answered yet. 'paused' is set when the CommandSource stops
+ * reading from the client because 'outstanding' reached the pipeline
+ * depth. Both are accessed with atomic operations: they're updated by the
+ * CommandSource and ResponseSink threads.
+ */
 typedef struct _Connection {
     GObject             parent_instance;
     GIOStream          *iostream;
     guint64             id;
     HandleMap          *transient_handle_map;
+    gint                outstanding;
+    gint                paused;
 } Connection;
 
 #define TYPE_CONNECTION              (connection_get_type ())
@@ -59,6 +68,14 @@ Connection*      connection_new          (GIOStream       *iostream,
                                           HandleMap       *transient_handle_map);
 gpointer         connection_key_istream  (Connection      *session);
 gpointer         connection_key_id       (Connection      *session);
+guint64          connection_get_id       (Connection      *connection);
 GIOStream*       connection_get_iostream (Connection      *connection);
+GSocket*         connection_get_socket   (Connection      *connection);
+gboolean         connection_is_seqpacket (Connection      *connection);
 HandleMap*       connection_get_trans_map(Connection      *session);
+void             connection_command_received (Connection  *connection);
+gboolean         connection_pause        (Connection      *connection,
+                                          guint            depth);
+void             connection_response_sent (Connection     *connection);
+guint            connection_get_outstanding (Connection   *connection);
 #endif /* CONNECTION_H */
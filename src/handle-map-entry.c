@@ -25,6 +25,9 @@
  * THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <inttypes.h>
+#include <string.h>
+
+#include <tss2/tss2_mu.h>
 
 #include "util.h"
 #include "handle-map-entry.h"
@@ -35,7 +38,7 @@ enum {
     PROP_0,
     PROP_PHANDLE,
     PROP_VHANDLE,
-    PROP_CONTEXT,
+    PROP_CONTEXT_BLOB,
     N_PROPERTIES
 };
 static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
@@ -57,7 +60,7 @@ handle_map_entry_get_property (GObject        *object,
     case PROP_VHANDLE:
         g_value_set_uint (value, (guint)self->vhandle);
         break;
-    case PROP_CONTEXT:
+    case PROP_CONTEXT_BLOB:
         g_value_set_pointer (value, &self->context);
         break;
     default:
@@ -82,8 +85,8 @@ handle_map_entry_set_property (GObject        *object,
     case PROP_VHANDLE:
         self->vhandle = (TPM2_HANDLE)g_value_get_uint (value);
         break;
-    case PROP_CONTEXT:
-        g_error ("Cannot set context property.");
+    case PROP_CONTEXT_BLOB:
+        g_error ("Cannot set context-blob property.");
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -99,13 +102,17 @@ handle_map_entry_init (HandleMapEntry *entry)
     /* noop */
 }
 /*
- * Deallocate all associated resources. All are static so we just chain
- * up to the parent like a good GObject.
+ * Deallocate all associated resources. The only dynamic resource is the
+ * marshalled context blob, private or shared.
  */
 static void
 handle_map_entry_finalize (GObject *object)
 {
+    HandleMapEntry *entry = HANDLE_MAP_ENTRY (object);
+
     g_debug ("handle_map_entry_finalize: 0x%" PRIxPTR, (uintptr_t)object);
+    size_buf_clear (&entry->context);
+    g_clear_pointer (&entry->context_shared, g_bytes_unref);
     G_OBJECT_CLASS (handle_map_entry_parent_class)->finalize (object);
 }
 /*
@@ -138,10 +145,16 @@ handle_map_entry_class_init (HandleMapEntryClass *klass)
                            UINT32_MAX,
                            0,
                            G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
-    obj_properties [PROP_CONTEXT] =
-        g_param_spec_pointer ("context",
-                              "TPMS_CONTEXT",
-                              "Context blob from TPM.",
+    /*
+     * This used to be the "context" property: a TPMS_CONTEXT*. The entry
+     * now keeps the marshalled context (a size_buf_t*) so the property got
+     * a new name rather than silently changing the type behind the old one.
+     * Use handle_map_entry_get_context to get a TPMS_CONTEXT.
+     */
+    obj_properties [PROP_CONTEXT_BLOB] =
+        g_param_spec_pointer ("context-blob",
+                              "size_buf_t",
+                              "Marshalled context blob from TPM.",
                               G_PARAM_READABLE);
     g_object_class_install_properties (object_class,
                                        N_PROPERTIES,
@@ -165,16 +178,125 @@ handle_map_entry_new (TPM2_HANDLE phandle,
     return entry;
 }
 /*
- * Access the TPMS_CONTEXT member.
- * NOTE: This directly exposes memory from an object instance. The caller
- * must be sure to hold a reference to this object to keep it from being
- * garbage collected while the caller is accessing the context structure.
- * Further this object provides no thread safety ... yet.
+ * Unmarshal the saved context into the caller provided TPMS_CONTEXT. The
+ * context is kept in its marshalled form since it's typically a fraction
+ * of sizeof (TPMS_CONTEXT). If no context has been saved for this entry
+ * the caller gets back a zeroed TPMS_CONTEXT.
+ * NOTE: This object provides no thread safety ... yet.
+ */
+TSS2_RC
+handle_map_entry_get_context (HandleMapEntry *entry,
+                              TPMS_CONTEXT   *context)
+{
+    guint8 const *buf;
+    size_t offset = 0, size;
+    TSS2_RC rc;
+
+    g_assert_nonnull (entry);
+    g_assert_nonnull (context);
+    buf = handle_map_entry_peek_context (entry, &size);
+    if (size == 0) {
+        memset (context, 0, sizeof (*context));
+        return TSS2_RC_SUCCESS;
+    }
+    rc = Tss2_MU_TPMS_CONTEXT_Unmarshal (buf,
+                                         size,
+                                         &offset,
+                                         context);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to unmarshal TPMS_CONTEXT from HandleMapEntry"
+                   " 0x%" PRIxPTR ", rc: 0x%" PRIx32, __func__,
+                   (uintptr_t)entry, rc);
+    }
+    return rc;
+}
+/*
+ * Marshal the provided TPMS_CONTEXT and store the result in the entry. Any
+ * previously saved context is freed, and a shared one released.
+ */
+TSS2_RC
+handle_map_entry_set_context (HandleMapEntry     *entry,
+                              TPMS_CONTEXT const *context)
+{
+    uint8_t buf [SIZE_BUF_MAX];
+    size_t offset = 0;
+    TSS2_RC rc;
+
+    g_assert_nonnull (entry);
+    g_assert_nonnull (context);
+    rc = Tss2_MU_TPMS_CONTEXT_Marshal (context, buf, sizeof (buf), &offset);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to marshal TPMS_CONTEXT for HandleMapEntry"
+                   " 0x%" PRIxPTR ", rc: 0x%" PRIx32, __func__,
+                   (uintptr_t)entry, rc);
+        return rc;
+    }
+    g_clear_pointer (&entry->context_shared, g_bytes_unref);
+    size_buf_set (&entry->context, buf, offset);
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Get the marshalled context held by the entry, shared or not, without
+ * copying it. The size is 0 if no context has been saved.
+ */
+guint8 const*
+handle_map_entry_peek_context (HandleMapEntry *entry,
+                               size_t         *size)
+{
+    gsize shared_size;
+    guint8 const *buf;
+
+    g_assert_nonnull (entry);
+    g_assert_nonnull (size);
+    if (entry->context_shared != NULL) {
+        buf = g_bytes_get_data (entry->context_shared, &shared_size);
+        *size = shared_size;
+        return buf;
+    }
+    *size = entry->context.size;
+    return entry->context.buf;
+}
+/*
+ * Objects that don't change once loaded can have one saved context used by
+ * entries in many connections. This turns the context saved in the entry
+ * into a shared one and returns a new reference to it, or NULL if no
+ * context has been saved.
+ */
+GBytes*
+handle_map_entry_share_context (HandleMapEntry *entry)
+{
+    g_assert_nonnull (entry);
+    if (entry->context_shared == NULL) {
+        if (entry->context.size == 0) {
+            return NULL;
+        }
+        entry->context_shared = g_bytes_new (entry->context.buf,
+                                             entry->context.size);
+        size_buf_clear (&entry->context);
+    }
+    return g_bytes_ref (entry->context_shared);
+}
+/*
+ * Back the entry with a shared context. Any private context is freed.
  */
-TPMS_CONTEXT*
-handle_map_entry_get_context (HandleMapEntry *entry)
+void
+handle_map_entry_set_context_shared (HandleMapEntry *entry,
+                                     GBytes         *context)
 {
-    return &entry->context;
+    g_assert_nonnull (entry);
+    g_assert_nonnull (context);
+    size_buf_clear (&entry->context);
+    g_clear_pointer (&entry->context_shared, g_bytes_unref);
+    entry->context_shared = g_bytes_ref (context);
+}
+/*
+ * An entry backed by a shared context never needs saving: the object is
+ * flushed from the TPM and loaded again from the shared context.
+ */
+gboolean
+handle_map_entry_is_shared (HandleMapEntry *entry)
+{
+    return entry->context_shared != NULL;
 }
 /*
  * Accessor for the physical handle member.
@@ -198,3 +320,19 @@ handle_map_entry_set_phandle (HandleMapEntry *entry,
 {
     entry->phandle = phandle;
 }
+/*
+ * Sequence objects (created by TPM2_HashSequenceStart / TPM2_HMAC_Start)
+ * carry running state that changes with each TPM2_SequenceUpdate. The
+ * ResourceManager keeps them loaded between commands.
+ */
+gboolean
+handle_map_entry_is_sequence (HandleMapEntry *entry)
+{
+    return entry->sequence;
+}
+void
+handle_map_entry_set_sequence (HandleMapEntry *entry,
+                               gboolean        sequence)
+{
+    entry->sequence = sequence;
+}
@@ -31,6 +31,8 @@
 #include <glib-object.h>
 #include <tss2/tss2_tpm2_types.h>
 
+#include "util.h"
+
 G_BEGIN_DECLS
 
 typedef struct _HandleMapEntryClass {
@@ -41,7 +43,9 @@ typedef struct _HandleMapEntry {
     GObject           parent_instance;
     TPM2_HANDLE        phandle;
     TPM2_HANDLE        vhandle;
-    TPMS_CONTEXT      context;
+    size_buf_t        context;
+    GBytes           *context_shared;
+    gboolean          sequence;
 } HandleMapEntry;
 
 #define TYPE_HANDLE_MAP_ENTRY              (handle_map_entry_get_type   ())
@@ -56,9 +60,21 @@ HandleMapEntry*  handle_map_entry_new           (TPM2_HANDLE         phandle,
                                                  TPM2_HANDLE         vhandle);
 TPM2_HANDLE       handle_map_entry_get_phandle   (HandleMapEntry    *entry);
 TPM2_HANDLE       handle_map_entry_get_vhandle   (HandleMapEntry    *entry);
-TPMS_CONTEXT*    handle_map_entry_get_context   (HandleMapEntry    *entry);
+TSS2_RC          handle_map_entry_get_context   (HandleMapEntry    *entry,
+                                                 TPMS_CONTEXT      *context);
+TSS2_RC          handle_map_entry_set_context   (HandleMapEntry    *entry,
+                                                 TPMS_CONTEXT const *context);
+guint8 const*    handle_map_entry_peek_context  (HandleMapEntry    *entry,
+                                                 size_t            *size);
+GBytes*          handle_map_entry_share_context (HandleMapEntry    *entry);
+void             handle_map_entry_set_context_shared (HandleMapEntry *entry,
+                                                      GBytes         *context);
+gboolean         handle_map_entry_is_shared     (HandleMapEntry    *entry);
 void             handle_map_entry_set_phandle   (HandleMapEntry    *entry,
                                                  TPM2_HANDLE         phandle);
+gboolean         handle_map_entry_is_sequence   (HandleMapEntry    *entry);
+void             handle_map_entry_set_sequence  (HandleMapEntry    *entry,
+                                                 gboolean           sequence);
 
 G_END_DECLS
 #endif /* HANDLE_MAP_ENTRY_H */
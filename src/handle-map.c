@@ -89,22 +89,19 @@ handle_map_set_property (GObject        *object,
 /*
  * Initialize object. This requires:
  * 1) initializing the mutex that mediate access to the hash tables
- * 2) creating the hash tables
- * 3) initializing the handle_count
+ * 2) initializing the handle_count
  * The handle_count is currently initialized to start allocating handles
  * @ 0xff. This is an arbitrary way we differentiate them from the handles
  * allocated by the TPM.
+ * The hash table is created by the first insert. Most client connections
+ * never load a transient object so there's no point in paying for the
+ * table up front.
  */
 static void
 handle_map_init (HandleMap     *map)
 {
     g_debug ("handle_map_init");
     pthread_mutex_init (&map->mutex, NULL);
-    map->vhandle_to_entry_table =
-        g_hash_table_new_full (g_direct_hash,
-                               g_direct_equal,
-                               NULL,
-                               (GDestroyNotify)g_object_unref);
     map->handle_count = 0xff;
 }
 /*
@@ -210,6 +207,9 @@ handle_map_is_full (HandleMap *map)
 {
     guint table_size;
 
+    if (map->vhandle_to_entry_table == NULL) {
+        return FALSE;
+    }
     table_size = g_hash_table_size (map->vhandle_to_entry_table);
     if (table_size < map->max_entries + 1) {
         return FALSE;
@@ -239,6 +239,13 @@ handle_map_insert (HandleMap      *map,
         return FALSE;
     }
     if (entry && vhandle != 0) {
+        if (map->vhandle_to_entry_table == NULL) {
+            map->vhandle_to_entry_table =
+                g_hash_table_new_full (g_direct_hash,
+                                       g_direct_equal,
+                                       NULL,
+                                       (GDestroyNotify)g_object_unref);
+        }
         g_object_ref (entry);
         g_hash_table_insert (map->vhandle_to_entry_table,
                              GINT_TO_POINTER (vhandle),
@@ -255,28 +262,32 @@ gboolean
 handle_map_remove (HandleMap *map,
                    TPM2_HANDLE vhandle)
 {
-    gboolean ret;
+    gboolean ret = FALSE;
 
     handle_map_lock (map);
-    ret = g_hash_table_remove (map->vhandle_to_entry_table,
-                               GINT_TO_POINTER (vhandle));
+    if (map->vhandle_to_entry_table != NULL) {
+        ret = g_hash_table_remove (map->vhandle_to_entry_table,
+                                   GINT_TO_POINTER (vhandle));
+    }
     handle_map_unlock (map);
 
     return ret;
 }
 /*
- * Generic lookup function to find an entry in a GHashTable for the given
+ * Generic lookup function to find an entry in the GHashTable for the given
  * handle.
  */
 static HandleMapEntry*
 handle_map_lookup (HandleMap     *map,
-                   TPM2_HANDLE     handle,
-                   GHashTable    *table)
+                   TPM2_HANDLE     handle)
 {
-    HandleMapEntry *entry;
+    HandleMapEntry *entry = NULL;
 
     handle_map_lock (map);
-    entry = g_hash_table_lookup (table, GINT_TO_POINTER (handle));
+    if (map->vhandle_to_entry_table != NULL) {
+        entry = g_hash_table_lookup (map->vhandle_to_entry_table,
+                                     GINT_TO_POINTER (handle));
+    }
     if (entry)
         g_object_ref (entry);
     handle_map_unlock (map);
@@ -294,7 +305,7 @@ HandleMapEntry*
 handle_map_vlookup (HandleMap    *map,
                     TPM2_HANDLE    vhandle)
 {
-    return handle_map_lookup (map, vhandle, map->vhandle_to_entry_table);
+    return handle_map_lookup (map, vhandle);
 }
 /*
  * Simple wrapper around the function that reports the number of entries in
@@ -303,10 +314,12 @@ handle_map_vlookup (HandleMap    *map,
 guint
 handle_map_size (HandleMap *map)
 {
-    guint ret;
+    guint ret = 0;
 
     handle_map_lock (map);
-    ret = g_hash_table_size (map->vhandle_to_entry_table);
+    if (map->vhandle_to_entry_table != NULL) {
+        ret = g_hash_table_size (map->vhandle_to_entry_table);
+    }
     handle_map_unlock (map);
 
     return ret;
@@ -336,6 +349,9 @@ handle_map_foreach (HandleMap *map,
                     GHFunc     callback,
                     gpointer   user_data)
 {
+    if (map->vhandle_to_entry_table == NULL) {
+        return;
+    }
     g_hash_table_foreach (map->vhandle_to_entry_table,
                           callback,
                           user_data);
@@ -347,5 +363,8 @@ handle_map_foreach (HandleMap *map,
 GList*
 handle_map_get_keys (HandleMap *map)
 {
+    if (map->vhandle_to_entry_table == NULL) {
+        return NULL;
+    }
     return g_hash_table_get_keys (map->vhandle_to_entry_table);
 }
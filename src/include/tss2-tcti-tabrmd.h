@@ -37,6 +37,25 @@ TSS2_RC Tss2_Tcti_Tabrmd_Init (TSS2_TCTI_CONTEXT *context,
                                size_t *size,
                                const char *conf);
 
+/*
+ * Send the TPM commands in 'commands' (back to back, 'commands_size' bytes
+ * total) to the daemon as one batch and wait for the responses. The daemon
+ * executes them in order without interleaving commands from other
+ * connections. The responses are returned back to back in 'responses'
+ * and their number in 'response_count'. With
+ * TSS2_TCTI_TABRMD_BATCH_STOP_ON_ERROR the daemon stops at the first
+ * command that fails and only returns the responses up to that one.
+ */
+#define TSS2_TCTI_TABRMD_BATCH_STOP_ON_ERROR (1 << 0)
+
+TSS2_RC Tss2_Tcti_Tabrmd_Batch (TSS2_TCTI_CONTEXT *context,
+                                const uint8_t *commands,
+                                size_t commands_size,
+                                uint8_t *responses,
+                                size_t *responses_size,
+                                size_t *response_count,
+                                uint32_t flags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,6 +27,7 @@
 
 #include <gio/gunixfdlist.h>
 #include <inttypes.h>
+#include <sys/socket.h>
 
 #include "ipc-frontend-dbus.h"
 #include "tabrmd.h"
@@ -49,6 +50,7 @@ enum {
     PROP_CONNECTION_MANAGER,
     PROP_MAX_TRANS,
     PROP_RANDOM,
+    PROP_CONNECTION_POOL,
     N_PROPERTIES
 };
 static GParamSpec *obj_properties[N_PROPERTIES] = { NULL };
@@ -80,6 +82,10 @@ ipc_frontend_dbus_set_property (GObject      *object,
         self->random = g_value_get_object (value);
         g_object_ref (self->random);
         break;
+    case PROP_CONNECTION_POOL:
+        g_clear_object (&self->connection_pool);
+        self->connection_pool = g_value_dup_object (value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -109,6 +115,9 @@ ipc_frontend_dbus_get_property (GObject    *object,
     case PROP_RANDOM:
         g_value_set_object (value, self->random);
         break;
+    case PROP_CONNECTION_POOL:
+        g_value_set_object (value, self->connection_pool);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -129,6 +138,7 @@ ipc_frontend_dbus_dispose (GObject *obj)
 
     g_clear_object (&self->connection_manager);
     g_clear_object (&self->random);
+    g_clear_object (&self->connection_pool);
     g_clear_object (&self->skeleton);
     G_OBJECT_CLASS (ipc_frontend_dbus_parent_class)->dispose (obj);
 }
@@ -194,6 +204,12 @@ ipc_frontend_dbus_class_init (IpcFrontendDbusClass *klass)
                              "Source of random numbers.",
                              TYPE_RANDOM,
                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_CONNECTION_POOL] =
+        g_param_spec_object ("connection-pool",
+                             "ConnectionPool object",
+                             "Source of pre-created per-connection state.",
+                             TYPE_CONNECTION_POOL,
+                             G_PARAM_READWRITE);
     g_object_class_install_properties (object_class,
                                        N_PROPERTIES,
                                        obj_properties);
@@ -344,11 +360,13 @@ get_id_pid_mix_from_invocation (GDBusProxy            *proxy,
     return pid_ret;
 }
 /*
- * This is a signal handler for the handle-create-connection signal from
- * the DBus interface. This signal is triggered by a request from a client
- * to create a new connection with the daemon. This requires a few things
- * be done:
+ * This function does the work for both the CreateConnection and the
+ * CreateConnectionWithFlags methods. A request from a client to create a
+ * new connection with the daemon requires a few things be done:
  * - Create a new ID (uint64) for the connection.
+ * - Get a socket pair and HandleMap from the ConnectionPool (if we have
+ *   one) or create them. The pool only holds SOCK_STREAM pairs so a
+ *   SOCK_SEQPACKET connection is always created here.
  * - Create a new Connection object.
  * - Build up a dbus response to the client with their connection ID and
  *   FD for the client side of the connection.
@@ -356,11 +374,10 @@ get_id_pid_mix_from_invocation (GDBusProxy            *proxy,
  * - Insert the new Connection object into the ConnectionManager.
  */
 static gboolean
-on_handle_create_connection (TctiTabrmd            *skeleton,
-                             GDBusMethodInvocation *invocation,
-                             gpointer               user_data)
+create_connection (IpcFrontendDbus       *self,
+                   GDBusMethodInvocation *invocation,
+                   int                    type)
 {
-    IpcFrontendDbus *self = NULL;
     HandleMap   *handle_map = NULL;
     Connection *connection = NULL;
     gint client_fd = 0, ret = 0;
@@ -369,10 +386,8 @@ on_handle_create_connection (TctiTabrmd            *skeleton,
     GUnixFDList *fd_list = NULL;
     guint64 id = 0, id_pid_mix = 0;
     gboolean id_ret = FALSE;
-    UNUSED_PARAM(skeleton);
 
-    self = IPC_FRONTEND_DBUS (user_data);
-    ipc_frontend_init_guard (IPC_FRONTEND (user_data));
+    ipc_frontend_init_guard (IPC_FRONTEND (self));
     if (connection_manager_is_full (self->connection_manager)) {
         g_dbus_method_invocation_return_error (invocation,
                                                TABRMD_ERROR,
@@ -399,10 +414,17 @@ on_handle_create_connection (TctiTabrmd            *skeleton,
             "Failed to allocate connection ID. Try again later.");
         return TRUE;
     }
-    handle_map = handle_map_new (TPM2_HT_TRANSIENT, self->max_transient_objects);
-    if (handle_map == NULL)
-        g_error ("Failed to allocate new HandleMap");
-    iostream = create_connection_iostream (&client_fd);
+    if (self->connection_pool != NULL && type == SOCK_STREAM) {
+        iostream = connection_pool_take (self->connection_pool,
+                                         &client_fd,
+                                         &handle_map);
+    } else {
+        handle_map = handle_map_new (TPM2_HT_TRANSIENT,
+                                     self->max_transient_objects);
+        if (handle_map == NULL)
+            g_error ("Failed to allocate new HandleMap");
+        iostream = create_connection_iostream_type (&client_fd, type);
+    }
     connection = connection_new (iostream, id_pid_mix, handle_map);
     g_object_unref (handle_map);
     g_object_unref (iostream);
@@ -434,6 +456,43 @@ on_handle_create_connection (TctiTabrmd            *skeleton,
 
     return TRUE;
 }
+/*
+ * This is a signal handler for the handle-create-connection signal from
+ * the DBus interface. This signal is triggered by a request from a client
+ * to create a new connection with the daemon.
+ */
+static gboolean
+on_handle_create_connection (TctiTabrmd            *skeleton,
+                             GDBusMethodInvocation *invocation,
+                             gpointer               user_data)
+{
+    UNUSED_PARAM(skeleton);
+
+    return create_connection (IPC_FRONTEND_DBUS (user_data),
+                              invocation,
+                              SOCK_STREAM);
+}
+/*
+ * This is a signal handler for the handle-create-connection-with-flags
+ * signal from the DBus interface. This is the same as CreateConnection
+ * except the client may ask for a SOCK_SEQPACKET socket. Flags we don't
+ * know about are ignored: the client finds out what it got from the type
+ * of the socket it's handed.
+ */
+static gboolean
+on_handle_create_connection_with_flags (TctiTabrmd            *skeleton,
+                                        GDBusMethodInvocation *invocation,
+                                        guint                  flags,
+                                        gpointer               user_data)
+{
+    UNUSED_PARAM(skeleton);
+
+    g_debug ("%s: flags 0x%" PRIx32, __func__, flags);
+    return create_connection (IPC_FRONTEND_DBUS (user_data),
+                              invocation,
+                              flags & TABRMD_CONNECTION_FLAG_SEQPACKET ?
+                                  SOCK_SEQPACKET : SOCK_STREAM);
+}
 /*
  * This is a signal handler for the Cancel event emitted by the
  * Tpm2 AccessBroker. It is invoked by a signal generated by a user
@@ -593,6 +652,10 @@ on_name_acquired (GDBusConnection *connection,
                       "handle-create-connection",
                       G_CALLBACK (on_handle_create_connection),
                       user_data);
+    g_signal_connect (self->skeleton,
+                      "handle-create-connection-with-flags",
+                      G_CALLBACK (on_handle_create_connection_with_flags),
+                      user_data);
     g_signal_connect (self->skeleton,
                       "handle-cancel",
                       G_CALLBACK (on_handle_cancel),
@@ -31,6 +31,7 @@
 #include <gio/gio.h>
 
 #include "connection-manager.h"
+#include "connection-pool.h"
 #include "ipc-frontend.h"
 #include "random.h"
 #include "tabrmd-generated.h"
@@ -58,6 +59,7 @@ typedef struct _IpcFrontendDbus
     GDBusProxy        *dbus_daemon_proxy;
     Random            *random;
     TctiTabrmd        *skeleton;
+    ConnectionPool    *connection_pool;
 } IpcFrontendDbus;
 
 #define TYPE_IPC_FRONTEND_DBUS             (ipc_frontend_dbus_get_type       ())
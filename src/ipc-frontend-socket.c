@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <gio/gunixsocketaddress.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ipc-frontend-socket.h"
+#include "tabrmd.h"
+#include "util.h"
+
+G_DEFINE_TYPE (IpcFrontendSocket, ipc_frontend_socket, TYPE_IPC_FRONTEND);
+
+enum {
+    PROP_0,
+    PROP_PATH,
+    PROP_CONNECTION_MANAGER,
+    PROP_MAX_TRANS,
+    PROP_RANDOM,
+    N_PROPERTIES
+};
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL };
+
+static void
+ipc_frontend_socket_set_property (GObject      *object,
+                                  guint         property_id,
+                                  const GValue *value,
+                                  GParamSpec   *pspec)
+{
+    IpcFrontendSocket *self = IPC_FRONTEND_SOCKET (object);
+
+    switch (property_id) {
+    case PROP_PATH:
+        self->path = g_value_dup_string (value);
+        g_debug ("IpcFrontendSocket set path: %s", self->path);
+        break;
+    case PROP_CONNECTION_MANAGER:
+        self->connection_manager = g_value_dup_object (value);
+        break;
+    case PROP_MAX_TRANS:
+        self->max_transient_objects = g_value_get_uint (value);
+        break;
+    case PROP_RANDOM:
+        self->random = g_value_dup_object (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+ipc_frontend_socket_get_property (GObject    *object,
+                                  guint       property_id,
+                                  GValue     *value,
+                                  GParamSpec *pspec)
+{
+    IpcFrontendSocket *self = IPC_FRONTEND_SOCKET (object);
+
+    switch (property_id) {
+    case PROP_PATH:
+        g_value_set_string (value, self->path);
+        break;
+    case PROP_CONNECTION_MANAGER:
+        g_value_set_object (value, self->connection_manager);
+        break;
+    case PROP_MAX_TRANS:
+        g_value_set_uint (value, self->max_transient_objects);
+        break;
+    case PROP_RANDOM:
+        g_value_set_object (value, self->random);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+ipc_frontend_socket_init (IpcFrontendSocket *self)
+{
+    UNUSED_PARAM(self);
+    /* noop, required by G_DEFINE_TYPE */
+}
+/*
+ * Dispose method where where we free up references to other objects.
+ */
+static void
+ipc_frontend_socket_dispose (GObject *obj)
+{
+    IpcFrontendSocket *self = IPC_FRONTEND_SOCKET (obj);
+
+    g_clear_object (&self->connection_manager);
+    g_clear_object (&self->random);
+    g_clear_object (&self->service);
+    G_OBJECT_CLASS (ipc_frontend_socket_parent_class)->dispose (obj);
+}
+/*
+ * Finalize method where we free resources.
+ */
+static void
+ipc_frontend_socket_finalize (GObject *obj)
+{
+    IpcFrontendSocket *self = IPC_FRONTEND_SOCKET (obj);
+
+    g_clear_pointer (&self->path, g_free);
+    G_OBJECT_CLASS (ipc_frontend_socket_parent_class)->finalize (obj);
+}
+
+static void
+ipc_frontend_socket_class_init (IpcFrontendSocketClass *klass)
+{
+    GObjectClass    *object_class      = G_OBJECT_CLASS (klass);
+    IpcFrontendClass *ipc_frontend_class = IPC_FRONTEND_CLASS (klass);
+
+    if (ipc_frontend_socket_parent_class == NULL)
+        ipc_frontend_socket_parent_class = g_type_class_peek_parent (klass);
+    /* GObject functions */
+    object_class->dispose      = ipc_frontend_socket_dispose;
+    object_class->finalize     = ipc_frontend_socket_finalize;
+    object_class->get_property = ipc_frontend_socket_get_property;
+    object_class->set_property = ipc_frontend_socket_set_property;
+    /* IpcFrontend functions */
+    ipc_frontend_class->connect    = (IpcFrontendConnect)ipc_frontend_socket_connect;
+    ipc_frontend_class->disconnect = (IpcFrontendDisconnect)ipc_frontend_socket_disconnect;
+    obj_properties [PROP_PATH] =
+        g_param_spec_string ("path",
+                             "Socket path",
+                             "Path of the Unix socket clients connect to",
+                             NULL,
+                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_CONNECTION_MANAGER] =
+        g_param_spec_object ("connection-manager",
+                             "ConnectionManager object",
+                             "ConnectionManager object for connection",
+                             TYPE_CONNECTION_MANAGER,
+                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_MAX_TRANS] =
+        g_param_spec_uint ("max-trans",
+                          "maximum transient objects",
+                          "maximum number of transient objects for the handle map",
+                          1,
+                          TABRMD_TRANSIENT_MAX,
+                          TABRMD_TRANSIENT_MAX_DEFAULT,
+                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_RANDOM] =
+        g_param_spec_object ("random",
+                             "Random object",
+                             "Source of random numbers.",
+                             TYPE_RANDOM,
+                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_properties (object_class,
+                                       N_PROPERTIES,
+                                       obj_properties);
+}
+
+IpcFrontendSocket*
+ipc_frontend_socket_new (gchar const       *path,
+                         ConnectionManager *connection_manager,
+                         guint              max_trans,
+                         Random            *random)
+{
+    GObject *object = NULL;
+
+    object = g_object_new (TYPE_IPC_FRONTEND_SOCKET,
+                           "path",               path,
+                           "connection-manager", connection_manager,
+                           "max-trans",          max_trans,
+                           "random",             random,
+                           NULL);
+    return IPC_FRONTEND_SOCKET (object);
+}
+/*
+ * Get the PID of the process on the other end of a connected Unix socket.
+ * GIO gets this from the kernel (SO_PEERCRED on Linux) so, unlike a PID
+ * sent by the client, it can't be forged. Returns FALSE on error.
+ */
+static gboolean
+get_pid_from_socket (GSocket *socket,
+                     guint32 *pid)
+{
+    GCredentials *credentials;
+    GError *error = NULL;
+    pid_t peer_pid;
+
+    credentials = g_socket_get_credentials (socket, &error);
+    if (credentials == NULL) {
+        g_warning ("Unable to get credentials for client: %s",
+                   error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+    peer_pid = g_credentials_get_unix_pid (credentials, &error);
+    g_object_unref (credentials);
+    if (peer_pid == -1) {
+        g_warning ("Unable to get PID for client: %s", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+    *pid = (guint32)peer_pid;
+    return TRUE;
+}
+/*
+ * This is a signal handler for the 'incoming' signal from the
+ * GSocketService. It's the counterpart of the CreateConnection D-Bus
+ * method: the connected socket becomes the client's connection with the
+ * daemon. This requires a few things be done:
+ * - Get the client PID from the socket credentials.
+ * - Create a new ID (uint64) for the connection and mix in the PID.
+ * - Send the ID (*not* mixed with the PID) to the client over the socket
+ *   without blocking the main loop.
+ * - Create a new Connection object with the socket and a new HandleMap.
+ * - Insert the new Connection object into the ConnectionManager.
+ * On failure the socket is closed without sending an ID, the client sees
+ * this as the connection closing.
+ */
+static gboolean
+on_incoming (GSocketService    *service,
+             GSocketConnection *sock_connect,
+             GObject           *source_object,
+             gpointer           user_data)
+{
+    IpcFrontendSocket *self = IPC_FRONTEND_SOCKET (user_data);
+    HandleMap *handle_map = NULL;
+    Connection *connection = NULL;
+    GError *error = NULL;
+    guint64 id = 0, id_pid_mix = 0;
+    guint32 pid = 0;
+    gssize written;
+    gint ret;
+    UNUSED_PARAM(service);
+    UNUSED_PARAM(source_object);
+
+    ipc_frontend_init_guard (IPC_FRONTEND (self));
+    if (connection_manager_is_full (self->connection_manager)) {
+        g_warning ("%s: MAX_COMMANDS exceeded, closing socket", __func__);
+        return TRUE;
+    }
+    if (!get_pid_from_socket (g_socket_connection_get_socket (sock_connect),
+                              &pid)) {
+        return TRUE;
+    }
+    id = random_get_uint64 (self->random);
+    id_pid_mix = id ^ pid;
+    g_debug ("Creating connection with id: 0x%" PRIx64, id_pid_mix);
+    if (connection_manager_contains_id (self->connection_manager,
+                                        id_pid_mix)) {
+        g_warning ("ID collision in ConnectionManager: %" PRIu64, id_pid_mix);
+        return TRUE;
+    }
+    /*
+     * The ID goes out before the Connection is inserted into the
+     * ConnectionManager so nothing else writes to the socket until it has.
+     * The send buffer of a new socket has room for it, if it doesn't we
+     * drop the client rather than block the main loop.
+     */
+    written = g_socket_send_with_blocking (
+        g_socket_connection_get_socket (sock_connect),
+        (gchar const*)&id,
+        sizeof (id),
+        FALSE,
+        NULL,
+        &error);
+    if (written != sizeof (id)) {
+        g_warning ("%s: failed to send connection ID to client: %s",
+                   __func__, error != NULL ? error->message : "short write");
+        g_clear_error (&error);
+        return TRUE;
+    }
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT,
+                                 self->max_transient_objects);
+    if (handle_map == NULL)
+        g_error ("Failed to allocate new HandleMap");
+    connection = connection_new (G_IO_STREAM (sock_connect),
+                                 id_pid_mix,
+                                 handle_map);
+    g_object_unref (handle_map);
+    if (connection == NULL)
+        g_error ("Failed to allocate new connection.");
+    g_debug ("Created connection for PID %" PRIu32 " with id: 0x%" PRIx64,
+             pid, id_pid_mix);
+    ret = connection_manager_insert (self->connection_manager, connection);
+    if (ret != 0) {
+        g_warning ("Failed to add new connection to connection_manager.");
+    }
+    g_object_unref (connection);
+
+    return TRUE;
+}
+/*
+ * Remove whatever is at 'path' if it's a socket nobody is listening on:
+ * one left behind by a daemon that didn't exit cleanly. We only unlink
+ * once connecting to it is refused. Returns FALSE if a daemon accepts
+ * connections on the socket. Anything else is left alone and will make
+ * the bind fail.
+ */
+static gboolean
+remove_stale_socket (const gchar *path)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX, };
+    struct stat sb;
+    gint fd, ret;
+
+    if (lstat (path, &sb) != 0 || !S_ISSOCK (sb.st_mode)) {
+        return TRUE;
+    }
+    if (g_strlcpy (address.sun_path, path, sizeof (address.sun_path)) >=
+        sizeof (address.sun_path))
+    {
+        return TRUE;
+    }
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        g_warning ("failed to create socket to probe %s: %s",
+                   path, strerror (errno));
+        return TRUE;
+    }
+    ret = connect (fd, (struct sockaddr*)&address, sizeof (address));
+    if (ret == 0) {
+        close (fd);
+        g_warning ("socket %s is in use by another daemon", path);
+        return FALSE;
+    }
+    if (errno == ECONNREFUSED) {
+        g_info ("removing stale socket %s", path);
+        if (unlink (path) == -1) {
+            g_warning ("failed to remove socket %s: %s",
+                       path, strerror (errno));
+        }
+    }
+    close (fd);
+    return TRUE;
+}
+/*
+ * This function overrides the ipc_frontend_connect function from the
+ * IpcFrontend base class. It binds a Unix stream socket to the path
+ * provided in the constructor and starts accepting connections on it. The
+ * socket is made accessible to all users in the same way the D-Bus policy
+ * lets all users call CreateConnection. If the socket can't be created the
+ * 'disconnected' signal is emitted.
+ */
+void
+ipc_frontend_socket_connect (IpcFrontendSocket *self,
+                             GMutex            *init_mutex)
+{
+    IpcFrontend *frontend = IPC_FRONTEND (self);
+    GSocketAddress *address;
+    GError *error = NULL;
+    gboolean ret;
+    g_return_if_fail (IS_IPC_FRONTEND_SOCKET (self));
+
+    frontend->init_mutex = init_mutex;
+    if (!remove_stale_socket (self->path)) {
+        ipc_frontend_disconnected_invoke (frontend);
+        return;
+    }
+    address = g_unix_socket_address_new (self->path);
+    self->service = g_socket_service_new ();
+    ret = g_socket_listener_add_address (G_SOCKET_LISTENER (self->service),
+                                         address,
+                                         G_SOCKET_TYPE_STREAM,
+                                         G_SOCKET_PROTOCOL_DEFAULT,
+                                         NULL,
+                                         NULL,
+                                         &error);
+    g_object_unref (address);
+    if (ret == FALSE) {
+        g_critical ("Failed to listen on socket %s: %s",
+                    self->path, error->message);
+        g_error_free (error);
+        g_clear_object (&self->service);
+        ipc_frontend_disconnected_invoke (frontend);
+        return;
+    }
+    if (chmod (self->path, 0666) == -1) {
+        g_warning ("failed to set mode of socket %s: %s",
+                   self->path, strerror (errno));
+    }
+    g_signal_connect (self->service,
+                      "incoming",
+                      G_CALLBACK (on_incoming),
+                      self);
+    g_socket_service_start (self->service);
+}
+/*
+ * This function overrides the ipc_frontend_disconnect function from the
+ * IpcFrontend base class. It stops accepting connections and removes the
+ * socket. Connections already established are unaffected.
+ */
+void
+ipc_frontend_socket_disconnect (IpcFrontendSocket *self)
+{
+    if (self->service != NULL) {
+        g_socket_service_stop (self->service);
+        g_socket_listener_close (G_SOCKET_LISTENER (self->service));
+        g_clear_object (&self->service);
+        if (unlink (self->path) == -1) {
+            g_warning ("failed to remove socket %s: %s",
+                       self->path, strerror (errno));
+        }
+    }
+    IPC_FRONTEND (self)->init_mutex = NULL;
+}
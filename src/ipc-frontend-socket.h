@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef IPC_FRONTEND_SOCKET_H
+#define IPC_FRONTEND_SOCKET_H
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "connection-manager.h"
+#include "ipc-frontend.h"
+#include "random.h"
+
+G_BEGIN_DECLS
+
+typedef struct _IpcFrontendSocketClass {
+   IpcFrontendClass     parent;
+} IpcFrontendSocketClass;
+
+typedef struct _IpcFrontendSocket
+{
+    IpcFrontend        parent_instance;
+    /* data set by GObject properties */
+    gchar             *path;
+    guint              max_transient_objects;
+    ConnectionManager *connection_manager;
+    Random            *random;
+    /* private data */
+    GSocketService    *service;
+} IpcFrontendSocket;
+
+#define TYPE_IPC_FRONTEND_SOCKET             (ipc_frontend_socket_get_type       ())
+#define IPC_FRONTEND_SOCKET(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj),   TYPE_IPC_FRONTEND_SOCKET, IpcFrontendSocket))
+#define IPC_FRONTEND_SOCKET_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST    ((klass), TYPE_IPC_FRONTEND_SOCKET, IpcFrontendSocketClass))
+#define IS_IPC_FRONTEND_SOCKET(obj)          (G_TYPE_CHECK_INSTANCE_TYPE ((obj),   TYPE_IPC_FRONTEND_SOCKET))
+#define IS_IPC_FRONTEND_SOCKET_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE    ((klass), TYPE_IPC_FRONTEND_SOCKET))
+#define IPC_FRONTEND_SOCKET_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_IPC_FRONTEND_SOCKET, IpcFrontendSocketClass))
+
+GType              ipc_frontend_socket_get_type   (void);
+IpcFrontendSocket* ipc_frontend_socket_new        (gchar const       *path,
+                                                   ConnectionManager *connection_manager,
+                                                   guint              max_trans,
+                                                   Random            *random);
+void               ipc_frontend_socket_connect    (IpcFrontendSocket *self,
+                                                   GMutex            *init_mutex);
+void               ipc_frontend_socket_disconnect (IpcFrontendSocket *self);
+
+G_END_DECLS
+#endif /* IPC_FRONTEND_SOCKET_H */
@@ -107,3 +107,61 @@ message_queue_dequeue (MessageQueue *message_queue)
     g_debug ("  got obj: 0x%" PRIxPTR, (uintptr_t)obj);
     return obj;
 }
+/**
+ * Get a reference to the next object that message_queue_dequeue will
+ * return without removing it from the queue. This function doesn't block.
+ * Returns NULL if the queue is empty. The caller must unref the returned
+ * object.
+ * GAsyncQueue has no peek function so we pop the object and put it back
+ * at the front while holding the queue lock.
+ */
+GObject*
+message_queue_peek (MessageQueue *message_queue)
+{
+    GObject *obj;
+
+    g_assert (message_queue != NULL);
+    g_async_queue_lock (message_queue->queue);
+    obj = g_async_queue_try_pop_unlocked (message_queue->queue);
+    if (obj != NULL) {
+        g_async_queue_push_front_unlocked (message_queue->queue,
+                                           g_object_ref (obj));
+    }
+    g_async_queue_unlock (message_queue->queue);
+    return obj;
+}
+/*
+ * Remove the objects for which 'func' returns TRUE from the queue and
+ * return them in a GSList in the order they were queued. 'func' is called
+ * for each object in queue order while holding the queue lock so it must
+ * not use the queue. The caller owns the references to the objects in the
+ * returned list. The order of the remaining objects is preserved: we pop
+ * each one and push the ones we keep back to the end.
+ */
+GSList*
+message_queue_take_matching (MessageQueue         *message_queue,
+                             MessageQueueMatchFunc func,
+                             gpointer              user_data)
+{
+    GSList *taken = NULL;
+    GObject *obj;
+    gint i, length;
+
+    g_assert (message_queue != NULL);
+    g_assert (func != NULL);
+    g_async_queue_lock (message_queue->queue);
+    length = g_async_queue_length_unlocked (message_queue->queue);
+    for (i = 0; i < length; ++i) {
+        obj = g_async_queue_try_pop_unlocked (message_queue->queue);
+        if (obj == NULL) {
+            break;
+        }
+        if (func (obj, user_data)) {
+            taken = g_slist_prepend (taken, obj);
+        } else {
+            g_async_queue_push_unlocked (message_queue->queue, obj);
+        }
+    }
+    g_async_queue_unlock (message_queue->queue);
+    return g_slist_reverse (taken);
+}
@@ -41,6 +41,9 @@ typedef struct _MessageQueue {
     GAsyncQueue  *queue;
 } MessageQueue;
 
+typedef gboolean (*MessageQueueMatchFunc) (GObject  *obj,
+                                           gpointer  user_data);
+
 #define TYPE_MESSAGE_QUEUE           (message_queue_get_type             ())
 #define MESSAGE_QUEUE(obj)           (G_TYPE_CHECK_INSTANCE_CAST ((obj), TYPE_MESSAGE_QUEUE, MessageQueue))
 #define MESSAGE_QUEUE_CLASS(cls)     (G_TYPE_CHECK_CLASS_CAST    ((cls), TYPE_MESSAGE_QUEUE, MessageQueueClass))
@@ -53,6 +56,10 @@ MessageQueue*   message_queue_new          (void);
 void        message_queue_enqueue          (MessageQueue   *message_queue,
                                             GObject        *obj);
 GObject*    message_queue_dequeue          (MessageQueue   *message_queue);
+GObject*    message_queue_peek             (MessageQueue   *message_queue);
+GSList*     message_queue_take_matching    (MessageQueue   *message_queue,
+                                            MessageQueueMatchFunc func,
+                                            gpointer        user_data);
 
 G_END_DECLS
 #endif /* MESSAGE_QUEUE_H */
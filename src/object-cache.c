@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <inttypes.h>
+#include <string.h>
+
+#include "object-cache.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+G_DEFINE_TYPE (ObjectCache, object_cache, G_TYPE_OBJECT);
+
+enum {
+    PROP_0,
+    PROP_MAX_ENTRIES,
+    PROP_FLAGS,
+    N_PROPERTIES
+};
+static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+
+/*
+ * The value stored for each cached command: the response from the TPM and
+ * the marshalled context of the object saved right after it was created
+ * or loaded.
+ */
+typedef struct {
+    GBytes *response;
+    GBytes *context;
+} object_cache_entry_t;
+
+static void
+object_cache_entry_free (gpointer data)
+{
+    object_cache_entry_t *entry = (object_cache_entry_t*)data;
+
+    g_bytes_unref (entry->response);
+    g_bytes_unref (entry->context);
+    g_free (entry);
+}
+static void
+object_cache_set_property (GObject      *object,
+                           guint         property_id,
+                           GValue const *value,
+                           GParamSpec   *pspec)
+{
+    ObjectCache *self = OBJECT_CACHE (object);
+
+    switch (property_id) {
+    case PROP_MAX_ENTRIES:
+        self->max_entries = g_value_get_uint (value);
+        g_debug ("%s: ObjectCache 0x%" PRIxPTR " max-entries: %u", __func__,
+                 (uintptr_t)self, self->max_entries);
+        break;
+    case PROP_FLAGS:
+        self->flags = g_value_get_uint (value);
+        g_debug ("%s: ObjectCache 0x%" PRIxPTR " flags: 0x%x", __func__,
+                 (uintptr_t)self, self->flags);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+object_cache_get_property (GObject    *object,
+                           guint       property_id,
+                           GValue     *value,
+                           GParamSpec *pspec)
+{
+    ObjectCache *self = OBJECT_CACHE (object);
+
+    switch (property_id) {
+    case PROP_MAX_ENTRIES:
+        g_value_set_uint (value, self->max_entries);
+        break;
+    case PROP_FLAGS:
+        g_value_set_uint (value, self->flags);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+object_cache_init (ObjectCache *cache)
+{
+    cache->table = g_hash_table_new_full (g_bytes_hash,
+                                          g_bytes_equal,
+                                          (GDestroyNotify)g_bytes_unref,
+                                          object_cache_entry_free);
+}
+static void
+object_cache_finalize (GObject *object)
+{
+    ObjectCache *self = OBJECT_CACHE (object);
+
+    g_info ("ObjectCache 0x%" PRIxPTR ": %" PRIu64 " hits, %" PRIu64
+            " misses", (uintptr_t)self, self->hits, self->misses);
+    g_clear_pointer (&self->table, g_hash_table_unref);
+    G_OBJECT_CLASS (object_cache_parent_class)->finalize (object);
+}
+static void
+object_cache_class_init (ObjectCacheClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    if (object_cache_parent_class == NULL)
+        object_cache_parent_class = g_type_class_peek_parent (klass);
+    object_class->finalize     = object_cache_finalize;
+    object_class->get_property = object_cache_get_property;
+    object_class->set_property = object_cache_set_property;
+
+    obj_properties [PROP_MAX_ENTRIES] =
+        g_param_spec_uint ("max-entries",
+                           "max entries",
+                           "Maximum number of cached objects",
+                           0,
+                           G_MAXUINT,
+                           OBJECT_CACHE_MAX_ENTRIES_DEFAULT,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_FLAGS] =
+        g_param_spec_uint ("flags",
+                           "flags",
+                           "Commands whose results are cached",
+                           0,
+                           G_MAXUINT,
+                           OBJECT_CACHE_PRIMARY,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_properties (object_class,
+                                       N_PROPERTIES,
+                                       obj_properties);
+}
+ObjectCache*
+object_cache_new (guint max_entries,
+                  guint flags)
+{
+    return OBJECT_CACHE (g_object_new (TYPE_OBJECT_CACHE,
+                                       "max-entries", max_entries,
+                                       "flags", flags,
+                                       NULL));
+}
+typedef struct {
+    Tpm2Command *command;
+    gboolean     password_only;
+} object_cache_auth_data_t;
+/*
+ * GFunc invoked for each authorization in the command. Clears
+ * 'password_only' if the authorization isn't a password.
+ */
+static void
+object_cache_auth_callback (gpointer auth_offset_ptr,
+                            gpointer user_data)
+{
+    object_cache_auth_data_t *data = (object_cache_auth_data_t*)user_data;
+    size_t auth_offset = *(size_t*)auth_offset_ptr;
+
+    if (tpm2_command_get_auth_handle (data->command, auth_offset) !=
+        TPM2_RS_PW)
+    {
+        data->password_only = FALSE;
+    }
+}
+/*
+ * Returns TRUE if the result of the provided command may be cached. We
+ * cache TPM2_CreatePrimary and TPM2_Load under persistent parents: the
+ * parent handle in the command buffer is the same for all connections.
+ * Only commands authorized with passwords are cached: the response to an
+ * HMAC or policy session depends on the session state and can't be
+ * replayed. The password is part of the key so a client has to know it
+ * to get the cached object.
+ */
+gboolean
+object_cache_cacheable (ObjectCache *cache,
+                        Tpm2Command *command)
+{
+    object_cache_auth_data_t data = {
+        .command = command,
+        .password_only = TRUE,
+    };
+
+    if (tpm2_command_get_handle_count (command) != 1 ||
+        !tpm2_command_has_auths (command))
+    {
+        return FALSE;
+    }
+    switch (tpm2_command_get_code (command)) {
+    case TPM2_CC_CreatePrimary:
+        if (!(cache->flags & OBJECT_CACHE_PRIMARY)) {
+            return FALSE;
+        }
+        break;
+    case TPM2_CC_Load:
+        if (!(cache->flags & OBJECT_CACHE_LOAD) ||
+            tpm2_command_get_handle (command, 0) >> TPM2_HR_SHIFT !=
+                TPM2_HT_PERSISTENT)
+        {
+            return FALSE;
+        }
+        break;
+    default:
+        return FALSE;
+    }
+    if (!tpm2_command_foreach_auth (command,
+                                    object_cache_auth_callback,
+                                    &data))
+    {
+        return FALSE;
+    }
+    return data.password_only;
+}
+/*
+ * Look up the result of the provided command. If it's cached a new
+ * Tpm2Response for the connection associated with the command is returned
+ * and 'context' is set to a new reference to the shared context of the
+ * object. The handle in the response is the one from the connection that
+ * first got the object, the caller must replace it. Otherwise NULL.
+ */
+Tpm2Response*
+object_cache_lookup (ObjectCache  *cache,
+                     Tpm2Command  *command,
+                     GBytes      **context)
+{
+    object_cache_entry_t *entry;
+    Connection *connection;
+    Tpm2Response *response;
+    GBytes *key;
+    guint8 *buf;
+    gsize size;
+
+    if (!object_cache_cacheable (cache, command)) {
+        return NULL;
+    }
+    key = g_bytes_new_static (tpm2_command_get_buffer (command),
+                              tpm2_command_get_size (command));
+    entry = g_hash_table_lookup (cache->table, key);
+    g_bytes_unref (key);
+    if (entry == NULL) {
+        ++cache->misses;
+        return NULL;
+    }
+    ++cache->hits;
+    g_debug ("%s: command 0x%" PRIx32 " under 0x%08" PRIx32 " is cached",
+             __func__, tpm2_command_get_code (command),
+             tpm2_command_get_handle (command, 0));
+    size = g_bytes_get_size (entry->response);
+    buf = g_malloc (size);
+    memcpy (buf, g_bytes_get_data (entry->response, NULL), size);
+    connection = tpm2_command_get_connection (command);
+    response = tpm2_response_new (connection,
+                                  buf,
+                                  size,
+                                  tpm2_command_get_attributes (command));
+    g_object_unref (connection);
+    *context = g_bytes_ref (entry->context);
+    return response;
+}
+/*
+ * Cache the result of the provided command: the response and the shared
+ * context of the object. Only successful responses to cacheable commands
+ * are kept. Once the cache holds 'max_entries' objects nothing more is
+ * added until the cache is invalidated.
+ */
+void
+object_cache_insert (ObjectCache  *cache,
+                     Tpm2Command  *command,
+                     Tpm2Response *response,
+                     GBytes       *context)
+{
+    object_cache_entry_t *entry;
+
+    if (!object_cache_cacheable (cache, command) ||
+        tpm2_response_get_code (response) != TSS2_RC_SUCCESS ||
+        g_hash_table_size (cache->table) >= cache->max_entries)
+    {
+        return;
+    }
+    entry = g_new0 (object_cache_entry_t, 1);
+    entry->response = g_bytes_new (tpm2_response_get_buffer (response),
+                                   tpm2_response_get_size (response));
+    entry->context = g_bytes_ref (context);
+    g_hash_table_replace (cache->table,
+                          g_bytes_new (tpm2_command_get_buffer (command),
+                                       tpm2_command_get_size (command)),
+                          entry);
+}
+/*
+ * Drop all cached objects if the provided command may make them invalid.
+ * This must be called for every command before it's sent to the TPM.
+ * Primary objects are derived from the hierarchy seeds, and saved
+ * contexts are bound to the hierarchy proofs, which change on Clear and
+ * ChangePPS / ChangeEPS. Object contexts don't survive a TPM Reset
+ * (Startup). Changing the hierarchy authorization or disabling a
+ * hierarchy must make the TPM check the next request again, and
+ * EvictControl may remove or replace the parent of a cached Load.
+ */
+void
+object_cache_invalidate (ObjectCache *cache,
+                         Tpm2Command *command)
+{
+    if (g_hash_table_size (cache->table) == 0) {
+        return;
+    }
+    switch (tpm2_command_get_code (command)) {
+    case TPM2_CC_Clear:
+    case TPM2_CC_ChangePPS:
+    case TPM2_CC_ChangeEPS:
+    case TPM2_CC_Startup:
+    case TPM2_CC_HierarchyChangeAuth:
+    case TPM2_CC_HierarchyControl:
+    case TPM2_CC_EvictControl:
+        g_debug ("%s: command 0x%" PRIx32 " invalidates all entries",
+                 __func__, tpm2_command_get_code (command));
+        g_hash_table_remove_all (cache->table);
+        break;
+    default:
+        break;
+    }
+}
+guint
+object_cache_size (ObjectCache *cache)
+{
+    return g_hash_table_size (cache->table);
+}
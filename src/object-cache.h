@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include <glib.h>
+#include <glib-object.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tpm2-command.h"
+#include "tpm2-response.h"
+
+G_BEGIN_DECLS
+
+#define OBJECT_CACHE_MAX_ENTRIES_DEFAULT 16
+/* the commands whose results are cached */
+#define OBJECT_CACHE_PRIMARY (1 << 0) /* CreatePrimary */
+#define OBJECT_CACHE_LOAD    (1 << 1) /* Load under a persistent parent */
+
+typedef struct _ObjectCacheClass {
+    GObjectClass      parent;
+} ObjectCacheClass;
+
+/*
+ * Cache of the objects created by TPM2_CreatePrimary or loaded by
+ * TPM2_Load. The key is the command buffer: the parent or hierarchy, the
+ * authorization and all parameters. The value is the response buffer and
+ * the saved context of the object, shared with the HandleMapEntry of each
+ * connection that gets the object. 'flags' selects the commands that are
+ * cached. 'hits' and 'misses' count lookups.
+ */
+typedef struct _ObjectCache {
+    GObject           parent_instance;
+    GHashTable       *table;
+    guint             max_entries;
+    guint             flags;
+    guint64           hits;
+    guint64           misses;
+} ObjectCache;
+
+#define TYPE_OBJECT_CACHE              (object_cache_get_type   ())
+#define OBJECT_CACHE(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj),   TYPE_OBJECT_CACHE, ObjectCache))
+#define OBJECT_CACHE_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST    ((klass), TYPE_OBJECT_CACHE, ObjectCacheClass))
+#define IS_OBJECT_CACHE(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj),   TYPE_OBJECT_CACHE))
+#define IS_OBJECT_CACHE_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE    ((klass), TYPE_OBJECT_CACHE))
+#define OBJECT_CACHE_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_OBJECT_CACHE, ObjectCacheClass))
+
+GType          object_cache_get_type   (void);
+ObjectCache*   object_cache_new        (guint          max_entries,
+                                        guint          flags);
+gboolean       object_cache_cacheable  (ObjectCache   *cache,
+                                        Tpm2Command   *command);
+Tpm2Response*  object_cache_lookup     (ObjectCache   *cache,
+                                        Tpm2Command   *command,
+                                        GBytes       **context);
+void           object_cache_insert     (ObjectCache   *cache,
+                                        Tpm2Command   *command,
+                                        Tpm2Response  *response,
+                                        GBytes        *context);
+void           object_cache_invalidate (ObjectCache   *cache,
+                                        Tpm2Command   *command);
+guint          object_cache_size       (ObjectCache   *cache);
+
+G_END_DECLS
+#endif /* OBJECT_CACHE_H */
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <inttypes.h>
+#include <string.h>
+
+#include "read-cache.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+G_DEFINE_TYPE (ReadCache, read_cache, G_TYPE_OBJECT);
+
+enum {
+    PROP_0,
+    PROP_MAX_ENTRIES,
+    PROP_FLAGS,
+    PROP_PCR_LIFETIME,
+    N_PROPERTIES
+};
+static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+
+/*
+ * The value stored for each cached command. 'handle' is the TPM handle the
+ * response was read from, used to invalidate the entry. For PCR_Read
+ * responses 'pcr' is set, 'generation' is the PCR generation and 'time'
+ * the monotonic time at which the response was received. The entry is
+ * stale once the generation has moved on or it's older than the PCR
+ * lifetime.
+ */
+typedef struct {
+    TPM2_HANDLE  handle;
+    gboolean     pcr;
+    guint64      generation;
+    gint64       time;
+    GBytes      *response;
+} read_cache_entry_t;
+
+static void
+read_cache_entry_free (gpointer data)
+{
+    read_cache_entry_t *entry = (read_cache_entry_t*)data;
+
+    g_bytes_unref (entry->response);
+    g_free (entry);
+}
+static void
+read_cache_set_property (GObject      *object,
+                         guint         property_id,
+                         GValue const *value,
+                         GParamSpec   *pspec)
+{
+    ReadCache *self = READ_CACHE (object);
+
+    switch (property_id) {
+    case PROP_MAX_ENTRIES:
+        self->max_entries = g_value_get_uint (value);
+        g_debug ("%s: ReadCache 0x%" PRIxPTR " max-entries: %u", __func__,
+                 (uintptr_t)self, self->max_entries);
+        break;
+    case PROP_FLAGS:
+        self->flags = g_value_get_uint (value);
+        g_debug ("%s: ReadCache 0x%" PRIxPTR " flags: 0x%x", __func__,
+                 (uintptr_t)self, self->flags);
+        break;
+    case PROP_PCR_LIFETIME:
+        self->pcr_lifetime = g_value_get_uint (value);
+        g_debug ("%s: ReadCache 0x%" PRIxPTR " pcr-lifetime: %u", __func__,
+                 (uintptr_t)self, self->pcr_lifetime);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+read_cache_get_property (GObject    *object,
+                         guint       property_id,
+                         GValue     *value,
+                         GParamSpec *pspec)
+{
+    ReadCache *self = READ_CACHE (object);
+
+    switch (property_id) {
+    case PROP_MAX_ENTRIES:
+        g_value_set_uint (value, self->max_entries);
+        break;
+    case PROP_FLAGS:
+        g_value_set_uint (value, self->flags);
+        break;
+    case PROP_PCR_LIFETIME:
+        g_value_set_uint (value, self->pcr_lifetime);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+read_cache_init (ReadCache *cache)
+{
+    cache->table = g_hash_table_new_full (g_bytes_hash,
+                                          g_bytes_equal,
+                                          (GDestroyNotify)g_bytes_unref,
+                                          read_cache_entry_free);
+}
+static void
+read_cache_finalize (GObject *object)
+{
+    ReadCache *self = READ_CACHE (object);
+
+    g_info ("ReadCache 0x%" PRIxPTR ": %" PRIu64 " hits, %" PRIu64
+            " misses", (uintptr_t)self, self->hits, self->misses);
+    g_clear_pointer (&self->table, g_hash_table_unref);
+    G_OBJECT_CLASS (read_cache_parent_class)->finalize (object);
+}
+static void
+read_cache_class_init (ReadCacheClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    if (read_cache_parent_class == NULL)
+        read_cache_parent_class = g_type_class_peek_parent (klass);
+    object_class->finalize     = read_cache_finalize;
+    object_class->get_property = read_cache_get_property;
+    object_class->set_property = read_cache_set_property;
+
+    obj_properties [PROP_MAX_ENTRIES] =
+        g_param_spec_uint ("max-entries",
+                           "max entries",
+                           "Maximum number of cached responses",
+                           0,
+                           G_MAXUINT,
+                           READ_CACHE_MAX_ENTRIES_DEFAULT,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_FLAGS] =
+        g_param_spec_uint ("flags",
+                           "flags",
+                           "Commands whose responses are cached",
+                           0,
+                           G_MAXUINT,
+                           READ_CACHE_PUBLIC,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_PCR_LIFETIME] =
+        g_param_spec_uint ("pcr-lifetime",
+                           "PCR_Read lifetime",
+                           "Milliseconds a PCR_Read response is cached",
+                           0,
+                           G_MAXUINT,
+                           READ_CACHE_PCR_LIFETIME_DEFAULT,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+    g_object_class_install_properties (object_class,
+                                       N_PROPERTIES,
+                                       obj_properties);
+}
+ReadCache*
+read_cache_new (guint max_entries,
+                guint flags)
+{
+    return READ_CACHE (g_object_new (TYPE_READ_CACHE,
+                                     "max-entries", max_entries,
+                                     "flags", flags,
+                                     NULL));
+}
+/*
+ * Returns TRUE if the response to the command may be cached. We cache
+ * TPM2_ReadPublic for persistent objects and TPM2_NV_ReadPublic for NV
+ * indices. Neither handle type is virtualized so the response is the same
+ * for all connections. TPM2_PCR_Read has no handles, the PCR selection is
+ * part of the command buffer and so of the key. Commands with sessions are
+ * never cached since the response carries session data specific to the
+ * caller.
+ */
+static gboolean
+read_cache_command_cacheable (ReadCache   *cache,
+                              Tpm2Command *command,
+                              TPM2_HANDLE *handle)
+{
+    if (tpm2_command_has_auths (command)) {
+        return FALSE;
+    }
+    switch (tpm2_command_get_code (command)) {
+    case TPM2_CC_ReadPublic:
+    case TPM2_CC_NV_ReadPublic:
+        if (!(cache->flags & READ_CACHE_PUBLIC)) {
+            return FALSE;
+        }
+        break;
+    case TPM2_CC_PCR_Read:
+        *handle = 0;
+        return (cache->flags & READ_CACHE_PCR_READ) ? TRUE : FALSE;
+    default:
+        return FALSE;
+    }
+    if (tpm2_command_get_handle_count (command) != 1) {
+        return FALSE;
+    }
+    *handle = tpm2_command_get_handle (command, 0);
+    switch (*handle >> TPM2_HR_SHIFT) {
+    case TPM2_HT_PERSISTENT:
+    case TPM2_HT_NV_INDEX:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+/*
+ * Returns TRUE if the entry is a PCR_Read response that may no longer be
+ * current: a command that changes PCRs went through the daemon since, or
+ * it's older than the PCR lifetime. The latter covers PCRs extended by
+ * other means (e.g. IMA, the kernel or a locality 4 hash sequence).
+ */
+static gboolean
+read_cache_entry_stale (ReadCache          *cache,
+                        read_cache_entry_t *entry,
+                        gint64              now)
+{
+    return entry->pcr &&
+        (entry->generation != cache->pcr_generation ||
+         now - entry->time >= (gint64)cache->pcr_lifetime * 1000);
+}
+/*
+ * Look up the response to the provided command. If it's cached a new
+ * Tpm2Response for the connection associated with the command is returned.
+ * Otherwise NULL.
+ */
+Tpm2Response*
+read_cache_lookup (ReadCache   *cache,
+                   Tpm2Command *command)
+{
+    read_cache_entry_t *entry;
+    Connection *connection;
+    Tpm2Response *response;
+    GBytes *key;
+    TPM2_HANDLE handle;
+    guint8 *buf;
+    gsize size;
+
+    if (!read_cache_command_cacheable (cache, command, &handle)) {
+        return NULL;
+    }
+    key = g_bytes_new_static (tpm2_command_get_buffer (command),
+                              tpm2_command_get_size (command));
+    entry = g_hash_table_lookup (cache->table, key);
+    if (entry != NULL &&
+        read_cache_entry_stale (cache, entry, g_get_monotonic_time ()))
+    {
+        g_debug ("%s: dropping stale PCR_Read response from generation %"
+                 PRIu64, __func__, entry->generation);
+        g_hash_table_remove (cache->table, key);
+        entry = NULL;
+    }
+    g_bytes_unref (key);
+    if (entry == NULL) {
+        ++cache->misses;
+        return NULL;
+    }
+    ++cache->hits;
+    g_debug ("%s: response for command 0x%" PRIx32 " on handle 0x%08"
+             PRIx32 " is cached", __func__, tpm2_command_get_code (command),
+             handle);
+    size = g_bytes_get_size (entry->response);
+    buf = g_malloc (size);
+    memcpy (buf, g_bytes_get_data (entry->response, NULL), size);
+    connection = tpm2_command_get_connection (command);
+    response = tpm2_response_new (connection,
+                                  buf,
+                                  size,
+                                  tpm2_command_get_attributes (command));
+    g_object_unref (connection);
+    return response;
+}
+static gboolean
+read_cache_stale_match (gpointer key,
+                        gpointer value,
+                        gpointer user_data)
+{
+    ReadCache *cache = READ_CACHE (user_data);
+    UNUSED_PARAM(key);
+
+    return read_cache_entry_stale (cache,
+                                   (read_cache_entry_t*)value,
+                                   g_get_monotonic_time ());
+}
+/*
+ * Cache the response to the provided command. Only successful responses
+ * to cacheable commands are kept. Once the cache holds 'max_entries'
+ * responses stale PCR_Read responses are dropped to make room. If that
+ * doesn't free a slot nothing more is added until entries are invalidated.
+ */
+void
+read_cache_insert (ReadCache    *cache,
+                   Tpm2Command  *command,
+                   Tpm2Response *response)
+{
+    read_cache_entry_t *entry;
+    TPM2_HANDLE handle;
+
+    if (!read_cache_command_cacheable (cache, command, &handle) ||
+        tpm2_response_get_code (response) != TSS2_RC_SUCCESS ||
+        tpm2_response_get_tag (response) != TPM2_ST_NO_SESSIONS)
+    {
+        return;
+    }
+    if (g_hash_table_size (cache->table) >= cache->max_entries) {
+        g_hash_table_foreach_remove (cache->table,
+                                     read_cache_stale_match,
+                                     cache);
+    }
+    if (g_hash_table_size (cache->table) >= cache->max_entries) {
+        return;
+    }
+    entry = g_new0 (read_cache_entry_t, 1);
+    entry->handle = handle;
+    entry->pcr = tpm2_command_get_code (command) == TPM2_CC_PCR_Read;
+    entry->generation = cache->pcr_generation;
+    entry->time = g_get_monotonic_time ();
+    entry->response = g_bytes_new (tpm2_response_get_buffer (response),
+                                   tpm2_response_get_size (response));
+    g_hash_table_replace (cache->table,
+                          g_bytes_new (tpm2_command_get_buffer (command),
+                                       tpm2_command_get_size (command)),
+                          entry);
+}
+static gboolean
+read_cache_handle_match (gpointer key,
+                         gpointer value,
+                         gpointer user_data)
+{
+    read_cache_entry_t *entry = (read_cache_entry_t*)value;
+    UNUSED_PARAM(key);
+
+    return entry->handle == *(TPM2_HANDLE*)user_data;
+}
+/*
+ * Drop the cached responses that the provided command may change. This
+ * must be called for every command before it's sent to the TPM.
+ * Commands that change an NV index drop the responses for the NV indices
+ * in their handle area (e.g. TPMA_NV_WRITTEN is set by the first write).
+ * Commands that can change the set of persistent objects or NV indices
+ * drop everything. Commands that change PCRs advance the PCR generation
+ * which makes all PCR_Read responses stale: the response carries the
+ * pcrUpdateCounter so a change to any PCR changes every response. PCRs
+ * extended without going through the daemon aren't seen here, the PCR
+ * lifetime bounds how long those responses are served.
+ */
+void
+read_cache_invalidate (ReadCache   *cache,
+                       Tpm2Command *command)
+{
+    TPM2_HANDLE handles [TPM2_COMMAND_MAX_HANDLES] = { 0, };
+    size_t i, handle_count = TPM2_COMMAND_MAX_HANDLES;
+
+    switch (tpm2_command_get_code (command)) {
+    case TPM2_CC_PCR_Extend:
+    case TPM2_CC_PCR_Event:
+    case TPM2_CC_PCR_Reset:
+    case TPM2_CC_PCR_Allocate:
+    case TPM2_CC_EventSequenceComplete:
+        ++cache->pcr_generation;
+        g_debug ("%s: command 0x%" PRIx32 " changes PCRs, generation %"
+                 PRIu64, __func__, tpm2_command_get_code (command),
+                 cache->pcr_generation);
+        break;
+    case TPM2_CC_NV_Write:
+    case TPM2_CC_NV_Increment:
+    case TPM2_CC_NV_Extend:
+    case TPM2_CC_NV_SetBits:
+    case TPM2_CC_NV_WriteLock:
+    case TPM2_CC_NV_ReadLock:
+    case TPM2_CC_NV_UndefineSpace:
+    case TPM2_CC_NV_UndefineSpaceSpecial:
+        if (!tpm2_command_get_handles (command, handles, &handle_count)) {
+            g_hash_table_remove_all (cache->table);
+            break;
+        }
+        for (i = 0; i < handle_count; ++i) {
+            if (handles [i] >> TPM2_HR_SHIFT == TPM2_HT_NV_INDEX) {
+                g_hash_table_foreach_remove (cache->table,
+                                             read_cache_handle_match,
+                                             &handles [i]);
+            }
+        }
+        break;
+    case TPM2_CC_EvictControl:
+    case TPM2_CC_NV_DefineSpace:
+    case TPM2_CC_NV_GlobalWriteLock:
+    case TPM2_CC_HierarchyControl:
+    case TPM2_CC_Clear:
+    case TPM2_CC_ChangePPS:
+    case TPM2_CC_ChangeEPS:
+    case TPM2_CC_Startup:
+        ++cache->pcr_generation;
+        g_debug ("%s: command 0x%" PRIx32 " invalidates all entries",
+                 __func__, tpm2_command_get_code (command));
+        g_hash_table_remove_all (cache->table);
+        break;
+    default:
+        break;
+    }
+}
+guint
+read_cache_size (ReadCache *cache)
+{
+    return g_hash_table_size (cache->table);
+}
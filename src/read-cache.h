@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef READ_CACHE_H
+#define READ_CACHE_H
+
+#include <glib.h>
+#include <glib-object.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tpm2-command.h"
+#include "tpm2-response.h"
+
+G_BEGIN_DECLS
+
+#define READ_CACHE_MAX_ENTRIES_DEFAULT 64
+/* milliseconds a PCR_Read response is served from the cache */
+#define READ_CACHE_PCR_LIFETIME_DEFAULT 1000
+/* the commands whose responses are cached */
+#define READ_CACHE_PUBLIC   (1 << 0) /* ReadPublic & NV_ReadPublic */
+#define READ_CACHE_PCR_READ (1 << 1) /* PCR_Read */
+
+typedef struct _ReadCacheClass {
+    GObjectClass      parent;
+} ReadCacheClass;
+
+/*
+ * Cache of responses to commands that only read TPM state. The key is the
+ * command buffer, the value the response buffer and the handle it was read
+ * from. 'flags' selects the commands that are cached. 'pcr_generation' is
+ * advanced by every command that changes PCRs. PCRs may also be extended
+ * without going through the daemon so PCR_Read responses are only kept
+ * for 'pcr_lifetime' milliseconds. 'hits' and 'misses' count lookups.
+ */
+typedef struct _ReadCache {
+    GObject           parent_instance;
+    GHashTable       *table;
+    guint             max_entries;
+    guint             flags;
+    guint64           pcr_generation;
+    guint             pcr_lifetime;
+    guint64           hits;
+    guint64           misses;
+} ReadCache;
+
+#define TYPE_READ_CACHE              (read_cache_get_type   ())
+#define READ_CACHE(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj),   TYPE_READ_CACHE, ReadCache))
+#define READ_CACHE_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST    ((klass), TYPE_READ_CACHE, ReadCacheClass))
+#define IS_READ_CACHE(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj),   TYPE_READ_CACHE))
+#define IS_READ_CACHE_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE    ((klass), TYPE_READ_CACHE))
+#define READ_CACHE_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_READ_CACHE, ReadCacheClass))
+
+GType          read_cache_get_type    (void);
+ReadCache*     read_cache_new         (guint         max_entries,
+                                       guint         flags);
+Tpm2Response*  read_cache_lookup      (ReadCache    *cache,
+                                       Tpm2Command  *command);
+void           read_cache_insert      (ReadCache    *cache,
+                                       Tpm2Command  *command,
+                                       Tpm2Response *response);
+void           read_cache_invalidate  (ReadCache    *cache,
+                                       Tpm2Command  *command);
+guint          read_cache_size        (ReadCache    *cache);
+
+G_END_DECLS
+#endif /* READ_CACHE_H */
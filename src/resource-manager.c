@@ -44,9 +44,12 @@
 #include "tpm2-header.h"
 #include "tpm2-command.h"
 #include "tpm2-response.h"
+#include "tss2-tcti-tabrmd.h"
 #include "util.h"
 
 #define MAX_ABANDONED 4
+/* a command can have at most 3 sessions in its authorization area */
+#define SESSIONS_PER_COMMAND_MAX 3
 
 static void resource_manager_sink_interface_init   (gpointer g_iface);
 static void resource_manager_source_interface_init (gpointer g_iface);
@@ -68,12 +71,105 @@ enum {
     PROP_SINK,
     PROP_ACCESS_BROKER,
     PROP_SESSION_LIST,
+    PROP_READ_CACHE,
+    PROP_OBJECT_CACHE,
+    PROP_SESSION_POOL,
     N_PROPERTIES
 };
 static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+/*
+ * The 'resident' queue holds the HandleMapEntry objects for transient
+ * objects that are currently loaded in the TPM, least recently used at the
+ * head. This is what we evict from when the TPM runs out of object slots.
+ * Mark the entry as most recently used, adding it to the queue if it's not
+ * already there. The queue holds a reference to each entry.
+ */
+void
+resource_manager_resident_touch (ResourceManager *resmgr,
+                                 HandleMapEntry  *entry)
+{
+    GList *link;
+
+    link = g_queue_find (resmgr->resident, entry);
+    if (link != NULL) {
+        g_queue_unlink (resmgr->resident, link);
+        g_queue_push_tail_link (resmgr->resident, link);
+    } else {
+        g_queue_push_tail (resmgr->resident, g_object_ref (entry));
+    }
+}
+/*
+ * Remove the entry from the 'resident' queue if it's there. Used once the
+ * object is no longer loaded in the TPM.
+ */
+void
+resource_manager_resident_remove (ResourceManager *resmgr,
+                                  HandleMapEntry  *entry)
+{
+    if (g_queue_remove (resmgr->resident, entry)) {
+        g_object_unref (entry);
+    }
+}
+/*
+ * Save and flush every resident transient object except those in the
+ * 'keep' list and sequence objects. Sequence objects stay loaded until the
+ * sequence is completed or we need the slot for something else.
+ */
+static void
+resource_manager_flushsave_resident (ResourceManager *resmgr,
+                                     GSList          *keep)
+{
+    GList *link, *next;
+
+    for (link = resmgr->resident->head; link != NULL; link = next) {
+        next = link->next;
+        if (g_slist_find (keep, link->data) != NULL ||
+            handle_map_entry_is_sequence (HANDLE_MAP_ENTRY (link->data)))
+        {
+            g_debug ("%s: keeping HandleMapEntry 0x%" PRIxPTR " loaded",
+                     __func__, (uintptr_t)link->data);
+            continue;
+        }
+        resource_manager_flushsave_context (link->data, resmgr);
+    }
+}
+/*
+ * Save and flush up to 'count' resident transient objects, least recently
+ * used first, skipping those in the 'skip' list. Returns the number of
+ * objects that were flushed.
+ */
+static guint
+resource_manager_evict_transients (ResourceManager *resmgr,
+                                   GSList          *skip,
+                                   guint            count)
+{
+    HandleMapEntry *entry;
+    GList *link, *next;
+    guint evicted = 0;
+
+    for (link = resmgr->resident->head;
+         link != NULL && evicted < count;
+         link = next)
+    {
+        next = link->next;
+        entry = HANDLE_MAP_ENTRY (link->data);
+        if (g_slist_find (skip, entry) != NULL)
+            continue;
+        g_debug ("%s: evicting transient with phandle 0x%08" PRIx32,
+                 __func__, handle_map_entry_get_phandle (entry));
+        /* on success this drops the resident queue's reference */
+        g_object_ref (entry);
+        resource_manager_flushsave_context (entry, resmgr);
+        if (handle_map_entry_get_phandle (entry) == 0)
+            ++evicted;
+        g_object_unref (entry);
+    }
+    return evicted;
+}
 /*
  * This is a helper function that does everything required to convert
  * a virtual handle to a physical one in a Tpm2Command object.
+ * - if the entry is still resident, use its physical handle, else
  * - load the context from the provided HandleMapEntry
  * - store the newly assigned TPM handle (physical handle) in the entry
  * - set this handle in the comamnd at the position indicated by
@@ -86,15 +182,26 @@ resource_manager_virt_to_phys (ResourceManager *resmgr,
                                guint8           handle_number)
 {
     TPM2_HANDLE    phandle = 0;
-    TPMS_CONTEXT *context;
+    TPMS_CONTEXT  context;
     TSS2_RC       rc = TSS2_RC_SUCCESS;
 
-    context = handle_map_entry_get_context (entry);
-    rc = access_broker_context_load (resmgr->access_broker, context, &phandle);
+    if (g_queue_find (resmgr->resident, entry) != NULL) {
+        phandle = handle_map_entry_get_phandle (entry);
+        g_debug ("phandle: 0x%" PRIx32 " still loaded", phandle);
+        tpm2_command_set_handle (command, phandle, handle_number);
+        resource_manager_resident_touch (resmgr, entry);
+        return TSS2_RC_SUCCESS;
+    }
+    rc = handle_map_entry_get_context (entry, &context);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    rc = access_broker_context_load (resmgr->access_broker, &context, &phandle);
     g_debug ("phandle: 0x%" PRIx32, phandle);
     if (rc == TSS2_RC_SUCCESS) {
         handle_map_entry_set_phandle (entry, phandle);
         tpm2_command_set_handle (command, phandle, handle_number);
+        resource_manager_resident_touch (resmgr, entry);
     } else {
         g_warning ("Failed to load context: 0x%" PRIx32, rc);
     }
@@ -128,7 +235,20 @@ resource_manager_load_transient (ResourceManager  *resmgr,
         goto out;
     }
     rc = resource_manager_virt_to_phys (resmgr, command, entry, handle_index);
+    /*
+     * Sequence objects may be holding the slots we need. Make room without
+     * touching the objects already loaded for this command.
+     */
+    if (rc == TPM2_RC_OBJECT_MEMORY &&
+        resource_manager_evict_transients (resmgr, *entry_slist, 1) > 0)
+    {
+        rc = resource_manager_virt_to_phys (resmgr,
+                                            command,
+                                            entry,
+                                            handle_index);
+    }
     if (rc != TSS2_RC_SUCCESS) {
+        g_object_unref (entry);
         goto out;
     }
     *entry_slist = g_slist_prepend (*entry_slist, entry);
@@ -178,6 +298,14 @@ resource_manager_load_session_from_handle (ResourceManager *resmgr,
         goto out;
     }
     session_entry_state = session_entry_get_state (session_entry);
+    if (session_entry_state == SESSION_ENTRY_LOADED) {
+        g_debug ("%s: session with handle 0x%08" PRIx32 " still loaded",
+                 __func__, handle);
+        if (will_flush) {
+            session_list_remove (resmgr->session_list, session_entry);
+        }
+        goto out;
+    }
     if (session_entry_state != SESSION_ENTRY_SAVED_RM) {
         g_warning ("%s: Handle in handle area references SessionEntry 0x%"
                    PRIxPTR " for session in state \"%s\". Must be in state: "
@@ -308,6 +436,7 @@ resource_manager_load_handles (ResourceManager *resmgr,
 /*
  * Remove the context associated with the provided HandleMapEntry
  * from the TPM. Only handles in the TRANSIENT range will be flushed.
+ * Entries backed by a shared context are flushed without saving.
  * Any entry with a context that's flushed will have the physical handle
  * to 0.
  */
@@ -317,7 +446,7 @@ resource_manager_flushsave_context (gpointer data_entry,
 {
     ResourceManager *resmgr = RESOURCE_MANAGER (data_resmgr);
     HandleMapEntry  *entry  = HANDLE_MAP_ENTRY (data_entry);
-    TPMS_CONTEXT   *context;
+    TPMS_CONTEXT    context = { 0, };
     TPM2_HANDLE      phandle;
     TSS2_RC         rc = TSS2_RC_SUCCESS;
 
@@ -329,13 +458,28 @@ resource_manager_flushsave_context (gpointer data_entry,
     g_debug ("resource_manager_save_context phandle: 0x%" PRIx32, phandle);
     switch (phandle >> TPM2_HR_SHIFT) {
     case TPM2_HT_TRANSIENT:
+        if (handle_map_entry_is_shared (entry)) {
+            g_debug ("handle is transient with a shared context, flushing");
+            rc = access_broker_context_flush (resmgr->access_broker, phandle);
+            if (rc == TSS2_RC_SUCCESS) {
+                handle_map_entry_set_phandle (entry, 0);
+                resource_manager_resident_remove (resmgr, entry);
+            } else {
+                g_warning ("access_broker_context_flush failed for handle: 0x%"
+                           PRIx32 " rc: 0x%" PRIx32, phandle, rc);
+            }
+            break;
+        }
         g_debug ("handle is transient, saving context");
-        context = handle_map_entry_get_context (entry);
         rc = access_broker_context_saveflush (resmgr->access_broker,
                                               phandle,
-                                              context);
+                                              &context);
+        if (rc == TSS2_RC_SUCCESS) {
+            rc = handle_map_entry_set_context (entry, &context);
+        }
         if (rc == TSS2_RC_SUCCESS) {
             handle_map_entry_set_phandle (entry, 0);
+            resource_manager_resident_remove (resmgr, entry);
         } else {
             g_warning ("access_broker_context_save failed for handle: 0x%"
                        PRIx32 " rc: 0x%" PRIx32, phandle, rc);
@@ -345,6 +489,40 @@ resource_manager_flushsave_context (gpointer data_entry,
         break;
     }
 }
+/*
+ * Every session saved advances the TPM context counter. Flush the pooled
+ * sessions that were saved more than half of TPM2_PT_CONTEXT_GAP_MAX
+ * contexts before 'sequence', the sequence number of the context just
+ * saved, before they get in the way of saving more sessions.
+ */
+static void
+resource_manager_drain_session_pool (ResourceManager *resmgr,
+                                     UINT64           sequence)
+{
+    GSList *handles, *link;
+    guint32 gap_max;
+    TSS2_RC rc;
+
+    if (resmgr->session_pool == NULL) {
+        return;
+    }
+    access_broker_lock (resmgr->access_broker);
+    rc = access_broker_get_fixed_property (resmgr->access_broker,
+                                           TPM2_PT_CONTEXT_GAP_MAX,
+                                           &gap_max);
+    access_broker_unlock (resmgr->access_broker);
+    if (rc != TSS2_RC_SUCCESS || gap_max == 0) {
+        gap_max = SESSION_POOL_CONTEXT_GAP_DEFAULT;
+    }
+    handles = session_pool_take_stale (resmgr->session_pool,
+                                       sequence,
+                                       gap_max / 2);
+    for (link = handles; link != NULL; link = link->next) {
+        access_broker_context_flush (resmgr->access_broker,
+                                     GPOINTER_TO_UINT (link->data));
+    }
+    g_slist_free (handles);
+}
 /*
  * Remove the context associated with the provided SessionEntry from the
  * TPM. Only session objects should be saved by this function.
@@ -358,6 +536,8 @@ resource_manager_save_session_context (gpointer data_entry,
     ResourceManager *resmgr = RESOURCE_MANAGER (data_resmgr);
     SessionEntry    *entry  = SESSION_ENTRY (data_entry);
     TSS2_RC          rc = TSS2_RC_SUCCESS;
+    UINT64           sequence = 0;
+    size_t           offset = TPM_HEADER_SIZE;
 
     g_debug ("resource_manager_save_session_context");
     if (resmgr == NULL || entry == NULL) {
@@ -379,6 +559,13 @@ resource_manager_save_session_context (gpointer data_entry,
                                &tpm2_response_get_buffer (resp)[TPM_HEADER_SIZE],
                                tpm2_response_get_size (resp) - TPM_HEADER_SIZE);
     session_entry_set_state (entry, SESSION_ENTRY_SAVED_RM);
+    if (Tss2_MU_UINT64_Unmarshal (tpm2_response_get_buffer (resp),
+                                  tpm2_response_get_size (resp),
+                                  &offset,
+                                  &sequence) == TSS2_RC_SUCCESS)
+    {
+        resource_manager_drain_session_pool (resmgr, sequence);
+    }
     goto out;
 err_out:
     access_broker_context_flush (resmgr->access_broker,
@@ -443,6 +630,17 @@ resource_manager_save_context_session (ResourceManager *resmgr,
         g_warning ("%s: session belongs to a different connection", __func__);
         goto out;
     }
+    /*
+     * The session may have been kept loaded for this command. The context
+     * we hold is from before it was last used, save it again first.
+     */
+    if (session_entry_get_state (entry) == SESSION_ENTRY_LOADED) {
+        resource_manager_save_session_context (entry, resmgr);
+        if (session_entry_get_state (entry) != SESSION_ENTRY_SAVED_RM) {
+            g_warning ("%s: failed to save loaded session", __func__);
+            goto out;
+        }
+    }
     session_entry_set_state (entry, SESSION_ENTRY_SAVED_CLIENT);
     response = tpm2_response_new_context_save (conn_cmd, entry);
     g_debug ("%s: Tpm2Response 0x%" PRIxPTR " in reponse to TPM2_ContextSave",
@@ -462,14 +660,11 @@ out:
  * depends on the parameters / handle type as well as how much work we
  * actually *want* to do.
  *
- * Transient objects that are tracked by the RM require no special handling.
- * It's possible that the whole of this command could be virtualized: When a
- * command is received all transient objects have been saved and flushed. The
- * saved context held by the RM could very well be returned to the caller
- * with no interaction with the TPM. This would however require that the RM
- * marshal the context object into the response buffer. This is less easy
- * than it should be and so we suffer the inefficiency to keep the RM code
- * more simple. Simple in this case means no special handling.
+ * Transient objects that are tracked by the RM are virtualized: When a
+ * command is received all transient objects, except sequence objects, have
+ * been saved and flushed. The saved context held by the RM is returned to
+ * the caller with no interaction with the TPM. Objects that are still
+ * loaded go to the TPM since the context we hold may be stale.
  *
  * Session objects are handled much in the same way with a specific caveat:
  * A session can be either loaded or saved. Unlike a transient object saving
@@ -480,6 +675,36 @@ out:
  * destroy the mapping maintained by the RM. Since this function is called
  * after the session contexts are loaded we just need to drop the mapping.
  */
+static Tpm2Response*
+resource_manager_save_context_transient (ResourceManager *resmgr,
+                                         Tpm2Command     *command)
+{
+    Connection     *connection;
+    HandleMap      *map;
+    HandleMapEntry *entry;
+    Tpm2Response   *response = NULL;
+    TPM2_HANDLE     handle = tpm2_command_get_handle (command, 0);
+
+    connection = tpm2_command_get_connection (command);
+    map = connection_get_trans_map (connection);
+    entry = handle_map_vlookup (map, handle);
+    if (entry == NULL) {
+        g_debug ("%s: no HandleMapEntry for vhandle 0x%08" PRIx32,
+                 __func__, handle);
+        goto out;
+    }
+    if (g_queue_find (resmgr->resident, entry) != NULL) {
+        g_debug ("%s: vhandle 0x%08" PRIx32 " is loaded, not virtualizing",
+                 __func__, handle);
+        goto out;
+    }
+    response = tpm2_response_new_context_save_transient (connection, entry);
+out:
+    g_clear_object (&entry);
+    g_object_unref (map);
+    g_object_unref (connection);
+    return response;
+}
 Tpm2Response*
 resource_manager_save_context (ResourceManager *resmgr,
                                Tpm2Command     *command)
@@ -492,6 +717,8 @@ resource_manager_save_context (ResourceManager *resmgr,
     case TPM2_HT_HMAC_SESSION:
     case TPM2_HT_POLICY_SESSION:
         return resource_manager_save_context_session (resmgr, command);
+    case TPM2_HT_TRANSIENT:
+        return resource_manager_save_context_transient (resmgr, command);
     default:
         g_debug ("save_context: not virtualizing TPM2_CC_ContextSave for "
                  "handles: 0x%08" PRIx32, handle);
@@ -603,9 +830,11 @@ resource_manager_load_context (ResourceManager *resmgr,
  *
  * Transient objects that are tracked by the RM (stored in the transient
  * HandleMap in the Connection object) then we can simply delete the mapping
- * since transient objects are always saved / flushed after each command is
- * processed. So for this handle type we just delete the mapping, create a
- * Tpm2Response object and return it to the caller.
+ * since transient objects are saved / flushed after each command is
+ * processed. Sequence objects are the exception: they may still be loaded
+ * in which case we flush them from the TPM. So for this handle type we
+ * delete the mapping, create a Tpm2Response object and return it to the
+ * caller.
  *
  * Session objects are not so simple. Sessions cannot be flushed after each
  * use. The TPM will only allow us to save the context as it must maintain
@@ -647,6 +876,11 @@ resource_manager_flush_context (ResourceManager *resmgr,
         map = connection_get_trans_map (connection);
         entry = handle_map_vlookup (map, handle);
         if (entry != NULL) {
+            if (g_queue_find (resmgr->resident, entry) != NULL) {
+                access_broker_context_flush (resmgr->access_broker,
+                                             handle_map_entry_get_phandle (entry));
+                resource_manager_resident_remove (resmgr, entry);
+            }
             handle_map_remove (map, handle);
             g_object_unref (entry);
             rc = TSS2_RC_SUCCESS;
@@ -752,22 +986,17 @@ remove_entry_from_handle_map (gpointer data_entry,
 /*
  * This function handles the required post-processing on the HandleMapEntry
  * objects in the GSList that represent objects loaded into the TPM as part of
- * executing a command.
+ * executing a command. All resident objects are then saved & flushed except
+ * those in the 'keep' list.
  */
 void
 post_process_loaded_transients (ResourceManager  *resmgr,
                                 GSList          **transient_slist,
                                 Connection       *connection,
-                                TPMA_CC           command_attrs)
+                                TPMA_CC           command_attrs,
+                                GSList           *keep)
 {
-    /* if flushed bit is clear we need to flush & save contexts */
-    if (!(command_attrs & TPMA_CC_FLUSHED)) {
-        g_debug ("flushsave_context for %" PRIu32 " entries",
-                 g_slist_length (*transient_slist));
-        g_slist_foreach (*transient_slist,
-                        resource_manager_flushsave_context,
-                        resmgr);
-    } else {
+    if (command_attrs & TPMA_CC_FLUSHED) {
         /*
          * if flushed bit is set the transient object entry has been flushed
          * and so we just remove it
@@ -776,7 +1005,15 @@ post_process_loaded_transients (ResourceManager  *resmgr,
         g_slist_foreach (*transient_slist,
                          remove_entry_from_handle_map,
                          connection);
+        g_slist_foreach (*transient_slist,
+                         (GFunc)resource_manager_resident_remove,
+                         resmgr);
     }
+    /* everything else loaded needs to be flushed & saved */
+    g_debug ("flushsave_context for %" PRIu32 " resident entries, keeping %"
+             PRIu32, g_queue_get_length (resmgr->resident),
+             g_slist_length (keep));
+    resource_manager_flushsave_resident (resmgr, keep);
     g_slist_free_full (*transient_slist, g_object_unref);
 }
 /*
@@ -978,6 +1215,252 @@ get_cap_handles_response (Tpm2Command *command,
 
     return response;
 }
+/*
+ * GetCapability queries for fixed TPM properties, algorithms and commands
+ * are answered from the data cached by the AccessBroker. The TPM isn't
+ * involved. If the query can't be answered from the cache we return NULL.
+ */
+static Tpm2Response*
+get_cap_cached_response (ResourceManager *resmgr,
+                         Tpm2Command     *command,
+                         Connection      *connection)
+{
+    TPMS_CAPABILITY_DATA cap_data;
+    TPMI_YES_NO more_data;
+    size_t size = TPM_HEADER_SIZE + sizeof (TPMI_YES_NO) + sizeof (cap_data);
+    size_t offset = TPM_HEADER_SIZE;
+    uint8_t *buf;
+    TSS2_RC rc;
+
+    if (tpm2_command_has_auths (command) ||
+        !access_broker_get_capability_cached (resmgr->access_broker,
+                                              tpm2_command_get_cap (command),
+                                              tpm2_command_get_prop (command),
+                                              tpm2_command_get_prop_count (command),
+                                              &more_data,
+                                              &cap_data))
+    {
+        return NULL;
+    }
+    buf = g_malloc0 (size);
+    rc = Tss2_MU_TPMI_YES_NO_Marshal (more_data, buf, size, &offset);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPMS_CAPABILITY_DATA_Marshal (&cap_data, buf, size, &offset);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = tpm2_header_init (buf, size, TPM2_ST_NO_SESSIONS, offset,
+                               TSS2_RC_SUCCESS);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to build GetCapability response: 0x%" PRIx32,
+                   __func__, rc);
+        g_free (buf);
+        return NULL;
+    }
+    g_debug ("%s: answered GetCapability 0x%" PRIx32 " from cache",
+             __func__, cap_data.capability);
+    return tpm2_response_new (connection,
+                              buf,
+                              offset,
+                              tpm2_command_get_attributes (command));
+}
+/*
+ * Unauthenticated GetRandom commands are answered from the pool of TPM
+ * randomness kept by the AccessBroker. If the pool is disabled or doesn't
+ * hold enough bytes we return NULL and the command goes to the TPM.
+ */
+static Tpm2Response*
+get_random_pool_response (ResourceManager *resmgr,
+                          Tpm2Command     *command,
+                          Connection      *connection)
+{
+    TPM2B_DIGEST random = { .size = 0, };
+    UINT16 bytes_requested = 0;
+    size_t size = TPM_HEADER_SIZE + sizeof (random);
+    size_t offset = TPM_HEADER_SIZE;
+    uint8_t *buf;
+    TSS2_RC rc;
+
+    if (tpm2_command_has_auths (command)) {
+        return NULL;
+    }
+    rc = Tss2_MU_UINT16_Unmarshal (tpm2_command_get_buffer (command),
+                                   tpm2_command_get_size (command),
+                                   &offset,
+                                   &bytes_requested);
+    if (rc != TSS2_RC_SUCCESS ||
+        bytes_requested > sizeof (random.buffer) ||
+        !access_broker_random_pool_get (resmgr->access_broker,
+                                        random.buffer,
+                                        bytes_requested))
+    {
+        return NULL;
+    }
+    random.size = bytes_requested;
+    buf = g_malloc0 (size);
+    offset = TPM_HEADER_SIZE;
+    rc = Tss2_MU_TPM2B_DIGEST_Marshal (&random, buf, size, &offset);
+    secure_zero (&random, sizeof (random));
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = tpm2_header_init (buf, size, TPM2_ST_NO_SESSIONS, offset,
+                               TSS2_RC_SUCCESS);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to build GetRandom response: 0x%" PRIx32,
+                   __func__, rc);
+        secure_zero (buf, size);
+        g_free (buf);
+        return NULL;
+    }
+    g_debug ("%s: answered GetRandom for %" PRIu16 " bytes from pool",
+             __func__, bytes_requested);
+    return tpm2_response_new (connection,
+                              buf,
+                              offset,
+                              tpm2_command_get_attributes (command));
+}
+/*
+ * Answer a TPM2_CreatePrimary or TPM2_Load from the ObjectCache. The
+ * connection gets a new virtual handle backed by the shared context of the
+ * cached object. Like any other saved object it's loaded when a command
+ * uses it. The rest of the response is what the TPM returned when the
+ * object was first created or loaded. Returns NULL if the command isn't
+ * cached.
+ */
+static Tpm2Response*
+resource_manager_object_cached (ResourceManager *resmgr,
+                                Tpm2Command     *command)
+{
+    Connection *connection;
+    HandleMap *map;
+    HandleMapEntry *entry;
+    Tpm2Response *response;
+    GBytes *context = NULL;
+    TPM2_HANDLE vhandle;
+
+    response = object_cache_lookup (resmgr->object_cache, command, &context);
+    if (response == NULL) {
+        return NULL;
+    }
+    connection = tpm2_command_get_connection (command);
+    map = connection_get_trans_map (connection);
+    vhandle = handle_map_next_vhandle (map);
+    if (vhandle == 0) {
+        g_error ("vhandle rolled over!");
+    }
+    entry = handle_map_entry_new (0, vhandle);
+    handle_map_entry_set_context_shared (entry, context);
+    handle_map_insert (map, vhandle, entry);
+    tpm2_response_set_handle (response, vhandle);
+    g_debug ("%s: mapped cached object to vhandle 0x%08" PRIx32,
+             __func__, vhandle);
+    g_bytes_unref (context);
+    g_object_unref (entry);
+    g_object_unref (map);
+    g_object_unref (connection);
+    return response;
+}
+/*
+ * Save a context for the object created or loaded by a cacheable command
+ * and add it to the ObjectCache with the response. The context becomes
+ * shared by the HandleMapEntry of this connection and those of the
+ * connections answered from the cache. This must be called after the
+ * object handle in the response is virtualized.
+ */
+static void
+resource_manager_object_cache_insert (ResourceManager *resmgr,
+                                      Tpm2Command     *command,
+                                      Tpm2Response    *response)
+{
+    Connection *connection;
+    HandleMap *map;
+    HandleMapEntry *entry;
+    TPMS_CONTEXT context;
+    GBytes *shared;
+    TPM2_HANDLE vhandle;
+    TSS2_RC rc;
+
+    if (tpm2_response_get_code (response) != TSS2_RC_SUCCESS ||
+        !object_cache_cacheable (resmgr->object_cache, command))
+    {
+        return;
+    }
+    vhandle = tpm2_response_get_handle (response);
+    connection = tpm2_response_get_connection (response);
+    map = connection_get_trans_map (connection);
+    entry = handle_map_vlookup (map, vhandle);
+    if (entry == NULL) {
+        g_warning ("%s: no HandleMapEntry for vhandle 0x%08" PRIx32,
+                   __func__, vhandle);
+        goto out;
+    }
+    rc = access_broker_context_save (resmgr->access_broker,
+                                     handle_map_entry_get_phandle (entry),
+                                     &context);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = handle_map_entry_set_context (entry, &context);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to save context of object: 0x%" PRIx32,
+                   __func__, rc);
+        goto out;
+    }
+    shared = handle_map_entry_share_context (entry);
+    object_cache_insert (resmgr->object_cache, command, response, shared);
+    g_bytes_unref (shared);
+out:
+    g_clear_object (&entry);
+    g_object_unref (map);
+    g_object_unref (connection);
+}
+/*
+ * Answer a TPM2_StartAuthSession with a session from the SessionPool. The
+ * session is saved: it gets a SessionEntry owned by the connection in the
+ * SAVED_RM state and is loaded when a command uses it, like any session
+ * the RM saved. Returns NULL if no pooled session matches the command.
+ */
+static Tpm2Response*
+resource_manager_start_auth_session_pooled (ResourceManager *resmgr,
+                                            Tpm2Command     *command)
+{
+    Connection *connection;
+    SessionEntry *entry;
+    Tpm2Response *response;
+    GBytes *context = NULL;
+    gsize size;
+
+    response = session_pool_take (resmgr->session_pool, command, &context);
+    if (response == NULL) {
+        return NULL;
+    }
+    connection = tpm2_command_get_connection (command);
+    entry = session_entry_new (connection,
+                               tpm2_response_get_handle (response));
+    session_entry_set_context (entry,
+                               (uint8_t*)g_bytes_get_data (context, &size),
+                               size);
+    session_entry_set_state (entry, SESSION_ENTRY_SAVED_RM);
+    session_list_insert (resmgr->session_list, entry);
+    g_bytes_unref (context);
+    g_object_unref (entry);
+    g_object_unref (connection);
+    return response;
+}
+/*
+ * Empty the SessionPool and flush the pooled sessions from the TPM.
+ */
+static void
+resource_manager_flush_session_pool (ResourceManager *resmgr)
+{
+    GSList *handles, *link;
+
+    handles = session_pool_take_all (resmgr->session_pool);
+    for (link = handles; link != NULL; link = link->next) {
+        access_broker_context_flush (resmgr->access_broker,
+                                     GPOINTER_TO_UINT (link->data));
+    }
+    g_slist_free (handles);
+}
 /*
  * If the provided command is something that the ResourceManager "virtualizes"
  * then this function will do so and return a Tpm2Response object that will be
@@ -1004,12 +1487,39 @@ command_special_processing (ResourceManager *resmgr,
         g_debug ("%s: processing TPM2_CC_ContextLoad", __func__);
         response = resource_manager_load_context (resmgr, command);
         break;
+    case TPM2_CC_ReadPublic:
+    case TPM2_CC_NV_ReadPublic:
+    case TPM2_CC_PCR_Read:
+        if (resmgr->read_cache != NULL) {
+            response = read_cache_lookup (resmgr->read_cache, command);
+        }
+        break;
     case TPM2_CC_GetCapability:
         g_debug ("processing TPM2_CC_GetCapability");
         connection = tpm2_command_get_connection (command);
         response = get_cap_handles_response (command, connection);
+        if (response == NULL) {
+            response = get_cap_cached_response (resmgr, command, connection);
+        }
         g_object_unref (connection);
         break;
+    case TPM2_CC_CreatePrimary:
+    case TPM2_CC_Load:
+        if (resmgr->object_cache != NULL) {
+            response = resource_manager_object_cached (resmgr, command);
+        }
+        break;
+    case TPM2_CC_GetRandom:
+        connection = tpm2_command_get_connection (command);
+        response = get_random_pool_response (resmgr, command, connection);
+        g_object_unref (connection);
+        break;
+    case TPM2_CC_StartAuthSession:
+        if (resmgr->session_pool != NULL) {
+            response = resource_manager_start_auth_session_pooled (resmgr,
+                                                                   command);
+        }
+        break;
     default:
         break;
     }
@@ -1020,7 +1530,9 @@ command_special_processing (ResourceManager *resmgr,
  * This function creates a mapping from the transient physical to a virtual
  * handle in the provided response object. This mapping is then added to
  * the transient HandleMap for the associated connection, as well as the
- * list of currently loaded transient objects.
+ * list of currently loaded transient objects. Sequence objects are marked
+ * as such so that they're kept loaded for the following
+ * TPM2_SequenceUpdate commands.
  */
 void
 create_context_mapping_transient (ResourceManager  *resmgr,
@@ -1031,7 +1543,6 @@ create_context_mapping_transient (ResourceManager  *resmgr,
     HandleMapEntry *handle_entry;
     TPM2_HANDLE      phandle, vhandle;
     Connection     *connection;
-    UNUSED_PARAM(resmgr);
 
     g_debug ("create_context_mapping_transient");
     phandle = tpm2_response_get_handle (response);
@@ -1050,11 +1561,21 @@ create_context_mapping_transient (ResourceManager  *resmgr,
                    PRIx32, phandle);
     }
     g_debug ("handle map entry: 0x%" PRIxPTR, (uintptr_t)handle_entry);
+    switch (tpm2_response_get_attributes (response) & TPMA_CC_COMMANDINDEX_MASK) {
+    case TPM2_CC_HashSequenceStart:
+    case TPM2_CC_HMAC_Start:
+        g_debug ("  handle is a sequence object");
+        handle_map_entry_set_sequence (handle_entry, TRUE);
+        break;
+    default:
+        break;
+    }
     *loaded_transient_slist = g_slist_prepend (*loaded_transient_slist,
                                                handle_entry);
     handle_map_insert (handle_map, vhandle, handle_entry);
     g_object_unref (handle_map);
     tpm2_response_set_handle (response, vhandle);
+    resource_manager_resident_touch (resmgr, handle_entry);
     g_object_ref (handle_entry);
     *loaded_transient_slist = g_slist_prepend (*loaded_transient_slist,
                                                    handle_entry);
@@ -1162,6 +1683,395 @@ resource_manager_create_context_mapping (ResourceManager  *resmgr,
         break;
     }
 }
+/*
+ * Data passed to the callbacks used to find whether a command references a
+ * given handle in its authorization area.
+ */
+typedef struct {
+    Tpm2Command *command;
+    TPM2_HANDLE  handle;
+    gboolean     found;
+} auth_handle_search_t;
+static void
+auth_handle_search_callback (gpointer auth_offset_ptr,
+                             gpointer user_data)
+{
+    auth_handle_search_t *data = (auth_handle_search_t*)user_data;
+    size_t auth_offset = *(size_t*)auth_offset_ptr;
+
+    if (tpm2_command_get_auth_handle (data->command, auth_offset) ==
+        data->handle)
+    {
+        data->found = TRUE;
+    }
+}
+/*
+ * Returns TRUE if 'handle' is in either the handle area or the
+ * authorization area of the command.
+ */
+static gboolean
+command_uses_handle (Tpm2Command *command,
+                     TPM2_HANDLE  handle)
+{
+    TPM2_HANDLE handles [TPM2_COMMAND_MAX_HANDLES] = { 0, };
+    size_t i, handle_count = TPM2_COMMAND_MAX_HANDLES;
+    auth_handle_search_t data = {
+        .command = command,
+        .handle = handle,
+        .found = FALSE,
+    };
+
+    if (tpm2_command_get_handles (command, handles, &handle_count)) {
+        for (i = 0; i < handle_count; ++i) {
+            if (handles [i] == handle)
+                return TRUE;
+        }
+    }
+    if (tpm2_command_has_auths (command)) {
+        tpm2_command_foreach_auth (command, auth_handle_search_callback, &data);
+    }
+    return data.found;
+}
+/*
+ * State for evict_session_callback: 'count' is the number of sessions that
+ * may still be evicted and 'evicted' the number that were.
+ */
+typedef struct {
+    ResourceManager *resmgr;
+    Tpm2Command     *command;
+    guint            count;
+    guint            evicted;
+} evict_session_data_t;
+static void
+evict_session_callback (gpointer data_entry,
+                        gpointer user_data)
+{
+    SessionEntry *entry = SESSION_ENTRY (data_entry);
+    evict_session_data_t *data = (evict_session_data_t*)user_data;
+
+    if (data->evicted >= data->count ||
+        session_entry_get_state (entry) != SESSION_ENTRY_LOADED ||
+        command_uses_handle (data->command, session_entry_get_handle (entry)))
+    {
+        return;
+    }
+    g_debug ("%s: evicting session with handle 0x%08" PRIx32, __func__,
+             session_entry_get_handle (entry));
+    resource_manager_save_session_context (entry, data->resmgr);
+    ++data->evicted;
+}
+/*
+ * When the TPM fails a command with TPM2_RC_OBJECT_MEMORY or
+ * TPM2_RC_SESSION_MEMORY we make room by saving and flushing contexts that
+ * we manage but that the command doesn't use. Transient objects are taken
+ * from the head of the 'resident' queue (least recently used first), the
+ * entries in 'transient_slist' were loaded for this command and are skipped.
+ * We evict at most as many objects as the command can occupy: one per
+ * handle plus one for an object it creates. For sessions the limit is the
+ * number of sessions a command can carry. Returns the number of contexts
+ * evicted, 0 if the RC isn't one of the above or there was nothing to
+ * evict.
+ */
+guint
+resource_manager_evict (ResourceManager *resmgr,
+                        Tpm2Command     *command,
+                        GSList          *transient_slist,
+                        TSS2_RC          rc)
+{
+    evict_session_data_t session_data = {
+        .resmgr = resmgr,
+        .command = command,
+        .count = SESSIONS_PER_COMMAND_MAX,
+        .evicted = 0,
+    };
+    guint evicted = 0;
+
+    switch (rc) {
+    case TPM2_RC_OBJECT_MEMORY:
+        evicted = resource_manager_evict_transients (
+                      resmgr,
+                      transient_slist,
+                      tpm2_command_get_handle_count (command) + 1);
+        break;
+    case TPM2_RC_SESSION_MEMORY:
+        session_list_foreach (resmgr->session_list,
+                              evict_session_callback,
+                              &session_data);
+        evicted = session_data.evicted;
+        break;
+    default:
+        return 0;
+    }
+    g_info ("%s: TPM returned 0x%" PRIx32 ", evicted %u contexts",
+            __func__, rc, evicted);
+    return evicted;
+}
+/*
+ * The contexts used by the next command in the queue. 'transients' holds
+ * a reference to each resident HandleMapEntry from the command handle area.
+ * 'sessions' holds the session handles from the handle and auth areas.
+ * 'next' is the next command in the same batch. When it's NULL we look
+ * at the queue.
+ */
+typedef struct {
+    ResourceManager *resmgr;
+    Tpm2Command *next;
+    Tpm2Command *command;
+    GSList      *transients;
+    TPM2_HANDLE  sessions [TPM2_COMMAND_MAX_HANDLES + SESSIONS_PER_COMMAND_MAX];
+    size_t       session_count;
+} lookahead_t;
+static void
+lookahead_add_session (lookahead_t *lookahead,
+                       TPM2_HANDLE  handle)
+{
+    switch (handle >> TPM2_HR_SHIFT) {
+    case TPM2_HT_HMAC_SESSION:
+    case TPM2_HT_POLICY_SESSION:
+        if (lookahead->session_count < G_N_ELEMENTS (lookahead->sessions)) {
+            lookahead->sessions [lookahead->session_count++] = handle;
+        }
+        break;
+    default:
+        break;
+    }
+}
+static void
+lookahead_auth_callback (gpointer auth_offset_ptr,
+                         gpointer user_data)
+{
+    lookahead_t *lookahead = (lookahead_t*)user_data;
+    size_t auth_offset = *(size_t*)auth_offset_ptr;
+
+    lookahead_add_session (lookahead,
+                           tpm2_command_get_auth_handle (lookahead->command,
+                                                         auth_offset));
+}
+/*
+ * Look at the next command in the batch or the next message in the queue.
+ * If it's a Tpm2Command from the same connection, collect the contexts it uses that are still loaded so
+ * that we don't save & flush them only to load them again right away.
+ * Commands that manage contexts themselves are excluded since their
+ * special processing expects the RM to hold current saved contexts.
+ */
+static void
+resource_manager_lookahead (Connection  *connection,
+                            lookahead_t *lookahead)
+{
+    ResourceManager *resmgr = lookahead->resmgr;
+    GObject *obj;
+    Connection *next_connection = NULL;
+    HandleMap *map = NULL;
+    HandleMapEntry *entry;
+    TPM2_HANDLE handles [TPM2_COMMAND_MAX_HANDLES] = { 0, };
+    size_t i, handle_count = TPM2_COMMAND_MAX_HANDLES;
+
+    if (lookahead->next != NULL) {
+        obj = G_OBJECT (g_object_ref (lookahead->next));
+    } else {
+        obj = message_queue_peek (resmgr->in_queue);
+    }
+    if (obj == NULL || !IS_TPM2_COMMAND (obj)) {
+        goto out;
+    }
+    lookahead->command = TPM2_COMMAND (obj);
+    switch (tpm2_command_get_code (lookahead->command)) {
+    case TPM2_CC_ContextLoad:
+    case TPM2_CC_ContextSave:
+    case TPM2_CC_FlushContext:
+        goto out;
+    default:
+        break;
+    }
+    next_connection = tpm2_command_get_connection (lookahead->command);
+    if (next_connection != connection) {
+        goto out;
+    }
+    map = connection_get_trans_map (connection);
+    if (tpm2_command_get_handles (lookahead->command, handles, &handle_count)) {
+        for (i = 0; i < handle_count; ++i) {
+            if (handles [i] >> TPM2_HR_SHIFT != TPM2_HT_TRANSIENT) {
+                lookahead_add_session (lookahead, handles [i]);
+                continue;
+            }
+            entry = handle_map_vlookup (map, handles [i]);
+            if (entry == NULL) {
+                continue;
+            }
+            if (g_queue_find (resmgr->resident, entry) != NULL) {
+                lookahead->transients =
+                    g_slist_prepend (lookahead->transients, entry);
+            } else {
+                g_object_unref (entry);
+            }
+        }
+    }
+    if (tpm2_command_has_auths (lookahead->command)) {
+        tpm2_command_foreach_auth (lookahead->command,
+                                   lookahead_auth_callback,
+                                   lookahead);
+    }
+    g_debug ("%s: next command uses %u resident objects and %zu sessions",
+             __func__, g_slist_length (lookahead->transients),
+             lookahead->session_count);
+out:
+    lookahead->command = NULL;
+    g_clear_object (&map);
+    g_clear_object (&next_connection);
+    g_clear_object (&obj);
+}
+/*
+ * Save the context of a loaded session unless the next command uses it.
+ */
+static void
+lookahead_save_session_callback (gpointer data_entry,
+                                 gpointer user_data)
+{
+    lookahead_t *lookahead = (lookahead_t*)user_data;
+    TPM2_HANDLE handle = session_entry_get_handle (SESSION_ENTRY (data_entry));
+    size_t i;
+
+    for (i = 0; i < lookahead->session_count; ++i) {
+        if (lookahead->sessions [i] == handle) {
+            g_debug ("%s: keeping session 0x%08" PRIx32 " loaded",
+                     __func__, handle);
+            return;
+        }
+    }
+    resource_manager_save_session_context (data_entry, lookahead->resmgr);
+}
+/*
+ * Returns TRUE if the response to the provided command may be handed to
+ * any connection that sent a byte-identical command. These commands don't
+ * change TPM state, carry no sessions and don't reference virtualized
+ * handles: ReadPublic / NV_ReadPublic are limited to persistent objects &
+ * NV indices and GetCapability for handles is answered per connection.
+ */
+static gboolean
+resource_manager_command_shareable (Tpm2Command *command)
+{
+    TPM2_HANDLE handles [TPM2_COMMAND_MAX_HANDLES] = { 0, };
+    size_t handle_count = TPM2_COMMAND_MAX_HANDLES;
+
+    if (tpm2_command_has_auths (command)) {
+        return FALSE;
+    }
+    switch (tpm2_command_get_code (command)) {
+    case TPM2_CC_PCR_Read:
+    case TPM2_CC_ReadClock:
+    case TPM2_CC_GetTestResult:
+        return TRUE;
+    case TPM2_CC_GetCapability:
+        return tpm2_command_get_cap (command) != TPM2_CAP_HANDLES;
+    case TPM2_CC_ReadPublic:
+    case TPM2_CC_NV_ReadPublic:
+        if (!tpm2_command_get_handles (command, handles, &handle_count) ||
+            handle_count != 1)
+        {
+            return FALSE;
+        }
+        switch (handles [0] >> TPM2_HR_SHIFT) {
+        case TPM2_HT_PERSISTENT:
+        case TPM2_HT_NV_INDEX:
+            return TRUE;
+        default:
+            return FALSE;
+        }
+    default:
+        return FALSE;
+    }
+}
+/*
+ * Data passed to resource_manager_shared_match. 'blocked' holds the
+ * connections with a command queued ahead of the match candidates.
+ */
+typedef struct {
+    Tpm2Command *command;
+    GHashTable  *blocked;
+} shared_match_t;
+/*
+ * MessageQueueMatchFunc selecting the queued commands that are identical
+ * to the one in flight. A command from a connection that has a different
+ * command or a batch queued ahead of it isn't taken: its response would
+ * overtake the response to the earlier command.
+ */
+static gboolean
+resource_manager_shared_match (GObject  *obj,
+                               gpointer  user_data)
+{
+    shared_match_t *match = (shared_match_t*)user_data;
+    Tpm2Command *command;
+    Connection *connection;
+    gboolean ret = FALSE;
+
+    if (IS_TPM2_BATCH (obj)) {
+        connection = tpm2_batch_get_connection (TPM2_BATCH (obj));
+        g_hash_table_add (match->blocked, connection);
+        g_object_unref (connection);
+        return FALSE;
+    }
+    if (!IS_TPM2_COMMAND (obj)) {
+        return FALSE;
+    }
+    command = TPM2_COMMAND (obj);
+    connection = tpm2_command_get_connection (command);
+    if (!g_hash_table_contains (match->blocked, connection) &&
+        tpm2_command_get_size (command) ==
+            tpm2_command_get_size (match->command) &&
+        memcmp (tpm2_command_get_buffer (command),
+                tpm2_command_get_buffer (match->command),
+                tpm2_command_get_size (command)) == 0)
+    {
+        ret = TRUE;
+    } else {
+        g_hash_table_add (match->blocked, connection);
+    }
+    g_object_unref (connection);
+    return ret;
+}
+/*
+ * Hand a copy of the response to a shareable command to each connection
+ * that queued an identical command while it was waiting or in flight.
+ * Those commands are removed from the queue so they're never sent to the
+ * TPM.
+ */
+static void
+resource_manager_send_shared (ResourceManager *resmgr,
+                              Tpm2Command     *command,
+                              Tpm2Response    *response)
+{
+    shared_match_t match = { .command = command, };
+    Tpm2Response *dup_response;
+    Tpm2Command *dup;
+    Connection *connection;
+    GSList *taken, *entry;
+
+    if (!resource_manager_command_shareable (command)) {
+        return;
+    }
+    match.blocked = g_hash_table_new (g_direct_hash, g_direct_equal);
+    taken = message_queue_take_matching (resmgr->in_queue,
+                                         resource_manager_shared_match,
+                                         &match);
+    g_hash_table_unref (match.blocked);
+    for (entry = taken; entry != NULL; entry = entry->next) {
+        dup = TPM2_COMMAND (entry->data);
+        connection = tpm2_command_get_connection (dup);
+        g_debug ("%s: sharing response to command 0x%" PRIx32 " with "
+                 "connection 0x%" PRIxPTR, __func__,
+                 tpm2_command_get_code (dup), (uintptr_t)connection);
+        dup_response =
+            tpm2_response_new (connection,
+                               g_memdup (tpm2_response_get_buffer (response),
+                                         tpm2_response_get_size (response)),
+                               tpm2_response_get_size (response),
+                               tpm2_command_get_attributes (dup));
+        sink_enqueue (resmgr->sink, G_OBJECT (dup_response));
+        g_object_unref (dup_response);
+        g_object_unref (connection);
+    }
+    g_slist_free_full (taken, g_object_unref);
+}
 /**
  * This function is invoked in response to the receipt of a Tpm2Command.
  * This is the place where we send the command buffer out to the TPM
@@ -1170,24 +2080,35 @@ resource_manager_create_context_mapping (ResourceManager  *resmgr,
  * the client by way of our Sink object. The flow is roughly:
  * - Receive the Tpm2Command as a parameter
  * - Load all virtualized objects required by the command.
+ * - Drop cached responses the command may change.
  * - Send the Tpm2Command out through the AccessBroker.
- * - Receive the response from the AccessBroker.
+ * - Receive the response from the AccessBroker. If the TPM ran out of
+ *   object or session memory, evict contexts not used by the command and
+ *   send it once more.
  * - Virtualize the new objects created by the command & referenced in the
  *   response.
  * - Enqueue the response back out to the processing pipeline through the
- *   Sink object.
+ *   Sink object. Commands without side effects that are queued by other
+ *   connections with identical bytes get a copy of the response.
  * - Flush all objects loaded for the command or as part of executing the
- *   command..
+ *   command, except those the next command in the queue from the same
+ *   connection uses.
+ * When the command is part of a batch the response is added to the batch
+ * instead and 'next' is the command that follows it in the batch.
+ * Returns the response code.
  */
-void
-resource_manager_process_tpm2_command (ResourceManager   *resmgr,
-                                       Tpm2Command       *command)
+static TSS2_RC
+resource_manager_process_command (ResourceManager *resmgr,
+                                  Tpm2Command     *command,
+                                  Tpm2Batch       *batch,
+                                  Tpm2Command     *next)
 {
     Connection    *connection;
     Tpm2Response   *response;
     TSS2_RC         rc = TSS2_RC_SUCCESS;
     GSList         *transient_slist = NULL;
     TPMA_CC         command_attrs;
+    lookahead_t     lookahead = { .resmgr = resmgr, .next = next, };
 
     command_attrs = tpm2_command_get_attributes (command);
     g_debug ("resource_manager_process_tpm2_command: resmgr: 0x%" PRIxPTR
@@ -1223,6 +2144,19 @@ resource_manager_process_tpm2_command (ResourceManager   *resmgr,
                                    resource_manager_load_auth_callback,
                                    &auth_callback_data);
     }
+    /* Drop cached responses this command may change. */
+    if (resmgr->read_cache != NULL) {
+        read_cache_invalidate (resmgr->read_cache, command);
+    }
+    if (resmgr->object_cache != NULL) {
+        object_cache_invalidate (resmgr->object_cache, command);
+    }
+    /* Sessions don't survive TPM Reset / Restart. */
+    if (resmgr->session_pool != NULL &&
+        tpm2_command_get_code (command) == TPM2_CC_Startup)
+    {
+        resource_manager_flush_session_pool (resmgr);
+    }
     /* Send command and create response object. */
     response = access_broker_send_command (resmgr->access_broker,
                                            command,
@@ -1231,21 +2165,97 @@ resource_manager_process_tpm2_command (ResourceManager   *resmgr,
         g_warning ("access_broker_send_command returned error: 0x%x", rc);
         response = tpm2_response_new_rc (connection, rc);
     }
+    /* If the TPM is out of memory make room and try once more. */
+    if (resource_manager_evict (resmgr,
+                                command,
+                                transient_slist,
+                                tpm2_response_get_code (response)) > 0)
+    {
+        g_object_unref (response);
+        response = access_broker_send_command (resmgr->access_broker,
+                                               command,
+                                               &rc);
+        if (response == NULL) {
+            g_warning ("access_broker_send_command returned error: 0x%x", rc);
+            response = tpm2_response_new_rc (connection, rc);
+        }
+    }
     dump_response (response);
+    if (resmgr->read_cache != NULL) {
+        read_cache_insert (resmgr->read_cache, command, response);
+    }
     /* transform virtualized handles in Tpm2Response if necessary */
     resource_manager_create_context_mapping (resmgr,
                                              response,
                                              &transient_slist);
+    if (resmgr->object_cache != NULL) {
+        resource_manager_object_cache_insert (resmgr, command, response);
+    }
 send_response:
-    sink_enqueue (resmgr->sink, G_OBJECT (response));
+    if (batch != NULL) {
+        tpm2_batch_add_response (batch, response);
+    } else {
+        sink_enqueue (resmgr->sink, G_OBJECT (response));
+    }
+    resource_manager_send_shared (resmgr, command, response);
+    rc = tpm2_response_get_code (response);
     g_object_unref (response);
+    /* keep contexts loaded if the next command uses them */
+    resource_manager_lookahead (connection, &lookahead);
     /* save contexts that were previously loaded */
     session_list_foreach (resmgr->session_list,
-                          resource_manager_save_session_context,
-                          resmgr);
-    post_process_loaded_transients (resmgr, &transient_slist, connection, command_attrs);
+                          lookahead_save_session_callback,
+                          &lookahead);
+    post_process_loaded_transients (resmgr,
+                                    &transient_slist,
+                                    connection,
+                                    command_attrs,
+                                    lookahead.transients);
+    g_slist_free_full (lookahead.transients, g_object_unref);
     g_object_unref (connection);
-    return;
+    return rc;
+}
+void
+resource_manager_process_tpm2_command (ResourceManager   *resmgr,
+                                       Tpm2Command       *command)
+{
+    resource_manager_process_command (resmgr, command, NULL, NULL);
+}
+/*
+ * Execute the commands in a batch back to back. Nothing else is taken
+ * from the queue until the batch is done so commands from other
+ * connections can't get in between. If the client asked us to stop on
+ * error we skip the commands after the first one that fails. The contexts
+ * kept loaded for the next command in the batch are then saved since that
+ * command never runs. The responses go back to the client together.
+ */
+void
+resource_manager_process_tpm2_batch (ResourceManager *resmgr,
+                                     Tpm2Batch       *batch)
+{
+    guint i, count = tpm2_batch_get_command_count (batch);
+    TSS2_RC rc;
+
+    g_debug ("%s: batch 0x%" PRIxPTR " with %u commands",
+             __func__, (uintptr_t)batch, count);
+    for (i = 0; i < count; ++i) {
+        rc = resource_manager_process_command (resmgr,
+                                               tpm2_batch_get_command (batch, i),
+                                               batch,
+                                               tpm2_batch_get_command (batch, i + 1));
+        if (rc != TSS2_RC_SUCCESS &&
+            tpm2_batch_get_flags (batch) & TSS2_TCTI_TABRMD_BATCH_STOP_ON_ERROR)
+        {
+            g_debug ("%s: command %u failed with 0x%" PRIx32 ", skipping "
+                     "the remaining %u", __func__, i, rc, count - i - 1);
+            session_list_foreach (resmgr->session_list,
+                                  resource_manager_save_session_context,
+                                  resmgr);
+            resource_manager_flushsave_resident (resmgr, NULL);
+            break;
+        }
+    }
+    sink_enqueue (resmgr->sink, G_OBJECT (batch));
 }
 /*
  * Return FALSE to terminate main thread.
@@ -1275,8 +2285,99 @@ resource_manager_process_control (ResourceManager *resmgr,
         return TRUE;
     }
 }
+/*
+ * Top up the AccessBroker's pool of TPM randomness while no message is
+ * waiting. We check the queue before each GetRandom so a client command
+ * waits for at most one of them.
+ */
+static void
+resource_manager_fill_random_pool (ResourceManager *resmgr)
+{
+    GObject *obj;
+    size_t added;
+
+    while (access_broker_random_pool_needs_fill (resmgr->access_broker)) {
+        obj = message_queue_peek (resmgr->in_queue);
+        if (obj != NULL) {
+            g_object_unref (obj);
+            return;
+        }
+        if (access_broker_random_pool_fill (resmgr->access_broker, &added) !=
+            TSS2_RC_SUCCESS || added == 0)
+        {
+            return;
+        }
+    }
+}
+/*
+ * Start sessions for the SessionPool while no command is waiting. Each
+ * session is saved right away so it doesn't hold a TPM session slot. If
+ * the TPM refuses to start or save a session we stop filling the pool
+ * until a pooled session is handed out.
+ */
+static void
+resource_manager_fill_session_pool (ResourceManager *resmgr)
+{
+    session_pool_params_t const *params;
+    TPMS_CONTEXT context;
+    TPM2B_NONCE nonce_tpm = { .size = 0, };
+    TPM2_HANDLE handle;
+    GObject *obj;
+    guint8 buf [sizeof (TPMS_CONTEXT)];
+    size_t offset;
+    guint set;
+    TSS2_RC rc;
+
+    if (resmgr->session_pool == NULL) {
+        return;
+    }
+    while (session_pool_needs_fill (resmgr->session_pool, &set)) {
+        obj = message_queue_peek (resmgr->in_queue);
+        if (obj != NULL) {
+            g_object_unref (obj);
+            return;
+        }
+        params = session_pool_get_params (set);
+        rc = access_broker_start_auth_session (resmgr->access_broker,
+                                               params->session_type,
+                                               &params->symmetric,
+                                               params->auth_hash,
+                                               &handle,
+                                               &nonce_tpm);
+        if (rc != TSS2_RC_SUCCESS) {
+            session_pool_fill_failed (resmgr->session_pool);
+            return;
+        }
+        offset = 0;
+        rc = access_broker_context_save (resmgr->access_broker,
+                                         handle,
+                                         &context);
+        if (rc == TSS2_RC_SUCCESS) {
+            rc = Tss2_MU_TPMS_CONTEXT_Marshal (&context,
+                                               buf,
+                                               sizeof (buf),
+                                               &offset);
+        }
+        if (rc != TSS2_RC_SUCCESS) {
+            g_warning ("%s: failed to save pooled session 0x%08" PRIx32
+                       ": 0x%" PRIx32, __func__, handle, rc);
+            access_broker_context_flush (resmgr->access_broker, handle);
+            session_pool_fill_failed (resmgr->session_pool);
+            return;
+        }
+        session_pool_add (resmgr->session_pool,
+                          set,
+                          handle,
+                          &nonce_tpm,
+                          buf,
+                          offset);
+        resource_manager_drain_session_pool (resmgr, context.sequence);
+    }
+}
 /**
  * This function acts as a thread. It simply:
+ * - Fills the pools of TPM randomness and sessions if there's nothing
+ *   to do.
  * - Blocks on the in_queue. Then wakes up and
  * - Dequeues a message from the in_queue.
  * - Processes the message (depending on TYPE)
@@ -1291,6 +2392,8 @@ resource_manager_thread (gpointer data)
 
     g_debug ("resource_manager_thread start");
     while (!done) {
+        resource_manager_fill_random_pool (resmgr);
+        resource_manager_fill_session_pool (resmgr);
         obj = message_queue_dequeue (resmgr->in_queue);
         g_debug ("resource_manager_thread: message_queue_dequeue got obj: "
                  "0x%" PRIxPTR, (uintptr_t)obj);
@@ -1300,6 +2403,8 @@ resource_manager_thread (gpointer data)
         }
         if (IS_TPM2_COMMAND (obj)) {
             resource_manager_process_tpm2_command (resmgr, TPM2_COMMAND (obj));
+        } else if (IS_TPM2_BATCH (obj)) {
+            resource_manager_process_tpm2_batch (resmgr, TPM2_BATCH (obj));
         } else if (IS_CONTROL_MESSAGE (obj)) {
             gboolean ret =
                 resource_manager_process_control (resmgr, CONTROL_MESSAGE (obj));
@@ -1398,6 +2503,23 @@ resource_manager_set_property (GObject        *object,
     case PROP_SESSION_LIST:
         resmgr->session_list = SESSION_LIST (g_value_dup_object (value));
         break;
+    case PROP_READ_CACHE:
+        g_clear_object (&resmgr->read_cache);
+        resmgr->read_cache = g_value_dup_object (value);
+        g_debug ("  read_cache: 0x%" PRIxPTR, (uintptr_t)resmgr->read_cache);
+        break;
+    case PROP_OBJECT_CACHE:
+        g_clear_object (&resmgr->object_cache);
+        resmgr->object_cache = g_value_dup_object (value);
+        g_debug ("  object_cache: 0x%" PRIxPTR,
+                 (uintptr_t)resmgr->object_cache);
+        break;
+    case PROP_SESSION_POOL:
+        g_clear_object (&resmgr->session_pool);
+        resmgr->session_pool = g_value_dup_object (value);
+        g_debug ("  session_pool: 0x%" PRIxPTR,
+                 (uintptr_t)resmgr->session_pool);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -1428,6 +2550,15 @@ resource_manager_get_property (GObject     *object,
     case PROP_SESSION_LIST:
         g_value_set_object (value, resmgr->session_list);
         break;
+    case PROP_READ_CACHE:
+        g_value_set_object (value, resmgr->read_cache);
+        break;
+    case PROP_OBJECT_CACHE:
+        g_value_set_object (value, resmgr->object_cache);
+        break;
+    case PROP_SESSION_POOL:
+        g_value_set_object (value, resmgr->session_pool);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -1447,16 +2578,26 @@ resource_manager_dispose (GObject *obj)
         g_error ("%s: passed NULL parameter", __func__);
     if (thread->thread_id != 0)
         g_error ("%s: thread running, cancel thread first", __func__);
+    if (resmgr->session_pool != NULL && resmgr->access_broker != NULL) {
+        resource_manager_flush_session_pool (resmgr);
+    }
+    g_clear_object (&resmgr->session_pool);
     g_clear_object (&resmgr->in_queue);
     g_clear_object (&resmgr->sink);
     g_clear_object (&resmgr->access_broker);
     g_clear_object (&resmgr->session_list);
+    g_clear_object (&resmgr->read_cache);
+    g_clear_object (&resmgr->object_cache);
+    if (resmgr->resident != NULL) {
+        g_queue_free_full (resmgr->resident, g_object_unref);
+        resmgr->resident = NULL;
+    }
     G_OBJECT_CLASS (resource_manager_parent_class)->dispose (obj);
 }
 static void
 resource_manager_init (ResourceManager *manager)
 {
-    UNUSED_PARAM (manager);
+    manager->resident = g_queue_new ();
 }
 /**
  * GObject class initialization function. This function boils down to:
@@ -1502,6 +2643,24 @@ resource_manager_class_init (ResourceManagerClass *klass)
                              "Data structure to hold session tracking data",
                              TYPE_SESSION_LIST,
                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_READ_CACHE] =
+        g_param_spec_object ("read-cache",
+                             "ReadCache object",
+                             "Cache for responses to ReadPublic / NV_ReadPublic / PCR_Read",
+                             TYPE_READ_CACHE,
+                             G_PARAM_READWRITE);
+    obj_properties [PROP_OBJECT_CACHE] =
+        g_param_spec_object ("object-cache",
+                             "ObjectCache object",
+                             "Cache for the results of CreatePrimary and Load",
+                             TYPE_OBJECT_CACHE,
+                             G_PARAM_READWRITE);
+    obj_properties [PROP_SESSION_POOL] =
+        g_param_spec_object ("session-pool",
+                             "SessionPool object",
+                             "Pool of sessions started in advance",
+                             TYPE_SESSION_POOL,
+                             G_PARAM_READWRITE);
     g_object_class_install_properties (object_class,
                                        N_PROPERTIES,
                                        obj_properties);
@@ -1570,9 +2729,11 @@ typedef struct {
  * - change state to SESSION_ENTRY_SAVED_CLIENT_CLOSED
  * - "prune" other abandoned sessions
  * - add SessionEntry to queue of abandoned sessions
- * If session is in state SESSION_ENTRY_SAVED_RM:
+ * If session is in state SESSION_ENTRY_SAVED_RM or SESSION_ENTRY_LOADED:
  * - flush session from TPM
  * - remove SessionEntry from session list
+ * A session is left LOADED when the next queued command from the same
+ * connection was going to use it, that command won't run now.
  * If session is in any other state
  * - panic
  */
@@ -1609,6 +2770,7 @@ connection_close_session_callback (gpointer data,
                                       resource_manager);
         break;
     case SESSION_ENTRY_SAVED_RM:
+    case SESSION_ENTRY_LOADED:
         g_debug ("%s: SessionEntry 0x%" PRIxPTR " is in state "
                  "%s: flushing.", __func__, (uintptr_t)session_entry,
                  session_entry_state_to_str (session_state));
@@ -1628,11 +2790,50 @@ connection_close_session_callback (gpointer data,
         break;
     }
 }
+/*
+ * Flush the transient objects still loaded for the provided connection
+ * from the TPM. Only sequence objects are left loaded between commands
+ * so this is how they're cleaned up when the client goes away.
+ */
+static void
+resource_manager_flush_resident (ResourceManager *resmgr,
+                                 Connection      *connection)
+{
+    HandleMap *map = connection_get_trans_map (connection);
+    HandleMapEntry *entry, *map_entry;
+    GList *link, *next;
+    TPM2_HANDLE phandle;
+    TSS2_RC rc;
+
+    for (link = resmgr->resident->head; link != NULL; link = next) {
+        next = link->next;
+        entry = HANDLE_MAP_ENTRY (link->data);
+        map_entry = handle_map_vlookup (map,
+                                        handle_map_entry_get_vhandle (entry));
+        if (map_entry == NULL) {
+            continue;
+        }
+        g_object_unref (map_entry);
+        if (map_entry != entry) {
+            continue;
+        }
+        phandle = handle_map_entry_get_phandle (entry);
+        g_debug ("%s: flushing resident transient with phandle 0x%08"
+                 PRIx32, __func__, phandle);
+        rc = access_broker_context_flush (resmgr->access_broker, phandle);
+        if (rc != TSS2_RC_SUCCESS) {
+            g_warning ("%s: failed to flush transient with handle 0x%08"
+                       PRIx32 ": 0x%" PRIx32, __func__, phandle, rc);
+        }
+        resource_manager_resident_remove (resmgr, entry);
+    }
+    g_object_unref (map);
+}
 /*
  * This function is invoked when a connection is removed from the
  * ConnectionManager. This is if how we know a connection has been closed.
  * When a connection is removed, we need to remove all associated sessions
- * from the TPM.
+ * and any transient objects that are still loaded from the TPM.
  */
 void
 resource_manager_remove_connection (ResourceManager *resource_manager,
@@ -1648,6 +2849,7 @@ resource_manager_remove_connection (ResourceManager *resource_manager,
     session_list_foreach (resource_manager->session_list,
                           connection_close_session_callback,
                           &connection_close_data);
+    resource_manager_flush_resident (resource_manager, connection);
     g_debug ("%s: done", __func__);
 }
 /**
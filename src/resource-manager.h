@@ -35,9 +35,13 @@
 #include "access-broker.h"
 #include "connection-manager.h"
 #include "message-queue.h"
+#include "object-cache.h"
+#include "read-cache.h"
 #include "session-list.h"
+#include "session-pool.h"
 #include "sink-interface.h"
 #include "thread.h"
+#include "tpm2-batch.h"
 
 G_BEGIN_DECLS
 
@@ -51,6 +55,10 @@ typedef struct _ResourceManager {
     MessageQueue     *in_queue;
     Sink             *sink;
     SessionList      *session_list;
+    GQueue           *resident;
+    ReadCache        *read_cache;
+    ObjectCache      *object_cache;
+    SessionPool      *session_pool;
 } ResourceManager;
 
 #define TYPE_RESOURCE_MANAGER              (resource_manager_get_type ())
@@ -65,8 +73,12 @@ ResourceManager*      resource_manager_new            (AccessBroker *broker,
                                                        SessionList  *session_list);
 void                  resource_manager_process_tpm2_command (ResourceManager   *resmgr,
                                                              Tpm2Command       *command);
+void                  resource_manager_process_tpm2_batch (ResourceManager *resmgr,
+                                                           Tpm2Batch       *batch);
 void                  resource_manager_flushsave_context (gpointer              entry,
                                                           gpointer              resmgr);
+Tpm2Response*         resource_manager_save_context      (ResourceManager *resmgr,
+                                                          Tpm2Command     *command);
 TSS2_RC               resource_manager_load_handles    (ResourceManager *resmgr,
                                                         Tpm2Command     *command,
                                                         GSList         **slist);
@@ -74,6 +86,14 @@ TSS2_RC               resource_manager_virt_to_phys      (ResourceManager *resmg
                                                           Tpm2Command     *command,
                                                           HandleMapEntry  *entry,
                                                           guint8           handle_number);
+void                  resource_manager_resident_touch    (ResourceManager *resmgr,
+                                                          HandleMapEntry  *entry);
+void                  resource_manager_resident_remove   (ResourceManager *resmgr,
+                                                          HandleMapEntry  *entry);
+guint                 resource_manager_evict             (ResourceManager *resmgr,
+                                                          Tpm2Command     *command,
+                                                          GSList          *transient_slist,
+                                                          TSS2_RC          rc);
 void                  resource_manager_enqueue           (Sink            *sink,
                                                           GObject         *obj);
 void                  resource_manager_remove_connection (ResourceManager *resource_manager,
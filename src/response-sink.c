@@ -33,7 +33,9 @@
 #include "sink-interface.h"
 #include "response-sink.h"
 #include "control-message.h"
+#include "tpm2-batch.h"
 #include "tpm2-response.h"
+#include "trace.h"
 #include "util.h"
 
 #define RESPONSE_SINK_TIMEOUT 1e6
@@ -51,6 +53,7 @@ G_DEFINE_TYPE_WITH_CODE (
 enum {
     PROP_0,
     PROP_IN_QUEUE,
+    PROP_TRACE,
     N_PROPERTIES
 };
 static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
@@ -87,6 +90,11 @@ response_sink_set_property (GObject        *object,
         g_debug ("  setting PROP_IN_QUEUE");
         self->in_queue = g_value_get_object (value);
         break;
+    case PROP_TRACE:
+        g_clear_object (&self->trace);
+        self->trace = g_value_dup_object (value);
+        g_debug ("  trace: 0x%" PRIxPTR, (uintptr_t)self->trace);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -108,6 +116,9 @@ response_sink_get_property (GObject     *object,
     case PROP_IN_QUEUE:
         g_value_set_object (value, self->in_queue);
         break;
+    case PROP_TRACE:
+        g_value_set_object (value, self->trace);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -128,6 +139,7 @@ response_sink_dispose (GObject *obj)
     if (thread->thread_id != 0)
         g_error ("%s: thread running, cancel first", __func__);
     g_clear_object (&sink->in_queue);
+    g_clear_object (&sink->trace);
     G_OBJECT_CLASS (response_sink_parent_class)->dispose (obj);
 }
 void* response_sink_thread (void *data);
@@ -177,6 +189,12 @@ response_sink_class_init (ResponseSinkClass *klass)
                              "Input MessageQueue.",
                              G_TYPE_OBJECT,
                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_TRACE] =
+        g_param_spec_object ("trace",
+                             "Trace",
+                             "Trace recording responses sent to clients.",
+                             TYPE_TRACE,
+                             G_PARAM_READWRITE);
     g_object_class_install_properties (object_class,
                                        N_PROPERTIES,
                                        obj_properties);
@@ -202,7 +220,8 @@ response_sink_new ()
 }
 
 ssize_t
-response_sink_process_response (Tpm2Response *response)
+response_sink_process_response (ResponseSink *sink,
+                                Tpm2Response *response)
 {
     ssize_t      written = 0;
     guint32      size    = tpm2_response_get_size (response);
@@ -215,7 +234,50 @@ response_sink_process_response (Tpm2Response *response)
              (uintptr_t)response, size);
     g_debug ("  writing 0x%x bytes", size);
     g_debug_bytes (buffer, size, 16, 4);
+    if (sink->trace != NULL) {
+        trace_record_response (sink->trace, response);
+    }
+    written = write_all (ostream, buffer, size);
+    /*
+     * Responses leave this thread in the order the commands were queued so
+     * a client pipelining commands reads them back in the order it sent
+     * them. Only the count of unanswered commands needs updating here.
+     */
+    connection_response_sent (connection);
+    g_object_unref (connection);
+
+    return written;
+}
+
+/*
+ * Write the responses to a batch of commands back to the client in a
+ * single frame.
+ */
+ssize_t
+response_sink_process_batch (ResponseSink *sink,
+                             Tpm2Batch    *batch)
+{
+    ssize_t      written = 0;
+    size_t       size;
+    guint8      *buffer;
+    guint        i;
+    Connection  *connection = tpm2_batch_get_connection (batch);
+    GIOStream   *iostream = connection_get_iostream (connection);
+    GOutputStream *ostream = g_io_stream_get_output_stream (iostream);
+
+    buffer = tpm2_batch_get_response_buffer (batch, &size);
+    g_debug ("%s: batch: 0x%" PRIxPTR " with %u responses, writing 0x%zx "
+             "bytes", __func__, (uintptr_t)batch,
+             tpm2_batch_get_response_count (batch), size);
+    if (sink->trace != NULL) {
+        for (i = 0; i < tpm2_batch_get_response_count (batch); ++i) {
+            trace_record_response (sink->trace,
+                                   tpm2_batch_get_response (batch, i));
+        }
+    }
     written = write_all (ostream, buffer, size);
+    g_free (buffer);
+    connection_response_sent (connection);
     g_object_unref (connection);
 
     return written;
@@ -258,7 +320,9 @@ response_sink_thread (void *data)
         obj = message_queue_dequeue (sink->in_queue);
         g_debug ("response_sink_thread got obj: 0x%" PRIxPTR, (uintptr_t)obj);
         if (IS_TPM2_RESPONSE (obj)) {
-            response_sink_process_response (TPM2_RESPONSE (obj));
+            response_sink_process_response (sink, TPM2_RESPONSE (obj));
+        } else if (IS_TPM2_BATCH (obj)) {
+            response_sink_process_batch (sink, TPM2_BATCH (obj));
         } else if (IS_CONTROL_MESSAGE (obj)) {
             gboolean ret =
                 response_sink_process_control (sink, CONTROL_MESSAGE (obj));
@@ -33,6 +33,7 @@
 
 #include "message-queue.h"
 #include "thread.h"
+#include "trace.h"
 
 G_BEGIN_DECLS
 
@@ -48,6 +49,7 @@ typedef struct _ResponseSinkClass {
 typedef struct _ResponseSink {
     Thread             parent_instance;
     MessageQueue      *in_queue;
+    Trace             *trace;
 } ResponseSink;
 
 #define TYPE_RESPONSE_SINK              (response_sink_get_type ())
@@ -112,8 +112,8 @@ session_entry_init (SessionEntry *entry)
     /* noop */
 }
 /*
- * Deallocate all associated resources. All are static so we just chain
- * up to the parent like a good GObject.
+ * Drop the reference to the associated Connection and chain up to the
+ * parent.
  */
 static void
 session_entry_dispose (GObject *object)
@@ -124,6 +124,25 @@ session_entry_dispose (GObject *object)
     g_clear_object (&entry->connection);
     G_OBJECT_CLASS (session_entry_parent_class)->dispose (object);
 }
+/*
+ * Free the context blobs. The 'context' and 'context_client' blobs share
+ * the same allocation until the first time the context is saved by the RM
+ * so we must be careful not to free it twice.
+ */
+static void
+session_entry_finalize (GObject *object)
+{
+    SessionEntry *entry = SESSION_ENTRY (object);
+
+    g_debug ("%s: 0x%" PRIxPTR, __func__, (uintptr_t)entry);
+    if (entry->context.buf == entry->context_client.buf) {
+        entry->context.buf = NULL;
+        entry->context.size = 0;
+    }
+    size_buf_clear (&entry->context);
+    size_buf_clear (&entry->context_client);
+    G_OBJECT_CLASS (session_entry_parent_class)->finalize (object);
+}
 /*
  * Class initialization function. Register function pointers and properties.
  */
@@ -135,6 +154,7 @@ session_entry_class_init (SessionEntryClass *klass)
     if (session_entry_parent_class == NULL)
         session_entry_parent_class = g_type_class_peek_parent (klass);
     object_class->dispose = session_entry_dispose;
+    object_class->finalize = session_entry_finalize;
     object_class->get_property = session_entry_get_property;
     object_class->set_property = session_entry_set_property;
 
@@ -275,9 +295,11 @@ session_entry_set_state (SessionEntry *entry,
 /*
  * Set the contents of the 'context' blob. This blob holds the TPMS_CONTEXT
  * in its marshalled form (ready to be sent to the TPM in the body of a
- * ContextLoad command). We also copy this same blob to the 'context_client'
- * blob (the TPMS_CONTEXT that we expose to clients) if it has not yet been
- * initialized.
+ * ContextLoad command). Both blobs are allocated to the exact size of the
+ * marshalled context. The 'context_client' blob (the TPMS_CONTEXT that we
+ * expose to clients) is set to the same blob if it has not yet been
+ * initialized. The two share a single allocation until the 'context' blob
+ * is replaced by a later save.
  */
 void
 session_entry_set_context (SessionEntry *entry,
@@ -286,11 +308,17 @@ session_entry_set_context (SessionEntry *entry,
 {
     assert (entry != NULL && buf != NULL && size <= SIZE_BUF_MAX);
 
-    memcpy (entry->context.buf, buf, size);
-    entry->context.size = size;
+    if (entry->context.buf != NULL &&
+        entry->context.buf == entry->context_client.buf)
+    {
+        /* don't free the blob still referenced by context_client */
+        entry->context.buf = NULL;
+        entry->context.size = 0;
+    }
+    size_buf_set (&entry->context, buf, size);
     if (entry->context_client.size == 0) {
-        memcpy (entry->context_client.buf, buf, size);
-        entry->context_client.size = size;
+        entry->context_client.buf = entry->context.buf;
+        entry->context_client.size = entry->context.size;
     }
 }
 /*
@@ -422,5 +450,11 @@ session_entry_compare_on_context_client (SessionEntry *entry,
              "0x%zx", __func__, (uintptr_t)entry, (uintptr_t)buf, size);
     g_assert (size <= SIZE_BUF_MAX);
     size_buf = session_entry_get_context_client (entry);
+    if (size_buf->size != size) {
+        return size_buf->size < size ? -1 : 1;
+    }
+    if (size == 0) {
+        return 0;
+    }
     return memcmp (size_buf->buf, buf, size);
 }
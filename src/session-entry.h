@@ -33,16 +33,10 @@
 
 #include "connection.h"
 #include "session-entry-state-enum.h"
+#include "util.h"
 
 G_BEGIN_DECLS
 
-#define SIZE_BUF_MAX sizeof (TPMS_CONTEXT)
-
-typedef struct size_buf {
-    size_t size;
-    uint8_t buf [SIZE_BUF_MAX];
-} size_buf_t;
-
 typedef struct _SessionEntryClass {
     GObjectClass      parent;
 } SessionEntryClass;
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <inttypes.h>
+#include <string.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "session-pool.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+G_DEFINE_TYPE (SessionPool, session_pool, G_TYPE_OBJECT);
+
+enum {
+    PROP_0,
+    PROP_SIZE,
+    N_PROPERTIES
+};
+static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+
+/*
+ * The StartAuthSession parameter sets we pool: unbound, unsalted HMAC
+ * sessions using SHA256, with and without AES-128-CFB parameter
+ * encryption. For these the session key is empty so the nonceCaller sent
+ * to StartAuthSession doesn't affect the session key. The TPM does size
+ * the nonces of the session after nonceCaller though, and pooled sessions
+ * are started with a SHA256 sized one, so only a client nonceCaller of
+ * that size can be honored. Bound or salted sessions derive the session
+ * key from nonceCaller and can't be pooled. Policy sessions aren't pooled
+ * either: the expiration in PolicySigned / PolicySecret is counted from
+ * the time the session was started, so a session started in advance would
+ * expire early.
+ */
+static session_pool_params_t const session_pool_params [SESSION_POOL_SET_COUNT] = {
+    {
+        .session_type = TPM2_SE_HMAC,
+        .symmetric = { .algorithm = TPM2_ALG_NULL, },
+        .auth_hash = TPM2_ALG_SHA256,
+    },
+    {
+        .session_type = TPM2_SE_HMAC,
+        .symmetric = {
+            .algorithm = TPM2_ALG_AES,
+            .keyBits = { .aes = 128, },
+            .mode = { .aes = TPM2_ALG_CFB, },
+        },
+        .auth_hash = TPM2_ALG_SHA256,
+    },
+};
+/*
+ * A pooled session: the handle and nonceTPM returned by StartAuthSession,
+ * the saved context and the context sequence number from it.
+ */
+typedef struct {
+    TPM2_HANDLE  handle;
+    TPM2B_NONCE  nonce_tpm;
+    UINT64       sequence;
+    GBytes      *context;
+} session_pool_entry_t;
+
+static void
+session_pool_entry_free (gpointer data)
+{
+    session_pool_entry_t *entry = (session_pool_entry_t*)data;
+
+    g_bytes_unref (entry->context);
+    g_free (entry);
+}
+static void
+session_pool_set_property (GObject      *object,
+                           guint         property_id,
+                           GValue const *value,
+                           GParamSpec   *pspec)
+{
+    SessionPool *self = SESSION_POOL (object);
+
+    switch (property_id) {
+    case PROP_SIZE:
+        self->size = g_value_get_uint (value);
+        g_debug ("%s: SessionPool 0x%" PRIxPTR " size: %u", __func__,
+                 (uintptr_t)self, self->size);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+session_pool_get_property (GObject    *object,
+                           guint       property_id,
+                           GValue     *value,
+                           GParamSpec *pspec)
+{
+    SessionPool *self = SESSION_POOL (object);
+
+    switch (property_id) {
+    case PROP_SIZE:
+        g_value_set_uint (value, self->size);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+session_pool_init (SessionPool *pool)
+{
+    guint i;
+
+    for (i = 0; i < SESSION_POOL_SET_COUNT; ++i) {
+        pool->queues [i] = g_queue_new ();
+    }
+}
+/*
+ * The sessions still in the pool are only forgotten here. The owner must
+ * take them with session_pool_take_all and flush them from the TPM first.
+ */
+static void
+session_pool_finalize (GObject *object)
+{
+    SessionPool *self = SESSION_POOL (object);
+    guint i;
+
+    g_info ("SessionPool 0x%" PRIxPTR ": %" PRIu64 " hits, %" PRIu64
+            " misses", (uintptr_t)self, self->hits, self->misses);
+    for (i = 0; i < SESSION_POOL_SET_COUNT; ++i) {
+        g_queue_free_full (self->queues [i], session_pool_entry_free);
+        self->queues [i] = NULL;
+    }
+    G_OBJECT_CLASS (session_pool_parent_class)->finalize (object);
+}
+static void
+session_pool_class_init (SessionPoolClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    if (session_pool_parent_class == NULL)
+        session_pool_parent_class = g_type_class_peek_parent (klass);
+    object_class->finalize     = session_pool_finalize;
+    object_class->get_property = session_pool_get_property;
+    object_class->set_property = session_pool_set_property;
+
+    obj_properties [PROP_SIZE] =
+        g_param_spec_uint ("size",
+                           "size",
+                           "Number of sessions kept for each parameter set",
+                           0,
+                           SESSION_POOL_SIZE_MAX,
+                           0,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_properties (object_class,
+                                       N_PROPERTIES,
+                                       obj_properties);
+}
+SessionPool*
+session_pool_new (guint size)
+{
+    return SESSION_POOL (g_object_new (TYPE_SESSION_POOL,
+                                       "size", size,
+                                       NULL));
+}
+/*
+ * Get the StartAuthSession parameters for the pooled parameter set 'set'.
+ */
+session_pool_params_t const*
+session_pool_get_params (guint set)
+{
+    g_assert (set < SESSION_POOL_SET_COUNT);
+    return &session_pool_params [set];
+}
+static gboolean
+session_pool_symmetric_equal (TPMT_SYM_DEF const *a,
+                              TPMT_SYM_DEF const *b)
+{
+    if (a->algorithm != b->algorithm) {
+        return FALSE;
+    }
+    switch (a->algorithm) {
+    case TPM2_ALG_NULL:
+        return TRUE;
+    case TPM2_ALG_XOR:
+        return a->keyBits.exclusiveOr == b->keyBits.exclusiveOr;
+    default:
+        return a->keyBits.sym == b->keyBits.sym && a->mode.sym == b->mode.sym;
+    }
+}
+/*
+ * Find the pooled parameter set matching the provided command. This is a
+ * TPM2_StartAuthSession without authorizations, with tpmKey and bind set
+ * to TPM2_RH_NULL, no encryptedSalt, the session type, symmetric algorithm
+ * and authHash of a pooled set, and a nonceCaller of the same size as the
+ * one the pooled sessions were started with. Returns the index of the set
+ * or -1.
+ */
+gint
+session_pool_match (Tpm2Command *command)
+{
+    guint8 const *buf = tpm2_command_get_buffer (command);
+    size_t size = tpm2_command_get_size (command);
+    size_t offset = TPM_HEADER_SIZE + 2 * sizeof (TPM2_HANDLE);
+    TPM2B_NONCE nonce_caller = { .size = 0, };
+    TPM2B_ENCRYPTED_SECRET salt = { .size = 0, };
+    TPMT_SYM_DEF symmetric = { .algorithm = TPM2_ALG_NULL, };
+    session_pool_params_t const *params;
+    TPM2_SE session_type = 0;
+    UINT16 auth_hash = 0;
+    TSS2_RC rc;
+    guint i;
+
+    if (tpm2_command_get_code (command) != TPM2_CC_StartAuthSession ||
+        tpm2_command_has_auths (command) ||
+        tpm2_command_get_handle_count (command) != 2 ||
+        tpm2_command_get_handle (command, 0) != TPM2_RH_NULL ||
+        tpm2_command_get_handle (command, 1) != TPM2_RH_NULL)
+    {
+        return -1;
+    }
+    rc = Tss2_MU_TPM2B_NONCE_Unmarshal (buf, size, &offset, &nonce_caller);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPM2B_ENCRYPTED_SECRET_Unmarshal (buf, size, &offset,
+                                                       &salt);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPM2_SE_Unmarshal (buf, size, &offset, &session_type);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPMT_SYM_DEF_Unmarshal (buf, size, &offset, &symmetric);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT16_Unmarshal (buf, size, &offset, &auth_hash);
+    }
+    if (rc != TSS2_RC_SUCCESS || offset != size || salt.size != 0) {
+        return -1;
+    }
+    for (i = 0; i < SESSION_POOL_SET_COUNT; ++i) {
+        params = &session_pool_params [i];
+        if (session_type == params->session_type &&
+            auth_hash == params->auth_hash &&
+            session_pool_symmetric_equal (&symmetric, &params->symmetric))
+        {
+            /* all pooled sets are started with a SHA256 sized nonce */
+            if (nonce_caller.size != TPM2_SHA256_DIGEST_SIZE) {
+                return -1;
+            }
+            return (gint)i;
+        }
+    }
+    return -1;
+}
+/*
+ * Returns TRUE and the parameter set in 'set' if the pool is short of
+ * sessions for any set. Returns FALSE after the TPM refused to start a
+ * session until a pooled session is handed out.
+ */
+gboolean
+session_pool_needs_fill (SessionPool *pool,
+                         guint       *set)
+{
+    guint i;
+
+    g_assert_nonnull (pool);
+    g_assert_nonnull (set);
+    if (pool->fill_failed) {
+        return FALSE;
+    }
+    for (i = 0; i < SESSION_POOL_SET_COUNT; ++i) {
+        if (g_queue_get_length (pool->queues [i]) < pool->size) {
+            *set = i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+/*
+ * Called when the TPM refused to start or save a session for the pool.
+ * session_pool_needs_fill returns FALSE until a pooled session is handed
+ * out by session_pool_take.
+ */
+void
+session_pool_fill_failed (SessionPool *pool)
+{
+    g_assert_nonnull (pool);
+    pool->fill_failed = TRUE;
+}
+/*
+ * Add a session started with the parameters from set 'set' and saved by
+ * the caller. 'context' is the marshalled TPMS_CONTEXT and is copied. The
+ * sequence number at its start is kept for session_pool_take_stale.
+ */
+void
+session_pool_add (SessionPool       *pool,
+                  guint              set,
+                  TPM2_HANDLE        handle,
+                  TPM2B_NONCE const *nonce_tpm,
+                  guint8 const      *context,
+                  size_t             context_size)
+{
+    session_pool_entry_t *entry;
+    size_t offset = 0;
+    TSS2_RC rc;
+
+    g_assert_nonnull (pool);
+    g_assert (set < SESSION_POOL_SET_COUNT);
+    entry = g_new0 (session_pool_entry_t, 1);
+    entry->handle = handle;
+    entry->nonce_tpm = *nonce_tpm;
+    rc = Tss2_MU_UINT64_Unmarshal (context, context_size, &offset,
+                                   &entry->sequence);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to get sequence from context of session 0x%08"
+                   PRIx32 ": 0x%" PRIx32, __func__, handle, rc);
+    }
+    entry->context = g_bytes_new (context, context_size);
+    g_queue_push_tail (pool->queues [set], entry);
+    g_debug ("%s: pooled session 0x%08" PRIx32 " for set %u, %u pooled",
+             __func__, handle, set, g_queue_get_length (pool->queues [set]));
+}
+/*
+ * Answer a TPM2_StartAuthSession from the pool. If the command matches a
+ * pooled parameter set and a session is available it's removed from the
+ * pool and a response carrying its handle and nonceTPM is returned for
+ * the connection associated with the command. 'context' is set to the
+ * saved context of the session. Otherwise NULL. The oldest session is
+ * handed out first to keep the saved contexts close to the TPM context
+ * counter.
+ */
+Tpm2Response*
+session_pool_take (SessionPool  *pool,
+                   Tpm2Command  *command,
+                   GBytes      **context)
+{
+    session_pool_entry_t *entry;
+    Connection *connection;
+    Tpm2Response *response;
+    size_t size, offset = TPM_HEADER_SIZE;
+    guint8 *buf;
+    gint set;
+    TSS2_RC rc;
+
+    set = session_pool_match (command);
+    if (set < 0) {
+        return NULL;
+    }
+    entry = g_queue_pop_head (pool->queues [set]);
+    if (entry == NULL) {
+        ++pool->misses;
+        return NULL;
+    }
+    ++pool->hits;
+    pool->fill_failed = FALSE;
+    size = TPM_HEADER_SIZE + sizeof (TPM2_HANDLE) + sizeof (UINT16) +
+           entry->nonce_tpm.size;
+    buf = g_malloc0 (size);
+    rc = Tss2_MU_TPM2_HANDLE_Marshal (entry->handle, buf, size, &offset);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPM2B_NONCE_Marshal (&entry->nonce_tpm, buf, size,
+                                          &offset);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = tpm2_header_init (buf, size, TPM2_ST_NO_SESSIONS, offset,
+                               TSS2_RC_SUCCESS);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to build StartAuthSession response: 0x%"
+                   PRIx32, __func__, rc);
+        g_free (buf);
+        g_queue_push_head (pool->queues [set], entry);
+        return NULL;
+    }
+    g_debug ("%s: handing out pooled session 0x%08" PRIx32, __func__,
+             entry->handle);
+    connection = tpm2_command_get_connection (command);
+    response = tpm2_response_new (connection,
+                                  buf,
+                                  offset,
+                                  tpm2_command_get_attributes (command));
+    g_object_unref (connection);
+    *context = g_bytes_ref (entry->context);
+    session_pool_entry_free (entry);
+    return response;
+}
+/*
+ * Remove the sessions saved at least 'max_gap' contexts before the context
+ * with sequence number 'sequence'. A saved session the TPM context counter
+ * has moved too far past can't be loaded (TPM2_RC_CONTEXT_GAP) and keeps
+ * the TPM from saving more sessions, so pooled sessions are dropped well
+ * before that. Returns the handles of the removed sessions (stored with
+ * GUINT_TO_POINTER) so the caller can flush them.
+ */
+GSList*
+session_pool_take_stale (SessionPool *pool,
+                         UINT64       sequence,
+                         UINT64       max_gap)
+{
+    session_pool_entry_t *entry;
+    GSList *handles = NULL;
+    guint i;
+
+    g_assert_nonnull (pool);
+    for (i = 0; i < SESSION_POOL_SET_COUNT; ++i) {
+        /* the queues are ordered oldest first */
+        while ((entry = g_queue_peek_head (pool->queues [i])) != NULL &&
+               sequence > entry->sequence &&
+               sequence - entry->sequence >= max_gap)
+        {
+            g_debug ("%s: dropping pooled session 0x%08" PRIx32 " saved at"
+                     " sequence %" PRIu64, __func__, entry->handle,
+                     entry->sequence);
+            g_queue_pop_head (pool->queues [i]);
+            handles = g_slist_prepend (handles,
+                                       GUINT_TO_POINTER (entry->handle));
+            session_pool_entry_free (entry);
+        }
+    }
+    return handles;
+}
+/*
+ * Empty the pool. Returns the handles of the sessions that were pooled
+ * (stored with GUINT_TO_POINTER) so the caller can flush them.
+ */
+GSList*
+session_pool_take_all (SessionPool *pool)
+{
+    session_pool_entry_t *entry;
+    GSList *handles = NULL;
+    guint i;
+
+    g_assert_nonnull (pool);
+    for (i = 0; i < SESSION_POOL_SET_COUNT; ++i) {
+        while ((entry = g_queue_pop_head (pool->queues [i])) != NULL) {
+            handles = g_slist_prepend (handles,
+                                       GUINT_TO_POINTER (entry->handle));
+            session_pool_entry_free (entry);
+        }
+    }
+    return handles;
+}
+/*
+ * The number of sessions in the pool, for all parameter sets.
+ */
+guint
+session_pool_count (SessionPool *pool)
+{
+    guint i, count = 0;
+
+    for (i = 0; i < SESSION_POOL_SET_COUNT; ++i) {
+        count += g_queue_get_length (pool->queues [i]);
+    }
+    return count;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SESSION_POOL_H
+#define SESSION_POOL_H
+
+#include <glib.h>
+#include <glib-object.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tpm2-command.h"
+#include "tpm2-response.h"
+
+G_BEGIN_DECLS
+
+#define SESSION_POOL_SIZE_MAX 8
+/* number of StartAuthSession parameter sets that are pooled */
+#define SESSION_POOL_SET_COUNT 2
+/* TPM2_PT_CONTEXT_GAP_MAX assumed if the TPM doesn't report it */
+#define SESSION_POOL_CONTEXT_GAP_DEFAULT 0xffff
+
+/*
+ * A StartAuthSession parameter set that qualifies for pooling. The
+ * session is always unbound and unsalted.
+ */
+typedef struct {
+    TPM2_SE        session_type;
+    TPMT_SYM_DEF   symmetric;
+    TPMI_ALG_HASH  auth_hash;
+} session_pool_params_t;
+
+typedef struct _SessionPoolClass {
+    GObjectClass      parent;
+} SessionPoolClass;
+
+/*
+ * Pool of sessions started in advance and saved, ready to answer a
+ * matching TPM2_StartAuthSession. 'size' is the number of sessions kept
+ * for each parameter set, 'queues' holds them. 'fill_failed' is set when
+ * the TPM refuses to start a session and stops further attempts until a
+ * pooled session is handed out. 'hits' and 'misses' count lookups.
+ */
+typedef struct _SessionPool {
+    GObject           parent_instance;
+    GQueue           *queues [SESSION_POOL_SET_COUNT];
+    guint             size;
+    gboolean          fill_failed;
+    guint64           hits;
+    guint64           misses;
+} SessionPool;
+
+#define TYPE_SESSION_POOL              (session_pool_get_type   ())
+#define SESSION_POOL(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj),   TYPE_SESSION_POOL, SessionPool))
+#define SESSION_POOL_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST    ((klass), TYPE_SESSION_POOL, SessionPoolClass))
+#define IS_SESSION_POOL(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj),   TYPE_SESSION_POOL))
+#define IS_SESSION_POOL_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE    ((klass), TYPE_SESSION_POOL))
+#define SESSION_POOL_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_SESSION_POOL, SessionPoolClass))
+
+GType          session_pool_get_type     (void);
+SessionPool*   session_pool_new          (guint          size);
+session_pool_params_t const* session_pool_get_params (guint set);
+gint           session_pool_match        (Tpm2Command   *command);
+gboolean       session_pool_needs_fill   (SessionPool   *pool,
+                                          guint         *set);
+void           session_pool_fill_failed  (SessionPool   *pool);
+void           session_pool_add          (SessionPool   *pool,
+                                          guint          set,
+                                          TPM2_HANDLE    handle,
+                                          TPM2B_NONCE const *nonce_tpm,
+                                          guint8 const  *context,
+                                          size_t         context_size);
+Tpm2Response*  session_pool_take         (SessionPool   *pool,
+                                          Tpm2Command   *command,
+                                          GBytes       **context);
+GSList*        session_pool_take_stale   (SessionPool   *pool,
+                                          UINT64         sequence,
+                                          UINT64         max_gap);
+GSList*        session_pool_take_all     (SessionPool   *pool);
+guint          session_pool_count        (SessionPool   *pool);
+
+G_END_DECLS
+#endif /* SESSION_POOL_H */
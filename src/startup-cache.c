@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "startup-cache.h"
+#include "util.h"
+
+G_DEFINE_TYPE (StartupCache, startup_cache, G_TYPE_OBJECT);
+
+enum {
+    PROP_0,
+    PROP_FILENAME,
+    N_PROPERTIES
+};
+static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+
+static void
+startup_cache_set_property (GObject      *object,
+                            guint         property_id,
+                            GValue const *value,
+                            GParamSpec   *pspec)
+{
+    StartupCache *self = STARTUP_CACHE (object);
+
+    switch (property_id) {
+    case PROP_FILENAME:
+        g_free (self->filename);
+        self->filename = g_value_dup_string (value);
+        g_debug ("%s: StartupCache 0x%" PRIxPTR " filename: %s", __func__,
+                 (uintptr_t)self, self->filename);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+startup_cache_get_property (GObject    *object,
+                            guint       property_id,
+                            GValue     *value,
+                            GParamSpec *pspec)
+{
+    StartupCache *self = STARTUP_CACHE (object);
+
+    switch (property_id) {
+    case PROP_FILENAME:
+        g_value_set_string (value, self->filename);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+/*
+ * G_DEFINE_TYPE requires an instance init even though we don't use it.
+ */
+static void
+startup_cache_init (StartupCache *cache)
+{
+    UNUSED_PARAM(cache);
+    /* noop */
+}
+static void
+startup_cache_finalize (GObject *object)
+{
+    StartupCache *self = STARTUP_CACHE (object);
+
+    g_debug ("%s: 0x%" PRIxPTR, __func__, (uintptr_t)self);
+    g_clear_pointer (&self->filename, g_free);
+    G_OBJECT_CLASS (startup_cache_parent_class)->finalize (object);
+}
+static void
+startup_cache_class_init (StartupCacheClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    if (startup_cache_parent_class == NULL)
+        startup_cache_parent_class = g_type_class_peek_parent (klass);
+    object_class->finalize     = startup_cache_finalize;
+    object_class->get_property = startup_cache_get_property;
+    object_class->set_property = startup_cache_set_property;
+
+    obj_properties [PROP_FILENAME] =
+        g_param_spec_string ("filename",
+                             "cache file name",
+                             "Path to file holding cached TPM properties",
+                             NULL,
+                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_properties (object_class,
+                                       N_PROPERTIES,
+                                       obj_properties);
+}
+StartupCache*
+startup_cache_new (const gchar *filename)
+{
+    return STARTUP_CACHE (g_object_new (TYPE_STARTUP_CACHE,
+                                        "filename", filename,
+                                        NULL));
+}
+/*
+ * Read the cache file and unmarshal its contents. The cache is only
+ * considered loaded if the whole file parses and holds the expected
+ * capabilities.
+ * Returns 0 on success, an errno value otherwise.
+ */
+gint
+startup_cache_load (StartupCache *cache)
+{
+    TPMS_CAPABILITY_DATA properties_fixed, commands;
+    gchar *contents = NULL;
+    gsize length = 0;
+    size_t offset = STARTUP_CACHE_MAGIC_SIZE;
+    UINT32 version = 0;
+    GError *error = NULL;
+    TSS2_RC rc;
+    gint ret = 0;
+
+    g_assert_nonnull (cache);
+    cache->loaded = FALSE;
+    if (!g_file_get_contents (cache->filename, &contents, &length, &error)) {
+        g_info ("%s: failed to read startup cache %s: %s", __func__,
+                cache->filename, error->message);
+        ret = error->domain == G_FILE_ERROR &&
+              error->code == G_FILE_ERROR_NOENT ? ENOENT : EIO;
+        g_clear_error (&error);
+        return ret;
+    }
+    if (length < STARTUP_CACHE_HEADER_SIZE || length > STARTUP_CACHE_SIZE_MAX ||
+        memcmp (contents, STARTUP_CACHE_MAGIC, STARTUP_CACHE_MAGIC_SIZE) != 0)
+    {
+        g_warning ("%s: %s is not a startup cache", __func__, cache->filename);
+        ret = EPROTO;
+        goto out;
+    }
+    rc = Tss2_MU_UINT32_Unmarshal ((uint8_t*)contents, length, &offset, &version);
+    if (rc != TSS2_RC_SUCCESS || version != STARTUP_CACHE_VERSION) {
+        g_warning ("%s: unsupported startup cache version: %" PRIu32,
+                   __func__, version);
+        ret = EPROTO;
+        goto out;
+    }
+    rc = Tss2_MU_TPMS_CAPABILITY_DATA_Unmarshal ((uint8_t*)contents,
+                                                 length,
+                                                 &offset,
+                                                 &properties_fixed);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPMS_CAPABILITY_DATA_Unmarshal ((uint8_t*)contents,
+                                                     length,
+                                                     &offset,
+                                                     &commands);
+    }
+    if (rc != TSS2_RC_SUCCESS || offset != length ||
+        properties_fixed.capability != TPM2_CAP_TPM_PROPERTIES ||
+        commands.capability != TPM2_CAP_COMMANDS ||
+        commands.data.command.count == 0)
+    {
+        g_warning ("%s: startup cache %s is corrupt", __func__,
+                   cache->filename);
+        ret = EPROTO;
+        goto out;
+    }
+    cache->properties_fixed = properties_fixed;
+    cache->commands = commands;
+    cache->loaded = TRUE;
+out:
+    g_free (contents);
+    return ret;
+}
+/*
+ * Marshal the cached data and write it to the cache file. The file is
+ * replaced atomically so a daemon starting concurrently never sees a
+ * partially written cache.
+ * Returns 0 on success, an errno value otherwise.
+ */
+gint
+startup_cache_save (StartupCache *cache)
+{
+    uint8_t *buf;
+    size_t offset = STARTUP_CACHE_MAGIC_SIZE;
+    GError *error = NULL;
+    TSS2_RC rc;
+    gint ret = 0;
+
+    g_assert_nonnull (cache);
+    buf = g_malloc0 (STARTUP_CACHE_SIZE_MAX);
+    memcpy (buf, STARTUP_CACHE_MAGIC, STARTUP_CACHE_MAGIC_SIZE);
+    rc = Tss2_MU_UINT32_Marshal (STARTUP_CACHE_VERSION,
+                                 buf,
+                                 STARTUP_CACHE_SIZE_MAX,
+                                 &offset);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPMS_CAPABILITY_DATA_Marshal (&cache->properties_fixed,
+                                                   buf,
+                                                   STARTUP_CACHE_SIZE_MAX,
+                                                   &offset);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPMS_CAPABILITY_DATA_Marshal (&cache->commands,
+                                                   buf,
+                                                   STARTUP_CACHE_SIZE_MAX,
+                                                   &offset);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to marshal startup cache: 0x%" PRIx32,
+                   __func__, rc);
+        ret = EPROTO;
+        goto out;
+    }
+    if (!g_file_set_contents (cache->filename,
+                              (gchar*)buf,
+                              (gssize)offset,
+                              &error))
+    {
+        g_warning ("%s: failed to write startup cache %s: %s", __func__,
+                   cache->filename, error->message);
+        g_clear_error (&error);
+        ret = EIO;
+    }
+out:
+    g_free (buf);
+    return ret;
+}
+/*
+ * Replace the cached data with the provided capability data.
+ */
+void
+startup_cache_set (StartupCache               *cache,
+                   TPMS_CAPABILITY_DATA const *properties_fixed,
+                   TPMS_CAPABILITY_DATA const *commands)
+{
+    g_assert_nonnull (cache);
+    g_assert_nonnull (properties_fixed);
+    g_assert_nonnull (commands);
+
+    cache->properties_fixed = *properties_fixed;
+    cache->commands = *commands;
+    cache->commands.capability = TPM2_CAP_COMMANDS;
+    cache->loaded = TRUE;
+}
+/*
+ * Compare the cached data to the provided capability data. Only the parts
+ * of the TPMS_CAPABILITY_DATA that are in use are compared.
+ */
+gboolean
+startup_cache_equal (StartupCache               *cache,
+                     TPMS_CAPABILITY_DATA const *properties_fixed,
+                     TPMS_CAPABILITY_DATA const *commands)
+{
+    TPML_TAGGED_TPM_PROPERTY const *props_a, *props_b;
+    TPML_CCA const *cmds_a, *cmds_b;
+
+    g_assert_nonnull (cache);
+    props_a = &cache->properties_fixed.data.tpmProperties;
+    props_b = &properties_fixed->data.tpmProperties;
+    cmds_a = &cache->commands.data.command;
+    cmds_b = &commands->data.command;
+    if (props_a->count != props_b->count || cmds_a->count != cmds_b->count) {
+        return FALSE;
+    }
+    if (memcmp (props_a->tpmProperty,
+                props_b->tpmProperty,
+                props_a->count * sizeof (props_a->tpmProperty [0])) != 0)
+    {
+        return FALSE;
+    }
+    return memcmp (cmds_a->commandAttributes,
+                   cmds_b->commandAttributes,
+                   cmds_a->count * sizeof (cmds_a->commandAttributes [0])) == 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef STARTUP_CACHE_H
+#define STARTUP_CACHE_H
+
+#include <glib.h>
+#include <glib-object.h>
+#include <tss2/tss2_tpm2_types.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Startup cache file format. All integers are big endian (marshalled with
+ * the libtss2-mu functions).
+ *
+ * magic (8 bytes, STARTUP_CACHE_MAGIC), version (UINT32),
+ * fixed TPM properties (TPMS_CAPABILITY_DATA, TPM2_CAP_TPM_PROPERTIES),
+ * command attributes (TPMS_CAPABILITY_DATA, TPM2_CAP_COMMANDS)
+ *
+ * The fixed properties include the manufacturer and firmware version that
+ * the AccessBroker uses to decide whether the cache belongs to the TPM.
+ */
+#define STARTUP_CACHE_MAGIC       "TABRMDSC"
+#define STARTUP_CACHE_MAGIC_SIZE  8
+#define STARTUP_CACHE_VERSION     1
+#define STARTUP_CACHE_HEADER_SIZE (STARTUP_CACHE_MAGIC_SIZE + sizeof (UINT32))
+#define STARTUP_CACHE_SIZE_MAX \
+    (STARTUP_CACHE_HEADER_SIZE + 2 * sizeof (TPMS_CAPABILITY_DATA))
+
+typedef struct _StartupCacheClass {
+    GObjectClass      parent;
+} StartupCacheClass;
+
+typedef struct _StartupCache {
+    GObject               parent_instance;
+    gchar                *filename;
+    gboolean              loaded;
+    TPMS_CAPABILITY_DATA  properties_fixed;
+    TPMS_CAPABILITY_DATA  commands;
+} StartupCache;
+
+#define TYPE_STARTUP_CACHE              (startup_cache_get_type   ())
+#define STARTUP_CACHE(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj),   TYPE_STARTUP_CACHE, StartupCache))
+#define STARTUP_CACHE_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST    ((klass), TYPE_STARTUP_CACHE, StartupCacheClass))
+#define IS_STARTUP_CACHE(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj),   TYPE_STARTUP_CACHE))
+#define IS_STARTUP_CACHE_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE    ((klass), TYPE_STARTUP_CACHE))
+#define STARTUP_CACHE_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_STARTUP_CACHE, StartupCacheClass))
+
+GType          startup_cache_get_type   (void);
+StartupCache*  startup_cache_new        (const gchar                *filename);
+gint           startup_cache_load       (StartupCache               *cache);
+gint           startup_cache_save       (StartupCache               *cache);
+void           startup_cache_set        (StartupCache               *cache,
+                                         TPMS_CAPABILITY_DATA const *properties_fixed,
+                                         TPMS_CAPABILITY_DATA const *commands);
+gboolean       startup_cache_equal      (StartupCache               *cache,
+                                         TPMS_CAPABILITY_DATA const *properties_fixed,
+                                         TPMS_CAPABILITY_DATA const *commands);
+
+G_END_DECLS
+#endif /* STARTUP_CACHE_H */
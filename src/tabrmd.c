@@ -39,17 +39,24 @@
 #include "access-broker.h"
 #include "connection.h"
 #include "connection-manager.h"
+#include "connection-pool.h"
 #include "tabrmd.h"
 #include "logging.h"
 #include "thread.h"
 #include "command-source.h"
 #include "ipc-frontend.h"
 #include "ipc-frontend-dbus.h"
+#include "ipc-frontend-socket.h"
+#include "object-cache.h"
 #include "random.h"
+#include "read-cache.h"
 #include "resource-manager.h"
 #include "response-sink.h"
+#include "session-pool.h"
 #include "source-interface.h"
+#include "startup-cache.h"
 #include "tcti-dynamic.h"
+#include "trace.h"
 #include "util.h"
 
 /* work around older glib versions missing this symbol */
@@ -72,6 +79,11 @@ typedef struct gmain_data {
     GMutex                  init_mutex;
     Tcti                   *tcti;
     IpcFrontend            *ipc_frontend;
+    IpcFrontend            *ipc_frontend_socket;
+    StartupCache           *startup_cache;
+    gboolean                startup_cache_hit;
+    GThread                *startup_cache_thread;
+    GThread                *self_test_thread;
 } gmain_data_t;
 
 /**
@@ -107,6 +119,149 @@ on_ipc_frontend_disconnect (IpcFrontend *ipc_frontend,
     g_info ("IpcFrontend 0x%" PRIxPTR " disconnected", (uintptr_t)ipc_frontend);
     main_loop_quit (loop);
 }
+/*
+ * This function initializes the TPM side of the daemon: the TCTI, the
+ * AccessBroker and the CommandAttrs. It runs on its own thread in parallel
+ * with the D-Bus and PRNG setup done by the init thread since neither
+ * depends on the other. When a StartupCache is configured the fixed TPM
+ * properties and command attributes are taken from it if it matches the
+ * TPM. The initialized CommandAttrs object is returned to the thread that
+ * joins this one.
+ */
+static gpointer
+tpm_init_thread_func (gpointer user_data)
+{
+    gmain_data_t *data = (gmain_data_t*)user_data;
+    TPMS_CAPABILITY_DATA const *properties_fixed = NULL;
+    CommandAttrs *command_attrs;
+    TSS2_RC rc;
+    gint ret;
+
+    g_info ("tpm_init_thread_func start");
+    /**
+     * this isn't strictly necessary but it allows us to detect a failure in
+     * the TCTI before we start communicating with clients
+     */
+    rc = tcti_initialize (data->tcti);
+    if (rc != TSS2_RC_SUCCESS) {
+        tabrmd_critical ("TCTI initialization failed: 0x%x", rc);
+    }
+
+    data->access_broker = access_broker_new (data->tcti);
+    g_debug ("created AccessBroker: 0x%" PRIxPTR,
+             (uintptr_t)data->access_broker);
+    if (data->startup_cache != NULL &&
+        startup_cache_load (data->startup_cache) == 0)
+    {
+        properties_fixed = &data->startup_cache->properties_fixed;
+    }
+    rc = access_broker_init_tpm_cached (data->access_broker,
+                                        properties_fixed,
+                                        &data->startup_cache_hit);
+    if (rc != TSS2_RC_SUCCESS)
+        g_error ("failed to initialize AccessBroker: 0x%" PRIx32, rc);
+    if (data->options.flush_all) {
+        access_broker_flush_all_context (data->access_broker);
+    }
+    command_attrs = command_attrs_new ();
+    g_debug ("created CommandAttrs: 0x%" PRIxPTR, (uintptr_t)command_attrs);
+    if (data->startup_cache_hit) {
+        ret = command_attrs_init_capability (command_attrs,
+                                             &data->startup_cache->commands);
+    } else {
+        ret = command_attrs_init_tpm (command_attrs, data->access_broker);
+    }
+    if (ret != 0)
+        g_error ("failed to initialize CommandAttribute object: 0x%" PRIxPTR,
+                 (uintptr_t)command_attrs);
+    rc = access_broker_init_cap_cache (data->access_broker,
+                                       data->startup_cache_hit ?
+                                       &data->startup_cache->commands : NULL);
+    if (rc != TSS2_RC_SUCCESS)
+        g_warning ("failed to initialize capability cache: 0x%" PRIx32, rc);
+    g_info ("tpm_init_thread_func done");
+
+    return command_attrs;
+}
+/*
+ * Query the TPM for the data held in the StartupCache and compare it to
+ * the cached data. If it differs (or there was no cache) the cache file is
+ * rewritten. A stale cache is only possible if the TPM firmware changed
+ * without changing its version. In that case the capability data cached
+ * by the AccessBroker, which came from the stale cache, is replaced so
+ * that GetCapability queries are answered with what the TPM reports. The
+ * CommandAttrs aren't shared safely between threads so they keep the
+ * cached command attributes until the next start. This runs after the
+ * daemon is serving clients so it doesn't delay startup.
+ */
+static gpointer
+startup_cache_thread_func (gpointer user_data)
+{
+    gmain_data_t *data = (gmain_data_t*)user_data;
+    StartupCache *cache = data->startup_cache;
+    TPMS_CAPABILITY_DATA properties_fixed, commands;
+    TSS2_RC rc;
+
+    g_info ("startup_cache_thread_func start");
+    rc = access_broker_get_capability (data->access_broker,
+                                       TPM2_CAP_TPM_PROPERTIES,
+                                       TPM2_PT_FIXED,
+                                       TPM2_MAX_TPM_PROPERTIES,
+                                       &properties_fixed);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = access_broker_get_capability (data->access_broker,
+                                           TPM2_CAP_COMMANDS,
+                                           TPM2_CC_FIRST,
+                                           TPM2_MAX_CAP_CC,
+                                           &commands);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("failed to query TPM to validate startup cache %s",
+                   cache->filename);
+        return NULL;
+    }
+    if (cache->loaded &&
+        startup_cache_equal (cache, &properties_fixed, &commands))
+    {
+        g_info ("startup cache %s is current", cache->filename);
+        return NULL;
+    }
+    if (cache->loaded) {
+        g_warning ("TPM properties differ from startup cache %s, updating",
+                   cache->filename);
+        if (data->startup_cache_hit) {
+            access_broker_update_cap_cache (data->access_broker,
+                                            &properties_fixed,
+                                            &commands);
+        }
+    }
+    startup_cache_set (cache, &properties_fixed, &commands);
+    startup_cache_save (cache);
+    g_info ("startup_cache_thread_func done");
+
+    return NULL;
+}
+/*
+ * Test the commonly used algorithms in the background so that the first
+ * client command using one of them doesn't have to wait for the TPM to
+ * test it.
+ */
+static gpointer
+self_test_thread_func (gpointer user_data)
+{
+    gmain_data_t *data = (gmain_data_t*)user_data;
+    TPML_ALG algs = ACCESS_BROKER_SELF_TEST_ALGS_DEFAULT;
+    TSS2_RC rc;
+
+    g_info ("self_test_thread_func start");
+    rc = access_broker_self_test (data->access_broker, &algs);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("background self test failed: 0x%" PRIx32, rc);
+    }
+    g_info ("self_test_thread_func done");
+
+    return NULL;
+}
 /**
  * This function initializes and configures all of the long-lived objects
  * in the tabrmd system. It is invoked on a thread separate from the main
@@ -118,25 +273,35 @@ on_ipc_frontend_disconnect (IpcFrontend *ipc_frontend,
  * - Registers a handler for UNIX signals for SIGINT and SIGTERM.
  * - Seeds the RNG state from an entropy source.
  * - Creates the ConnectionManager.
- * - Creates the TCTI instance used by the Tab.
- * - Creates an access broker and verify the current state of the TPM.
+ * - Initializes the TCTI, access broker and command attributes on a
+ *   separate thread (see tpm_init_thread_func) in parallel with the above.
  * - Creates and wires up the objects that make up the TPM command
  *   processing pipeline.
  * - Starts all of the threads in the command processing pipeline.
  * - Unlocks the init_mutex.
+ * - Starts the thread that validates / updates the startup cache.
+ * - Starts the thread that runs the background TPM self test.
  */
 static gpointer
 init_thread_func (gpointer user_data)
 {
     gmain_data_t *data = (gmain_data_t*)user_data;
     gint ret;
-    TSS2_RC rc;
     CommandAttrs *command_attrs;
     ConnectionManager *connection_manager = NULL;
     SessionList *session_list;
+    Trace *trace = NULL;
+    ReadCache *read_cache = NULL;
+    ObjectCache *object_cache = NULL;
+    SessionPool *session_pool = NULL;
+    ConnectionPool *connection_pool = NULL;
+    GThread *tpm_init_thread;
 
     g_info ("init_thread_func start");
     g_mutex_lock (&data->init_mutex);
+    tpm_init_thread = g_thread_new (TABD_TPM_INIT_THREAD_NAME,
+                                    tpm_init_thread_func,
+                                    data);
     /* Setup program signals */
     if (g_unix_signal_add(SIGINT, signal_handler, data->loop) <= 0 ||
         g_unix_signal_add(SIGTERM, signal_handler, data->loop) <= 0)
@@ -163,57 +328,101 @@ init_thread_func (gpointer user_data)
     if (data->ipc_frontend == NULL) {
         g_error ("failed to allocate IpcFrontend object");
     }
+    if (data->options.connection_pool > 0) {
+        connection_pool = connection_pool_new (data->options.connection_pool,
+                                               data->options.max_transients);
+        connection_pool_fill (connection_pool);
+        g_object_set (data->ipc_frontend,
+                      "connection-pool", connection_pool,
+                      NULL);
+        g_clear_object (&connection_pool);
+    }
     g_signal_connect (data->ipc_frontend,
                       "disconnected",
                       (GCallback) on_ipc_frontend_disconnect,
                       data->loop);
     ipc_frontend_connect (data->ipc_frontend,
                           &data->init_mutex);
-
-    /**
-     * this isn't strictly necessary but it allows us to detect a failure in
-     * the TCTI before we start communicating with clients
+    /*
+     * Clients may also connect directly over a Unix socket. This bypasses
+     * D-Bus for CreateConnection, the other D-Bus methods still apply.
      */
-    rc = tcti_initialize (data->tcti);
-    if (rc != TSS2_RC_SUCCESS) {
-        tabrmd_critical ("TCTI initialization failed: 0x%x", rc);
+    if (data->options.socket_path != NULL) {
+        data->ipc_frontend_socket =
+            IPC_FRONTEND (ipc_frontend_socket_new (data->options.socket_path,
+                                                   connection_manager,
+                                                   data->options.max_transients,
+                                                   data->random));
+        g_signal_connect (data->ipc_frontend_socket,
+                          "disconnected",
+                          (GCallback) on_ipc_frontend_disconnect,
+                          data->loop);
+        ipc_frontend_connect (data->ipc_frontend_socket,
+                              &data->init_mutex);
     }
 
-    data->access_broker = access_broker_new (data->tcti);
-    g_debug ("created AccessBroker: 0x%" PRIxPTR,
-             (uintptr_t)data->access_broker);
-    rc = access_broker_init_tpm (data->access_broker);
-    if (rc != TSS2_RC_SUCCESS)
-        g_error ("failed to initialize AccessBroker: 0x%" PRIx32, rc);
-    if (data->options.flush_all) {
-        access_broker_flush_all_context (data->access_broker);
-    }
+    command_attrs = COMMAND_ATTRS (g_thread_join (tpm_init_thread));
     /**
      * Instantiate and the objects that make up the TPM command processing
      * pipeline.
      */
-    command_attrs = command_attrs_new ();
-    g_debug ("created CommandAttrs: 0x%" PRIxPTR, (uintptr_t)command_attrs);
-    ret = command_attrs_init_tpm (command_attrs, data->access_broker);
-    if (ret != 0)
-        g_error ("failed to initialize CommandAttribute object: 0x%" PRIxPTR,
-                 (uintptr_t)command_attrs);
 
     data->command_source =
         command_source_new (connection_manager, command_attrs);
+    g_object_set (data->command_source,
+                  "pipeline-depth", data->options.pipeline_depth,
+                  NULL);
     g_object_unref (connection_manager);
     g_debug ("created command source: 0x%" PRIxPTR,
              (uintptr_t)data->command_source);
     session_list = session_list_new (data->options.max_sessions,
                                      SESSION_LIST_MAX_ABANDONED_DEFAULT);
+    if (data->options.random_pool > 0) {
+        access_broker_random_pool_init (data->access_broker,
+                                        data->options.random_pool);
+    }
     data->resource_manager = resource_manager_new (data->access_broker,
                                                    session_list);
     g_clear_object (&session_list);
     g_debug ("created ResourceManager: 0x%" PRIxPTR,
              (uintptr_t)data->resource_manager);
+    if (data->options.read_cache || data->options.pcr_cache) {
+        read_cache = read_cache_new (READ_CACHE_MAX_ENTRIES_DEFAULT,
+            (data->options.read_cache ? READ_CACHE_PUBLIC : 0) |
+            (data->options.pcr_cache ? READ_CACHE_PCR_READ : 0));
+        g_object_set (data->resource_manager, "read-cache", read_cache, NULL);
+        g_clear_object (&read_cache);
+    }
+    if (data->options.primary_cache || data->options.load_cache) {
+        object_cache = object_cache_new (OBJECT_CACHE_MAX_ENTRIES_DEFAULT,
+            (data->options.primary_cache ? OBJECT_CACHE_PRIMARY : 0) |
+            (data->options.load_cache ? OBJECT_CACHE_LOAD : 0));
+        g_object_set (data->resource_manager,
+                      "object-cache", object_cache,
+                      NULL);
+        g_clear_object (&object_cache);
+    }
+    if (data->options.session_pool > 0) {
+        session_pool = session_pool_new (data->options.session_pool);
+        g_object_set (data->resource_manager,
+                      "session-pool", session_pool,
+                      NULL);
+        g_clear_object (&session_pool);
+    }
     data->response_sink = response_sink_new ();
     g_debug ("created response source: 0x%" PRIxPTR,
              (uintptr_t)data->response_sink);
+    if (data->options.trace_file != NULL) {
+        trace = trace_new (data->options.trace_file);
+        ret = trace_open (trace);
+        if (ret != 0) {
+            tabrmd_critical ("failed to open trace file %s: %s",
+                             data->options.trace_file, strerror (ret));
+        }
+        g_object_set (data->command_source, "trace", trace, NULL);
+        g_object_set (data->response_sink, "trace", trace, NULL);
+        g_clear_object (&trace);
+    }
     g_object_unref (command_attrs);
     g_object_unref (data->access_broker);
     /**
@@ -239,6 +448,17 @@ init_thread_func (gpointer user_data)
         g_error ("failed to start response_source");
 
     g_mutex_unlock (&data->init_mutex);
+    if (data->startup_cache != NULL) {
+        data->startup_cache_thread =
+            g_thread_new (TABD_STARTUP_CACHE_THREAD_NAME,
+                          startup_cache_thread_func,
+                          data);
+    }
+    if (data->options.self_test) {
+        data->self_test_thread = g_thread_new (TABD_SELF_TEST_THREAD_NAME,
+                                               self_test_thread_func,
+                                               data);
+    }
     g_info ("init_thread_func done");
 
     return NULL;
@@ -378,6 +598,114 @@ parse_opts (gint            argc,
             .description     = "TCTI configuration string. See tpm2-abrmd (8) for search rules.",
             .arg_description = "tcti-conf",
         },
+        {
+            .long_name       = "trace-file",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_FILENAME,
+            .arg_data        = &options->trace_file,
+            .description     = "Record all commands and responses to file.",
+            .arg_description = "file",
+        },
+        {
+            .long_name       = "socket",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_FILENAME,
+            .arg_data        = &options->socket_path,
+            .description     = "Also accept connections on a Unix socket at this path.",
+            .arg_description = "path",
+        },
+        {
+            .long_name       = "startup-cache",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_FILENAME,
+            .arg_data        = &options->startup_cache,
+            .description     = "Cache fixed TPM properties in file for faster startup.",
+            .arg_description = "file",
+        },
+        {
+            .long_name       = "self-test",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_NONE,
+            .arg_data        = &options->self_test,
+            .description     = "Self test common algorithms in the background on startup.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "read-cache",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_NONE,
+            .arg_data        = &options->read_cache,
+            .description     = "Cache ReadPublic / NV_ReadPublic responses for persistent objects and NV indices.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "pcr-cache",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_NONE,
+            .arg_data        = &options->pcr_cache,
+            .description     = "Cache PCR_Read responses until PCRs are changed.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "primary-cache",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_NONE,
+            .arg_data        = &options->primary_cache,
+            .description     = "Reuse primary objects created with the same CreatePrimary command.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "load-cache",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_NONE,
+            .arg_data        = &options->load_cache,
+            .description     = "Share objects loaded under persistent parents with the same Load command.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "random-pool",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->random_pool,
+            .description     = "Bytes of TPM randomness to fetch in advance for GetRandom, 0 to disable.",
+            .arg_description = "bytes",
+        },
+        {
+            .long_name       = "session-pool",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->session_pool,
+            .description     = "Number of HMAC sessions of each pooled kind to start in advance, 0 to disable.",
+            .arg_description = "count",
+        },
+        {
+            .long_name       = "pipeline-depth",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->pipeline_depth,
+            .description     = "Number of commands a client may send before reading a response.",
+            .arg_description = "count",
+        },
+        {
+            .long_name       = "connection-pool",
+            .short_name      = 0,
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->connection_pool,
+            .description     = "Number of client connections to prepare in advance, 0 to disable.",
+            .arg_description = "count",
+        },
         { NULL, '\0', 0, 0, NULL, NULL, NULL },
     };
 
@@ -409,6 +737,24 @@ parse_opts (gint            argc,
         tabrmd_critical ("max-trans-obj parameter must be between 1 and %d",
                          TABRMD_TRANSIENT_MAX);
     }
+    if (options->connection_pool > TABRMD_CONNECTION_MAX) {
+        tabrmd_critical ("connection-pool must be between 0 and %d",
+                         TABRMD_CONNECTION_MAX);
+    }
+    if (options->random_pool > ACCESS_BROKER_RANDOM_POOL_MAX) {
+        tabrmd_critical ("random-pool must be between 0 and %d",
+                         ACCESS_BROKER_RANDOM_POOL_MAX);
+    }
+    if (options->session_pool > SESSION_POOL_SIZE_MAX) {
+        tabrmd_critical ("session-pool must be between 0 and %d",
+                         SESSION_POOL_SIZE_MAX);
+    }
+    if (options->pipeline_depth < 1 ||
+        options->pipeline_depth > TABRMD_PIPELINE_DEPTH_MAX)
+    {
+        tabrmd_critical ("pipeline-depth must be between 1 and %d",
+                         TABRMD_PIPELINE_DEPTH_MAX);
+    }
     if (!tcti_conf_parse (tcti_optconf,
                           &options->tcti_filename,
                           &options->tcti_conf)) {
@@ -453,6 +799,10 @@ main (int argc, char *argv[])
 
     gmain_data.tcti = TCTI (tcti_dynamic_new (gmain_data.options.tcti_filename,
                                               gmain_data.options.tcti_conf));
+    if (gmain_data.options.startup_cache != NULL) {
+        gmain_data.startup_cache =
+            startup_cache_new (gmain_data.options.startup_cache);
+    }
     g_mutex_init (&gmain_data.init_mutex);
     gmain_data.loop = g_main_loop_new (NULL, FALSE);
     /*
@@ -467,9 +817,20 @@ main (int argc, char *argv[])
     g_main_loop_run (gmain_data.loop);
     g_info ("g_main_loop_run done, cleaning up");
     g_thread_join (init_thread);
+    /* the startup cache and self test threads use the AccessBroker */
+    if (gmain_data.startup_cache_thread != NULL) {
+        g_thread_join (gmain_data.startup_cache_thread);
+    }
+    if (gmain_data.self_test_thread != NULL) {
+        g_thread_join (gmain_data.self_test_thread);
+    }
     /* cleanup glib stuff first so we stop getting events */
     ipc_frontend_disconnect (gmain_data.ipc_frontend);
     g_object_unref (gmain_data.ipc_frontend);
+    if (gmain_data.ipc_frontend_socket != NULL) {
+        ipc_frontend_disconnect (gmain_data.ipc_frontend_socket);
+        g_object_unref (gmain_data.ipc_frontend_socket);
+    }
     /* tear down the command processing pipeline */
     thread_cleanup (THREAD (gmain_data.command_source));
     thread_cleanup (THREAD (gmain_data.resource_manager));
@@ -477,5 +838,6 @@ main (int argc, char *argv[])
     /* clean up what remains */
     g_object_unref (gmain_data.random);
     g_object_unref (gmain_data.tcti);
+    g_clear_object (&gmain_data.startup_cache);
     return 0;
 }
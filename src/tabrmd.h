@@ -38,6 +38,10 @@
 #define TABRMD_DBUS_TYPE_DEFAULT G_BUS_TYPE_SYSTEM
 #define TABRMD_DBUS_PATH                     "/com/intel/tss2/Tabrmd/Tcti"
 #define TABRMD_DBUS_METHOD_CREATE_CONNECTION "CreateConnection"
+#define TABRMD_DBUS_METHOD_CREATE_CONNECTION_WITH_FLAGS \
+    "CreateConnectionWithFlags"
+/* flags for CreateConnectionWithFlags */
+#define TABRMD_CONNECTION_FLAG_SEQPACKET (1 << 0)
 #define TABRMD_DBUS_METHOD_CANCEL            "Cancel"
 #define TABRMD_ERROR tabrmd_error_quark ()
 #define TABRMD_ENTROPY_SRC_DEFAULT "/dev/urandom"
@@ -47,8 +51,34 @@
 #define TABRMD_TCTI_CONF_DEFAULT NULL
 #define TABRMD_TRANSIENT_MAX_DEFAULT 27
 #define TABRMD_TRANSIENT_MAX 100
+#define TABRMD_TRACE_FILE_DEFAULT NULL
+#define TABRMD_SOCKET_PATH_DEFAULT NULL
+#define TABRMD_CONNECTION_POOL_DEFAULT 8
+#define TABRMD_STARTUP_CACHE_DEFAULT NULL
+#define TABRMD_RANDOM_POOL_DEFAULT 0
+#define TABRMD_SESSION_POOL_DEFAULT 0
+/*
+ * Number of commands a client may send before reading the response to the
+ * first one. Once this many are unanswered the daemon stops reading from
+ * the client until a response goes out.
+ */
+#define TABRMD_PIPELINE_DEPTH_DEFAULT 8
+#define TABRMD_PIPELINE_DEPTH_MAX 64
+/*
+ * Batches of commands are framed by a header laid out like a TPM command
+ * header: the tag, the size of the whole frame and a flags field (request)
+ * or the number of responses (reply), followed by the commands / responses
+ * back to back. The tag isn't a valid TPM2_ST so it can't be mistaken for
+ * a single command.
+ */
+#define TABRMD_BATCH_TAG 0xba7c
+#define TABRMD_BATCH_COUNT_MAX 32
+#define TABRMD_BATCH_SIZE_MAX (TPM_HEADER_SIZE + TABRMD_BATCH_COUNT_MAX * UTIL_BUF_MAX)
 
 #define TABD_INIT_THREAD_NAME "tss2-tabrmd_init-thread"
+#define TABD_TPM_INIT_THREAD_NAME "tss2-tabrmd_tpm-init-thread"
+#define TABD_STARTUP_CACHE_THREAD_NAME "tss2-tabrmd_startup-cache-thread"
+#define TABD_SELF_TEST_THREAD_NAME "tss2-tabrmd_self-test-thread"
 
 /* implementation specific RCs */
 #define TSS2_RESMGR_RC_INTERNAL_ERROR (TSS2_RC)(TSS2_RESMGR_RC_LAYER | (1 << TSS2_LEVEL_IMPLEMENTATION_SPECIFIC_SHIFT))
@@ -73,6 +103,18 @@
     .allow_root = FALSE, \
     .tcti_filename = TABRMD_TCTI_FILENAME_DEFAULT, \
     .tcti_conf = TABRMD_TCTI_CONF_DEFAULT, \
+    .trace_file = TABRMD_TRACE_FILE_DEFAULT, \
+    .connection_pool = TABRMD_CONNECTION_POOL_DEFAULT, \
+    .startup_cache = TABRMD_STARTUP_CACHE_DEFAULT, \
+    .self_test = FALSE, \
+    .read_cache = FALSE, \
+    .pcr_cache = FALSE, \
+    .primary_cache = FALSE, \
+    .load_cache = FALSE, \
+    .random_pool = TABRMD_RANDOM_POOL_DEFAULT, \
+    .session_pool = TABRMD_SESSION_POOL_DEFAULT, \
+    .pipeline_depth = TABRMD_PIPELINE_DEPTH_DEFAULT, \
+    .socket_path = TABRMD_SOCKET_PATH_DEFAULT, \
 }
 
 typedef struct tabrmd_options {
@@ -86,6 +128,18 @@ typedef struct tabrmd_options {
     gboolean        allow_root;
     gchar          *tcti_filename;
     gchar          *tcti_conf;
+    gchar          *trace_file;
+    guint           connection_pool;
+    gchar          *startup_cache;
+    gboolean        self_test;
+    gboolean        read_cache;
+    gboolean        pcr_cache;
+    gboolean        primary_cache;
+    gboolean        load_cache;
+    guint           random_pool;
+    guint           session_pool;
+    guint           pipeline_depth;
+    gchar          *socket_path;
 } tabrmd_options_t;
 
 GQuark  tabrmd_error_quark (void);
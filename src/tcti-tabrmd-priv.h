@@ -48,6 +48,10 @@
     ((TSS2_TCTI_TABRMD_CONTEXT*)context)->header
 #define TSS2_TCTI_TABRMD_STATE(context) \
     ((TSS2_TCTI_TABRMD_CONTEXT*)context)->state
+#define TSS2_TCTI_TABRMD_PIPELINE_DEPTH(context) \
+    ((TSS2_TCTI_TABRMD_CONTEXT*)context)->pipeline_depth
+#define TSS2_TCTI_TABRMD_OUTSTANDING(context) \
+    ((TSS2_TCTI_TABRMD_CONTEXT*)context)->outstanding
 
 /*
  * Macros for accessing the internals of the I/O stream. These are helpers
@@ -75,8 +79,11 @@
  *     cancel:      produces TSS2_TCTI_RC_BAD_SEQUENCE
  *     setLocality: success or failure leaves state unchanged
  *   RECEIVE:
- *     transmit:    produces TSS2_TCTI_RC_BAD_SEQUENCE
- *     receive:     success transitions the state machine to TRANSMIT
+ *     transmit:    produces TSS2_TCTI_RC_BAD_SEQUENCE unless fewer than
+ *                  'pipeline_depth' commands are waiting for a response,
+ *                  in which case it behaves as in the TRANSMIT state
+ *     receive:     success transitions the state machine to TRANSMIT once
+ *                  no more commands are waiting for a response
  *                  failure with the following RCs leave the state unchanged:
  *                    TRY_AGAIN, INSUFFICIENT_BUFFER, BAD_CONTEXT,
  *                    BAD_REFERENCE, BAD_VALUE, BAD_SEQUENCE
@@ -88,6 +95,13 @@
  *     setLocality: produces TSS2_TCTI_RC_BAD_SEQUENCE
  *   FINAL:
  *     all function calls produce TSS2_TCTI_RC_BAD_SEQUENCE
+ * In async mode transmit and receive never block. A command that the socket
+ * only partly takes is queued in 'tx_buf' and counts as transmitted; the
+ * rest is written by later calls to transmit or receive. Receive returns
+ * TSS2_TCTI_RC_TRY_AGAIN when no more data is available and picks up from
+ * 'index' / 'header_buf' on the next call.
+ * Over a SOCK_SEQPACKET socket ('seqpacket' set) each response is a single
+ * message that receive takes whole: 'index' stays at 0.
  */
 typedef enum {
     TABRMD_STATE_FINAL,
@@ -110,16 +124,29 @@ typedef struct {
     tcti_tabrmd_state_t            state;
     size_t                         index;
     uint8_t                        header_buf [TPM_HEADER_SIZE];
+    guint32                        pipeline_depth;
+    guint32                        outstanding;
+    gboolean                       async;
+    uint8_t                       *tx_buf;
+    size_t                         tx_size;
+    size_t                         tx_index;
+    gboolean                       seqpacket;
 } TSS2_TCTI_TABRMD_CONTEXT;
 
 #define TABRMD_CONF_INIT_DEFAULT { \
     .bus_name = TABRMD_DBUS_NAME_DEFAULT, \
     .bus_type = TABRMD_DBUS_TYPE_DEFAULT, \
+    .pipeline_depth = 1, \
+    .socket_path = NULL, \
 }
 
 typedef struct {
     const char *bus_name;
     GBusType bus_type;
+    guint pipeline_depth;
+    gboolean async;
+    const char *socket_path;
+    gboolean seqpacket;
 } tabrmd_conf_t;
 
 /*
@@ -28,10 +28,13 @@
 #include <fcntl.h>
 #include <gio/gio.h>
 #include <gio/gunixfdlist.h>
+#include <gio/gunixsocketaddress.h>
 #include <glib.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 
 #include <tss2/tss2_tpm2_types.h>
 
@@ -41,56 +44,6 @@
 #include "tpm2-header.h"
 #include "util.h"
 
-static TSS2_RC
-tss2_tcti_tabrmd_transmit (TSS2_TCTI_CONTEXT *context,
-                           size_t             size,
-                           const uint8_t      *command)
-{
-    ssize_t write_ret;
-    TSS2_RC tss2_ret = TSS2_RC_SUCCESS;
-    GOutputStream *ostream;
-
-    g_debug ("tss2_tcti_tabrmd_transmit");
-    if (context == NULL || command == NULL) {
-        return TSS2_TCTI_RC_BAD_REFERENCE;
-    }
-    if (size == 0) {
-        return TSS2_TCTI_RC_BAD_VALUE;
-    }
-    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
-        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
-        return TSS2_TCTI_RC_BAD_CONTEXT;
-    }
-    if (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_TRANSMIT) {
-        return TSS2_TCTI_RC_BAD_SEQUENCE;
-    }
-    g_debug_bytes (command, size, 16, 4);
-    ostream = g_io_stream_get_output_stream (TSS2_TCTI_TABRMD_IOSTREAM (context));
-    g_debug ("blocking write on iostream: 0x%" PRIxPTR,
-             (uintptr_t)ostream);
-    write_ret = write_all (ostream, command, size);
-    /* should switch on possible errors to translate to TSS2 error codes */
-    switch (write_ret) {
-    case -1:
-        g_debug ("tss2_tcti_tabrmd_transmit: error writing to pipe: %s",
-                 strerror (errno));
-        tss2_ret = TSS2_TCTI_RC_IO_ERROR;
-        break;
-    case 0:
-        g_debug ("tss2_tcti_tabrmd_transmit: EOF returned writing to pipe");
-        tss2_ret = TSS2_TCTI_RC_NO_CONNECTION;
-        break;
-    default:
-        if (write_ret == (ssize_t) size) {
-            TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_RECEIVE;
-        } else {
-            g_debug ("tss2_tcti_tabrmd_transmit: short write");
-            tss2_ret = TSS2_TCTI_RC_GENERAL_FAILURE;
-        }
-        break;
-    }
-    return tss2_ret;
-}
 /*
  * This function maps errno values to TCTI RCs.
  */
@@ -144,6 +97,147 @@ gerror_code_to_tcti_rc (int error_number)
         return TSS2_TCTI_RC_GENERAL_FAILURE;
     }
 }
+/*
+ * Write as much of the queued command as the socket will take without
+ * blocking. Returns TSS2_TCTI_RC_TRY_AGAIN if some of it is still queued.
+ */
+static TSS2_RC
+tcti_tabrmd_flush (TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx)
+{
+    GPollableOutputStream *ostream;
+    GError *error = NULL;
+    gssize written;
+    TSS2_RC rc;
+
+    ostream = G_POLLABLE_OUTPUT_STREAM (
+        g_io_stream_get_output_stream (TSS2_TCTI_TABRMD_IOSTREAM (tabrmd_ctx)));
+    while (tabrmd_ctx->tx_index < tabrmd_ctx->tx_size) {
+        written = g_pollable_output_stream_write_nonblocking (
+                      ostream,
+                      &tabrmd_ctx->tx_buf [tabrmd_ctx->tx_index],
+                      tabrmd_ctx->tx_size - tabrmd_ctx->tx_index,
+                      NULL,
+                      &error);
+        if (written < 0) {
+            g_debug ("%s: write produced error: %s", __func__, error->message);
+            rc = gerror_code_to_tcti_rc (error->code);
+            g_error_free (error);
+            return rc;
+        } else if (written == 0) {
+            return TSS2_TCTI_RC_NO_CONNECTION;
+        }
+        tabrmd_ctx->tx_index += (size_t)written;
+    }
+    g_clear_pointer (&tabrmd_ctx->tx_buf, g_free);
+    tabrmd_ctx->tx_size = 0;
+    tabrmd_ctx->tx_index = 0;
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Transmit for a context in async mode. A command is taken once any part
+ * of it has been written to the socket; the rest stays queued in the
+ * context and is written by later calls to transmit or receive. If the
+ * socket won't take a single byte the command isn't taken and we return
+ * TSS2_TCTI_RC_TRY_AGAIN.
+ */
+static TSS2_RC
+tcti_tabrmd_transmit_async (TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx,
+                            size_t                    size,
+                            const uint8_t            *command)
+{
+    TSS2_RC rc;
+
+    if (tabrmd_ctx->tx_buf != NULL) {
+        rc = tcti_tabrmd_flush (tabrmd_ctx);
+        if (rc != TSS2_RC_SUCCESS) {
+            return rc;
+        }
+    }
+    tabrmd_ctx->tx_buf = g_memdup (command, size);
+    tabrmd_ctx->tx_size = size;
+    tabrmd_ctx->tx_index = 0;
+    rc = tcti_tabrmd_flush (tabrmd_ctx);
+    if (rc == TSS2_RC_SUCCESS ||
+        (rc == TSS2_TCTI_RC_TRY_AGAIN && tabrmd_ctx->tx_index > 0))
+    {
+        ++tabrmd_ctx->outstanding;
+        tabrmd_ctx->state = TABRMD_STATE_RECEIVE;
+        return TSS2_RC_SUCCESS;
+    }
+    g_clear_pointer (&tabrmd_ctx->tx_buf, g_free);
+    tabrmd_ctx->tx_size = 0;
+    tabrmd_ctx->tx_index = 0;
+    return rc;
+}
+/*
+ * This is the transmit function that is exposed to clients through the
+ * TCTI API.
+ */
+static TSS2_RC
+tss2_tcti_tabrmd_transmit (TSS2_TCTI_CONTEXT *context,
+                           size_t             size,
+                           const uint8_t      *command)
+{
+    ssize_t write_ret;
+    TSS2_RC tss2_ret = TSS2_RC_SUCCESS;
+    GOutputStream *ostream;
+
+    g_debug ("tss2_tcti_tabrmd_transmit");
+    if (context == NULL || command == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (size == 0) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
+        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    /*
+     * With a pipeline depth above 1 the caller may send further commands
+     * before reading the responses to earlier ones.
+     */
+    if (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_TRANSMIT &&
+        (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_RECEIVE ||
+         TSS2_TCTI_TABRMD_PIPELINE_DEPTH (context) < 2 ||
+         TSS2_TCTI_TABRMD_OUTSTANDING (context) >=
+         TSS2_TCTI_TABRMD_PIPELINE_DEPTH (context)))
+    {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    g_debug_bytes (command, size, 16, 4);
+    if (((TSS2_TCTI_TABRMD_CONTEXT*)context)->async) {
+        return tcti_tabrmd_transmit_async ((TSS2_TCTI_TABRMD_CONTEXT*)context,
+                                           size,
+                                           command);
+    }
+    ostream = g_io_stream_get_output_stream (TSS2_TCTI_TABRMD_IOSTREAM (context));
+    g_debug ("blocking write on iostream: 0x%" PRIxPTR,
+             (uintptr_t)ostream);
+    write_ret = write_all (ostream, command, size);
+    /* should switch on possible errors to translate to TSS2 error codes */
+    switch (write_ret) {
+    case -1:
+        g_debug ("tss2_tcti_tabrmd_transmit: error writing to pipe: %s",
+                 strerror (errno));
+        tss2_ret = TSS2_TCTI_RC_IO_ERROR;
+        break;
+    case 0:
+        g_debug ("tss2_tcti_tabrmd_transmit: EOF returned writing to pipe");
+        tss2_ret = TSS2_TCTI_RC_NO_CONNECTION;
+        break;
+    default:
+        if (write_ret == (ssize_t) size) {
+            ++TSS2_TCTI_TABRMD_OUTSTANDING (context);
+            TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_RECEIVE;
+        } else {
+            g_debug ("tss2_tcti_tabrmd_transmit: short write");
+            tss2_ret = TSS2_TCTI_RC_GENERAL_FAILURE;
+        }
+        break;
+    }
+    return tss2_ret;
+}
 /*
  * This is a thin wrapper around a call to poll. It packages up the provided
  * file descriptor and timeout and polls on that same FD for data or a hangup.
@@ -191,6 +285,120 @@ tcti_tabrmd_poll (int        fd,
         return 0;
     }
 }
+/*
+ * Read up to 'count' bytes from the daemon into 'buf' starting at 'index'.
+ * In async mode this never blocks: if the data isn't there yet we return
+ * G_IO_ERROR_WOULD_BLOCK with 'index' updated so the next call picks up
+ * where this one left off. Return values are those of read_data.
+ */
+static int
+tcti_tabrmd_read (TSS2_TCTI_CONTEXT *context,
+                  size_t            *index,
+                  uint8_t           *buf,
+                  size_t             count)
+{
+    GPollableInputStream *istream;
+    GError *error = NULL;
+    gssize num_read;
+    int error_code;
+
+    if (!((TSS2_TCTI_TABRMD_CONTEXT*)context)->async) {
+        return read_data (TSS2_TCTI_TABRMD_ISTREAM (context),
+                          index,
+                          buf,
+                          count);
+    }
+    istream = G_POLLABLE_INPUT_STREAM (TSS2_TCTI_TABRMD_ISTREAM (context));
+    while (count > 0) {
+        num_read = g_pollable_input_stream_read_nonblocking (istream,
+                                                             &buf [*index],
+                                                             count,
+                                                             NULL,
+                                                             &error);
+        if (num_read == 0) {
+            g_debug ("%s: read produced EOF", __func__);
+            return -1;
+        } else if (num_read < 0) {
+            error_code = error->code;
+            g_error_free (error);
+            return error_code;
+        }
+        *index += (size_t)num_read;
+        count -= (size_t)num_read;
+    }
+    return 0;
+}
+/*
+ * A whole response has been read. Stay in the RECEIVE state while responses
+ * to pipelined commands are still to come.
+ */
+static void
+tcti_tabrmd_response_done (TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx)
+{
+    if (tabrmd_ctx->outstanding > 0) {
+        --tabrmd_ctx->outstanding;
+    }
+    tabrmd_ctx->state = tabrmd_ctx->outstanding > 0 ?
+        TABRMD_STATE_RECEIVE : TABRMD_STATE_TRANSMIT;
+}
+/*
+ * Receive a response over a SOCK_SEQPACKET socket. Each response is a
+ * single message so we peek at the header to get the size and then take
+ * the whole message with one call: a read shorter than the message would
+ * throw the rest of it away. There's never part of a response left over
+ * between calls so 'index' isn't used. With MSG_TRUNC recv returns the
+ * length of the message even when it's longer than the size in the header.
+ */
+static TSS2_RC
+tcti_tabrmd_receive_message (TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx,
+                             size_t                   *size,
+                             uint8_t                  *response)
+{
+    int fd = TSS2_TCTI_TABRMD_FD (tabrmd_ctx);
+    size_t msg_size;
+    ssize_t ret;
+
+    ret = TABRMD_ERRNO_EINTR_RETRY (recv (fd,
+                                          tabrmd_ctx->header_buf,
+                                          TPM_HEADER_SIZE,
+                                          MSG_PEEK | MSG_DONTWAIT));
+    if (ret <= 0) {
+        return errno_to_tcti_rc (ret == 0 ? -1 : errno);
+    }
+    msg_size = get_response_size (tabrmd_ctx->header_buf);
+    if ((size_t)ret < TPM_HEADER_SIZE || msg_size < TPM_HEADER_SIZE) {
+        /* drop the message */
+        (void)TABRMD_ERRNO_EINTR_RETRY (recv (fd, NULL, 0, MSG_DONTWAIT));
+        goto malformed;
+    }
+    /* if response is NULL, caller is querying size, we know size isn't NULL */
+    if (response == NULL) {
+        *size = msg_size;
+        return TSS2_RC_SUCCESS;
+    }
+    if (*size < msg_size) {
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+    }
+    ret = TABRMD_ERRNO_EINTR_RETRY (recv (fd,
+                                          response,
+                                          msg_size,
+                                          MSG_TRUNC | MSG_DONTWAIT));
+    if (ret == -1) {
+        return errno_to_tcti_rc (errno);
+    }
+    if ((size_t)ret != msg_size) {
+        g_warning ("%s: message of %zd bytes, header says %zu",
+                   __func__, ret, msg_size);
+        goto malformed;
+    }
+    *size = msg_size;
+    tcti_tabrmd_response_done (tabrmd_ctx);
+    return TSS2_RC_SUCCESS;
+malformed:
+    tabrmd_ctx->outstanding = 0;
+    tabrmd_ctx->state = TABRMD_STATE_TRANSMIT;
+    return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+}
 /*
  * This is the receive function that is exposed to clients through the TCTI
  * API.
@@ -228,21 +436,39 @@ tss2_tcti_tabrmd_receive (TSS2_TCTI_CONTEXT *context,
     if (response != NULL && *size < TPM_HEADER_SIZE) {
         return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
     }
-    ret = tcti_tabrmd_poll (TSS2_TCTI_TABRMD_FD (context), timeout);
-    switch (ret) {
-    case -1:
-        return TSS2_TCTI_RC_TRY_AGAIN;
-    case 0:
-        break;
-    default:
-        return errno_to_tcti_rc (ret);
+    /*
+     * In async mode the end of a pipelined command may still be queued. If
+     * the socket won't take it yet it stays queued for the next call: the
+     * responses to commands already sent may be waiting and the daemon
+     * can't drain our command until we read them. A timeout of 0 means the
+     * caller's event loop says the socket is readable: no need to poll.
+     */
+    if (tabrmd_ctx->tx_buf != NULL) {
+        TSS2_RC rc = tcti_tabrmd_flush (tabrmd_ctx);
+        if (rc != TSS2_RC_SUCCESS && rc != TSS2_TCTI_RC_TRY_AGAIN) {
+            return rc;
+        }
+    }
+    if (!tabrmd_ctx->async || timeout != 0) {
+        ret = tcti_tabrmd_poll (TSS2_TCTI_TABRMD_FD (context), timeout);
+        switch (ret) {
+        case -1:
+            return TSS2_TCTI_RC_TRY_AGAIN;
+        case 0:
+            break;
+        default:
+            return errno_to_tcti_rc (ret);
+        }
+    }
+    if (tabrmd_ctx->seqpacket) {
+        return tcti_tabrmd_receive_message (tabrmd_ctx, size, response);
     }
     /* make sure we've got the response header */
     if (tabrmd_ctx->index < TPM_HEADER_SIZE) {
-        ret = read_data (TSS2_TCTI_TABRMD_ISTREAM (context),
-                         &tabrmd_ctx->index,
-                         tabrmd_ctx->header_buf,
-                         TPM_HEADER_SIZE - tabrmd_ctx->index);
+        ret = tcti_tabrmd_read (context,
+                                &tabrmd_ctx->index,
+                                tabrmd_ctx->header_buf,
+                                TPM_HEADER_SIZE - tabrmd_ctx->index);
         if (ret != 0) {
             return gerror_code_to_tcti_rc (ret);
         }
@@ -251,6 +477,7 @@ tss2_tcti_tabrmd_receive (TSS2_TCTI_CONTEXT *context,
             tabrmd_ctx->header.size = get_response_size (tabrmd_ctx->header_buf);
             tabrmd_ctx->header.code = get_response_code (tabrmd_ctx->header_buf);
             if (tabrmd_ctx->header.size < TPM_HEADER_SIZE) {
+                tabrmd_ctx->outstanding = 0;
                 tabrmd_ctx->state = TABRMD_STATE_TRANSMIT;
                 return TSS2_TCTI_RC_MALFORMED_RESPONSE;
             }
@@ -266,24 +493,198 @@ tss2_tcti_tabrmd_receive (TSS2_TCTI_CONTEXT *context,
     }
     if (tabrmd_ctx->header.size == TPM_HEADER_SIZE) {
         tabrmd_ctx->index = 0;
-        tabrmd_ctx->state = TABRMD_STATE_TRANSMIT;
+        tcti_tabrmd_response_done (tabrmd_ctx);
         return TSS2_RC_SUCCESS;
     }
     if (*size < tabrmd_ctx->header.size) {
         return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
     }
-    ret = read_data (TSS2_TCTI_TABRMD_ISTREAM (context),
-                     &tabrmd_ctx->index,
-                     response,
-                     tabrmd_ctx->header.size - tabrmd_ctx->index);
+    ret = tcti_tabrmd_read (context,
+                            &tabrmd_ctx->index,
+                            response,
+                            tabrmd_ctx->header.size - tabrmd_ctx->index);
+    if (ret != 0 && tabrmd_ctx->async) {
+        return gerror_code_to_tcti_rc (ret);
+    }
     if (ret == 0) {
         /* We got all the bytes we asked for, reset the index & state: done */
         *size = tabrmd_ctx->index;
         tabrmd_ctx->index = 0;
-        tabrmd_ctx->state = TABRMD_STATE_TRANSMIT;
+        tcti_tabrmd_response_done (tabrmd_ctx);
     }
     return errno_to_tcti_rc (ret);
 }
+/*
+ * Read from the daemon into 'buf' until 'index' reaches 'size', waiting
+ * for data as long as it takes.
+ */
+static TSS2_RC
+tcti_tabrmd_read_blocking (TSS2_TCTI_CONTEXT *context,
+                           size_t            *index,
+                           uint8_t           *buf,
+                           size_t             size)
+{
+    int ret;
+
+    while (*index < size) {
+        ret = tcti_tabrmd_poll (TSS2_TCTI_TABRMD_FD (context),
+                                TSS2_TCTI_TIMEOUT_BLOCK);
+        if (ret != 0) {
+            return errno_to_tcti_rc (ret);
+        }
+        ret = read_data (TSS2_TCTI_TABRMD_ISTREAM (context),
+                         index,
+                         buf,
+                         size - *index);
+        if (ret != 0 && ret != G_IO_ERROR_WOULD_BLOCK) {
+            return gerror_code_to_tcti_rc (ret);
+        }
+    }
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Check that 'commands' holds whole TPM commands back to back and count
+ * them.
+ */
+static TSS2_RC
+tcti_tabrmd_batch_count (const uint8_t *commands,
+                         size_t         commands_size,
+                         size_t        *count)
+{
+    size_t offset, command_size;
+
+    *count = 0;
+    for (offset = 0; offset < commands_size; offset += command_size) {
+        if (commands_size - offset < TPM_HEADER_SIZE) {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        command_size = get_command_size ((uint8_t*)&commands [offset]);
+        if (command_size < TPM_HEADER_SIZE ||
+            command_size > commands_size - offset ||
+            command_size > UTIL_BUF_MAX)
+        {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        if (++*count > TABRMD_BATCH_COUNT_MAX) {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+    }
+    return *count > 0 ? TSS2_RC_SUCCESS : TSS2_TCTI_RC_BAD_VALUE;
+}
+/*
+ * Send a batch of commands to the daemon in a single frame and wait for
+ * the frame holding the responses. The batch is a complete exchange: the
+ * context must be ready to transmit and is ready to transmit again when
+ * this function returns. If 'responses' is too small the responses are
+ * discarded, 'responses_size' is set to the size required and
+ * TSS2_TCTI_RC_INSUFFICIENT_BUFFER is returned.
+ */
+TSS2_RC
+Tss2_Tcti_Tabrmd_Batch (TSS2_TCTI_CONTEXT *context,
+                        const uint8_t     *commands,
+                        size_t             commands_size,
+                        uint8_t           *responses,
+                        size_t            *responses_size,
+                        size_t            *response_count,
+                        uint32_t           flags)
+{
+    uint8_t header [TPM_HEADER_SIZE];
+    uint8_t *frame = NULL;
+    size_t count, index = 0, frame_size;
+    ssize_t write_ret;
+    GOutputStream *ostream;
+    TSS2_RC rc;
+    int error = 0;
+
+    g_debug ("%s", __func__);
+    if (context == NULL || commands == NULL || responses == NULL ||
+        responses_size == NULL || response_count == NULL)
+    {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
+        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_TRANSMIT) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    if (flags & ~(uint32_t)TSS2_TCTI_TABRMD_BATCH_STOP_ON_ERROR) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    rc = tcti_tabrmd_batch_count (commands, commands_size, &count);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    frame_size = TPM_HEADER_SIZE + commands_size;
+    frame = g_malloc (frame_size);
+    set_response_tag (frame, TABRMD_BATCH_TAG);
+    set_response_size (frame, frame_size);
+    set_response_code (frame, flags);
+    memcpy (&frame [TPM_HEADER_SIZE], commands, commands_size);
+    g_debug ("%s: sending batch of %zu commands, 0x%zx bytes",
+             __func__, count, frame_size);
+    ostream = g_io_stream_get_output_stream (TSS2_TCTI_TABRMD_IOSTREAM (context));
+    write_ret = write_all (ostream, frame, frame_size);
+    g_clear_pointer (&frame, g_free);
+    if (write_ret != (ssize_t)frame_size) {
+        g_debug ("%s: failed to write batch", __func__);
+        return write_ret == 0 ? TSS2_TCTI_RC_NO_CONNECTION :
+                                TSS2_TCTI_RC_IO_ERROR;
+    }
+    if (((TSS2_TCTI_TABRMD_CONTEXT*)context)->seqpacket) {
+        /* the response frame is one message, it must be read in one go */
+        do {
+            rc = errno_to_tcti_rc (tcti_tabrmd_poll (TSS2_TCTI_TABRMD_FD (context),
+                                                     TSS2_TCTI_TIMEOUT_BLOCK));
+            if (rc != TSS2_RC_SUCCESS) {
+                return rc;
+            }
+            frame = read_tpm_message_alloc (TSS2_TCTI_TABRMD_SOCKET (context),
+                                            TABRMD_BATCH_SIZE_MAX,
+                                            &frame_size,
+                                            &error);
+        } while (frame == NULL && error == EAGAIN);
+        if (frame == NULL) {
+            return error == 0 ? TSS2_TCTI_RC_NO_CONNECTION :
+                                TSS2_TCTI_RC_IO_ERROR;
+        }
+        memcpy (header, frame, TPM_HEADER_SIZE);
+        if (get_response_tag (header) != TABRMD_BATCH_TAG) {
+            rc = TSS2_TCTI_RC_MALFORMED_RESPONSE;
+            goto out;
+        }
+    } else {
+        rc = tcti_tabrmd_read_blocking (context, &index, header, TPM_HEADER_SIZE);
+        if (rc != TSS2_RC_SUCCESS) {
+            return rc;
+        }
+        frame_size = get_response_size (header);
+        if (get_response_tag (header) != TABRMD_BATCH_TAG ||
+            frame_size < TPM_HEADER_SIZE ||
+            frame_size > TABRMD_BATCH_SIZE_MAX)
+        {
+            return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+        }
+        frame = g_malloc (frame_size);
+        memcpy (frame, header, TPM_HEADER_SIZE);
+        rc = tcti_tabrmd_read_blocking (context, &index, frame, frame_size);
+        if (rc != TSS2_RC_SUCCESS) {
+            goto out;
+        }
+    }
+    if (*responses_size < frame_size - TPM_HEADER_SIZE) {
+        *responses_size = frame_size - TPM_HEADER_SIZE;
+        rc = TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+        goto out;
+    }
+    *responses_size = frame_size - TPM_HEADER_SIZE;
+    *response_count = get_response_code (header);
+    memcpy (responses, &frame [TPM_HEADER_SIZE], *responses_size);
+out:
+    g_free (frame);
+    return rc;
+}
 
 static void
 tss2_tcti_tabrmd_finalize (TSS2_TCTI_CONTEXT *context)
@@ -294,6 +695,7 @@ tss2_tcti_tabrmd_finalize (TSS2_TCTI_CONTEXT *context)
         return;
     }
     TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_FINAL;
+    g_clear_pointer (&((TSS2_TCTI_TABRMD_CONTEXT*)context)->tx_buf, g_free);
     g_clear_object (&TSS2_TCTI_TABRMD_SOCK_CONNECT (context));
     g_clear_object (&TSS2_TCTI_TABRMD_PROXY (context));
 }
@@ -313,6 +715,10 @@ tss2_tcti_tabrmd_cancel (TSS2_TCTI_CONTEXT *context)
     if (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_RECEIVE) {
         return TSS2_TCTI_RC_BAD_SEQUENCE;
     }
+    /* connected over the Unix socket, there's no dbus proxy */
+    if (TSS2_TCTI_TABRMD_PROXY (context) == NULL) {
+        return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+    }
     cancel_ret = tcti_tabrmd_call_cancel_sync (
                      TSS2_TCTI_TABRMD_PROXY (context),
                      TSS2_TCTI_TABRMD_ID (context),
@@ -346,6 +752,14 @@ tss2_tcti_tabrmd_get_poll_handles (TSS2_TCTI_CONTEXT     *context,
     *num_handles = 1;
     if (handles != NULL) {
         handles [0].fd = TSS2_TCTI_TABRMD_FD (context);
+        /*
+         * While part of a command is queued (async mode only) the caller
+         * must wait for room in the socket, otherwise for a response.
+         */
+        handles [0].events =
+            ((TSS2_TCTI_TABRMD_CONTEXT*)context)->tx_buf != NULL ?
+            POLLOUT : POLLIN;
+        handles [0].revents = 0;
     }
     return TSS2_RC_SUCCESS;
 }
@@ -366,6 +780,9 @@ tss2_tcti_tabrmd_set_locality (TSS2_TCTI_CONTEXT *context,
     if (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_TRANSMIT) {
         return TSS2_TCTI_RC_BAD_SEQUENCE;
     }
+    if (TSS2_TCTI_TABRMD_PROXY (context) == NULL) {
+        return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+    }
     status = tcti_tabrmd_call_set_locality_sync (
                  TSS2_TCTI_TABRMD_PROXY (context),
                  TSS2_TCTI_TABRMD_ID (context),
@@ -395,6 +812,7 @@ init_tcti_data (TSS2_TCTI_CONTEXT *context)
     TSS2_TCTI_MAGIC (context)            = TSS2_TCTI_TABRMD_MAGIC;
     TSS2_TCTI_VERSION (context)          = TSS2_TCTI_TABRMD_VERSION;
     TSS2_TCTI_TABRMD_STATE (context)     = TABRMD_STATE_TRANSMIT;
+    TSS2_TCTI_TABRMD_PIPELINE_DEPTH (context) = 1;
     TSS2_TCTI_TRANSMIT (context)         = tss2_tcti_tabrmd_transmit;
     TSS2_TCTI_RECEIVE (context)          = tss2_tcti_tabrmd_receive;
     TSS2_TCTI_FINALIZE (context)         = tss2_tcti_tabrmd_finalize;
@@ -403,17 +821,51 @@ init_tcti_data (TSS2_TCTI_CONTEXT *context)
     TSS2_TCTI_SET_LOCALITY (context)     = tss2_tcti_tabrmd_set_locality;
 }
 
+/*
+ * Ask the daemon for a new connection. When flags are set we call
+ * CreateConnectionWithFlags. A daemon that doesn't know this method gets
+ * the plain CreateConnection call: the caller finds out which transport it
+ * got from the type of the socket returned.
+ */
 static gboolean
 tcti_tabrmd_call_create_connection_sync_fdlist (TctiTabrmd     *proxy,
+                                                guint32         flags,
                                                 GVariant      **out_fds,
                                                 guint64        *out_id,
                                                 GUnixFDList   **out_fd_list,
                                                 GCancellable   *cancellable,
                                                 GError        **error)
 {
-    GVariant *_ret;
+    GVariant *_ret = NULL;
+    GError *flags_error = NULL;
+
+    if (flags != 0) {
+        _ret = g_dbus_proxy_call_with_unix_fd_list_sync (G_DBUS_PROXY (proxy),
+            TABRMD_DBUS_METHOD_CREATE_CONNECTION_WITH_FLAGS,
+            g_variant_new ("(u)", flags),
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            NULL,
+            out_fd_list,
+            cancellable,
+            &flags_error);
+        if (_ret != NULL) {
+            goto _get;
+        }
+        if (!g_error_matches (flags_error,
+                              G_DBUS_ERROR,
+                              G_DBUS_ERROR_UNKNOWN_METHOD)) {
+            g_propagate_error (error, flags_error);
+            goto _out;
+        }
+        g_debug ("%s: daemon doesn't support %s, falling back to %s",
+                 __func__,
+                 TABRMD_DBUS_METHOD_CREATE_CONNECTION_WITH_FLAGS,
+                 TABRMD_DBUS_METHOD_CREATE_CONNECTION);
+        g_error_free (flags_error);
+    }
     _ret = g_dbus_proxy_call_with_unix_fd_list_sync (G_DBUS_PROXY (proxy),
-        "CreateConnection",
+        TABRMD_DBUS_METHOD_CREATE_CONNECTION,
         g_variant_new ("()"),
         G_DBUS_CALL_FLAGS_NONE,
         -1,
@@ -424,6 +876,7 @@ tcti_tabrmd_call_create_connection_sync_fdlist (TctiTabrmd     *proxy,
     if (_ret == NULL) {
         goto _out;
     }
+_get:
     g_variant_get (_ret, "(@aht)", out_fds, out_id);
     g_variant_unref (_ret);
 _out:
@@ -486,6 +939,40 @@ tabrmd_kv_callback (const key_value_t *key_value,
             return TSS2_TCTI_RC_BAD_VALUE;
         }
         return TSS2_RC_SUCCESS;
+    } else if (strcmp (key_value->key, "socket") == 0) {
+        tabrmd_conf->socket_path = key_value->value;
+        return TSS2_RC_SUCCESS;
+    } else if (strcmp (key_value->key, "mode") == 0) {
+        if (strcmp (key_value->value, "async") == 0) {
+            tabrmd_conf->async = TRUE;
+        } else if (strcmp (key_value->value, "blocking") == 0) {
+            tabrmd_conf->async = FALSE;
+        } else {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        return TSS2_RC_SUCCESS;
+    } else if (strcmp (key_value->key, "transport") == 0) {
+        if (strcmp (key_value->value, "seqpacket") == 0) {
+            tabrmd_conf->seqpacket = TRUE;
+        } else if (strcmp (key_value->value, "stream") == 0) {
+            tabrmd_conf->seqpacket = FALSE;
+        } else {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        return TSS2_RC_SUCCESS;
+    } else if (strcmp (key_value->key, "pipeline_depth") == 0) {
+        char *end = NULL;
+        unsigned long depth;
+
+        errno = 0;
+        depth = strtoul (key_value->value, &end, 10);
+        if (errno != 0 || end == key_value->value || *end != '\0' ||
+            depth < 1 || depth > TABRMD_PIPELINE_DEPTH_MAX)
+        {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        tabrmd_conf->pipeline_depth = (guint)depth;
+        return TSS2_RC_SUCCESS;
     } else {
         return TSS2_TCTI_RC_BAD_VALUE;
     }
@@ -498,11 +985,14 @@ tabrmd_kv_callback (const key_value_t *key_value,
  * ID used when sending commands over the dbus interface.
  *
  * The proxy object in the context structure must be created / valid before
- * calling this function.
+ * calling this function. If the 'seqpacket' field in the context is set we
+ * ask the daemon for a SOCK_SEQPACKET socket. On return it's set according
+ * to the socket we actually got.
  */
 TSS2_RC
 tcti_tabrmd_connect (TSS2_TCTI_CONTEXT *context)
 {
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)context;
     GError *error = NULL;
     GSocket *sock = NULL;
     GUnixFDList *fd_list = NULL;
@@ -513,6 +1003,7 @@ tcti_tabrmd_connect (TSS2_TCTI_CONTEXT *context)
 
     call_ret = tcti_tabrmd_call_create_connection_sync_fdlist (
         TSS2_TCTI_TABRMD_PROXY (context),
+        tabrmd_ctx->seqpacket ? TABRMD_CONNECTION_FLAG_SEQPACKET : 0,
         &fds_variant,
         &id,
         &fd_list,
@@ -544,6 +1035,16 @@ tcti_tabrmd_connect (TSS2_TCTI_CONTEXT *context)
         goto out;
     }
     sock = g_socket_new_from_fd (fd, NULL);
+    if (sock == NULL) {
+        g_critical ("unable to create GSocket from fd %d", fd);
+        rc = TSS2_TCTI_RC_GENERAL_FAILURE;
+        goto out;
+    }
+    /* an older daemon hands us a SOCK_STREAM socket whatever we asked for */
+    tabrmd_ctx->seqpacket =
+        g_socket_get_socket_type (sock) == G_SOCKET_TYPE_SEQPACKET;
+    g_debug ("%s: got %s socket from daemon", __func__,
+             tabrmd_ctx->seqpacket ? "SOCK_SEQPACKET" : "SOCK_STREAM");
     TSS2_TCTI_TABRMD_SOCK_CONNECT (context) = \
         g_socket_connection_factory_create_connection (sock);
     TSS2_TCTI_TABRMD_ID (context) = id;
@@ -555,13 +1056,63 @@ out:
     return rc;
 }
 
+/*
+ * Establish a connection with the daemon over the Unix socket at 'path'
+ * instead of through the CreateConnection dbus method. The daemon sends
+ * the connection ID as soon as it accepts the connection, after that the
+ * socket carries commands and responses as usual. No dbus proxy is
+ * created so cancel and setLocality aren't available on this connection.
+ */
+static TSS2_RC
+tcti_tabrmd_connect_socket (TSS2_TCTI_CONTEXT *context,
+                            const char        *path)
+{
+    GError *error = NULL;
+    GSocketClient *client;
+    GSocketAddress *address;
+    GSocketConnection *sock_connect;
+    guint64 id = 0;
+    size_t index = 0;
+    int ret;
+
+    client = g_socket_client_new ();
+    address = g_unix_socket_address_new (path);
+    sock_connect = g_socket_client_connect (client,
+                                            G_SOCKET_CONNECTABLE (address),
+                                            NULL,
+                                            &error);
+    g_object_unref (address);
+    g_object_unref (client);
+    if (sock_connect == NULL) {
+        g_warning ("Failed to connect to socket %s: %s", path, error->message);
+        g_error_free (error);
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    }
+    ret = read_data (g_io_stream_get_input_stream (G_IO_STREAM (sock_connect)),
+                     &index,
+                     (uint8_t*)&id,
+                     sizeof (id));
+    if (ret != 0) {
+        g_warning ("Failed to read connection ID from socket %s", path);
+        g_object_unref (sock_connect);
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    }
+    TSS2_TCTI_TABRMD_SOCK_CONNECT (context) = sock_connect;
+    TSS2_TCTI_TABRMD_ID (context) = id;
+    return TSS2_RC_SUCCESS;
+}
+
 /*
  * The longest configuration string we'll take. Each dbus name can be 255
  * characters long (see dbus spec). The bus_types that we support are
  * 'system' or 'session' (255 + 7 = 262). 'bus_type=' and 'bus_name=' are
- * each another 9 characters for a total of 280.
+ * each another 9 characters for a total of 280. 'pipeline_depth=' with a
+ * two digit value and a separator brings this to 298. 'mode=blocking' and
+ * a separator are another 14 for a total of 312. A Unix socket path is at
+ * most 107 characters, with 'socket=' and a separator that's 115 more for
+ * a total of 427. 'transport=seqpacket' and a separator bring us to 447.
  */
-#define CONF_STRING_MAX 280
+#define CONF_STRING_MAX 450
 TSS2_RC
 Tss2_Tcti_Tabrmd_Init (TSS2_TCTI_CONTEXT *context,
                        size_t            *size,
@@ -600,6 +1151,17 @@ Tss2_Tcti_Tabrmd_Init (TSS2_TCTI_CONTEXT *context,
     /* Register dbus error mapping for tabrmd. Gets us RCs from Gerror codes */
     TABRMD_ERROR;
     init_tcti_data (context);
+    TSS2_TCTI_TABRMD_PIPELINE_DEPTH (context) = tabrmd_conf.pipeline_depth;
+    ((TSS2_TCTI_TABRMD_CONTEXT*)context)->async = tabrmd_conf.async;
+    if (tabrmd_conf.socket_path != NULL) {
+        rc = tcti_tabrmd_connect_socket (context, tabrmd_conf.socket_path);
+        if (rc == TSS2_RC_SUCCESS) {
+            g_debug ("initialized tabrmd TCTI context with id: 0x%" PRIx64
+                     " over socket %s", TSS2_TCTI_TABRMD_ID (context),
+                     tabrmd_conf.socket_path);
+        }
+        goto out;
+    }
     TSS2_TCTI_TABRMD_PROXY (context) =
         tcti_tabrmd_proxy_new_for_bus_sync (tabrmd_conf.bus_type,
                                             G_DBUS_PROXY_FLAGS_NONE,
@@ -612,6 +1174,7 @@ Tss2_Tcti_Tabrmd_Init (TSS2_TCTI_CONTEXT *context,
         rc = TSS2_TCTI_RC_NO_CONNECTION;
         goto out;
     }
+    ((TSS2_TCTI_TABRMD_CONTEXT*)context)->seqpacket = tabrmd_conf.seqpacket;
     rc = tcti_tabrmd_connect (context);
     if (rc == TSS2_RC_SUCCESS) {
         g_debug ("initialized tabrmd TCTI context with id: 0x%" PRIx64,
@@ -632,7 +1195,8 @@ static const TSS2_TCTI_INFO tss2_tcti_info = {
     .config_help = "This conf string is a series of key / value pairs " \
         "where keys and values are separated by the '=' character and " \
         "each pair is separated by the ',' character. Valid keys are " \
-        "\"bus_name\" and \"bus_type\".",
+        "\"bus_name\", \"bus_type\", \"socket\", \"mode\", " \
+        "\"transport\" and \"pipeline_depth\".",
     .init = Tss2_Tcti_Tabrmd_Init,
 };
 
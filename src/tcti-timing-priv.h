@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TSS2TCTI_TIMING_PRIV_H
+#define TSS2TCTI_TIMING_PRIV_H
+
+#include <glib.h>
+#include <stdio.h>
+#include <tss2/tss2_tcti.h>
+
+#include "util.h"
+
+#define TSS2_TCTI_TIMING_MAGIC 0x8f3bd56a1e0c4b27
+#define TSS2_TCTI_TIMING_VERSION 2
+
+/* upper bound on injected latency / jitter: 10 seconds per command */
+#define TIMING_DELAY_US_MAX 10000000
+#define TIMING_LOG_HEADER "sequence,command_code,command_size,response_code," \
+    "response_size,transmit_ns,tpm_ns,injected_ns\n"
+
+#define TSS2_TCTI_TIMING_CHILD(context) \
+    ((TSS2_TCTI_TIMING_CONTEXT*)context)->child
+
+/*
+ * This is our private TCTI structure. Like every other TCTI it begins with
+ * the TSS2_TCTI_CONTEXT_COMMON_V1 structure. Everything after it is private
+ * to the timing wrapper. The 'child' context is the TCTI that we forward
+ * all calls to. The 'transmit_ns', 'command_code' and 'command_size' fields
+ * are populated by a successful call to transmit and consumed by the next
+ * successful call to receive.
+ */
+typedef struct {
+    TSS2_TCTI_CONTEXT_COMMON_V1    common;
+    TSS2_TCTI_CONTEXT             *child;
+    void                          *child_dl_handle;
+    FILE                          *log;
+    guint64                        latency_us;
+    guint64                        jitter_us;
+    GRand                         *rand;
+    guint64                        sequence;
+    guint64                        transmit_ns;
+    TPM2_CC                        command_code;
+    size_t                         command_size;
+    gboolean                       pending;
+} TSS2_TCTI_TIMING_CONTEXT;
+
+#define TIMING_CONF_INIT_DEFAULT { \
+    .log = NULL, \
+    .latency_us = 0, \
+    .jitter_us = 0, \
+    .tcti_name = NULL, \
+    .tcti_conf = NULL, \
+}
+
+/*
+ * Configuration for the timing TCTI. The 'tcti_name' and 'tcti_conf' fields
+ * describe the TCTI that we wrap. All strings point into the conf string
+ * passed to tcti_timing_conf_parse.
+ */
+typedef struct {
+    const char *log;
+    guint64 latency_us;
+    guint64 jitter_us;
+    const char *tcti_name;
+    const char *tcti_conf;
+} timing_conf_t;
+
+const TSS2_TCTI_INFO* Tss2_Tcti_Info (void);
+TSS2_RC timing_kv_callback (const key_value_t *key_value,
+                            gpointer user_data);
+TSS2_RC tcti_timing_conf_parse (char *conf,
+                                timing_conf_t *timing_conf);
+void tcti_timing_init_context (TSS2_TCTI_CONTEXT *context,
+                               TSS2_TCTI_CONTEXT *child,
+                               void *child_dl_handle,
+                               FILE *log,
+                               const timing_conf_t *timing_conf);
+
+#endif /* TSS2TCTI_TIMING_PRIV_H */
@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <dlfcn.h>
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tss2-tcti-timing.h"
+#include "tcti-timing-priv.h"
+#include "tcti-util.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+/*
+ * The timing TCTI is a pass-through wrapper around another TCTI. Every call
+ * is forwarded to the wrapped (child) TCTI unmodified. The time between a
+ * successful transmit and the successful receive that follows it is the
+ * time the TPM (and the driver below it) spent executing the command. This
+ * is written to a CSV log, one line per command, along with any latency
+ * that we were configured to inject before handing the response back to
+ * the caller.
+ */
+static guint64
+timing_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (guint64)ts.tv_sec * G_GUINT64_CONSTANT (1000000000) +
+        (guint64)ts.tv_nsec;
+}
+
+static TSS2_RC
+timing_context_check (TSS2_TCTI_CONTEXT *context)
+{
+    if (context == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TIMING_MAGIC ||
+        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TIMING_VERSION ||
+        TSS2_TCTI_TIMING_CHILD (context) == NULL) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC
+tss2_tcti_timing_transmit (TSS2_TCTI_CONTEXT *context,
+                           size_t             size,
+                           const uint8_t      *command)
+{
+    TSS2_TCTI_TIMING_CONTEXT *timing = (TSS2_TCTI_TIMING_CONTEXT*)context;
+    TSS2_RC rc;
+
+    rc = timing_context_check (context);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    if (command != NULL && size >= TPM_HEADER_SIZE) {
+        timing->command_code = get_command_code ((uint8_t*)command);
+    } else {
+        timing->command_code = 0;
+    }
+    timing->command_size = size;
+    timing->transmit_ns = timing_now_ns ();
+    rc = Tss2_Tcti_Transmit (timing->child, size, command);
+    timing->pending = (rc == TSS2_RC_SUCCESS) ? TRUE : FALSE;
+
+    return rc;
+}
+/*
+ * Calculate the delay to inject for a single command in microseconds:
+ * the configured latency plus a uniformly distributed value between 0
+ * and the configured jitter.
+ */
+static guint64
+timing_injected_us (TSS2_TCTI_TIMING_CONTEXT *timing)
+{
+    guint64 delay = timing->latency_us;
+
+    if (timing->jitter_us > 0) {
+        delay += (guint64)g_rand_double_range (timing->rand,
+                                               0,
+                                               (gdouble)timing->jitter_us + 1);
+    }
+    return delay;
+}
+
+static void
+timing_log_record (TSS2_TCTI_TIMING_CONTEXT *timing,
+                   const uint8_t *response,
+                   size_t size,
+                   guint64 tpm_ns,
+                   guint64 injected_ns)
+{
+    TSS2_RC response_code = 0;
+
+    if (timing->log == NULL) {
+        return;
+    }
+    if (size >= TPM_HEADER_SIZE) {
+        response_code = get_response_code ((uint8_t*)response);
+    }
+    fprintf (timing->log,
+             "%" PRIu64 ",0x%08" PRIx32 ",%zu,0x%08" PRIx32 ",%zu,%"
+             PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+             timing->sequence,
+             timing->command_code,
+             timing->command_size,
+             response_code,
+             size,
+             timing->transmit_ns,
+             tpm_ns,
+             injected_ns);
+}
+
+static TSS2_RC
+tss2_tcti_timing_receive (TSS2_TCTI_CONTEXT *context,
+                          size_t            *size,
+                          uint8_t           *response,
+                          int32_t            timeout)
+{
+    TSS2_TCTI_TIMING_CONTEXT *timing = (TSS2_TCTI_TIMING_CONTEXT*)context;
+    guint64 tpm_ns, injected_us = 0;
+    TSS2_RC rc;
+
+    rc = timing_context_check (context);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    rc = Tss2_Tcti_Receive (timing->child, size, response, timeout);
+    /*
+     * A receive with a NULL response buffer is only a query for the
+     * response size. Only a successful receive of the full response
+     * completes the command.
+     */
+    if (rc != TSS2_RC_SUCCESS || response == NULL || !timing->pending) {
+        return rc;
+    }
+    tpm_ns = timing_now_ns () - timing->transmit_ns;
+    timing->pending = FALSE;
+    injected_us = timing_injected_us (timing);
+    if (injected_us > 0) {
+        g_usleep ((gulong)injected_us);
+    }
+    timing_log_record (timing, response, *size, tpm_ns, injected_us * 1000);
+    ++timing->sequence;
+
+    return rc;
+}
+
+static void
+tss2_tcti_timing_finalize (TSS2_TCTI_CONTEXT *context)
+{
+    TSS2_TCTI_TIMING_CONTEXT *timing = (TSS2_TCTI_TIMING_CONTEXT*)context;
+
+    if (timing_context_check (context) != TSS2_RC_SUCCESS) {
+        return;
+    }
+    Tss2_Tcti_Finalize (timing->child);
+    g_clear_pointer (&timing->child, g_free);
+    if (timing->log != NULL) {
+        fclose (timing->log);
+        timing->log = NULL;
+    }
+    g_clear_pointer (&timing->rand, g_rand_free);
+#if !defined (DISABLE_DLCLOSE)
+    if (timing->child_dl_handle != NULL) {
+        dlclose (timing->child_dl_handle);
+    }
+#endif
+    timing->child_dl_handle = NULL;
+}
+
+static TSS2_RC
+tss2_tcti_timing_cancel (TSS2_TCTI_CONTEXT *context)
+{
+    TSS2_TCTI_TIMING_CONTEXT *timing = (TSS2_TCTI_TIMING_CONTEXT*)context;
+    TSS2_RC rc;
+
+    rc = timing_context_check (context);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    rc = Tss2_Tcti_Cancel (timing->child);
+    if (rc == TSS2_RC_SUCCESS) {
+        timing->pending = FALSE;
+    }
+    return rc;
+}
+
+static TSS2_RC
+tss2_tcti_timing_get_poll_handles (TSS2_TCTI_CONTEXT     *context,
+                                   TSS2_TCTI_POLL_HANDLE *handles,
+                                   size_t                *num_handles)
+{
+    TSS2_RC rc;
+
+    rc = timing_context_check (context);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    return Tss2_Tcti_GetPollHandles (TSS2_TCTI_TIMING_CHILD (context),
+                                     handles,
+                                     num_handles);
+}
+
+static TSS2_RC
+tss2_tcti_timing_set_locality (TSS2_TCTI_CONTEXT *context,
+                               uint8_t            locality)
+{
+    TSS2_RC rc;
+
+    rc = timing_context_check (context);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    return Tss2_Tcti_SetLocality (TSS2_TCTI_TIMING_CHILD (context), locality);
+}
+/*
+ * Populate the timing TCTI context structure. The context takes ownership
+ * of the 'child' context, the 'child_dl_handle' and the 'log' FILE.
+ */
+void
+tcti_timing_init_context (TSS2_TCTI_CONTEXT *context,
+                          TSS2_TCTI_CONTEXT *child,
+                          void *child_dl_handle,
+                          FILE *log,
+                          const timing_conf_t *timing_conf)
+{
+    TSS2_TCTI_TIMING_CONTEXT *timing = (TSS2_TCTI_TIMING_CONTEXT*)context;
+
+    memset (context, 0, sizeof (TSS2_TCTI_TIMING_CONTEXT));
+
+    TSS2_TCTI_MAGIC (context)            = TSS2_TCTI_TIMING_MAGIC;
+    TSS2_TCTI_VERSION (context)          = TSS2_TCTI_TIMING_VERSION;
+    TSS2_TCTI_TRANSMIT (context)         = tss2_tcti_timing_transmit;
+    TSS2_TCTI_RECEIVE (context)          = tss2_tcti_timing_receive;
+    TSS2_TCTI_FINALIZE (context)         = tss2_tcti_timing_finalize;
+    TSS2_TCTI_CANCEL (context)           = tss2_tcti_timing_cancel;
+    TSS2_TCTI_GET_POLL_HANDLES (context) = tss2_tcti_timing_get_poll_handles;
+    TSS2_TCTI_SET_LOCALITY (context)     = tss2_tcti_timing_set_locality;
+
+    timing->child = child;
+    timing->child_dl_handle = child_dl_handle;
+    timing->log = log;
+    timing->latency_us = timing_conf->latency_us;
+    timing->jitter_us = timing_conf->jitter_us;
+    timing->rand = g_rand_new ();
+}
+/*
+ * Parse a delay value in microseconds from the provided string.
+ */
+static TSS2_RC
+timing_parse_delay (const char *value,
+                    guint64 *delay)
+{
+    char *end = NULL;
+    guint64 tmp;
+
+    errno = 0;
+    tmp = g_ascii_strtoull (value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' ||
+        tmp > TIMING_DELAY_US_MAX) {
+        g_warning ("%s: invalid delay value: \"%s\"", __func__, value);
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    *delay = tmp;
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+timing_kv_callback (const key_value_t *key_value,
+                    gpointer user_data)
+{
+    timing_conf_t *timing_conf = (timing_conf_t*)user_data;
+
+    if (key_value == NULL || user_data == NULL) {
+        g_warning ("%s passed NULL parameter", __func__);
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+    }
+    g_debug ("key: %s / value: %s\n", key_value->key, key_value->value);
+    if (strcmp (key_value->key, "log") == 0) {
+        timing_conf->log = key_value->value;
+        return TSS2_RC_SUCCESS;
+    } else if (strcmp (key_value->key, "latency") == 0) {
+        return timing_parse_delay (key_value->value, &timing_conf->latency_us);
+    } else if (strcmp (key_value->key, "jitter") == 0) {
+        return timing_parse_delay (key_value->value, &timing_conf->jitter_us);
+    } else {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+}
+/*
+ * The conf string for the timing TCTI is a series of key / value pairs
+ * just like the tabrmd TCTI. The 'tcti' key is special: it must be the
+ * last key and its value extends to the end of the string. This is
+ * because the conf string for the wrapped TCTI may itself contain the ','
+ * and '=' characters. The value is split on the first ':' into the name
+ * of the wrapped TCTI and its conf string, just like the --tcti option to
+ * the daemon.
+ *
+ * NOTE: this function modifies the 'conf' string.
+ */
+TSS2_RC
+tcti_timing_conf_parse (char *conf,
+                        timing_conf_t *timing_conf)
+{
+    char *tcti, *split;
+    gboolean tcti_only = FALSE;
+
+    if (conf == NULL || timing_conf == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (strncmp (conf, "tcti=", strlen ("tcti=")) == 0) {
+        tcti = conf;
+        tcti_only = TRUE;
+    } else {
+        tcti = strstr (conf, ",tcti=");
+        if (tcti != NULL) {
+            tcti [0] = '\0';
+            ++tcti;
+        }
+    }
+    if (tcti != NULL) {
+        tcti += strlen ("tcti=");
+        split = strchr (tcti, ':');
+        if (split != NULL) {
+            split [0] = '\0';
+            timing_conf->tcti_conf = &split [1];
+        }
+        if (tcti [0] == '\0') {
+            g_warning ("%s: empty TCTI name", __func__);
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        timing_conf->tcti_name = tcti;
+    }
+    if (tcti_only) {
+        return TSS2_RC_SUCCESS;
+    }
+    return parse_key_value_string (conf, timing_kv_callback, timing_conf);
+}
+/*
+ * Open the log file and write the CSV header. The log is line buffered
+ * so that every completed command is visible to a reader immediately.
+ */
+static FILE*
+timing_log_open (const char *filename)
+{
+    FILE *log;
+
+    log = fopen (filename, "w");
+    if (log == NULL) {
+        g_warning ("failed to open timing log \"%s\": %s",
+                   filename, strerror (errno));
+        return NULL;
+    }
+    setvbuf (log, NULL, _IOLBF, 0);
+    fputs (TIMING_LOG_HEADER, log);
+
+    return log;
+}
+
+#define CONF_STRING_MAX 4096
+TSS2_RC
+Tss2_Tcti_Timing_Init (TSS2_TCTI_CONTEXT *context,
+                       size_t            *size,
+                       const char        *conf)
+{
+    char *conf_copy = NULL;
+    const TSS2_TCTI_INFO *child_info = NULL;
+    TSS2_TCTI_CONTEXT *child = NULL;
+    void *child_dl_handle = NULL;
+    FILE *log = NULL;
+    TSS2_RC rc;
+    timing_conf_t timing_conf = TIMING_CONF_INIT_DEFAULT;
+
+    if (context == NULL && size != NULL) {
+        *size = sizeof (TSS2_TCTI_TIMING_CONTEXT);
+        return TSS2_RC_SUCCESS;
+    }
+    if (size == NULL) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    if (conf == NULL || strlen (conf) > CONF_STRING_MAX) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    conf_copy = g_strdup (conf);
+    rc = tcti_timing_conf_parse (conf_copy, &timing_conf);
+    if (rc != TSS2_RC_SUCCESS) {
+        goto out;
+    }
+    if (timing_conf.tcti_name == NULL) {
+        g_warning ("%s: conf string has no \"tcti\" key", __func__);
+        rc = TSS2_TCTI_RC_BAD_VALUE;
+        goto out;
+    }
+    if (timing_conf.log != NULL) {
+        log = timing_log_open (timing_conf.log);
+        if (log == NULL) {
+            rc = TSS2_TCTI_RC_IO_ERROR;
+            goto out;
+        }
+    }
+    rc = tcti_util_discover_info (timing_conf.tcti_name,
+                                  &child_info,
+                                  &child_dl_handle);
+    if (rc != TSS2_RC_SUCCESS) {
+        /* tcti_util_discover_info cleans up the dl handle on failure */
+        child_dl_handle = NULL;
+        goto out;
+    }
+    rc = tcti_util_dynamic_init (child_info, timing_conf.tcti_conf, &child);
+    if (rc != TSS2_RC_SUCCESS) {
+        goto out;
+    }
+    tcti_timing_init_context (context, child, child_dl_handle, log, &timing_conf);
+    g_debug ("initialized timing TCTI wrapping \"%s\" with latency %" PRIu64
+             "us, jitter %" PRIu64 "us", timing_conf.tcti_name,
+             timing_conf.latency_us, timing_conf.jitter_us);
+out:
+    if (rc != TSS2_RC_SUCCESS) {
+        if (log != NULL) {
+            fclose (log);
+        }
+#if !defined (DISABLE_DLCLOSE)
+        if (child_dl_handle != NULL) {
+            dlclose (child_dl_handle);
+        }
+#endif
+    }
+    g_clear_pointer (&conf_copy, g_free);
+
+    return rc;
+}
+
+/* public info structure */
+static const TSS2_TCTI_INFO tss2_tcti_info = {
+    .version = TSS2_TCTI_TIMING_VERSION,
+    .name = "tcti-timing",
+    .description = "Pass-through TCTI that records TPM command execution " \
+        "time and optionally injects latency.",
+    .config_help = "This conf string is a series of key / value pairs " \
+        "where keys and values are separated by the '=' character and " \
+        "each pair is separated by the ',' character. Valid keys are " \
+        "\"log\", \"latency\", \"jitter\" and \"tcti\". The \"tcti\" key " \
+        "is required, must be last and takes the form <name>[:<conf>].",
+    .init = Tss2_Tcti_Timing_Init,
+};
+
+const TSS2_TCTI_INFO*
+Tss2_Tcti_Info (void)
+{
+    return &tss2_tcti_info;
+}
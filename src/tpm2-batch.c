@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <inttypes.h>
+#include <string.h>
+
+#include "tabrmd.h"
+#include "tpm2-batch.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+G_DEFINE_TYPE (Tpm2Batch, tpm2_batch, G_TYPE_OBJECT);
+
+enum {
+    PROP_0,
+    PROP_CONNECTION,
+    PROP_FLAGS,
+    N_PROPERTIES
+};
+static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+
+static void
+tpm2_batch_set_property (GObject      *object,
+                         guint         property_id,
+                         GValue const *value,
+                         GParamSpec   *pspec)
+{
+    Tpm2Batch *self = TPM2_BATCH (object);
+
+    switch (property_id) {
+    case PROP_CONNECTION:
+        self->connection = g_value_dup_object (value);
+        break;
+    case PROP_FLAGS:
+        self->flags = g_value_get_uint (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+tpm2_batch_get_property (GObject    *object,
+                         guint       property_id,
+                         GValue     *value,
+                         GParamSpec *pspec)
+{
+    Tpm2Batch *self = TPM2_BATCH (object);
+
+    switch (property_id) {
+    case PROP_CONNECTION:
+        g_value_set_object (value, self->connection);
+        break;
+    case PROP_FLAGS:
+        g_value_set_uint (value, self->flags);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+tpm2_batch_init (Tpm2Batch *batch)
+{
+    batch->commands = g_ptr_array_new_with_free_func (g_object_unref);
+    batch->responses = g_ptr_array_new_with_free_func (g_object_unref);
+}
+static void
+tpm2_batch_dispose (GObject *object)
+{
+    Tpm2Batch *self = TPM2_BATCH (object);
+
+    g_debug ("%s: Tpm2Batch: 0x%" PRIxPTR, __func__, (uintptr_t)self);
+    g_clear_object (&self->connection);
+    g_clear_pointer (&self->commands, g_ptr_array_unref);
+    g_clear_pointer (&self->responses, g_ptr_array_unref);
+    G_OBJECT_CLASS (tpm2_batch_parent_class)->dispose (object);
+}
+static void
+tpm2_batch_class_init (Tpm2BatchClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    if (tpm2_batch_parent_class == NULL)
+        tpm2_batch_parent_class = g_type_class_peek_parent (klass);
+    object_class->dispose      = tpm2_batch_dispose;
+    object_class->get_property = tpm2_batch_get_property;
+    object_class->set_property = tpm2_batch_set_property;
+
+    obj_properties [PROP_CONNECTION] =
+        g_param_spec_object ("connection",
+                             "Connection object",
+                             "The Connection that sent the batch.",
+                             TYPE_CONNECTION,
+                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_FLAGS] =
+        g_param_spec_uint ("flags",
+                           "flags",
+                           "TSS2_TCTI_TABRMD_BATCH_* flags from the client.",
+                           0,
+                           G_MAXUINT32,
+                           0,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_properties (object_class,
+                                       N_PROPERTIES,
+                                       obj_properties);
+}
+Tpm2Batch*
+tpm2_batch_new (Connection *connection,
+                guint32     flags)
+{
+    return TPM2_BATCH (g_object_new (TYPE_TPM2_BATCH,
+                                     "connection", connection,
+                                     "flags", flags,
+                                     NULL));
+}
+/*
+ * Create a Tpm2Batch from a batch frame read from a client: a header with
+ * the TABRMD_BATCH_TAG, the size of the frame and the flags, followed by
+ * one or more TPM commands. Each command gets a copy of its bytes, the
+ * caller keeps ownership of 'buffer'. Returns NULL if the frame is
+ * malformed or exceeds the batch limits.
+ */
+Tpm2Batch*
+tpm2_batch_new_from_buffer (Connection   *connection,
+                            CommandAttrs *command_attrs,
+                            guint8       *buffer,
+                            size_t        size)
+{
+    Tpm2Batch *batch;
+    Tpm2Command *command;
+    TPMA_CC attributes;
+    size_t offset, command_size;
+
+    if (buffer == NULL || size < TPM_HEADER_SIZE ||
+        size > TABRMD_BATCH_SIZE_MAX ||
+        get_command_tag (buffer) != TABRMD_BATCH_TAG ||
+        get_command_size (buffer) != size)
+    {
+        g_warning ("%s: bad batch header", __func__);
+        return NULL;
+    }
+    batch = tpm2_batch_new (connection, get_command_code (buffer));
+    for (offset = TPM_HEADER_SIZE; offset < size; offset += command_size) {
+        if (size - offset < TPM_HEADER_SIZE) {
+            g_warning ("%s: truncated command header at offset %zu",
+                       __func__, offset);
+            goto fail_out;
+        }
+        command_size = get_command_size (&buffer [offset]);
+        if (command_size < TPM_HEADER_SIZE ||
+            command_size > size - offset ||
+            command_size > UTIL_BUF_MAX)
+        {
+            g_warning ("%s: bad command size %zu at offset %zu",
+                       __func__, command_size, offset);
+            goto fail_out;
+        }
+        if (batch->commands->len == TABRMD_BATCH_COUNT_MAX) {
+            g_warning ("%s: more than %u commands in batch",
+                       __func__, TABRMD_BATCH_COUNT_MAX);
+            goto fail_out;
+        }
+        attributes = command_attrs_from_cc (command_attrs,
+                                            get_command_code (&buffer [offset]));
+        command = tpm2_command_new (connection,
+                                    g_memdup (&buffer [offset], command_size),
+                                    command_size,
+                                    attributes);
+        tpm2_batch_add_command (batch, command);
+        g_object_unref (command);
+    }
+    if (batch->commands->len == 0) {
+        g_warning ("%s: empty batch", __func__);
+        goto fail_out;
+    }
+    return batch;
+fail_out:
+    g_object_unref (batch);
+    return NULL;
+}
+/*
+ * The batch takes a reference to the command / response.
+ */
+void
+tpm2_batch_add_command (Tpm2Batch   *batch,
+                        Tpm2Command *command)
+{
+    g_ptr_array_add (batch->commands, g_object_ref (command));
+}
+void
+tpm2_batch_add_response (Tpm2Batch    *batch,
+                         Tpm2Response *response)
+{
+    g_ptr_array_add (batch->responses, g_object_ref (response));
+}
+guint
+tpm2_batch_get_command_count (Tpm2Batch *batch)
+{
+    return batch->commands->len;
+}
+/*
+ * Returns the command at 'index' without taking a reference, or NULL if
+ * 'index' is past the last command.
+ */
+Tpm2Command*
+tpm2_batch_get_command (Tpm2Batch *batch,
+                        guint      index)
+{
+    if (index >= batch->commands->len) {
+        return NULL;
+    }
+    return TPM2_COMMAND (g_ptr_array_index (batch->commands, index));
+}
+guint
+tpm2_batch_get_response_count (Tpm2Batch *batch)
+{
+    return batch->responses->len;
+}
+/*
+ * Returns the response at 'index' without taking a reference, or NULL if
+ * 'index' is past the last response.
+ */
+Tpm2Response*
+tpm2_batch_get_response (Tpm2Batch *batch,
+                         guint      index)
+{
+    if (index >= batch->responses->len) {
+        return NULL;
+    }
+    return TPM2_RESPONSE (g_ptr_array_index (batch->responses, index));
+}
+/*
+ * Returns a new reference to the Connection, the caller must unref it.
+ */
+Connection*
+tpm2_batch_get_connection (Tpm2Batch *batch)
+{
+    g_object_ref (batch->connection);
+    return batch->connection;
+}
+guint32
+tpm2_batch_get_flags (Tpm2Batch *batch)
+{
+    return batch->flags;
+}
+/*
+ * Build the frame sent back to the client: a header with the
+ * TABRMD_BATCH_TAG, the size of the frame and the number of responses,
+ * followed by the responses in the order the commands were executed. The
+ * caller must g_free the returned buffer.
+ */
+guint8*
+tpm2_batch_get_response_buffer (Tpm2Batch *batch,
+                                size_t    *size)
+{
+    Tpm2Response *response;
+    guint8 *buffer;
+    size_t offset = TPM_HEADER_SIZE;
+    guint i;
+
+    *size = TPM_HEADER_SIZE;
+    for (i = 0; i < batch->responses->len; ++i) {
+        *size += tpm2_response_get_size (tpm2_batch_get_response (batch, i));
+    }
+    buffer = g_malloc0 (*size);
+    set_response_tag (buffer, TABRMD_BATCH_TAG);
+    set_response_size (buffer, *size);
+    set_response_code (buffer, batch->responses->len);
+    for (i = 0; i < batch->responses->len; ++i) {
+        response = tpm2_batch_get_response (batch, i);
+        memcpy (&buffer [offset],
+                tpm2_response_get_buffer (response),
+                tpm2_response_get_size (response));
+        offset += tpm2_response_get_size (response);
+    }
+
+    return buffer;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TPM2_BATCH_H
+#define TPM2_BATCH_H
+
+#include <glib-object.h>
+
+#include "command-attrs.h"
+#include "connection.h"
+#include "tpm2-command.h"
+#include "tpm2-response.h"
+
+G_BEGIN_DECLS
+
+typedef struct _Tpm2BatchClass {
+    GObjectClass    parent;
+} Tpm2BatchClass;
+
+/*
+ * A batch of commands sent by a client in one frame. 'commands' holds the
+ * Tpm2Command objects in the order they were sent, 'responses' collects
+ * the Tpm2Response for each command as the ResourceManager executes them.
+ * 'flags' are the TSS2_TCTI_TABRMD_BATCH_* flags sent by the client.
+ */
+typedef struct _Tpm2Batch {
+    GObject         parent_instance;
+    Connection     *connection;
+    guint32         flags;
+    GPtrArray      *commands;
+    GPtrArray      *responses;
+} Tpm2Batch;
+
+#define TYPE_TPM2_BATCH            (tpm2_batch_get_type      ())
+#define TPM2_BATCH(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj),   TYPE_TPM2_BATCH, Tpm2Batch))
+#define TPM2_BATCH_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST    ((klass), TYPE_TPM2_BATCH, Tpm2BatchClass))
+#define IS_TPM2_BATCH(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj),   TYPE_TPM2_BATCH))
+#define IS_TPM2_BATCH_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE    ((klass), TYPE_TPM2_BATCH))
+#define TPM2_BATCH_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_TPM2_BATCH, Tpm2BatchClass))
+
+GType          tpm2_batch_get_type           (void);
+Tpm2Batch*     tpm2_batch_new                (Connection    *connection,
+                                              guint32        flags);
+Tpm2Batch*     tpm2_batch_new_from_buffer    (Connection    *connection,
+                                              CommandAttrs  *command_attrs,
+                                              guint8        *buffer,
+                                              size_t         size);
+void           tpm2_batch_add_command        (Tpm2Batch     *batch,
+                                              Tpm2Command   *command);
+void           tpm2_batch_add_response       (Tpm2Batch     *batch,
+                                              Tpm2Response  *response);
+guint          tpm2_batch_get_command_count  (Tpm2Batch     *batch);
+Tpm2Command*   tpm2_batch_get_command        (Tpm2Batch     *batch,
+                                              guint          index);
+guint          tpm2_batch_get_response_count (Tpm2Batch     *batch);
+Tpm2Response*  tpm2_batch_get_response       (Tpm2Batch     *batch,
+                                              guint          index);
+Connection*    tpm2_batch_get_connection     (Tpm2Batch     *batch);
+guint32        tpm2_batch_get_flags          (Tpm2Batch     *batch);
+guint8*        tpm2_batch_get_response_buffer (Tpm2Batch    *batch,
+                                               size_t       *size);
+
+G_END_DECLS
+#endif /* TPM2_BATCH_H */
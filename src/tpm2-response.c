@@ -325,6 +325,43 @@ out:
     }
     return response;
 }
+/*
+ * Create a new Tpm2Response object for the TPM2_ContextSave command from the
+ * context the RM holds for a transient object. The HandleMapEntry keeps the
+ * TPMS_CONTEXT marshalled (by libtss2-mu) so it's copied in to the response
+ * body as is. If the entry has no saved context NULL is returned.
+ */
+Tpm2Response*
+tpm2_response_new_context_save_transient (Connection     *connection,
+                                          HandleMapEntry *entry)
+{
+    Tpm2Response *response = NULL;
+    guint8 const *context;
+    size_t context_size, size;
+    uint8_t *buf;
+    TSS2_RC rc;
+
+    context = handle_map_entry_peek_context (entry, &context_size);
+    if (context_size == 0) {
+        g_debug ("%s: no context saved for HandleMapEntry 0x%" PRIxPTR,
+                 __func__, (uintptr_t)entry);
+        return NULL;
+    }
+    size = TPM_HEADER_SIZE + context_size;
+    buf = g_malloc0 (size);
+    memcpy (&buf[TPM_HEADER_SIZE], context, context_size);
+    rc = tpm2_header_init (buf, size, TPM2_ST_NO_SESSIONS, size, TSS2_RC_SUCCESS);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: Failed to initialize header: 0x%" PRIx32,
+                   __func__, rc);
+        g_free (buf);
+        return NULL;
+    }
+    response = tpm2_response_new (connection, buf, size, 0x02000162);
+    g_debug ("%s generated Tpm2Response object: 0x%" PRIxPTR " for connection: 0x%" PRIxPTR,
+             __func__, (uintptr_t)response, (uintptr_t)connection);
+    return response;
+}
 /* Simple "getter" to expose the attributes associated with the command. */
 TPMA_CC
 tpm2_response_get_attributes (Tpm2Response *response)
@@ -31,6 +31,7 @@
 #include <tss2/tss2_tpm2_types.h>
 
 #include "connection.h"
+#include "handle-map-entry.h"
 #include "session-entry.h"
 
 G_BEGIN_DECLS
@@ -67,6 +68,8 @@ Tpm2Response* tpm2_response_new_context_save (Connection *connection,
                                               SessionEntry *entry);
 Tpm2Response* tpm2_response_new_context_load (Connection *connection,
                                               SessionEntry *entry);
+Tpm2Response* tpm2_response_new_context_save_transient (Connection     *connection,
+                                                        HandleMapEntry *entry);
 TPMA_CC             tpm2_response_get_attributes (Tpm2Response   *response);
 guint8*             tpm2_response_get_buffer    (Tpm2Response    *response);
 TSS2_RC              tpm2_response_get_code      (Tpm2Response    *response);
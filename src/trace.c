@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "tpm2-header.h"
+#include "trace.h"
+#include "util.h"
+
+G_DEFINE_TYPE (Trace, trace, G_TYPE_OBJECT);
+
+enum {
+    PROP_0,
+    PROP_FILENAME,
+    N_PROPERTIES
+};
+static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+
+static void
+trace_set_property (GObject      *object,
+                    guint         property_id,
+                    GValue const *value,
+                    GParamSpec   *pspec)
+{
+    Trace *self = TRACE (object);
+
+    switch (property_id) {
+    case PROP_FILENAME:
+        g_free (self->filename);
+        self->filename = g_value_dup_string (value);
+        g_debug ("%s: Trace 0x%" PRIxPTR " filename: %s", __func__,
+                 (uintptr_t)self, self->filename);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+trace_get_property (GObject    *object,
+                    guint       property_id,
+                    GValue     *value,
+                    GParamSpec *pspec)
+{
+    Trace *self = TRACE (object);
+
+    switch (property_id) {
+    case PROP_FILENAME:
+        g_value_set_string (value, self->filename);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+trace_init (Trace *trace)
+{
+    pthread_mutex_init (&trace->mutex, NULL);
+}
+/*
+ * Close the trace file (flushing anything buffered) and release the
+ * mutex.
+ */
+static void
+trace_finalize (GObject *object)
+{
+    Trace *self = TRACE (object);
+
+    g_debug ("%s: 0x%" PRIxPTR, __func__, (uintptr_t)self);
+    if (self->file != NULL) {
+        fclose (self->file);
+        self->file = NULL;
+    }
+    g_clear_pointer (&self->filename, g_free);
+    pthread_mutex_destroy (&self->mutex);
+    G_OBJECT_CLASS (trace_parent_class)->finalize (object);
+}
+static void
+trace_class_init (TraceClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    if (trace_parent_class == NULL)
+        trace_parent_class = g_type_class_peek_parent (klass);
+    object_class->finalize     = trace_finalize;
+    object_class->get_property = trace_get_property;
+    object_class->set_property = trace_set_property;
+
+    obj_properties [PROP_FILENAME] =
+        g_param_spec_string ("filename",
+                             "trace file name",
+                             "Path to file where trace records are written",
+                             NULL,
+                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_properties (object_class,
+                                       N_PROPERTIES,
+                                       obj_properties);
+}
+Trace*
+trace_new (const gchar *filename)
+{
+    return TRACE (g_object_new (TYPE_TRACE,
+                                "filename", filename,
+                                NULL));
+}
+static gint64
+trace_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+/*
+ * Create the trace file and write the header. The trace holds the raw
+ * command and response buffers including any authorization values so we
+ * create it with permissions allowing only the daemon user to read it.
+ * Returns 0 on success, an errno value otherwise.
+ */
+gint
+trace_open (Trace *trace)
+{
+    guint8 header [TRACE_HEADER_SIZE] = { 0 };
+    size_t offset = TRACE_MAGIC_SIZE;
+    TSS2_RC rc;
+    int fd, ret = 0;
+
+    g_assert_nonnull (trace);
+    memcpy (header, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    rc = Tss2_MU_UINT32_Marshal (TRACE_VERSION, header, sizeof (header), &offset);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT64_Marshal ((UINT64)g_get_real_time (),
+                                     header,
+                                     sizeof (header),
+                                     &offset);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to marshal trace header: 0x%" PRIx32,
+                   __func__, rc);
+        return EPROTO;
+    }
+    fd = TABRMD_ERRNO_EINTR_RETRY (open (trace->filename,
+                                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                         S_IRUSR | S_IWUSR));
+    if (fd == -1) {
+        ret = errno;
+        g_warning ("%s: failed to open trace file %s: %s",
+                   __func__, trace->filename, strerror (ret));
+        return ret;
+    }
+    trace->file = fdopen (fd, "w");
+    if (trace->file == NULL) {
+        ret = errno;
+        g_warning ("%s: fdopen failed: %s", __func__, strerror (ret));
+        close (fd);
+        return ret;
+    }
+    if (fwrite (header, sizeof (header), 1, trace->file) != 1 ||
+        fflush (trace->file) != 0)
+    {
+        ret = EIO;
+        g_warning ("%s: failed to write trace header", __func__);
+    }
+    trace->start_time = trace_now_ns ();
+
+    return ret;
+}
+/*
+ * Write a single record to the trace. This is called from both the
+ * CommandSource and the ResponseSink threads so the record header and
+ * body are written under the mutex to keep records from interleaving.
+ * Each record is flushed as it's written: a trace is most useful after
+ * the daemon has crashed or been killed and anything left in the stdio
+ * buffer would be lost.
+ * Returns 0 on success, an errno value otherwise.
+ */
+gint
+trace_write_record (Trace           *trace,
+                    TraceRecordType  type,
+                    guint64          connection_id,
+                    const guint8    *buf,
+                    size_t           size)
+{
+    guint8 header [TRACE_RECORD_HEADER_SIZE] = { 0 };
+    size_t offset = 0;
+    TSS2_RC rc;
+    gint ret = 0;
+
+    if (trace == NULL || trace->file == NULL || buf == NULL) {
+        return EINVAL;
+    }
+    rc = Tss2_MU_UINT8_Marshal ((UINT8)type, header, sizeof (header), &offset);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT64_Marshal (trace_now_ns () - trace->start_time,
+                                     header,
+                                     sizeof (header),
+                                     &offset);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT64_Marshal (connection_id,
+                                     header,
+                                     sizeof (header),
+                                     &offset);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT32_Marshal ((UINT32)size,
+                                     header,
+                                     sizeof (header),
+                                     &offset);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to marshal record header: 0x%" PRIx32,
+                   __func__, rc);
+        return EPROTO;
+    }
+    pthread_mutex_lock (&trace->mutex);
+    if (fwrite (header, sizeof (header), 1, trace->file) != 1 ||
+        fwrite (buf, size, 1, trace->file) != 1 ||
+        fflush (trace->file) != 0)
+    {
+        g_warning ("%s: failed to write trace record", __func__);
+        ret = EIO;
+    }
+    pthread_mutex_unlock (&trace->mutex);
+
+    return ret;
+}
+gint
+trace_record_command (Trace       *trace,
+                      Tpm2Command *command)
+{
+    Connection *connection;
+    gint ret;
+
+    connection = tpm2_command_get_connection (command);
+    ret = trace_write_record (trace,
+                              TRACE_RECORD_COMMAND,
+                              connection_get_id (connection),
+                              tpm2_command_get_buffer (command),
+                              tpm2_command_get_size (command));
+    g_object_unref (connection);
+
+    return ret;
+}
+gint
+trace_record_response (Trace        *trace,
+                       Tpm2Response *response)
+{
+    Connection *connection;
+    gint ret;
+
+    connection = tpm2_response_get_connection (response);
+    ret = trace_write_record (trace,
+                              TRACE_RECORD_RESPONSE,
+                              connection_get_id (connection),
+                              tpm2_response_get_buffer (response),
+                              tpm2_response_get_size (response));
+    g_object_unref (connection);
+
+    return ret;
+}
+/*
+ * Read and validate the trace file header. Returns 0 on success, an errno
+ * value otherwise.
+ */
+gint
+trace_read_header (FILE    *file,
+                   guint64 *start_time)
+{
+    guint8 header [TRACE_HEADER_SIZE];
+    size_t offset = TRACE_MAGIC_SIZE;
+    UINT32 version = 0;
+    UINT64 time_start = 0;
+    TSS2_RC rc;
+
+    if (fread (header, sizeof (header), 1, file) != 1) {
+        return EIO;
+    }
+    if (memcmp (header, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+        g_warning ("%s: bad magic in trace header", __func__);
+        return EPROTO;
+    }
+    rc = Tss2_MU_UINT32_Unmarshal (header, sizeof (header), &offset, &version);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT64_Unmarshal (header,
+                                       sizeof (header),
+                                       &offset,
+                                       &time_start);
+    }
+    if (rc != TSS2_RC_SUCCESS || version != TRACE_VERSION) {
+        g_warning ("%s: unsupported trace version: %" PRIu32,
+                   __func__, version);
+        return EPROTO;
+    }
+    if (start_time != NULL) {
+        *start_time = time_start;
+    }
+    return 0;
+}
+/*
+ * Read the next record from the trace file. The caller owns the buffer
+ * in the record and must free it with trace_record_clear.
+ * Returns 0 on success, -1 at the end of the file and an errno value on
+ * error (like read_data from the util module).
+ */
+gint
+trace_read_record (FILE           *file,
+                   trace_record_t *record)
+{
+    guint8 header [TRACE_RECORD_HEADER_SIZE];
+    size_t offset = 0;
+    UINT8 type = 0;
+    TSS2_RC rc;
+
+    if (fread (header, sizeof (header), 1, file) != 1) {
+        return feof (file) ? -1 : EIO;
+    }
+    rc = Tss2_MU_UINT8_Unmarshal (header, sizeof (header), &offset, &type);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT64_Unmarshal (header,
+                                       sizeof (header),
+                                       &offset,
+                                       &record->timestamp);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT64_Unmarshal (header,
+                                       sizeof (header),
+                                       &offset,
+                                       &record->connection_id);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT32_Unmarshal (header,
+                                       sizeof (header),
+                                       &offset,
+                                       &record->size);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        return EPROTO;
+    }
+    if (type != TRACE_RECORD_COMMAND && type != TRACE_RECORD_RESPONSE) {
+        g_warning ("%s: unknown record type: %" PRIu8, __func__, type);
+        return EPROTO;
+    }
+    if (record->size < TPM_HEADER_SIZE || record->size > UTIL_BUF_MAX) {
+        g_warning ("%s: record size out of bounds: %" PRIu32,
+                   __func__, record->size);
+        return EPROTO;
+    }
+    record->type = (TraceRecordType)type;
+    record->buf = g_malloc (record->size);
+    if (fread (record->buf, record->size, 1, file) != 1) {
+        g_clear_pointer (&record->buf, g_free);
+        return EIO;
+    }
+    return 0;
+}
+void
+trace_record_clear (trace_record_t *record)
+{
+    g_clear_pointer (&record->buf, g_free);
+    record->size = 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+#include <glib-object.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "tpm2-command.h"
+#include "tpm2-response.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Trace file format. All integers are big endian (marshalled with the
+ * libtss2-mu functions for the corresponding TPM2 base type).
+ *
+ * header: magic (8 bytes, TRACE_MAGIC), version (UINT32),
+ *         start time (UINT64, microseconds since the epoch)
+ * record: type (UINT8, TraceRecordType), timestamp (UINT64, nanoseconds
+ *         since the trace was opened), connection id (UINT64),
+ *         size (UINT32), followed by 'size' bytes of TPM command / response
+ */
+#define TRACE_MAGIC          "TABRMDTR"
+#define TRACE_MAGIC_SIZE     8
+#define TRACE_VERSION        1
+#define TRACE_HEADER_SIZE    (TRACE_MAGIC_SIZE + sizeof (UINT32) + sizeof (UINT64))
+#define TRACE_RECORD_HEADER_SIZE \
+    (sizeof (UINT8) + sizeof (UINT64) + sizeof (UINT64) + sizeof (UINT32))
+
+typedef enum {
+    TRACE_RECORD_COMMAND  = 1,
+    TRACE_RECORD_RESPONSE = 2,
+} TraceRecordType;
+
+typedef struct {
+    TraceRecordType type;
+    guint64         timestamp;
+    guint64         connection_id;
+    guint32         size;
+    guint8         *buf;
+} trace_record_t;
+
+typedef struct _TraceClass {
+    GObjectClass      parent;
+} TraceClass;
+
+typedef struct _Trace {
+    GObject           parent_instance;
+    pthread_mutex_t   mutex;
+    gchar            *filename;
+    FILE             *file;
+    gint64            start_time;
+} Trace;
+
+#define TYPE_TRACE              (trace_get_type   ())
+#define TRACE(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj),   TYPE_TRACE, Trace))
+#define TRACE_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST    ((klass), TYPE_TRACE, TraceClass))
+#define IS_TRACE(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj),   TYPE_TRACE))
+#define IS_TRACE_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE    ((klass), TYPE_TRACE))
+#define TRACE_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_TRACE, TraceClass))
+
+GType      trace_get_type          (void);
+Trace*     trace_new               (const gchar      *filename);
+gint       trace_open              (Trace            *trace);
+gint       trace_write_record      (Trace            *trace,
+                                    TraceRecordType   type,
+                                    guint64           connection_id,
+                                    const guint8     *buf,
+                                    size_t            size);
+gint       trace_record_command    (Trace            *trace,
+                                    Tpm2Command      *command);
+gint       trace_record_response   (Trace            *trace,
+                                    Tpm2Response     *response);
+gint       trace_read_header       (FILE             *file,
+                                    guint64          *start_time);
+gint       trace_read_record       (FILE             *file,
+                                    trace_record_t   *record);
+void       trace_record_clear      (trace_record_t   *record);
+
+G_END_DECLS
+#endif /* TRACE_H */
@@ -223,8 +223,11 @@ read_tpm_buffer (GInputStream             *istream,
     if (size == TPM_HEADER_SIZE) {
         return ret;
     }
-    /* Not enough space in buf to for data in the buffer (header.size). */
-    if (size > buf_size) {
+    /*
+     * Not enough space in buf to for data in the buffer (header.size), or
+     * a header.size that can't be right.
+     */
+    if (size < TPM_HEADER_SIZE || size > buf_size) {
         return EPROTO;
     }
     /* Now that we have the header, we know the whole buffer size. Get it. */
@@ -233,7 +236,8 @@ read_tpm_buffer (GInputStream             *istream,
 /*
  * This fucntion is a wrapper around the read_tpm_buffer function above. It
  * adds the memory allocation logic necessary to create the buffer to hold
- * the TPM command / response buffer.
+ * the TPM command / response buffer. The size from the header is capped
+ * at UTIL_BUF_MAX, or TABRMD_BATCH_SIZE_MAX for a batch frame.
  * Returns NULL on error, and a pointer to the allocated buffer on success.
  *   The size of the allocated buffer is returned through the *buf_size
  *   parameter on success.
@@ -243,7 +247,7 @@ read_tpm_buffer_alloc (GInputStream *istream,
                        size_t       *buf_size)
 {
     uint8_t *buf = NULL;
-    size_t   size_tmp = TPM_HEADER_SIZE, index = 0;
+    size_t   size_tmp = TPM_HEADER_SIZE, size_max, index = 0;
     int ret = 0;
 
     if (istream == NULL || buf_size == NULL) {
@@ -256,7 +260,9 @@ read_tpm_buffer_alloc (GInputStream *istream,
         switch (ret) {
         case EPROTO:
             size_tmp = get_command_size (buf);
-            if (size_tmp < TPM_HEADER_SIZE && size_tmp > UTIL_BUF_MAX) {
+            size_max = get_command_tag (buf) == TABRMD_BATCH_TAG ?
+                TABRMD_BATCH_SIZE_MAX : UTIL_BUF_MAX;
+            if (size_tmp < TPM_HEADER_SIZE || size_tmp > size_max) {
                 g_warning ("%s: tpm buffer size is ouside of acceptable bounds: %zd",
                            __func__, size_tmp);
                 goto err_out;
@@ -281,6 +287,67 @@ err_out:
     }
     return NULL;
 }
+/*
+ * Read a TPM command / response from a SOCK_SEQPACKET socket. Each one is
+ * a single message so there's no header to parse to find where it ends and
+ * no partial read to keep track of: we peek at the length of the next
+ * message, allocate a buffer of that size and read the whole message into
+ * it with one call. The size field from the header must match the length
+ * of the message.
+ * Returns a pointer to the allocated buffer on success. The size of the
+ * buffer is returned through *buf_size. Otherwise NULL is returned and
+ * *error tells why: 0 on EOF, EAGAIN if no message is waiting (the caller
+ * should try again once the socket is readable), EPROTO for a malformed
+ * message or the errno from recv.
+ */
+uint8_t*
+read_tpm_message_alloc (GSocket *socket,
+                        size_t   max_size,
+                        size_t  *buf_size,
+                        int     *error)
+{
+    uint8_t *buf = NULL;
+    ssize_t size, ret;
+    int fd;
+
+    if (socket == NULL || buf_size == NULL || error == NULL) {
+        g_warning ("%s: got null parameter", __func__);
+        return NULL;
+    }
+    fd = g_socket_get_fd (socket);
+    /* with MSG_TRUNC recv returns the length of the message, not what fit */
+    size = TABRMD_ERRNO_EINTR_RETRY (recv (fd,
+                                           NULL,
+                                           0,
+                                           MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT));
+    if (size <= 0) {
+        *error = size == 0 ? 0 : errno;
+        g_debug ("%s: recv produced %s", __func__,
+                 size == 0 ? "EOF" : strerror (*error));
+        return NULL;
+    }
+    if ((size_t)size < TPM_HEADER_SIZE || (size_t)size > max_size) {
+        g_warning ("%s: message size is outside of acceptable bounds: %zd",
+                   __func__, size);
+        *error = EPROTO;
+        return NULL;
+    }
+    buf = g_malloc (size);
+    ret = TABRMD_ERRNO_EINTR_RETRY (recv (fd, buf, size, MSG_DONTWAIT));
+    if (ret != size || get_command_size (buf) != (size_t)size) {
+        g_warning ("%s: message of %zd bytes doesn't match the size in its "
+                   "header", __func__, ret);
+        g_free (buf);
+        *error = EPROTO;
+        return NULL;
+    }
+    *error = 0;
+    g_debug ("%s: read TPM buffer to 0x%" PRIxPTR " of size: %zd",
+             __func__, (uintptr_t)buf, size);
+    g_debug_bytes (buf, size, 16, 4);
+    *buf_size = (size_t)size;
+    return buf;
+}
 /*
  * Create a GSocket for use by the daemon for communicating with the client.
  * The client end of the socket is returned through the client_fd
@@ -288,14 +355,25 @@ err_out:
  */
 GIOStream*
 create_connection_iostream (int *client_fd)
+{
+    return create_connection_iostream_type (client_fd, SOCK_STREAM);
+}
+/*
+ * Same as create_connection_iostream but with a socket of the given type:
+ * SOCK_STREAM or SOCK_SEQPACKET.
+ */
+GIOStream*
+create_connection_iostream_type (int *client_fd,
+                                 int  type)
 {
     GIOStream *iostream;
     GSocket *sock;
     int server_fd, ret;
 
-    ret = create_socket_pair (client_fd,
-                              &server_fd,
-                              SOCK_CLOEXEC | SOCK_NONBLOCK);
+    ret = create_socket_pair_type (client_fd,
+                                   &server_fd,
+                                   type,
+                                   SOCK_CLOEXEC | SOCK_NONBLOCK);
     if (ret == -1) {
         g_error ("CreateConnection failed to make fd pair %s", strerror (errno));
     }
@@ -312,10 +390,18 @@ int
 create_socket_pair (int *fd_a,
                     int *fd_b,
                     int  flags)
+{
+    return create_socket_pair_type (fd_a, fd_b, SOCK_STREAM, flags);
+}
+int
+create_socket_pair_type (int *fd_a,
+                         int *fd_b,
+                         int  type,
+                         int  flags)
 {
     int ret, fds[2] = { 0, };
 
-    ret = socketpair (PF_LOCAL, SOCK_STREAM | flags, 0, fds);
+    ret = socketpair (PF_LOCAL, type | flags, 0, fds);
     if (ret == -1) {
         g_warning ("%s: failed to create socket pair with errno: %d",
                    __func__, errno);
@@ -406,3 +492,50 @@ parse_key_value_string (char *kv_str,
 out:
     return rc;
 }
+/*
+ * Replace the contents of the provided size_buf_t with a copy of 'size'
+ * bytes from 'buf'. The new buffer is allocated to exactly 'size' bytes and
+ * any buffer previously held by the size_buf_t is freed.
+ */
+void
+size_buf_set (size_buf_t *size_buf,
+              const uint8_t *buf,
+              size_t size)
+{
+    g_assert_nonnull (size_buf);
+    g_assert (buf != NULL || size == 0);
+
+    g_free (size_buf->buf);
+    if (size > 0) {
+        size_buf->buf = g_malloc (size);
+        memcpy (size_buf->buf, buf, size);
+    } else {
+        size_buf->buf = NULL;
+    }
+    size_buf->size = size;
+}
+/*
+ * Free the buffer held by the provided size_buf_t and reset it to empty.
+ */
+void
+size_buf_clear (size_buf_t *size_buf)
+{
+    g_assert_nonnull (size_buf);
+
+    g_clear_pointer (&size_buf->buf, g_free);
+    size_buf->size = 0;
+}
+/*
+ * Zero 'size' bytes of 'buf'. Unlike memset the compiler can't drop the
+ * writes when 'buf' isn't read afterwards, so use this for secrets.
+ */
+void
+secure_zero (void   *buf,
+             size_t  size)
+{
+    volatile uint8_t *p = (volatile uint8_t*)buf;
+
+    while (size-- > 0) {
+        *p++ = 0;
+    }
+}
@@ -76,6 +76,18 @@ typedef struct {
 
 typedef TSS2_RC (*KeyValueFunc) (const key_value_t* key_value,
                                  gpointer user_data);
+
+/*
+ * A marshalled TPMS_CONTEXT (or any other TPM structure) held in a buffer
+ * allocated to the exact size of the data. SIZE_BUF_MAX is the upper bound
+ * on the size of a marshalled context.
+ */
+#define SIZE_BUF_MAX sizeof (TPMS_CONTEXT)
+
+typedef struct size_buf {
+    size_t size;
+    uint8_t *buf;
+} size_buf_t;
 /*
 #define TPM2_CC_FROM_TPMA_CC(attrs) (attrs.val & 0x0000ffff)
 #define TPMA_CC_RESERVED(attrs)    (attrs.val & 0x003f0000)
@@ -101,17 +113,33 @@ int         read_tpm_buffer                 (GInputStream     *istream,
                                              size_t            buf_size);
 uint8_t*    read_tpm_buffer_alloc           (GInputStream     *istream,
                                              size_t           *buf_size);
+uint8_t*    read_tpm_message_alloc          (GSocket          *socket,
+                                             size_t            max_size,
+                                             size_t           *buf_size,
+                                             int              *error);
 void        g_debug_bytes                   (uint8_t const    *byte_array,
                                              size_t            array_size,
                                              size_t            width,
                                              size_t            indent);
 GIOStream*  create_connection_iostream      (int              *client_fd);
+GIOStream*  create_connection_iostream_type (int              *client_fd,
+                                             int               type);
 int         create_socket_pair              (int              *fd_a,
                                              int              *fd_b,
                                              int               flags);
+int         create_socket_pair_type         (int              *fd_a,
+                                             int              *fd_b,
+                                             int               type,
+                                             int               flags);
 void        g_debug_tpma_cc                 (TPMA_CC           tpma_cc);
 TSS2_RC     parse_key_value_string (char *kv_str,
                                     KeyValueFunc callback,
                                     gpointer user_data);
+void        size_buf_set                    (size_buf_t       *size_buf,
+                                             const uint8_t    *buf,
+                                             size_t            size);
+void        size_buf_clear                  (size_buf_t       *size_buf);
+void        secure_zero                     (void             *buf,
+                                             size_t            size);
 
 #endif /* UTIL_H */
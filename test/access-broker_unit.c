@@ -25,6 +25,7 @@
  * THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <glib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <setjmp.h>
@@ -99,6 +100,53 @@ __wrap_Tss2_Sys_GetCapability (TSS2_SYS_CONTEXT         *sysContext,
     g_debug ("__wrap_Tss2_Sys_GetCapability returning: 0x%x", rc);
     return rc;
 }
+/*
+ * The AccessBroker self test function sends IncrementalSelfTest once for
+ * each algorithm. Return the next RC prepared by the test.
+ */
+TSS2_RC
+__wrap_Tss2_Sys_IncrementalSelfTest (TSS2_SYS_CONTEXT         *sysContext,
+                                     TSS2L_SYS_AUTH_COMMAND const *cmdAuthsArray,
+                                     TPML_ALG const           *toTest,
+                                     TPML_ALG                 *toDoList,
+                                     TSS2L_SYS_AUTH_RESPONSE  *rspAuthsArray)
+{
+    TSS2_RC rc;
+    UNUSED_PARAM(sysContext);
+    UNUSED_PARAM(cmdAuthsArray);
+    UNUSED_PARAM(toTest);
+    UNUSED_PARAM(rspAuthsArray);
+
+    toDoList->count = 0;
+    rc = mock_type (TSS2_RC);
+    g_debug ("__wrap_Tss2_Sys_IncrementalSelfTest returning: 0x%x", rc);
+    return rc;
+}
+/*
+ * Return the requested number of bytes, each set to its index, and the
+ * next RC prepared by the test.
+ */
+TSS2_RC
+__wrap_Tss2_Sys_GetRandom (TSS2_SYS_CONTEXT         *sysContext,
+                           TSS2L_SYS_AUTH_COMMAND const *cmdAuthsArray,
+                           UINT16                    bytesRequested,
+                           TPM2B_DIGEST             *randomBytes,
+                           TSS2L_SYS_AUTH_RESPONSE  *rspAuthsArray)
+{
+    TSS2_RC rc;
+    UINT16 i;
+    UNUSED_PARAM(sysContext);
+    UNUSED_PARAM(cmdAuthsArray);
+    UNUSED_PARAM(rspAuthsArray);
+
+    randomBytes->size = bytesRequested;
+    for (i = 0; i < bytesRequested; ++i) {
+        randomBytes->buffer [i] = (BYTE)i;
+    }
+    rc = mock_type (TSS2_RC);
+    g_debug ("__wrap_Tss2_Sys_GetRandom returning: 0x%x", rc);
+    return rc;
+}
 TSS2_RC
 __wrap_tcti_echo_transmit (TSS2_TCTI_CONTEXT *tcti_context,
                            size_t             size,
@@ -131,6 +179,29 @@ __wrap_tcti_echo_receive (TSS2_TCTI_CONTEXT *tcti_context,
 
     return rc;
 }
+/*
+ * This receive function returns a response consisting of only a header
+ * with the response code prepared by the test.
+ */
+TSS2_RC
+__wrap_tcti_echo_receive_header (TSS2_TCTI_CONTEXT *tcti_context,
+                                 size_t            *size,
+                                 uint8_t           *response,
+                                 int32_t            timeout)
+{
+    TSS2_RC rc;
+    UNUSED_PARAM(tcti_context);
+    UNUSED_PARAM(timeout);
+
+    rc = mock_type (TSS2_RC);
+    g_debug ("__wrap_tcti_echo_receive_header response code: 0x%x", rc);
+    *size = TPM_HEADER_SIZE;
+    return tpm2_header_init (response,
+                             *size,
+                             TPM2_ST_NO_SESSIONS,
+                             TPM_HEADER_SIZE,
+                             rc);
+}
 /**
  * Do the minimum setup required by the AccessBroker object. This does not
  * call the access_broker_init_tpm function intentionally. We test that function
@@ -253,6 +324,232 @@ access_broker_init_tpm_test (void **state)
     assert_int_equal (access_broker_init_tpm (data->broker), TSS2_RC_SUCCESS);
     assert_true (data->broker->initialized);
 }
+/*
+ * Fill in a TPMS_CAPABILITY_DATA with the same two fixed properties that
+ * the GetCapability wrapper returns.
+ */
+static void
+properties_fixed_init (TPMS_CAPABILITY_DATA *properties,
+                       guint32               max_command,
+                       guint32               max_response)
+{
+    memset (properties, 0, sizeof (*properties));
+    properties->capability = TPM2_CAP_TPM_PROPERTIES;
+    properties->data.tpmProperties.tpmProperty[0].property = TPM2_PT_MAX_COMMAND_SIZE;
+    properties->data.tpmProperties.tpmProperty[0].value    = max_command;
+    properties->data.tpmProperties.tpmProperty[1].property = TPM2_PT_MAX_RESPONSE_SIZE;
+    properties->data.tpmProperties.tpmProperty[1].value    = max_response;
+    properties->data.tpmProperties.count = 2;
+}
+/*
+ * When the identifying properties returned by the TPM match the cached
+ * properties, the cached properties are used and only a single
+ * GetCapability is sent.
+ */
+static void
+access_broker_init_tpm_cached_hit_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    TPMS_CAPABILITY_DATA properties;
+    gboolean cache_hit = FALSE;
+
+    properties_fixed_init (&properties, MAX_COMMAND_VALUE, MAX_RESPONSE_VALUE);
+    will_return (__wrap_Tss2_Sys_Startup, TSS2_RC_SUCCESS);
+    will_return (__wrap_Tss2_Sys_GetCapability, MAX_COMMAND_VALUE);
+    will_return (__wrap_Tss2_Sys_GetCapability, MAX_RESPONSE_VALUE);
+    will_return (__wrap_Tss2_Sys_GetCapability, TSS2_RC_SUCCESS);
+    assert_int_equal (access_broker_init_tpm_cached (data->broker,
+                                                     &properties,
+                                                     &cache_hit),
+                      TSS2_RC_SUCCESS);
+    assert_true (cache_hit);
+    assert_true (data->broker->initialized);
+}
+/*
+ * When the identifying properties returned by the TPM differ from the
+ * cached properties, all fixed properties are queried from the TPM.
+ */
+static void
+access_broker_init_tpm_cached_miss_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    TPMS_CAPABILITY_DATA properties;
+    gboolean cache_hit = TRUE;
+    guint32 value = 0;
+
+    properties_fixed_init (&properties, MAX_COMMAND_VALUE + 1, MAX_RESPONSE_VALUE);
+    will_return (__wrap_Tss2_Sys_Startup, TSS2_RC_SUCCESS);
+    will_return (__wrap_Tss2_Sys_GetCapability, MAX_COMMAND_VALUE);
+    will_return (__wrap_Tss2_Sys_GetCapability, MAX_RESPONSE_VALUE);
+    will_return (__wrap_Tss2_Sys_GetCapability, TSS2_RC_SUCCESS);
+    will_return (__wrap_Tss2_Sys_GetCapability, MAX_COMMAND_VALUE);
+    will_return (__wrap_Tss2_Sys_GetCapability, MAX_RESPONSE_VALUE);
+    will_return (__wrap_Tss2_Sys_GetCapability, TSS2_RC_SUCCESS);
+    assert_int_equal (access_broker_init_tpm_cached (data->broker,
+                                                     &properties,
+                                                     &cache_hit),
+                      TSS2_RC_SUCCESS);
+    assert_false (cache_hit);
+    assert_int_equal (access_broker_get_max_command (data->broker, &value),
+                      TSS2_RC_SUCCESS);
+    assert_int_equal (value, MAX_COMMAND_VALUE);
+}
+/*
+ * Queries for algorithms, commands and fixed properties are answered from
+ * the cached data. A query for fixed properties that would continue into
+ * the variable properties can't be.
+ */
+static void
+access_broker_get_capability_cached_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    TPMS_CAPABILITY_DATA cap_data;
+    TPMI_YES_NO more_data;
+
+    data->broker->algs.capability = TPM2_CAP_ALGS;
+    data->broker->algs.data.algorithms.count = 3;
+    data->broker->algs.data.algorithms.algProperties [0].alg = TPM2_ALG_RSA;
+    data->broker->algs.data.algorithms.algProperties [1].alg = TPM2_ALG_SHA1;
+    data->broker->algs.data.algorithms.algProperties [2].alg = TPM2_ALG_HMAC;
+    data->broker->commands.capability = TPM2_CAP_COMMANDS;
+    data->broker->commands.data.command.count = 2;
+    data->broker->commands.data.command.commandAttributes [0] = TPM2_CC_Startup;
+    data->broker->commands.data.command.commandAttributes [1] = TPM2_CC_GetCapability;
+    properties_fixed_init (&data->broker->properties_fixed,
+                           MAX_COMMAND_VALUE,
+                           MAX_RESPONSE_VALUE);
+
+    assert_true (access_broker_get_capability_cached (data->broker,
+                                                      TPM2_CAP_ALGS,
+                                                      TPM2_ALG_SHA1,
+                                                      1,
+                                                      &more_data,
+                                                      &cap_data));
+    assert_int_equal (cap_data.capability, TPM2_CAP_ALGS);
+    assert_int_equal (cap_data.data.algorithms.count, 1);
+    assert_int_equal (cap_data.data.algorithms.algProperties [0].alg,
+                      TPM2_ALG_SHA1);
+    assert_int_equal (more_data, YES);
+
+    assert_true (access_broker_get_capability_cached (data->broker,
+                                                      TPM2_CAP_COMMANDS,
+                                                      TPM2_CC_FIRST,
+                                                      TPM2_MAX_CAP_CC,
+                                                      &more_data,
+                                                      &cap_data));
+    assert_int_equal (cap_data.data.command.count, 2);
+    assert_int_equal (more_data, NO);
+
+    assert_true (access_broker_get_capability_cached (data->broker,
+                                                      TPM2_CAP_TPM_PROPERTIES,
+                                                      TPM2_PT_MAX_COMMAND_SIZE,
+                                                      1,
+                                                      &more_data,
+                                                      &cap_data));
+    assert_int_equal (cap_data.data.tpmProperties.count, 1);
+    assert_int_equal (cap_data.data.tpmProperties.tpmProperty [0].value,
+                      MAX_COMMAND_VALUE);
+    assert_int_equal (more_data, YES);
+
+    assert_false (access_broker_get_capability_cached (data->broker,
+                                                       TPM2_CAP_TPM_PROPERTIES,
+                                                       TPM2_PT_FIXED,
+                                                       TPM2_MAX_TPM_PROPERTIES,
+                                                       &more_data,
+                                                       &cap_data));
+    assert_false (access_broker_get_capability_cached (data->broker,
+                                                       TPM2_CAP_HANDLES,
+                                                       (UINT32)TPM2_TRANSIENT_FIRST,
+                                                       1,
+                                                       &more_data,
+                                                       &cap_data));
+}
+/*
+ * Replacing the cached fixed properties and commands, as done when the
+ * startup cache turns out to be stale, changes the cached answers.
+ */
+static void
+access_broker_update_cap_cache_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    TPMS_CAPABILITY_DATA properties, commands = { 0, }, cap_data;
+    TPMI_YES_NO more_data;
+
+    data->broker->commands.capability = TPM2_CAP_COMMANDS;
+    data->broker->commands.data.command.count = 1;
+    data->broker->commands.data.command.commandAttributes [0] = TPM2_CC_Startup;
+    properties_fixed_init (&data->broker->properties_fixed,
+                           MAX_COMMAND_VALUE,
+                           MAX_RESPONSE_VALUE);
+
+    properties_fixed_init (&properties,
+                           MAX_COMMAND_VALUE * 2,
+                           MAX_RESPONSE_VALUE * 2);
+    commands.capability = TPM2_CAP_COMMANDS;
+    commands.data.command.count = 2;
+    commands.data.command.commandAttributes [0] = TPM2_CC_Startup;
+    commands.data.command.commandAttributes [1] = TPM2_CC_GetCapability;
+    access_broker_update_cap_cache (data->broker, &properties, &commands);
+
+    assert_true (access_broker_get_capability_cached (data->broker,
+                                                      TPM2_CAP_COMMANDS,
+                                                      TPM2_CC_FIRST,
+                                                      TPM2_MAX_CAP_CC,
+                                                      &more_data,
+                                                      &cap_data));
+    assert_int_equal (cap_data.data.command.count, 2);
+    assert_true (access_broker_get_capability_cached (data->broker,
+                                                      TPM2_CAP_TPM_PROPERTIES,
+                                                      TPM2_PT_MAX_COMMAND_SIZE,
+                                                      1,
+                                                      &more_data,
+                                                      &cap_data));
+    assert_int_equal (cap_data.data.tpmProperties.tpmProperty [0].value,
+                      MAX_COMMAND_VALUE * 2);
+}
+/*
+ * Fill a pool bigger than a single GetRandom response and drain it. Bytes
+ * taken from the pool are zeroed and requests for more than the pool
+ * holds, or more than a single GetRandom returned, fail.
+ */
+static void
+access_broker_random_pool_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    size_t size = sizeof (((TPM2B_DIGEST*)NULL)->buffer) + 8;
+    guint8 random [16] = { 0, };
+    size_t added;
+
+    access_broker_random_pool_init (data->broker, size);
+    assert_true (access_broker_random_pool_needs_fill (data->broker));
+    assert_false (access_broker_random_pool_get (data->broker, random, 1));
+
+    will_return (__wrap_Tss2_Sys_GetRandom, TSS2_RC_SUCCESS);
+    assert_int_equal (access_broker_random_pool_fill (data->broker, &added),
+                      TSS2_RC_SUCCESS);
+    assert_int_equal (added, size - 8);
+    will_return (__wrap_Tss2_Sys_GetRandom, TSS2_RC_SUCCESS);
+    assert_int_equal (access_broker_random_pool_fill (data->broker, &added),
+                      TSS2_RC_SUCCESS);
+    assert_int_equal (added, 8);
+    assert_false (access_broker_random_pool_needs_fill (data->broker));
+    assert_int_equal (data->broker->random_pool_count, size);
+
+    /* the last 8 bytes came from the second GetRandom */
+    assert_true (access_broker_random_pool_get (data->broker, random, 8));
+    assert_int_equal (random [0], 0);
+    assert_int_equal (random [7], 7);
+    assert_int_equal (data->broker->random_pool [size - 1], 0);
+    assert_int_equal (data->broker->random_pool_count, size - 8);
+    assert_true (access_broker_random_pool_needs_fill (data->broker));
+    assert_false (access_broker_random_pool_get (data->broker, random, 0));
+
+    will_return (__wrap_Tss2_Sys_GetRandom, TPM2_RC_FAILURE);
+    assert_int_equal (access_broker_random_pool_fill (data->broker, &added),
+                      TPM2_RC_FAILURE);
+    assert_int_equal (added, 0);
+    assert_int_equal (data->broker->random_pool_count, size - 8);
+}
 
 static void
 access_broker_get_max_command_test (void **state)
@@ -385,6 +682,60 @@ access_broker_send_command_success (void **state)
     assert_int_equal (connection, data->connection);
     g_object_unref (connection);
 }
+/*
+ * When the TPM responds with one of the retry codes the command must be
+ * resent and the caller only gets the final response.
+ */
+static void
+access_broker_send_command_retry_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    access_broker_retry_stats_t stats;
+    TSS2_RC rc;
+
+    TSS2_TCTI_RECEIVE (tcti_peek_context (TCTI (data->tcti))) =
+        __wrap_tcti_echo_receive_header;
+    will_return (__wrap_tcti_echo_transmit, TSS2_RC_SUCCESS);
+    will_return (__wrap_tcti_echo_receive_header, TPM2_RC_RETRY);
+    will_return (__wrap_tcti_echo_transmit, TSS2_RC_SUCCESS);
+    will_return (__wrap_tcti_echo_receive_header, TPM2_RC_YIELDED);
+    will_return (__wrap_tcti_echo_transmit, TSS2_RC_SUCCESS);
+    will_return (__wrap_tcti_echo_receive_header, TPM2_RC_TESTING);
+    will_return (__wrap_tcti_echo_transmit, TSS2_RC_SUCCESS);
+    will_return (__wrap_tcti_echo_receive_header, TSS2_RC_SUCCESS);
+    data->response = access_broker_send_command (data->broker, data->command, &rc);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (tpm2_response_get_code (data->response), TSS2_RC_SUCCESS);
+    access_broker_get_retry_stats (data->broker, &stats);
+    assert_int_equal (stats.commands, 1);
+    assert_int_equal (stats.retries, 3);
+    assert_int_equal (stats.exhausted, 0);
+    assert_true (stats.time_us > 0);
+}
+/*
+ * The self test must retry an algorithm while the TPM is testing, skip
+ * algorithms the TPM rejects and stop on errors below the TPM.
+ */
+static void
+access_broker_self_test_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    TPML_ALG algs = {
+        .count = 3,
+        .algorithms = { TPM2_ALG_SHA256, TPM2_ALG_NULL, TPM2_ALG_RSA, },
+    };
+
+    will_return (__wrap_Tss2_Sys_IncrementalSelfTest, TPM2_RC_TESTING);
+    will_return (__wrap_Tss2_Sys_IncrementalSelfTest, TSS2_RC_SUCCESS);
+    will_return (__wrap_Tss2_Sys_IncrementalSelfTest, TPM2_RC_VALUE);
+    will_return (__wrap_Tss2_Sys_IncrementalSelfTest, TSS2_RC_SUCCESS);
+    assert_int_equal (access_broker_self_test (data->broker, &algs),
+                      TSS2_RC_SUCCESS);
+
+    will_return (__wrap_Tss2_Sys_IncrementalSelfTest, TSS2_TCTI_RC_IO_ERROR);
+    assert_int_equal (access_broker_self_test (data->broker, &algs),
+                      TSS2_TCTI_RC_IO_ERROR);
+}
 
 int
 main (void)
@@ -396,6 +747,21 @@ main (void)
         cmocka_unit_test_setup_teardown (access_broker_init_tpm_test,
                                          access_broker_setup,
                                          access_broker_teardown),
+        cmocka_unit_test_setup_teardown (access_broker_init_tpm_cached_hit_test,
+                                         access_broker_setup,
+                                         access_broker_teardown),
+        cmocka_unit_test_setup_teardown (access_broker_init_tpm_cached_miss_test,
+                                         access_broker_setup,
+                                         access_broker_teardown),
+        cmocka_unit_test_setup_teardown (access_broker_get_capability_cached_test,
+                                         access_broker_setup_with_init,
+                                         access_broker_teardown),
+        cmocka_unit_test_setup_teardown (access_broker_update_cap_cache_test,
+                                         access_broker_setup_with_init,
+                                         access_broker_teardown),
+        cmocka_unit_test_setup_teardown (access_broker_random_pool_test,
+                                         access_broker_setup,
+                                         access_broker_teardown),
         cmocka_unit_test_setup_teardown (access_broker_get_max_command_test,
                                          access_broker_setup_with_init,
                                          access_broker_teardown),
@@ -414,6 +780,12 @@ main (void)
         cmocka_unit_test_setup_teardown (access_broker_send_command_success,
                                          access_broker_setup_with_command,
                                          access_broker_teardown),
+        cmocka_unit_test_setup_teardown (access_broker_send_command_retry_test,
+                                         access_broker_setup_with_command,
+                                         access_broker_teardown),
+        cmocka_unit_test_setup_teardown (access_broker_self_test_test,
+                                         access_broker_setup_with_init,
+                                         access_broker_teardown),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <glib.h>
+#include <inttypes.h>
+
+#include "bench-tcti.h"
+#include "tss2-tcti-tabrmd.h"
+
+/*
+ * Allocate and initialize a tabrmd TCTI context with the provided config
+ * string. Returns NULL on failure, the reason is logged with g_warning.
+ */
+TSS2_TCTI_CONTEXT*
+bench_tcti_tabrmd_init (const gchar *conf)
+{
+    TSS2_TCTI_CONTEXT *tcti_context;
+    TSS2_RC rc;
+    size_t size = 0;
+
+    rc = Tss2_Tcti_Tabrmd_Init (NULL, &size, NULL);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to get size of tabrmd TCTI context: 0x%"
+                   PRIx32, __func__, rc);
+        return NULL;
+    }
+    tcti_context = g_malloc0 (size);
+    rc = Tss2_Tcti_Tabrmd_Init (tcti_context, &size, conf);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to initialize tabrmd TCTI context: 0x%"
+                   PRIx32, __func__, rc);
+        g_free (tcti_context);
+        return NULL;
+    }
+    return tcti_context;
+}
+void
+bench_tcti_free (TSS2_TCTI_CONTEXT *tcti_context)
+{
+    if (tcti_context != NULL) {
+        Tss2_Tcti_Finalize (tcti_context);
+        g_free (tcti_context);
+    }
+}
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/*
+ * Monotonic clock in nanoseconds. g_get_monotonic_time only provides
+ * microsecond resolution which is too coarse for the operations we measure.
+ */
+gint64
+bench_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+/*
+ * Parse the options common to all benchmark programs. Program specific
+ * options may be passed through the 'extra_entries' array which must be
+ * NULL terminated like any other GOptionEntry array.
+ */
+gboolean
+bench_parse_opts (gint          argc,
+                  gchar        *argv[],
+                  const gchar  *description,
+                  GOptionEntry *extra_entries,
+                  bench_opts_t *opts)
+{
+    GOptionContext *ctx;
+    GError *err = NULL;
+    gchar *format = NULL;
+    gboolean ret = TRUE;
+    GOptionEntry entries[] = {
+        { "format", 'f', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &format,
+          "Output format for results, csv is default.", "[csv|json]" },
+        { "iterations", 'i', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &opts->iterations, "Base number of iterations for each case.",
+          NULL },
+        { "output", 'o', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+          &opts->output, "Write results to file instead of stdout.",
+          "file" },
+        { "filter", 'F', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+          &opts->filter, "Only run cases with names beginning with prefix.",
+          "prefix" },
+        { NULL, '\0', 0, 0, NULL, NULL, NULL },
+    };
+
+    ctx = g_option_context_new (description);
+    g_option_context_add_main_entries (ctx, entries, NULL);
+    if (extra_entries != NULL) {
+        g_option_context_add_main_entries (ctx, extra_entries, NULL);
+    }
+    if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+        g_printerr ("Failed to parse options: %s\n", err->message);
+        g_clear_error (&err);
+        ret = FALSE;
+        goto out;
+    }
+    if (format == NULL || g_strcmp0 (format, "csv") == 0) {
+        opts->format = BENCH_FORMAT_CSV;
+    } else if (g_strcmp0 (format, "json") == 0) {
+        opts->format = BENCH_FORMAT_JSON;
+    } else {
+        g_printerr ("Unknown output format: %s\n", format);
+        ret = FALSE;
+        goto out;
+    }
+    if (opts->iterations < BENCH_ITERATIONS_MIN) {
+        g_printerr ("Iterations must be at least %d\n", BENCH_ITERATIONS_MIN);
+        ret = FALSE;
+    }
+out:
+    g_free (format);
+    g_option_context_free (ctx);
+    return ret;
+}
+/*
+ * Scale the number of iterations for a case by the size of the container
+ * under test. Operations that are linear in the container size would
+ * otherwise make the large cases run for minutes.
+ */
+guint64
+bench_iterations (bench_opts_t *opts,
+                  guint64       size)
+{
+    guint64 iterations = (guint64)opts->iterations;
+
+    if (size > 1) {
+        iterations = iterations * 10 / size;
+    }
+    return MAX (iterations, BENCH_ITERATIONS_MIN);
+}
+/*
+ * Open the output stream and write the CSV header / JSON preamble. The
+ * timing and memory reports differ only in their CSV columns.
+ */
+static gboolean
+bench_report_open (bench_report_t *report,
+                   bench_opts_t   *opts,
+                   const gchar    *csv_header)
+{
+    report->format = opts->format;
+    report->count = 0;
+    report->filter = opts->filter;
+    if (opts->output != NULL) {
+        report->stream = fopen (opts->output, "w");
+        if (report->stream == NULL) {
+            g_printerr ("Failed to open %s: %s\n", opts->output,
+                        strerror (errno));
+            return FALSE;
+        }
+    } else {
+        report->stream = stdout;
+    }
+    switch (report->format) {
+    case BENCH_FORMAT_CSV:
+        fprintf (report->stream, "%s\n", csv_header);
+        break;
+    case BENCH_FORMAT_JSON:
+        fprintf (report->stream, "{\n  \"results\": [");
+        break;
+    }
+    return TRUE;
+}
+gboolean
+bench_report_begin (bench_report_t *report,
+                    bench_opts_t   *opts)
+{
+    return bench_report_open (report,
+                              opts,
+                              "name,param,iterations,elapsed_ns,ns_per_op,ops_per_sec");
+}
+gboolean
+bench_report_begin_memory (bench_report_t *report,
+                           bench_opts_t   *opts)
+{
+    return bench_report_open (report,
+                              opts,
+                              "name,count,rss_bytes,bytes_per_item");
+}
+/*
+ * Returns TRUE if the case with the given name was selected by the
+ * --filter option (or if there is no filter).
+ */
+gboolean
+bench_enabled (bench_report_t *report,
+               const gchar    *name)
+{
+    if (report->filter == NULL) {
+        return TRUE;
+    }
+    return g_str_has_prefix (name, report->filter);
+}
+void
+bench_report_result (bench_report_t *report,
+                     bench_result_t *result)
+{
+    gdouble ns_per_op, ops_per_sec;
+
+    ns_per_op = (gdouble)result->elapsed_ns / (gdouble)result->iterations;
+    ops_per_sec = ns_per_op > 0 ? 1e9 / ns_per_op : 0;
+    switch (report->format) {
+    case BENCH_FORMAT_CSV:
+        fprintf (report->stream,
+                 "%s,%" PRIu64 ",%" PRIu64 ",%" PRId64 ",%.2f,%.0f\n",
+                 result->name, result->param, result->iterations,
+                 result->elapsed_ns, ns_per_op, ops_per_sec);
+        break;
+    case BENCH_FORMAT_JSON:
+        fprintf (report->stream,
+                 "%s\n    { \"name\": \"%s\", \"param\": %" PRIu64 ", "
+                 "\"iterations\": %" PRIu64 ", \"elapsed_ns\": %" PRId64 ", "
+                 "\"ns_per_op\": %.2f, \"ops_per_sec\": %.0f }",
+                 report->count > 0 ? "," : "",
+                 result->name, result->param, result->iterations,
+                 result->elapsed_ns, ns_per_op, ops_per_sec);
+        break;
+    }
+    fflush (report->stream);
+    ++report->count;
+}
+void
+bench_report_memory (bench_report_t        *report,
+                     bench_memory_result_t *result)
+{
+    gdouble bytes_per_item;
+
+    bytes_per_item = result->count > 0 ?
+        (gdouble)result->rss_bytes / (gdouble)result->count : 0;
+    switch (report->format) {
+    case BENCH_FORMAT_CSV:
+        fprintf (report->stream,
+                 "%s,%" PRIu64 ",%" PRId64 ",%.1f\n",
+                 result->name, result->count, result->rss_bytes,
+                 bytes_per_item);
+        break;
+    case BENCH_FORMAT_JSON:
+        fprintf (report->stream,
+                 "%s\n    { \"name\": \"%s\", \"count\": %" PRIu64 ", "
+                 "\"rss_bytes\": %" PRId64 ", \"bytes_per_item\": %.1f }",
+                 report->count > 0 ? "," : "",
+                 result->name, result->count, result->rss_bytes,
+                 bytes_per_item);
+        break;
+    }
+    fflush (report->stream);
+    ++report->count;
+}
+/*
+ * Resident set size of the process identified by 'pid' in bytes, or of the
+ * calling process when 'pid' is 0. Returns -1 if it can't be determined.
+ * This is read from /proc/<pid>/statm so it's Linux specific.
+ */
+gint64
+bench_rss_bytes (pid_t pid)
+{
+    gchar *path, *contents = NULL;
+    unsigned long size = 0, resident = 0;
+    gint64 ret = -1;
+
+    if (pid == 0) {
+        path = g_strdup ("/proc/self/statm");
+    } else {
+        path = g_strdup_printf ("/proc/%ld/statm", (long)pid);
+    }
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+        goto out;
+    }
+    if (sscanf (contents, "%lu %lu", &size, &resident) != 2) {
+        goto out;
+    }
+    ret = (gint64)resident * sysconf (_SC_PAGESIZE);
+out:
+    g_free (contents);
+    g_free (path);
+    return ret;
+}
+void
+bench_report_end (bench_report_t *report)
+{
+    if (report->format == BENCH_FORMAT_JSON) {
+        fprintf (report->stream, "\n  ]\n}\n");
+    }
+    if (report->stream != stdout) {
+        fclose (report->stream);
+    }
+    report->stream = NULL;
+}
+static void
+bench_log_discard (const gchar    *log_domain,
+                   GLogLevelFlags  log_level,
+                   const gchar    *message,
+                   gpointer        user_data)
+{
+    (void)log_domain;
+    (void)log_level;
+    (void)message;
+    (void)user_data;
+}
+/*
+ * The code under test logs liberally at the debug and info levels. Drop
+ * these messages so they don't end up interleaved with the results.
+ */
+void
+bench_quiet_logging (void)
+{
+    g_log_set_handler (NULL,
+                       G_LOG_LEVEL_DEBUG | G_LOG_LEVEL_INFO | G_LOG_LEVEL_MESSAGE,
+                       bench_log_discard,
+                       NULL);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <glib.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Output formats supported by the benchmark programs. Both are intended to
+ * be consumed by scripts: CSV for spreadsheets / gnuplot and JSON for
+ * anything that wants to diff results between two builds.
+ */
+typedef enum {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON,
+} bench_format_t;
+
+#define BENCH_ITERATIONS_DEFAULT 100000
+#define BENCH_ITERATIONS_MIN     10
+
+typedef struct {
+    bench_format_t  format;
+    gint            iterations;
+    gchar          *output;
+    gchar          *filter;
+} bench_opts_t;
+
+#define BENCH_OPTS_INIT_DEFAULT { \
+    .format = BENCH_FORMAT_CSV, \
+    .iterations = BENCH_ITERATIONS_DEFAULT, \
+    .output = NULL, \
+    .filter = NULL, \
+}
+
+/*
+ * A single benchmark result. 'name' identifies the operation measured,
+ * 'param' is a case specific parameter (usually the number of entries in
+ * the container under test) and 'elapsed_ns' is the wall clock time spent
+ * performing 'iterations' operations.
+ */
+typedef struct {
+    const gchar *name;
+    guint64      param;
+    guint64      iterations;
+    gint64       elapsed_ns;
+} bench_result_t;
+
+/*
+ * A single memory footprint result. 'count' items were created and the
+ * resident set grew by 'rss_bytes' while doing so.
+ */
+typedef struct {
+    const gchar *name;
+    guint64      count;
+    gint64       rss_bytes;
+} bench_memory_result_t;
+
+typedef struct {
+    FILE           *stream;
+    bench_format_t  format;
+    guint           count;
+    const gchar    *filter;
+} bench_report_t;
+
+gint64      bench_now_ns        (void);
+gboolean    bench_parse_opts    (gint             argc,
+                                 gchar           *argv[],
+                                 const gchar     *description,
+                                 GOptionEntry    *extra_entries,
+                                 bench_opts_t    *opts);
+guint64     bench_iterations    (bench_opts_t    *opts,
+                                 guint64          size);
+gboolean    bench_report_begin  (bench_report_t  *report,
+                                 bench_opts_t    *opts);
+gboolean    bench_enabled       (bench_report_t  *report,
+                                 const gchar     *name);
+void        bench_report_result (bench_report_t  *report,
+                                 bench_result_t  *result);
+gboolean    bench_report_begin_memory (bench_report_t  *report,
+                                       bench_opts_t    *opts);
+void        bench_report_memory (bench_report_t  *report,
+                                 bench_memory_result_t *result);
+gint64      bench_rss_bytes     (pid_t            pid);
+void        bench_report_end    (bench_report_t  *report);
+void        bench_quiet_logging (void);
+
+#endif /* BENCH_H */
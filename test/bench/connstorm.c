@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Connection storm benchmark: fork a number of client processes that each
+ * open and close tabrmd TCTI connections in a tight loop. Each iteration
+ * is a full Tss2_Tcti_Tabrmd_Init (D-Bus CreateConnection call and socket
+ * setup) followed by Tss2_Tcti_Finalize. This is the pattern of short
+ * lived command line tools where connection setup dominates.
+ *
+ * Each child reports the number of connections made, the sum of their
+ * latency and the worst case latency back to the parent through a pipe.
+ * The result structure is smaller than PIPE_BUF so it's written and read
+ * with a single call.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "bench-tcti.h"
+#include "util.h"
+
+#define CONNSTORM_PROCESSES_DEFAULT   8
+#define CONNSTORM_CONNECTIONS_DEFAULT 1000
+
+typedef struct {
+    guint64 count;
+    guint64 errors;
+    gint64  latency_ns;
+    gint64  max_ns;
+} connstorm_result_t;
+
+static void
+connstorm_child (const gchar        *tcti_conf,
+                 guint               connections,
+                 connstorm_result_t *result)
+{
+    TSS2_TCTI_CONTEXT *tcti_context;
+    gint64 start, elapsed;
+    guint i;
+
+    for (i = 0; i < connections; ++i) {
+        start = bench_now_ns ();
+        tcti_context = bench_tcti_tabrmd_init (tcti_conf);
+        if (tcti_context == NULL) {
+            ++result->errors;
+            continue;
+        }
+        bench_tcti_free (tcti_context);
+        elapsed = bench_now_ns () - start;
+        result->latency_ns += elapsed;
+        result->max_ns = MAX (result->max_ns, elapsed);
+        ++result->count;
+    }
+}
+/*
+ * Fork 'processes' children and return the write end of the pipe each
+ * child reports through in 'fds'. Returns the number of children started.
+ */
+static guint
+connstorm_spawn (const gchar *tcti_conf,
+                 guint        processes,
+                 guint        connections,
+                 gint        *fds)
+{
+    connstorm_result_t result;
+    gint pipe_fds [2];
+    pid_t pid;
+    guint i;
+
+    for (i = 0; i < processes; ++i) {
+        if (pipe (pipe_fds) != 0) {
+            g_printerr ("pipe failed: %s\n", strerror (errno));
+            break;
+        }
+        pid = fork ();
+        if (pid == -1) {
+            g_printerr ("fork failed: %s\n", strerror (errno));
+            close (pipe_fds [0]);
+            close (pipe_fds [1]);
+            break;
+        }
+        if (pid == 0) {
+            close (pipe_fds [0]);
+            memset (&result, 0, sizeof (result));
+            connstorm_child (tcti_conf, connections, &result);
+            if (TABRMD_ERRNO_EINTR_RETRY (write (pipe_fds [1],
+                                                 &result,
+                                                 sizeof (result))) !=
+                (ssize_t)sizeof (result)) {
+                _exit (1);
+            }
+            _exit (0);
+        }
+        close (pipe_fds [1]);
+        fds [i] = pipe_fds [0];
+    }
+    return i;
+}
+int
+main (int   argc,
+      char *argv[])
+{
+    bench_opts_t opts = BENCH_OPTS_INIT_DEFAULT;
+    bench_report_t report = { 0 };
+    connstorm_result_t result, total = { 0 };
+    gchar *tcti_conf = NULL;
+    gint processes = CONNSTORM_PROCESSES_DEFAULT;
+    gint connections = CONNSTORM_CONNECTIONS_DEFAULT;
+    gint *fds, status;
+    ssize_t ret;
+    gint64 start, end;
+    guint i, started;
+    GOptionEntry entries[] = {
+        { "processes", 'p', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &processes, "Number of client processes.", NULL },
+        { "connections", 'n', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &connections, "Connections opened and closed by each process.",
+          NULL },
+        { "tcti-conf", 'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+          &tcti_conf, "Config string for the tabrmd TCTI.", "conf" },
+        { NULL, '\0', 0, 0, NULL, NULL, NULL },
+    };
+
+    if (!bench_parse_opts (argc, argv, "- tpm2-abrmd connection storm",
+                           entries, &opts)) {
+        return 2;
+    }
+    if (processes < 1 || connections < 1) {
+        g_printerr ("--processes and --connections must be positive\n");
+        return 2;
+    }
+    if (!bench_report_begin (&report, &opts)) {
+        return 1;
+    }
+    fds = g_new0 (gint, processes);
+    start = bench_now_ns ();
+    started = connstorm_spawn (tcti_conf, processes, connections, fds);
+    for (i = 0; i < started; ++i) {
+        memset (&result, 0, sizeof (result));
+        ret = TABRMD_ERRNO_EINTR_RETRY (read (fds [i], &result, sizeof (result)));
+        if (ret != (ssize_t)sizeof (result)) {
+            memset (&result, 0, sizeof (result));
+            g_printerr ("failed to read result from child %u\n", i);
+            total.errors += connections;
+        }
+        close (fds [i]);
+        total.count += result.count;
+        total.errors += result.errors;
+        total.latency_ns += result.latency_ns;
+        total.max_ns = MAX (total.max_ns, result.max_ns);
+    }
+    for (i = 0; i < started; ++i) {
+        TABRMD_ERRNO_EINTR_RETRY (wait (&status));
+    }
+    end = bench_now_ns ();
+    if (total.count > 0) {
+        bench_report_result (&report, &(bench_result_t) {
+            .name = "connect_close_wall", .param = started,
+            .iterations = total.count, .elapsed_ns = end - start,
+        });
+        bench_report_result (&report, &(bench_result_t) {
+            .name = "connect_close_latency", .param = started,
+            .iterations = total.count, .elapsed_ns = total.latency_ns,
+        });
+        bench_report_result (&report, &(bench_result_t) {
+            .name = "connect_close_max", .param = started,
+            .iterations = 1, .elapsed_ns = total.max_ns,
+        });
+    }
+    bench_report_end (&report);
+    g_printerr ("%" PRIu64 " connections from %u processes, %" PRIu64
+                " errors\n", total.count, started, total.errors);
+    g_free (fds);
+    g_free (tcti_conf);
+
+    return (total.errors > 0 || started < (guint)processes) ? 1 : 0;
+}
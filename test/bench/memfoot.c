@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Memory footprint benchmark: report the growth in resident set size per
+ * idle client connection, per saved session context and per saved
+ * transient object context.
+ *
+ * By default the objects are created in this process using the same code
+ * the daemon uses (Connection, SessionEntry, HandleMapEntry) so no TPM or
+ * D-Bus is required. When passed the PID of a running daemon with --pid the
+ * idle connection case is also measured against the daemon itself by
+ * opening TCTI connections to it and reading its RSS.
+ *
+ * RSS grows in whole pages so the per item numbers are only meaningful
+ * for counts in the hundreds or more.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "bench.h"
+#include "bench-tcti.h"
+#include "connection.h"
+#include "handle-map.h"
+#include "handle-map-entry.h"
+#include "session-entry.h"
+#include "util.h"
+
+#define MEMFOOT_COUNT_DEFAULT      1000
+#define MEMFOOT_BLOB_SIZE_DEFAULT  256
+/* file descriptors held back for stdio, D-Bus etc */
+#define MEMFOOT_FD_RESERVE         64
+
+/*
+ * Raise the soft limit on open files to the hard limit. Each in-process
+ * Connection holds one end of a socket pair.
+ */
+static rlim_t
+memfoot_raise_nofile (void)
+{
+    struct rlimit limit;
+
+    if (getrlimit (RLIMIT_NOFILE, &limit) != 0) {
+        return 0;
+    }
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit (RLIMIT_NOFILE, &limit) != 0) {
+            getrlimit (RLIMIT_NOFILE, &limit);
+        }
+    }
+    return limit.rlim_cur;
+}
+/*
+ * Build a marshalled TPMS_CONTEXT with a contextBlob of 'blob_size' bytes.
+ * The sequence number is varied by the caller so no two are identical.
+ */
+static size_t
+memfoot_context (TPMS_CONTEXT *context,
+                 TPM2_HANDLE   handle,
+                 guint64       sequence,
+                 uint8_t      *buf,
+                 size_t        buf_size)
+{
+    size_t offset = 0;
+    TSS2_RC rc;
+
+    context->sequence = sequence;
+    context->savedHandle = handle;
+    context->hierarchy = TPM2_RH_OWNER;
+    rc = Tss2_MU_TPMS_CONTEXT_Marshal (context, buf, buf_size, &offset);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_error ("failed to marshal TPMS_CONTEXT: 0x%" PRIx32, rc);
+    }
+    return offset;
+}
+static Connection*
+memfoot_connection_new (guint64 id)
+{
+    Connection *connection;
+    GIOStream *iostream;
+    HandleMap *handle_map;
+    int client_fd;
+
+    iostream = create_connection_iostream (&client_fd);
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    connection = connection_new (iostream, id, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    close (client_fd);
+
+    return connection;
+}
+static void
+memfoot_idle_connection (bench_report_t *report,
+                         guint64         count)
+{
+    GPtrArray *array;
+    gint64 before, after;
+    guint64 i;
+
+    array = g_ptr_array_new_full (count, g_object_unref);
+    before = bench_rss_bytes (0);
+    for (i = 0; i < count; ++i) {
+        g_ptr_array_add (array, memfoot_connection_new (i));
+    }
+    after = bench_rss_bytes (0);
+    bench_report_memory (report, &(bench_memory_result_t) {
+        .name = "idle_connection", .count = count,
+        .rss_bytes = after - before,
+    });
+    g_ptr_array_unref (array);
+}
+static void
+memfoot_saved_session (bench_report_t *report,
+                       guint64         count,
+                       guint16         blob_size)
+{
+    Connection *connection;
+    GPtrArray *array;
+    SessionEntry *entry;
+    TPMS_CONTEXT context = { 0, };
+    uint8_t buf [sizeof (TPMS_CONTEXT)];
+    size_t size;
+    gint64 before, after;
+    guint64 i;
+
+    connection = memfoot_connection_new (0);
+    context.contextBlob.size = blob_size;
+    memset (context.contextBlob.buffer, 0xa5, blob_size);
+    array = g_ptr_array_new_full (count, g_object_unref);
+    before = bench_rss_bytes (0);
+    for (i = 0; i < count; ++i) {
+        entry = session_entry_new (connection, TPM2_HMAC_SESSION_FIRST);
+        size = memfoot_context (&context, TPM2_HMAC_SESSION_FIRST, i,
+                                buf, sizeof (buf));
+        session_entry_set_context (entry, buf, size);
+        session_entry_set_state (entry, SESSION_ENTRY_SAVED_RM);
+        g_ptr_array_add (array, entry);
+    }
+    after = bench_rss_bytes (0);
+    bench_report_memory (report, &(bench_memory_result_t) {
+        .name = "saved_session", .count = count,
+        .rss_bytes = after - before,
+    });
+    g_ptr_array_unref (array);
+    g_object_unref (connection);
+}
+/*
+ * Saved transient contexts are held in HandleMaps the way they would be in
+ * the daemon. A HandleMap is limited to MAX_ENTRIES_MAX entries so a new
+ * one is started whenever the current one fills up.
+ */
+static void
+memfoot_saved_transient (bench_report_t *report,
+                         guint64         count,
+                         guint16         blob_size)
+{
+    GPtrArray *maps;
+    HandleMap *map = NULL;
+    HandleMapEntry *entry;
+    TPMS_CONTEXT context = { 0, };
+    TPM2_HANDLE vhandle;
+    gint64 before, after;
+    guint64 i;
+
+    context.contextBlob.size = blob_size;
+    memset (context.contextBlob.buffer, 0x5a, blob_size);
+    context.savedHandle = TPM2_TRANSIENT_FIRST;
+    context.hierarchy = TPM2_RH_OWNER;
+    maps = g_ptr_array_new_full (count / MAX_ENTRIES_MAX + 1, g_object_unref);
+    before = bench_rss_bytes (0);
+    for (i = 0; i < count; ++i) {
+        if (map == NULL || handle_map_is_full (map)) {
+            map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_MAX);
+            g_ptr_array_add (maps, map);
+        }
+        vhandle = handle_map_next_vhandle (map);
+        entry = handle_map_entry_new (0, vhandle);
+        context.sequence = i;
+        if (handle_map_entry_set_context (entry, &context) != TSS2_RC_SUCCESS) {
+            g_error ("failed to set context on HandleMapEntry");
+        }
+        handle_map_insert (map, vhandle, entry);
+        g_object_unref (entry);
+    }
+    after = bench_rss_bytes (0);
+    bench_report_memory (report, &(bench_memory_result_t) {
+        .name = "saved_transient", .count = count,
+        .rss_bytes = after - before,
+    });
+    g_ptr_array_unref (maps);
+}
+/*
+ * Open up to 'count' TCTI connections to the daemon identified by 'pid'
+ * and report its RSS growth. The daemon limits the number of connections
+ * (--max-connections) so we stop at the first failure and report what we
+ * got.
+ */
+static gboolean
+memfoot_daemon_idle_connection (bench_report_t *report,
+                                pid_t           pid,
+                                const gchar    *tcti_conf,
+                                guint64         count)
+{
+    TSS2_TCTI_CONTEXT **contexts;
+    gint64 before, after;
+    guint64 i, opened;
+
+    contexts = g_new0 (TSS2_TCTI_CONTEXT*, count);
+    before = bench_rss_bytes (pid);
+    if (before < 0) {
+        g_printerr ("failed to read RSS for PID %ld\n", (long)pid);
+        g_free (contexts);
+        return FALSE;
+    }
+    for (opened = 0; opened < count; ++opened) {
+        contexts [opened] = bench_tcti_tabrmd_init (tcti_conf);
+        if (contexts [opened] == NULL) {
+            break;
+        }
+    }
+    after = bench_rss_bytes (pid);
+    if (opened > 0) {
+        bench_report_memory (report, &(bench_memory_result_t) {
+            .name = "daemon_idle_connection", .count = opened,
+            .rss_bytes = after - before,
+        });
+    }
+    for (i = 0; i < opened; ++i) {
+        bench_tcti_free (contexts [i]);
+    }
+    g_free (contexts);
+    if (opened < count) {
+        g_printerr ("daemon accepted %" PRIu64 " of %" PRIu64
+                    " connections\n", opened, count);
+    }
+    return opened > 0;
+}
+int
+main (int   argc,
+      char *argv[])
+{
+    bench_opts_t opts = BENCH_OPTS_INIT_DEFAULT;
+    bench_report_t report = { 0 };
+    gchar *tcti_conf = NULL;
+    gint count = MEMFOOT_COUNT_DEFAULT;
+    gint blob_size = MEMFOOT_BLOB_SIZE_DEFAULT;
+    gint pid = 0;
+    guint64 connections;
+    rlim_t nofile;
+    int ret = 0;
+    GOptionEntry entries[] = {
+        { "count", 'n', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &count,
+          "Number of objects created for each case.", NULL },
+        { "blob-size", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &blob_size, "Size of the contextBlob in saved contexts.", NULL },
+        { "pid", 'p', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &pid,
+          "PID of a running tpm2-abrmd to measure.", "pid" },
+        { "tcti-conf", 'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+          &tcti_conf, "Config string for the tabrmd TCTI.", "conf" },
+        { NULL, '\0', 0, 0, NULL, NULL, NULL },
+    };
+
+    if (!bench_parse_opts (argc, argv, "- tpm2-abrmd memory footprint",
+                           entries, &opts)) {
+        return 2;
+    }
+    if (count < 1) {
+        g_printerr ("--count must be positive\n");
+        return 2;
+    }
+    if (blob_size < 0 || blob_size > TPM2_MAX_CONTEXT_SIZE) {
+        g_printerr ("--blob-size must be between 0 and %u\n",
+                    (guint)TPM2_MAX_CONTEXT_SIZE);
+        return 2;
+    }
+    bench_quiet_logging ();
+    if (!bench_report_begin_memory (&report, &opts)) {
+        return 1;
+    }
+    nofile = memfoot_raise_nofile ();
+    connections = (guint64)count;
+    if (nofile <= MEMFOOT_FD_RESERVE) {
+        connections = 0;
+    } else if (connections > nofile - MEMFOOT_FD_RESERVE) {
+        connections = nofile - MEMFOOT_FD_RESERVE;
+        g_printerr ("idle_connection limited to %" PRIu64 " by RLIMIT_NOFILE\n",
+                    connections);
+    }
+    if (connections > 0 && bench_enabled (&report, "idle_connection")) {
+        memfoot_idle_connection (&report, connections);
+    }
+    if (bench_enabled (&report, "saved_session")) {
+        memfoot_saved_session (&report, count, blob_size);
+    }
+    if (bench_enabled (&report, "saved_transient")) {
+        memfoot_saved_transient (&report, count, blob_size);
+    }
+    if (pid > 0 && bench_enabled (&report, "daemon_idle_connection")) {
+        if (!memfoot_daemon_idle_connection (&report, pid, tcti_conf,
+                                             MIN (connections, (guint64)count)))
+        {
+            ret = 1;
+        }
+    }
+    bench_report_end (&report);
+    g_free (tcti_conf);
+
+    return ret;
+}
@@ -0,0 +1,597 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Microbenchmarks for the data structures and parsers on the daemon's
+ * command path. Each case reports the wall clock time for a number of
+ * iterations of a single operation. Results are written as CSV or JSON
+ * so they can be compared between builds by a script.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "bench.h"
+#include "command-attrs.h"
+#include "connection.h"
+#include "control-message.h"
+#include "handle-map.h"
+#include "message-queue.h"
+#include "session-list.h"
+#include "tpm2-command.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+#define SESSION_LIST_SIZES_MAX 100000
+/*
+ * TPMA_CC for a command with a single handle in the handle area (e.g.
+ * TPM2_Sign). The command code is OR'd in when the buffer is built.
+ */
+#define BENCH_TPMA_CC_ONE_HANDLE 0x02000000
+
+/*
+ * Write to this to keep the compiler from optimizing away the result of
+ * an operation that has no other side effects.
+ */
+static volatile guint64 bench_sink;
+
+/*
+ * Build a command buffer with a single handle, a single password
+ * authorization and 'param_size' bytes of parameters. The structure matches
+ * a TPM2_Sign command closely enough for the accessors we exercise.
+ */
+static guint8*
+bench_command_buffer (size_t *size,
+                      size_t  param_size)
+{
+    TSS2_RC rc;
+    guint8 *buf;
+    size_t offset = TPM_HEADER_SIZE;
+    TPMS_AUTH_COMMAND auth = {
+        .sessionHandle = TPM2_RS_PW,
+    };
+    UINT32 auth_size = sizeof (TPM2_HANDLE) + sizeof (UINT16) +
+        sizeof (TPMA_SESSION) + sizeof (UINT16);
+
+    *size = TPM_HEADER_SIZE + sizeof (TPM2_HANDLE) + sizeof (UINT32) +
+        auth_size + param_size;
+    buf = g_malloc0 (*size);
+    rc = tpm2_header_init (buf, *size, TPM2_ST_SESSIONS, *size, TPM2_CC_Sign);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_error ("%s: tpm2_header_init failed: 0x%" PRIx32, __func__, rc);
+    }
+    rc = Tss2_MU_TPM2_HANDLE_Marshal (0x80000001, buf, *size, &offset);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT32_Marshal (auth_size, buf, *size, &offset);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_TPMS_AUTH_COMMAND_Marshal (&auth, buf, *size, &offset);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_error ("%s: failed to marshal command body: 0x%" PRIx32,
+                 __func__, rc);
+    }
+    memset (&buf [offset], 0xa5, *size - offset);
+    return buf;
+}
+/*
+ * Create a Connection backed by a real socketpair. The client end is closed
+ * since none of the cases using this function perform any I/O.
+ */
+static Connection*
+bench_connection_new (guint64 id)
+{
+    Connection *connection;
+    GIOStream *iostream;
+    HandleMap *handle_map;
+    int client_fd;
+
+    iostream = create_connection_iostream (&client_fd);
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    connection = connection_new (iostream, id, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    close (client_fd);
+
+    return connection;
+}
+static void
+bench_auth_noop (gpointer data,
+                 gpointer user_data)
+{
+    UNUSED_PARAM(user_data);
+    bench_sink += (guint64)(uintptr_t)data;
+}
+static void
+bench_tpm2_command (bench_report_t *report,
+                    bench_opts_t   *opts)
+{
+    Connection *connection;
+    Tpm2Command *command;
+    TPM2_HANDLE handles [TPM2_COMMAND_MAX_HANDLES];
+    TPMA_CC attrs = BENCH_TPMA_CC_ONE_HANDLE | TPM2_CC_Sign;
+    guint8 *buf_template, *buf;
+    size_t size, count;
+    guint64 i, iterations = bench_iterations (opts, 1);
+    gint64 start, end;
+
+    if (!bench_enabled (report, "tpm2_command")) {
+        return;
+    }
+    connection = bench_connection_new (0);
+    buf_template = bench_command_buffer (&size, 64);
+
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        buf = g_memdup (buf_template, size);
+        command = tpm2_command_new (connection, buf, size, attrs);
+        g_object_unref (command);
+    }
+    end = bench_now_ns ();
+    bench_report_result (report, &(bench_result_t) {
+        .name = "tpm2_command_new", .param = size,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+
+    command = tpm2_command_new (connection,
+                                g_memdup (buf_template, size),
+                                size,
+                                attrs);
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        count = TPM2_COMMAND_MAX_HANDLES;
+        tpm2_command_get_handles (command, handles, &count);
+        bench_sink += handles [0] + tpm2_command_get_handle_count (command) +
+            tpm2_command_get_code (command) + tpm2_command_get_size (command);
+    }
+    end = bench_now_ns ();
+    bench_report_result (report, &(bench_result_t) {
+        .name = "tpm2_command_get_handles", .param = size,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        bench_sink += tpm2_command_get_auths_size (command);
+        tpm2_command_foreach_auth (command, bench_auth_noop, NULL);
+    }
+    end = bench_now_ns ();
+    bench_report_result (report, &(bench_result_t) {
+        .name = "tpm2_command_foreach_auth", .param = size,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+
+    g_object_unref (command);
+    g_object_unref (connection);
+    g_free (buf_template);
+}
+/*
+ * Populate a CommandAttrs object with an entry for each command code in
+ * the TPM2_CC_FIRST to TPM2_CC_LAST range. This is the worst case for the
+ * linear search in command_attrs_from_cc.
+ */
+static void
+bench_command_attrs_lookup (bench_report_t *report,
+                            bench_opts_t   *opts,
+                            CommandAttrs   *attrs,
+                            const gchar    *name,
+                            TPM2_CC         command_code)
+{
+    guint64 i, iterations = bench_iterations (opts, 1);
+    gint64 start, end;
+
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        bench_sink += command_attrs_from_cc (attrs, command_code);
+    }
+    end = bench_now_ns ();
+    bench_report_result (report, &(bench_result_t) {
+        .name = name, .param = attrs->count,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+}
+static void
+bench_command_attrs (bench_report_t *report,
+                     bench_opts_t   *opts)
+{
+    CommandAttrs *attrs;
+    UINT32 i;
+
+    if (!bench_enabled (report, "command_attrs")) {
+        return;
+    }
+    attrs = command_attrs_new ();
+    attrs->count = TPM2_CC_LAST - TPM2_CC_FIRST + 1;
+    attrs->command_attrs = g_new0 (TPMA_CC, attrs->count);
+    for (i = 0; i < attrs->count; ++i) {
+        attrs->command_attrs [i] = TPM2_CC_FIRST + i;
+    }
+    bench_command_attrs_lookup (report, opts, attrs,
+                                "command_attrs_from_cc_first", TPM2_CC_FIRST);
+    bench_command_attrs_lookup (report, opts, attrs,
+                                "command_attrs_from_cc_last", TPM2_CC_LAST);
+    bench_command_attrs_lookup (report, opts, attrs,
+                                "command_attrs_from_cc_miss", TPM2_CC_LAST + 1);
+    g_object_unref (attrs);
+}
+/*
+ * The HandleMap caps the number of entries at MAX_ENTRIES_MAX so we can
+ * only measure it up to that size.
+ */
+static void
+bench_handle_map_size (bench_report_t *report,
+                       bench_opts_t   *opts,
+                       guint           size)
+{
+    HandleMap *map;
+    HandleMapEntry **entries, *entry;
+    guint64 round, rounds, iterations;
+    gint64 start, end, insert_ns = 0, lookup_ns = 0, remove_ns = 0;
+    guint i;
+
+    rounds = MAX (bench_iterations (opts, 1) / size, 1);
+    iterations = rounds * size;
+    map = handle_map_new (TPM2_HT_TRANSIENT, size);
+    entries = g_new0 (HandleMapEntry*, size);
+    for (i = 0; i < size; ++i) {
+        entries [i] = handle_map_entry_new (0x80000000 + i,
+                                            handle_map_next_vhandle (map));
+    }
+    for (round = 0; round < rounds; ++round) {
+        start = bench_now_ns ();
+        for (i = 0; i < size; ++i) {
+            handle_map_insert (map,
+                               handle_map_entry_get_vhandle (entries [i]),
+                               entries [i]);
+        }
+        end = bench_now_ns ();
+        insert_ns += end - start;
+
+        start = bench_now_ns ();
+        for (i = 0; i < size; ++i) {
+            entry = handle_map_vlookup (map,
+                                        handle_map_entry_get_vhandle (entries [i]));
+            bench_sink += (uintptr_t)entry;
+            g_object_unref (entry);
+        }
+        end = bench_now_ns ();
+        lookup_ns += end - start;
+
+        start = bench_now_ns ();
+        for (i = 0; i < size; ++i) {
+            handle_map_remove (map, handle_map_entry_get_vhandle (entries [i]));
+        }
+        end = bench_now_ns ();
+        remove_ns += end - start;
+    }
+    bench_report_result (report, &(bench_result_t) {
+        .name = "handle_map_insert", .param = size,
+        .iterations = iterations, .elapsed_ns = insert_ns,
+    });
+    bench_report_result (report, &(bench_result_t) {
+        .name = "handle_map_vlookup", .param = size,
+        .iterations = iterations, .elapsed_ns = lookup_ns,
+    });
+    bench_report_result (report, &(bench_result_t) {
+        .name = "handle_map_remove", .param = size,
+        .iterations = iterations, .elapsed_ns = remove_ns,
+    });
+    for (i = 0; i < size; ++i) {
+        g_object_unref (entries [i]);
+    }
+    g_free (entries);
+    g_object_unref (map);
+}
+static void
+bench_handle_map (bench_report_t *report,
+                  bench_opts_t   *opts)
+{
+    if (!bench_enabled (report, "handle_map")) {
+        return;
+    }
+    bench_handle_map_size (report, opts, 10);
+    bench_handle_map_size (report, opts, MAX_ENTRIES_MAX);
+}
+/*
+ * Measure SessionList operations against a list pre-populated with 'size'
+ * entries. The list is populated directly since session_list_insert
+ * enforces the per-connection limit (and is itself linear in the size of
+ * the list). Entries used for the measurement belong to a separate
+ * Connection so the per-connection limit isn't hit.
+ */
+static void
+bench_session_list_size (bench_report_t *report,
+                         bench_opts_t   *opts,
+                         guint64         size)
+{
+    SessionList *list;
+    SessionEntry *entry, *probe;
+    Connection *conn_fill, *conn;
+    guint8 context [TPM_HEADER_SIZE] = { 0xff };
+    guint64 i, iterations = bench_iterations (opts, size);
+    gint64 start, end;
+
+    list = session_list_new (SESSION_LIST_MAX_ENTRIES_MAX,
+                             SESSION_LIST_MAX_ABANDONED_DEFAULT);
+    conn_fill = bench_connection_new (1);
+    conn = bench_connection_new (2);
+    for (i = 0; i < size; ++i) {
+        entry = session_entry_new (conn_fill, TPM2_HMAC_SESSION_FIRST + i);
+        list->session_entry_list = g_list_prepend (list->session_entry_list,
+                                                   entry);
+    }
+    probe = session_entry_new (conn, TPM2_HMAC_SESSION_FIRST + size);
+
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        session_list_insert (list, probe);
+        session_list_remove (list, probe);
+    }
+    end = bench_now_ns ();
+    bench_report_result (report, &(bench_result_t) {
+        .name = "session_list_insert_remove", .param = size,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+    /* first entry prepended is the last in the list: worst case lookup */
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        entry = session_list_lookup_handle (list, TPM2_HMAC_SESSION_FIRST);
+        bench_sink += (uintptr_t)entry;
+        g_clear_object (&entry);
+    }
+    end = bench_now_ns ();
+    bench_report_result (report, &(bench_result_t) {
+        .name = "session_list_lookup_handle", .param = size,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        entry = session_list_lookup_context_client (list,
+                                                    context,
+                                                    sizeof (context));
+        bench_sink += (uintptr_t)entry;
+        g_clear_object (&entry);
+    }
+    end = bench_now_ns ();
+    bench_report_result (report, &(bench_result_t) {
+        .name = "session_list_lookup_context_client", .param = size,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        bench_sink += session_list_connection_count (list, conn);
+    }
+    end = bench_now_ns ();
+    bench_report_result (report, &(bench_result_t) {
+        .name = "session_list_connection_count", .param = size,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+
+    g_object_unref (probe);
+    g_object_unref (list);
+    g_object_unref (conn);
+    g_object_unref (conn_fill);
+}
+static void
+bench_session_list (bench_report_t *report,
+                    bench_opts_t   *opts,
+                    guint64         max_size)
+{
+    guint64 size;
+
+    if (!bench_enabled (report, "session_list")) {
+        return;
+    }
+    for (size = 10; size <= max_size; size *= 100) {
+        bench_session_list_size (report, opts, size);
+    }
+}
+typedef struct {
+    MessageQueue *in;
+    MessageQueue *out;
+    guint64       count;
+} bench_queue_data_t;
+/*
+ * Return each message received on the 'in' queue through the 'out' queue.
+ */
+static gpointer
+bench_queue_echo_thread (gpointer user_data)
+{
+    bench_queue_data_t *data = (bench_queue_data_t*)user_data;
+    GObject *obj;
+    guint64 i;
+
+    for (i = 0; i < data->count; ++i) {
+        obj = message_queue_dequeue (data->in);
+        message_queue_enqueue (data->out, obj);
+        g_object_unref (obj);
+    }
+    return NULL;
+}
+/*
+ * Enqueue 'count' messages on the 'out' queue as fast as possible.
+ */
+static gpointer
+bench_queue_producer_thread (gpointer user_data)
+{
+    bench_queue_data_t *data = (bench_queue_data_t*)user_data;
+    ControlMessage *msg;
+    guint64 i;
+
+    msg = control_message_new (CHECK_CANCEL);
+    for (i = 0; i < data->count; ++i) {
+        message_queue_enqueue (data->out, G_OBJECT (msg));
+    }
+    g_object_unref (msg);
+    return NULL;
+}
+static void
+bench_message_queue (bench_report_t *report,
+                     bench_opts_t   *opts)
+{
+    bench_queue_data_t data;
+    ControlMessage *msg;
+    GObject *obj;
+    GThread *thread;
+    guint64 i, iterations = bench_iterations (opts, 1);
+    gint64 start, end;
+
+    if (!bench_enabled (report, "message_queue")) {
+        return;
+    }
+    data.in = message_queue_new ();
+    data.out = message_queue_new ();
+    data.count = iterations;
+    msg = control_message_new (CHECK_CANCEL);
+    thread = g_thread_new ("bench-echo", bench_queue_echo_thread, &data);
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        message_queue_enqueue (data.in, G_OBJECT (msg));
+        obj = message_queue_dequeue (data.out);
+        g_object_unref (obj);
+    }
+    end = bench_now_ns ();
+    g_thread_join (thread);
+    /* a round trip is two handoffs between threads */
+    bench_report_result (report, &(bench_result_t) {
+        .name = "message_queue_handoff", .param = 1,
+        .iterations = iterations * 2, .elapsed_ns = end - start,
+    });
+
+    thread = g_thread_new ("bench-producer",
+                           bench_queue_producer_thread,
+                           &data);
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        obj = message_queue_dequeue (data.out);
+        g_object_unref (obj);
+    }
+    end = bench_now_ns ();
+    g_thread_join (thread);
+    bench_report_result (report, &(bench_result_t) {
+        .name = "message_queue_throughput", .param = 1,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+
+    g_object_unref (msg);
+    g_object_unref (data.in);
+    g_object_unref (data.out);
+}
+/*
+ * Measure the daemon's read path for a single TPM command: the client
+ * writes the whole command to its end of the socketpair and we read it
+ * back through the GInputStream the CommandSource would use.
+ */
+static void
+bench_read_tpm_buffer_size (bench_report_t *report,
+                            bench_opts_t   *opts,
+                            size_t          size)
+{
+    GIOStream *iostream;
+    GInputStream *istream;
+    guint8 *buf_in, *buf_out;
+    size_t size_out;
+    guint64 i, iterations = bench_iterations (opts, 1);
+    gint64 start, end;
+    int client_fd;
+
+    iostream = create_connection_iostream (&client_fd);
+    istream = g_io_stream_get_input_stream (iostream);
+    buf_in = g_malloc0 (size);
+    tpm2_header_init (buf_in, size, TPM2_ST_NO_SESSIONS, size,
+                      TPM2_CC_GetRandom);
+    start = bench_now_ns ();
+    for (i = 0; i < iterations; ++i) {
+        if (TABRMD_ERRNO_EINTR_RETRY (write (client_fd, buf_in, size)) !=
+            (ssize_t)size) {
+            g_error ("%s: short write to socket", __func__);
+        }
+        buf_out = read_tpm_buffer_alloc (istream, &size_out);
+        if (buf_out == NULL || size_out != size) {
+            g_error ("%s: read_tpm_buffer_alloc failed", __func__);
+        }
+        g_free (buf_out);
+    }
+    end = bench_now_ns ();
+    bench_report_result (report, &(bench_result_t) {
+        .name = "read_tpm_buffer_alloc", .param = size,
+        .iterations = iterations, .elapsed_ns = end - start,
+    });
+    g_free (buf_in);
+    close (client_fd);
+    g_object_unref (iostream);
+}
+static void
+bench_read_tpm_buffer (bench_report_t *report,
+                       bench_opts_t   *opts)
+{
+    if (!bench_enabled (report, "read_tpm_buffer")) {
+        return;
+    }
+    bench_read_tpm_buffer_size (report, opts, 64);
+    bench_read_tpm_buffer_size (report, opts, UTIL_BUF_SIZE);
+    bench_read_tpm_buffer_size (report, opts, UTIL_BUF_MAX);
+}
+int
+main (int   argc,
+      char *argv[])
+{
+    bench_opts_t opts = BENCH_OPTS_INIT_DEFAULT;
+    bench_report_t report = { 0 };
+    gint max_sessions = SESSION_LIST_SIZES_MAX;
+    GOptionEntry entries[] = {
+        { "max-sessions", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &max_sessions,
+          "Largest SessionList to measure (each SessionEntry is ~10KiB).",
+          NULL },
+        { NULL, '\0', 0, 0, NULL, NULL, NULL },
+    };
+
+    if (!bench_parse_opts (argc, argv, "- tpm2-abrmd microbenchmarks",
+                           entries, &opts)) {
+        return 2;
+    }
+    bench_quiet_logging ();
+    if (!bench_report_begin (&report, &opts)) {
+        return 1;
+    }
+    bench_tpm2_command (&report, &opts);
+    bench_command_attrs (&report, &opts);
+    bench_handle_map (&report, &opts);
+    bench_session_list (&report, &opts, (guint64)MAX (max_sessions, 0));
+    bench_message_queue (&report, &opts);
+    bench_read_tpm_buffer (&report, &opts);
+    bench_report_end (&report);
+
+    return 0;
+}
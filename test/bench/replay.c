@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Replay a trace captured by the daemon (tpm2-abrmd --trace-file) against a
+ * running daemon. Each connection in the trace is replayed by its own thread
+ * over its own TCTI connection so per-connection ordering is preserved and
+ * connections that were concurrent in the trace are concurrent here. Commands
+ * are issued at the time offsets recorded in the trace divided by the
+ * '--speed' factor, or as fast as possible when the speed is 0.
+ *
+ * Commands are replayed byte for byte. Virtual handles are allocated by the
+ * daemon deterministically for each connection so they will generally line
+ * up with the trace. Commands authorized with HMAC sessions won't: nonces
+ * differ between runs. Response codes that don't match the trace are counted
+ * and reported.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "bench-tcti.h"
+#include "tpm2-header.h"
+#include "trace.h"
+#include "util.h"
+
+typedef struct {
+    guint64         connection_id;
+    GPtrArray      *commands;
+    GPtrArray      *responses;
+    const gchar    *tcti_conf;
+    gdouble         speed;
+    guint64         time_base;
+    gint64          start_ns;
+    guint64         count;
+    guint64         mismatch;
+    guint64         errors;
+    gint64          latency_ns;
+} replay_connection_t;
+
+static void
+replay_record_free (gpointer data)
+{
+    trace_record_t *record = (trace_record_t*)data;
+
+    trace_record_clear (record);
+    g_free (record);
+}
+static void
+replay_connection_free (gpointer data)
+{
+    replay_connection_t *connection = (replay_connection_t*)data;
+
+    g_ptr_array_unref (connection->commands);
+    g_ptr_array_unref (connection->responses);
+    g_free (connection);
+}
+/*
+ * Read all records from the trace grouping them by connection. Returns a
+ * GHashTable mapping connection id to replay_connection_t or NULL on error.
+ * The timestamp of the first record is returned through 'time_base'.
+ */
+static GHashTable*
+replay_load_trace (const gchar *filename,
+                   guint64     *time_base)
+{
+    GHashTable *table;
+    replay_connection_t *connection;
+    trace_record_t *record;
+    FILE *file;
+    gboolean first = TRUE;
+    gint ret;
+
+    file = fopen (filename, "r");
+    if (file == NULL) {
+        g_printerr ("Failed to open trace %s: %s\n", filename, strerror (errno));
+        return NULL;
+    }
+    ret = trace_read_header (file, NULL);
+    if (ret != 0) {
+        g_printerr ("Failed to read trace header: %s\n", strerror (ret));
+        fclose (file);
+        return NULL;
+    }
+    table = g_hash_table_new_full (g_int64_hash,
+                                   g_int64_equal,
+                                   NULL,
+                                   replay_connection_free);
+    do {
+        record = g_new0 (trace_record_t, 1);
+        ret = trace_read_record (file, record);
+        if (ret != 0) {
+            g_free (record);
+            break;
+        }
+        if (first) {
+            *time_base = record->timestamp;
+            first = FALSE;
+        }
+        connection = g_hash_table_lookup (table, &record->connection_id);
+        if (connection == NULL) {
+            connection = g_new0 (replay_connection_t, 1);
+            connection->connection_id = record->connection_id;
+            connection->commands = g_ptr_array_new_with_free_func (replay_record_free);
+            connection->responses = g_ptr_array_new_with_free_func (replay_record_free);
+            g_hash_table_insert (table, &connection->connection_id, connection);
+        }
+        if (record->type == TRACE_RECORD_COMMAND) {
+            g_ptr_array_add (connection->commands, record);
+        } else {
+            g_ptr_array_add (connection->responses, record);
+        }
+    } while (TRUE);
+    fclose (file);
+    if (ret != -1) {
+        g_printerr ("Failed to read trace record: %s\n", strerror (ret));
+        g_hash_table_unref (table);
+        return NULL;
+    }
+    return table;
+}
+/*
+ * Sleep until the time offset 'timestamp' (relative to the start of the
+ * trace) scaled by the replay speed.
+ */
+static void
+replay_wait (replay_connection_t *connection,
+             guint64              timestamp)
+{
+    gint64 target, now;
+    struct timespec ts;
+
+    if (connection->speed <= 0) {
+        return;
+    }
+    target = connection->start_ns +
+        (gint64)((timestamp - connection->time_base) / connection->speed);
+    now = bench_now_ns ();
+    if (target <= now) {
+        return;
+    }
+    ts.tv_sec = (target - now) / G_GINT64_CONSTANT (1000000000);
+    ts.tv_nsec = (target - now) % G_GINT64_CONSTANT (1000000000);
+    TABRMD_ERRNO_EINTR_RETRY (nanosleep (&ts, &ts));
+}
+static gpointer
+replay_connection_thread (gpointer user_data)
+{
+    replay_connection_t *connection = (replay_connection_t*)user_data;
+    TSS2_TCTI_CONTEXT *tcti_context;
+    trace_record_t *command, *response;
+    guint8 buf [UTIL_BUF_MAX];
+    size_t size;
+    guint i;
+    gint64 start;
+    TSS2_RC rc;
+
+    tcti_context = bench_tcti_tabrmd_init (connection->tcti_conf);
+    if (tcti_context == NULL) {
+        connection->errors = connection->commands->len;
+        return NULL;
+    }
+    for (i = 0; i < connection->commands->len; ++i) {
+        command = g_ptr_array_index (connection->commands, i);
+        replay_wait (connection, command->timestamp);
+        start = bench_now_ns ();
+        rc = Tss2_Tcti_Transmit (tcti_context, command->size, command->buf);
+        if (rc == TSS2_RC_SUCCESS) {
+            size = sizeof (buf);
+            rc = Tss2_Tcti_Receive (tcti_context,
+                                    &size,
+                                    buf,
+                                    TSS2_TCTI_TIMEOUT_BLOCK);
+        }
+        if (rc != TSS2_RC_SUCCESS) {
+            g_warning ("connection 0x%" PRIx64 " command %u: TCTI error 0x%"
+                       PRIx32, connection->connection_id, i, rc);
+            ++connection->errors;
+            break;
+        }
+        connection->latency_ns += bench_now_ns () - start;
+        ++connection->count;
+        if (i < connection->responses->len) {
+            response = g_ptr_array_index (connection->responses, i);
+            if (get_response_code (response->buf) != get_response_code (buf)) {
+                ++connection->mismatch;
+            }
+        }
+    }
+    bench_tcti_free (tcti_context);
+
+    return NULL;
+}
+int
+main (int   argc,
+      char *argv[])
+{
+    bench_opts_t opts = BENCH_OPTS_INIT_DEFAULT;
+    bench_report_t report = { 0 };
+    GHashTable *table;
+    GHashTableIter iter;
+    GPtrArray *threads;
+    replay_connection_t *connection;
+    gchar *trace_file = NULL, *tcti_conf = NULL;
+    gdouble speed = 1.0;
+    guint64 time_base = 0, count = 0, mismatch = 0, errors = 0;
+    gint64 start, end, latency_ns = 0;
+    guint i;
+    GOptionEntry entries[] = {
+        { "trace", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &trace_file, "Trace file captured with tpm2-abrmd --trace-file.",
+          "file" },
+        { "tcti-conf", 'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+          &tcti_conf, "Config string for the tabrmd TCTI.", "conf" },
+        { "speed", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE,
+          &speed, "Replay speed relative to the trace, 0 for no delay.",
+          NULL },
+        { NULL, '\0', 0, 0, NULL, NULL, NULL },
+    };
+
+    if (!bench_parse_opts (argc, argv, "- replay a tpm2-abrmd trace",
+                           entries, &opts)) {
+        return 2;
+    }
+    if (trace_file == NULL) {
+        g_printerr ("A trace file is required, see --help\n");
+        return 2;
+    }
+    table = replay_load_trace (trace_file, &time_base);
+    if (table == NULL) {
+        return 1;
+    }
+    if (!bench_report_begin (&report, &opts)) {
+        return 1;
+    }
+    threads = g_ptr_array_new ();
+    start = bench_now_ns ();
+    g_hash_table_iter_init (&iter, table);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*)&connection)) {
+        connection->tcti_conf = tcti_conf;
+        connection->speed = speed;
+        connection->time_base = time_base;
+        connection->start_ns = start;
+        g_ptr_array_add (threads,
+                         g_thread_new ("replay",
+                                       replay_connection_thread,
+                                       connection));
+    }
+    for (i = 0; i < threads->len; ++i) {
+        g_thread_join (g_ptr_array_index (threads, i));
+    }
+    end = bench_now_ns ();
+    g_hash_table_iter_init (&iter, table);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*)&connection)) {
+        count += connection->count;
+        mismatch += connection->mismatch;
+        errors += connection->errors;
+        latency_ns += connection->latency_ns;
+    }
+    if (count > 0) {
+        bench_report_result (&report, &(bench_result_t) {
+            .name = "replay_wall", .param = g_hash_table_size (table),
+            .iterations = count, .elapsed_ns = end - start,
+        });
+        bench_report_result (&report, &(bench_result_t) {
+            .name = "replay_latency", .param = g_hash_table_size (table),
+            .iterations = count, .elapsed_ns = latency_ns,
+        });
+    }
+    bench_report_end (&report);
+    g_printerr ("replayed %" PRIu64 " commands on %u connections, %" PRIu64
+                " response code mismatches, %" PRIu64 " errors\n",
+                count, g_hash_table_size (table), mismatch, errors);
+    g_ptr_array_unref (threads);
+    g_hash_table_unref (table);
+    g_free (trace_file);
+    g_free (tcti_conf);
+
+    return errors > 0 ? 1 : 0;
+}
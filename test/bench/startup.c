@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Startup benchmark: spawn the daemon and measure the time until the first
+ * client connection succeeds. This covers everything the daemon does
+ * before it accepts connections: PRNG seeding, acquiring the D-Bus name,
+ * TCTI initialization and querying the TPM. Each run starts a fresh daemon
+ * and terminates it once a connection was made.
+ *
+ * Options for the daemon are passed after '--', e.g.:
+ *   startup --runs=20 -- --session --tcti=mssim --startup-cache=/tmp/sc
+ * The daemon must be started on a bus / with a name that the client side
+ * finds through --tcti-conf.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "bench-tcti.h"
+#include "util.h"
+
+#define STARTUP_RUNS_DEFAULT     10
+#define STARTUP_TIMEOUT_DEFAULT  10000
+#define STARTUP_POLL_USEC        1000
+#define STARTUP_DAEMON_DEFAULT   "tpm2-abrmd"
+
+/*
+ * Spawn the daemon with 'daemon_args' and poll the tabrmd TCTI until a
+ * connection succeeds. Returns the time in ns from spawn to the first
+ * connection or -1 if the daemon didn't accept a connection within
+ * 'timeout_ms', or exited.
+ */
+static gint64
+startup_run (const gchar  *daemon,
+             gchar       **daemon_args,
+             const gchar  *tcti_conf,
+             gint          timeout_ms)
+{
+    TSS2_TCTI_CONTEXT *tcti_context = NULL;
+    GPtrArray *argv;
+    GError *err = NULL;
+    GPid pid;
+    gint64 start, elapsed = -1;
+    gint status;
+    guint i;
+
+    argv = g_ptr_array_new ();
+    g_ptr_array_add (argv, (gpointer)daemon);
+    for (i = 0; daemon_args != NULL && daemon_args [i] != NULL; ++i) {
+        g_ptr_array_add (argv, daemon_args [i]);
+    }
+    g_ptr_array_add (argv, NULL);
+    start = bench_now_ns ();
+    if (!g_spawn_async (NULL,
+                        (gchar**)argv->pdata,
+                        NULL,
+                        G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD |
+                        G_SPAWN_STDOUT_TO_DEV_NULL,
+                        NULL,
+                        NULL,
+                        &pid,
+                        &err)) {
+        g_printerr ("failed to spawn %s: %s\n", daemon, err->message);
+        g_clear_error (&err);
+        goto out;
+    }
+    do {
+        tcti_context = bench_tcti_tabrmd_init (tcti_conf);
+        if (tcti_context != NULL) {
+            elapsed = bench_now_ns () - start;
+            bench_tcti_free (tcti_context);
+            break;
+        }
+        if (waitpid (pid, &status, WNOHANG) == pid) {
+            g_printerr ("%s exited before accepting a connection\n", daemon);
+            goto out_spawned;
+        }
+        g_usleep (STARTUP_POLL_USEC);
+    } while (bench_now_ns () - start < (gint64)timeout_ms * 1000000);
+    if (elapsed < 0) {
+        g_printerr ("no connection to %s after %d ms\n", daemon, timeout_ms);
+    }
+    kill (pid, SIGTERM);
+    TABRMD_ERRNO_EINTR_RETRY (waitpid (pid, &status, 0));
+out_spawned:
+    g_spawn_close_pid (pid);
+out:
+    g_ptr_array_free (argv, TRUE);
+    return elapsed;
+}
+int
+main (int   argc,
+      char *argv[])
+{
+    bench_opts_t opts = BENCH_OPTS_INIT_DEFAULT;
+    bench_report_t report = { 0 };
+    gchar *daemon = NULL, *tcti_conf = NULL, **daemon_args = NULL;
+    gint runs = STARTUP_RUNS_DEFAULT;
+    gint timeout_ms = STARTUP_TIMEOUT_DEFAULT;
+    gint64 elapsed, total = 0, max = 0, min = G_MAXINT64;
+    guint count = 0, errors = 0;
+    gint i;
+    GOptionEntry entries[] = {
+        { "daemon", 'd', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &daemon, "Daemon executable, default is tpm2-abrmd in PATH.",
+          "path" },
+        { "runs", 'r', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &runs, "Number of times the daemon is started.", NULL },
+        { "timeout", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &timeout_ms, "Milliseconds to wait for each startup.", NULL },
+        { "tcti-conf", 'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+          &tcti_conf, "Config string for the tabrmd TCTI.", "conf" },
+        { G_OPTION_REMAINING, '\0', G_OPTION_FLAG_NONE,
+          G_OPTION_ARG_STRING_ARRAY, &daemon_args, NULL,
+          "[-- DAEMON OPTIONS...]" },
+        { NULL, '\0', 0, 0, NULL, NULL, NULL },
+    };
+
+    if (!bench_parse_opts (argc, argv, "- tpm2-abrmd startup time",
+                           entries, &opts)) {
+        return 2;
+    }
+    if (runs < 1 || timeout_ms < 1) {
+        g_printerr ("--runs and --timeout must be positive\n");
+        return 2;
+    }
+    bench_quiet_logging ();
+    if (!bench_report_begin (&report, &opts)) {
+        return 1;
+    }
+    for (i = 0; i < runs; ++i) {
+        elapsed = startup_run (daemon != NULL ? daemon : STARTUP_DAEMON_DEFAULT,
+                               daemon_args,
+                               tcti_conf,
+                               timeout_ms);
+        if (elapsed < 0) {
+            ++errors;
+            continue;
+        }
+        total += elapsed;
+        max = MAX (max, elapsed);
+        min = MIN (min, elapsed);
+        ++count;
+    }
+    if (count > 0) {
+        bench_report_result (&report, &(bench_result_t) {
+            .name = "startup", .param = runs,
+            .iterations = count, .elapsed_ns = total,
+        });
+        bench_report_result (&report, &(bench_result_t) {
+            .name = "startup_min", .param = runs,
+            .iterations = 1, .elapsed_ns = min,
+        });
+        bench_report_result (&report, &(bench_result_t) {
+            .name = "startup_max", .param = runs,
+            .iterations = 1, .elapsed_ns = max,
+        });
+    }
+    bench_report_end (&report);
+    g_printerr ("%u of %d daemon starts accepted a connection\n",
+                count, runs);
+    g_free (daemon);
+    g_free (tcti_conf);
+    g_strfreev (daemon_args);
+
+    return errors > 0 ? 1 : 0;
+}
@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <setjmp.h>
@@ -361,6 +362,38 @@ command_source_on_io_ready_eof_test (void **state)
     assert_int_equal (hash_table_size, 0);
     g_object_unref (msg);
 }
+/*
+ * A SOCK_SEQPACKET connection can be reported readable with no message
+ * waiting. The read would block, this must not be taken for the client
+ * closing the connection: the GSource stays and the Connection isn't
+ * removed.
+ */
+static void
+command_source_on_io_ready_eagain_test (void **state)
+{
+    struct source_test_data *data = (struct source_test_data*)*state;
+    source_data_t *source_data;
+    GIOStream   *iostream;
+    HandleMap   *handle_map;
+    Connection *connection;
+    gint client_fd, hash_table_size;
+    gboolean ret;
+
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream_type (&client_fd, SOCK_SEQPACKET);
+    connection = connection_new (iostream, 0, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    will_return (__wrap_g_source_set_callback, &source_data);
+    will_return (__wrap_connection_manager_lookup_istream, connection);
+
+    command_source_on_new_connection (data->manager, connection, data->source);
+    ret = command_source_on_input_ready (g_io_stream_get_input_stream (connection->iostream), source_data);
+    assert_int_equal (ret, G_SOURCE_CONTINUE);
+    hash_table_size = g_hash_table_size (data->source->istream_to_source_data_map);
+    assert_int_equal (hash_table_size, 1);
+    close (client_fd);
+}
 /* command_source_connection_test end */
 int
 main (void)
@@ -381,6 +414,9 @@ main (void)
         cmocka_unit_test_setup_teardown (command_source_on_io_ready_eof_test,
                                          command_source_connection_setup,
                                          command_source_teardown),
+        cmocka_unit_test_setup_teardown (command_source_on_io_ready_eagain_test,
+                                         command_source_connection_setup,
+                                         command_source_teardown),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <glib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "connection-pool.h"
+#include "util.h"
+
+#define POOL_UNIT_SIZE 4
+
+static int
+connection_pool_setup (void **state)
+{
+    *state = connection_pool_new (POOL_UNIT_SIZE, MAX_ENTRIES_DEFAULT);
+    return 0;
+}
+static int
+connection_pool_teardown (void **state)
+{
+    g_object_unref (*state);
+    return 0;
+}
+static void
+connection_pool_type_test (void **state)
+{
+    assert_true (IS_CONNECTION_POOL (*state));
+}
+/*
+ * A new pool is empty until it's filled. Filling adds 'size' entries and
+ * filling a full pool is a no-op.
+ */
+static void
+connection_pool_fill_test (void **state)
+{
+    ConnectionPool *pool = CONNECTION_POOL (*state);
+
+    assert_int_equal (connection_pool_length (pool), 0);
+    assert_int_equal (connection_pool_fill (pool), POOL_UNIT_SIZE);
+    assert_int_equal (connection_pool_length (pool), POOL_UNIT_SIZE);
+    assert_int_equal (connection_pool_fill (pool), 0);
+}
+/*
+ * Taking from a filled pool hands over a connected socket pair and a
+ * HandleMap with the configured size. The refill is deferred to the main
+ * context so the pool stays one short until it's dispatched.
+ */
+static void
+connection_pool_take_test (void **state)
+{
+    ConnectionPool *pool = CONNECTION_POOL (*state);
+    GIOStream *iostream;
+    HandleMap *handle_map = NULL;
+    gint client_fd = -1;
+
+    connection_pool_fill (pool);
+    iostream = connection_pool_take (pool, &client_fd, &handle_map);
+    assert_true (G_IS_IO_STREAM (iostream));
+    assert_true (IS_HANDLE_MAP (handle_map));
+    assert_int_equal (handle_map->max_entries, MAX_ENTRIES_DEFAULT);
+    assert_true (fcntl (client_fd, F_GETFD) != -1);
+    assert_int_equal (pool->hits, 1);
+    assert_int_equal (connection_pool_length (pool), POOL_UNIT_SIZE - 1);
+    while (g_main_context_iteration (NULL, FALSE));
+    assert_int_equal (connection_pool_length (pool), POOL_UNIT_SIZE);
+
+    close (client_fd);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+}
+/*
+ * Taking from an empty pool still produces valid connection state, it's
+ * just created on the spot and counted as a miss.
+ */
+static void
+connection_pool_take_empty_test (void **state)
+{
+    ConnectionPool *pool = CONNECTION_POOL (*state);
+    GIOStream *iostream;
+    HandleMap *handle_map = NULL;
+    gint client_fd = -1;
+
+    iostream = connection_pool_take (pool, &client_fd, &handle_map);
+    assert_true (G_IS_IO_STREAM (iostream));
+    assert_true (IS_HANDLE_MAP (handle_map));
+    assert_true (client_fd >= 0);
+    assert_int_equal (pool->misses, 1);
+
+    close (client_fd);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+}
+/*
+ * A pool of size 0 never schedules a refill.
+ */
+static void
+connection_pool_size_zero_test (void **state)
+{
+    ConnectionPool *pool;
+    GIOStream *iostream;
+    HandleMap *handle_map = NULL;
+    gint client_fd = -1;
+    UNUSED_PARAM (state);
+
+    pool = connection_pool_new (0, MAX_ENTRIES_DEFAULT);
+    assert_int_equal (connection_pool_fill (pool), 0);
+    iostream = connection_pool_take (pool, &client_fd, &handle_map);
+    assert_non_null (iostream);
+    assert_null (pool->refill_source);
+
+    close (client_fd);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    g_object_unref (pool);
+}
+int
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (connection_pool_type_test,
+                                         connection_pool_setup,
+                                         connection_pool_teardown),
+        cmocka_unit_test_setup_teardown (connection_pool_fill_test,
+                                         connection_pool_setup,
+                                         connection_pool_teardown),
+        cmocka_unit_test_setup_teardown (connection_pool_take_test,
+                                         connection_pool_setup,
+                                         connection_pool_teardown),
+        cmocka_unit_test_setup_teardown (connection_pool_take_empty_test,
+                                         connection_pool_setup,
+                                         connection_pool_teardown),
+        cmocka_unit_test (connection_pool_size_zero_test),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
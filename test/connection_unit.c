@@ -34,6 +34,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <setjmp.h>
@@ -184,6 +185,73 @@ connection_server_to_client_test (void **state)
     assert_int_equal (ret, strlen ("test"));
 }
 /* connection_server_to_client_test end */
+/*
+ * Callback for the "resume" signal, counts the number of emissions.
+ */
+static void
+connection_resume_count (Connection *connection,
+                         gpointer    user_data)
+{
+    guint *count = (guint*)user_data;
+    UNUSED_PARAM(connection);
+
+    ++*count;
+}
+/*
+ * Ensure that a connection only pauses once 'depth' commands are
+ * outstanding and that the first response sent after that emits the
+ * "resume" signal exactly once.
+ */
+static void
+connection_pause_resume_test (void **state)
+{
+    connection_test_data_t *data = (connection_test_data_t*)*state;
+    guint resume_count = 0;
+
+    g_signal_connect (data->connection,
+                      "resume",
+                      G_CALLBACK (connection_resume_count),
+                      &resume_count);
+    connection_command_received (data->connection);
+    assert_false (connection_pause (data->connection, 2));
+    connection_command_received (data->connection);
+    assert_true (connection_pause (data->connection, 2));
+    assert_int_equal (connection_get_outstanding (data->connection), 2);
+    connection_response_sent (data->connection);
+    assert_int_equal (resume_count, 1);
+    connection_response_sent (data->connection);
+    assert_int_equal (resume_count, 1);
+    assert_int_equal (connection_get_outstanding (data->connection), 0);
+}
+/*
+ * The connection from connection_setup is a SOCK_STREAM socket.
+ */
+static void
+connection_is_seqpacket_stream_test (void **state)
+{
+    connection_test_data_t *data = (connection_test_data_t*)*state;
+
+    assert_non_null (connection_get_socket (data->connection));
+    assert_false (connection_is_seqpacket (data->connection));
+}
+static void
+connection_is_seqpacket_test (void **state)
+{
+    HandleMap *handle_map = NULL;
+    Connection *connection = NULL;
+    GIOStream *iostream;
+    gint client_fd;
+    UNUSED_PARAM(state);
+
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream_type (&client_fd, SOCK_SEQPACKET);
+    connection = connection_new (iostream, 0, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    assert_true (connection_is_seqpacket (connection));
+    g_object_unref (connection);
+    close (client_fd);
+}
 
 int
 main(void)
@@ -202,6 +270,13 @@ main(void)
         cmocka_unit_test_setup_teardown (connection_server_to_client_test,
                                          connection_setup,
                                          connection_teardown),
+        cmocka_unit_test_setup_teardown (connection_pause_resume_test,
+                                         connection_setup,
+                                         connection_teardown),
+        cmocka_unit_test_setup_teardown (connection_is_seqpacket_stream_test,
+                                         connection_setup,
+                                         connection_teardown),
+        cmocka_unit_test (connection_is_seqpacket_test),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -26,6 +26,7 @@
  */
 #include <glib.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
@@ -105,6 +106,124 @@ handle_map_entry_get_vhandle_test (void **state)
     assert_int_equal (VHANDLE,
                       handle_map_entry_get_vhandle (data->handle_map_entry));
 }
+/*
+ * An entry that has never had a context saved returns a zeroed TPMS_CONTEXT.
+ */
+static void
+handle_map_entry_get_context_empty_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    TPMS_CONTEXT context, zero = { 0, };
+    TSS2_RC rc;
+
+    memset (&context, 0xff, sizeof (context));
+    rc = handle_map_entry_get_context (data->handle_map_entry, &context);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_memory_equal (&context, &zero, sizeof (context));
+}
+/*
+ * A context stored in the entry is marshalled and the blob is sized to the
+ * marshalled data. Getting it back must produce the original TPMS_CONTEXT.
+ */
+static void
+handle_map_entry_set_get_context_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    TPMS_CONTEXT context_in = {
+        .sequence = 0x1122334455667788,
+        .savedHandle = 0x80000001,
+        .hierarchy = TPM2_RH_OWNER,
+        .contextBlob = {
+            .size = 4,
+            .buffer = { 0xde, 0xad, 0xbe, 0xef },
+        },
+    }, context_out = { 0, };
+    TSS2_RC rc;
+
+    rc = handle_map_entry_set_context (data->handle_map_entry, &context_in);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_true (data->handle_map_entry->context.size < sizeof (TPMS_CONTEXT));
+    rc = handle_map_entry_get_context (data->handle_map_entry, &context_out);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_true (context_out.sequence == context_in.sequence);
+    assert_int_equal (context_out.savedHandle, context_in.savedHandle);
+    assert_int_equal (context_out.hierarchy, context_in.hierarchy);
+    assert_int_equal (context_out.contextBlob.size, context_in.contextBlob.size);
+    assert_memory_equal (context_out.contextBlob.buffer,
+                         context_in.contextBlob.buffer,
+                         context_in.contextBlob.size);
+}
+/*
+ * The marshalled context is exposed through the "context-blob" property.
+ * The old "context" property was a TPMS_CONTEXT* and must be gone rather
+ * than hand out a pointer of a different type.
+ */
+static void
+handle_map_entry_context_blob_property_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    size_buf_t *blob = NULL;
+
+    g_object_get (data->handle_map_entry, "context-blob", &blob, NULL);
+    assert_ptr_equal (blob, &data->handle_map_entry->context);
+    assert_null (g_object_class_find_property (
+                     G_OBJECT_GET_CLASS (data->handle_map_entry),
+                     "context"));
+}
+/*
+ * Sharing a saved context moves it out of the entry into the GBytes
+ * returned. Another entry backed by that GBytes gets the same context.
+ * Setting a private context drops the shared one.
+ */
+static void
+handle_map_entry_share_context_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    HandleMapEntry *entry;
+    TPMS_CONTEXT context_in = {
+        .sequence = 0x10,
+        .savedHandle = 0x80000001,
+        .hierarchy = TPM2_RH_OWNER,
+    }, context_out = { 0, };
+    GBytes *shared;
+    size_t size;
+    TSS2_RC rc;
+
+    assert_null (handle_map_entry_share_context (data->handle_map_entry));
+    rc = handle_map_entry_set_context (data->handle_map_entry, &context_in);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    shared = handle_map_entry_share_context (data->handle_map_entry);
+    assert_non_null (shared);
+    assert_true (handle_map_entry_is_shared (data->handle_map_entry));
+    assert_int_equal (data->handle_map_entry->context.size, 0);
+
+    entry = handle_map_entry_new (0, TPM2_HR_TRANSIENT + 1);
+    handle_map_entry_set_context_shared (entry, shared);
+    assert_ptr_equal (handle_map_entry_peek_context (entry, &size),
+                      g_bytes_get_data (shared, NULL));
+    assert_int_equal (size, g_bytes_get_size (shared));
+    rc = handle_map_entry_get_context (entry, &context_out);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (context_out.savedHandle, context_in.savedHandle);
+
+    rc = handle_map_entry_set_context (entry, &context_in);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_false (handle_map_entry_is_shared (entry));
+    g_object_unref (entry);
+    g_bytes_unref (shared);
+}
+/*
+ * Entries aren't sequence objects until marked as such.
+ */
+static void
+handle_map_entry_sequence_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    assert_false (handle_map_entry_is_sequence (data->handle_map_entry));
+    handle_map_entry_set_sequence (data->handle_map_entry, TRUE);
+    assert_true (handle_map_entry_is_sequence (data->handle_map_entry));
+}
 
 gint
 main (void)
@@ -119,6 +238,21 @@ main (void)
         cmocka_unit_test_setup_teardown (handle_map_entry_get_vhandle_test,
                                          handle_map_entry_setup,
                                          handle_map_entry_teardown),
+        cmocka_unit_test_setup_teardown (handle_map_entry_get_context_empty_test,
+                                         handle_map_entry_setup,
+                                         handle_map_entry_teardown),
+        cmocka_unit_test_setup_teardown (handle_map_entry_set_get_context_test,
+                                         handle_map_entry_setup,
+                                         handle_map_entry_teardown),
+        cmocka_unit_test_setup_teardown (handle_map_entry_context_blob_property_test,
+                                         handle_map_entry_setup,
+                                         handle_map_entry_teardown),
+        cmocka_unit_test_setup_teardown (handle_map_entry_share_context_test,
+                                         handle_map_entry_setup,
+                                         handle_map_entry_teardown),
+        cmocka_unit_test_setup_teardown (handle_map_entry_sequence_test,
+                                         handle_map_entry_setup,
+                                         handle_map_entry_teardown),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }
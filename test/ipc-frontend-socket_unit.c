@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "ipc-frontend-socket.h"
+#include "util.h"
+
+typedef struct {
+    IpcFrontendSocket *ipc_frontend_socket;
+    ConnectionManager *connection_manager;
+    gchar             *dir;
+    gchar             *path;
+} test_data_t;
+
+static int
+ipc_frontend_socket_setup (void **state)
+{
+    test_data_t *data;
+    Random *random = NULL;
+    gint ret = 0;
+
+    data = calloc (1, sizeof (test_data_t));
+    assert_non_null (data);
+    random = random_new ();
+    ret = random_seed_from_file (random, "/dev/urandom");
+    assert_int_equal (ret, 0);
+    data->dir = g_dir_make_tmp ("ipc-frontend-socket_unit-XXXXXX", NULL);
+    assert_non_null (data->dir);
+    data->path = g_build_filename (data->dir, "tabrmd.sock", NULL);
+    data->connection_manager = connection_manager_new (100);
+    data->ipc_frontend_socket =
+        ipc_frontend_socket_new (data->path,
+                                 data->connection_manager,
+                                 100,
+                                 random);
+    assert_non_null (data->ipc_frontend_socket);
+    g_object_unref (random);
+    *state = data;
+    return 0;
+}
+
+static int
+ipc_frontend_socket_teardown (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    g_object_unref (data->ipc_frontend_socket);
+    g_object_unref (data->connection_manager);
+    g_unlink (data->path);
+    g_rmdir (data->dir);
+    g_free (data->path);
+    g_free (data->dir);
+    free (data);
+    return 0;
+}
+/*
+ * Ensure that the object system identifies the IpcFrontendSocket as both
+ * the abstract base type and the derived type.
+ */
+static void
+ipc_frontend_socket_type_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    assert_true (IS_IPC_FRONTEND (data->ipc_frontend_socket));
+    assert_true (IS_IPC_FRONTEND_SOCKET (data->ipc_frontend_socket));
+}
+/*
+ * Connect to the socket, run the main loop until the connection shows up
+ * in the ConnectionManager and read the ID sent by the daemon. The
+ * Connection must be stored under the ID mixed with our PID, the same as
+ * one created through D-Bus. Disconnecting removes the socket.
+ */
+static void
+ipc_frontend_socket_connect_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    struct sockaddr_un address = { .sun_family = AF_UNIX, };
+    guint64 id = 0;
+    size_t index = 0;
+    gint fd;
+
+    ipc_frontend_socket_connect (data->ipc_frontend_socket, NULL);
+    assert_true (g_file_test (data->path, G_FILE_TEST_EXISTS));
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    assert_true (fd >= 0);
+    g_strlcpy (address.sun_path, data->path, sizeof (address.sun_path));
+    assert_int_equal (connect (fd,
+                               (struct sockaddr*)&address,
+                               sizeof (address)),
+                      0);
+    while (connection_manager_size (data->connection_manager) == 0) {
+        g_main_context_iteration (NULL, TRUE);
+    }
+    while (index < sizeof (id)) {
+        ssize_t ret = read (fd, &((uint8_t*)&id) [index], sizeof (id) - index);
+        assert_true (ret > 0);
+        index += (size_t)ret;
+    }
+    assert_true (connection_manager_contains_id (data->connection_manager,
+                                                 id ^ (guint32)getpid ()));
+    ipc_frontend_socket_disconnect (data->ipc_frontend_socket);
+    assert_false (g_file_test (data->path, G_FILE_TEST_EXISTS));
+    close (fd);
+}
+/*
+ * Create a Unix stream socket bound to 'path'. If 'listening' is FALSE the
+ * socket is closed, leaving behind a socket file that refuses connections
+ * like one from a daemon that didn't exit cleanly. Returns the fd of the
+ * listening socket, or -1.
+ */
+static gint
+bind_socket (gchar const *path,
+             gboolean     listening)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX, };
+    gint fd;
+
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    assert_true (fd >= 0);
+    g_strlcpy (address.sun_path, path, sizeof (address.sun_path));
+    assert_int_equal (bind (fd, (struct sockaddr*)&address, sizeof (address)),
+                      0);
+    if (!listening) {
+        close (fd);
+        return -1;
+    }
+    assert_int_equal (listen (fd, 1), 0);
+    return fd;
+}
+/*
+ * A socket left behind at the path, that nobody listens on, is replaced.
+ */
+static void
+ipc_frontend_socket_connect_stale_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    bind_socket (data->path, FALSE);
+    ipc_frontend_socket_connect (data->ipc_frontend_socket, NULL);
+    assert_non_null (data->ipc_frontend_socket->service);
+    ipc_frontend_socket_disconnect (data->ipc_frontend_socket);
+    assert_false (g_file_test (data->path, G_FILE_TEST_EXISTS));
+}
+/*
+ * A socket another daemon is listening on is left alone and connecting
+ * fails.
+ */
+static void
+ipc_frontend_socket_connect_in_use_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    gint fd;
+
+    fd = bind_socket (data->path, TRUE);
+    ipc_frontend_socket_connect (data->ipc_frontend_socket, NULL);
+    assert_null (data->ipc_frontend_socket->service);
+    ipc_frontend_socket_disconnect (data->ipc_frontend_socket);
+    assert_true (g_file_test (data->path, G_FILE_TEST_EXISTS));
+    close (fd);
+}
+gint
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (ipc_frontend_socket_type_test,
+                                         ipc_frontend_socket_setup,
+                                         ipc_frontend_socket_teardown),
+        cmocka_unit_test_setup_teardown (ipc_frontend_socket_connect_test,
+                                         ipc_frontend_socket_setup,
+                                         ipc_frontend_socket_teardown),
+        cmocka_unit_test_setup_teardown (ipc_frontend_socket_connect_stale_test,
+                                         ipc_frontend_socket_setup,
+                                         ipc_frontend_socket_teardown),
+        cmocka_unit_test_setup_teardown (ipc_frontend_socket_connect_in_use_test,
+                                         ipc_frontend_socket_setup,
+                                         ipc_frontend_socket_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
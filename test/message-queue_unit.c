@@ -131,6 +131,79 @@ message_queue_dequeue_order_test (void **state)
     g_object_unref (obj_1);
     g_object_unref (obj_2);
 }
+/*
+ * Peeking returns the object at the head of the queue without removing
+ * it. Peeking an empty queue returns NULL.
+ */
+static void
+message_queue_peek_test (void **state)
+{
+    msgq_test_data_t *data = (msgq_test_data_t*)*state;
+    MessageQueue *queue = data->queue;
+    GObject *obj_0, *obj_1, *obj_tmp;
+
+    assert_null (message_queue_peek (queue));
+    obj_0 = G_OBJECT (handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT));
+    obj_1 = G_OBJECT (handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT));
+    message_queue_enqueue (queue, obj_0);
+    message_queue_enqueue (queue, obj_1);
+
+    obj_tmp = message_queue_peek (queue);
+    assert_int_equal (obj_tmp, obj_0);
+    g_object_unref (obj_tmp);
+    obj_tmp = message_queue_dequeue (queue);
+    assert_int_equal (obj_tmp, obj_0);
+    g_object_unref (obj_tmp);
+    obj_tmp = message_queue_peek (queue);
+    assert_int_equal (obj_tmp, obj_1);
+    g_object_unref (obj_tmp);
+    obj_tmp = message_queue_dequeue (queue);
+    assert_int_equal (obj_tmp, obj_1);
+    g_object_unref (obj_tmp);
+    assert_null (message_queue_peek (queue));
+    g_object_unref (obj_0);
+    g_object_unref (obj_1);
+}
+static gboolean
+match_obj (GObject  *obj,
+           gpointer  user_data)
+{
+    return obj == user_data;
+}
+/*
+ * Taking matching objects removes only those from the queue and leaves
+ * the others in order.
+ */
+static void
+message_queue_take_matching_test (void **state)
+{
+    msgq_test_data_t *data = (msgq_test_data_t*)*state;
+    MessageQueue *queue = data->queue;
+    GObject *obj_0, *obj_1, *obj_2, *obj_tmp;
+    GSList *taken;
+
+    obj_0 = G_OBJECT (handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT));
+    obj_1 = G_OBJECT (handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT));
+    obj_2 = G_OBJECT (handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT));
+    message_queue_enqueue (queue, obj_0);
+    message_queue_enqueue (queue, obj_1);
+    message_queue_enqueue (queue, obj_2);
+
+    taken = message_queue_take_matching (queue, match_obj, obj_1);
+    assert_int_equal (g_slist_length (taken), 1);
+    assert_int_equal (taken->data, obj_1);
+    g_slist_free_full (taken, g_object_unref);
+    obj_tmp = message_queue_dequeue (queue);
+    assert_int_equal (obj_tmp, obj_0);
+    g_object_unref (obj_tmp);
+    obj_tmp = message_queue_dequeue (queue);
+    assert_int_equal (obj_tmp, obj_2);
+    g_object_unref (obj_tmp);
+    assert_null (message_queue_take_matching (queue, match_obj, obj_1));
+    g_object_unref (obj_0);
+    g_object_unref (obj_1);
+    g_object_unref (obj_2);
+}
 /*
  * This function is used in the thread_unblock_test function as the thread
  * that blocks on the MessageQueue waiting for a message.
@@ -178,6 +251,12 @@ main(void)
         cmocka_unit_test_setup_teardown (message_queue_dequeue_order_test,
                                          message_queue_setup,
                                          message_queue_teardown),
+        cmocka_unit_test_setup_teardown (message_queue_peek_test,
+                                         message_queue_setup,
+                                         message_queue_teardown),
+        cmocka_unit_test_setup_teardown (message_queue_take_matching_test,
+                                         message_queue_setup,
+                                         message_queue_teardown),
         cmocka_unit_test_setup_teardown (message_queue_thread_unblock_test,
                                          message_queue_setup,
                                          message_queue_teardown),
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "object-cache.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+#define PHANDLE 0x80000001
+/* handle, auth size, auth: handle, nonce size, attrs, password size */
+#define CMD_SIZE (TPM_HEADER_SIZE + 4 + 4 + 4 + 2 + 1 + 2 + 4)
+#define RSP_SIZE (TPM_HEADER_SIZE + 4 + 4)
+
+typedef struct {
+    ObjectCache *cache;
+    Connection  *connection;
+} test_data_t;
+
+static int
+object_cache_setup (void **state)
+{
+    test_data_t *data;
+    HandleMap *handle_map;
+    GIOStream *iostream;
+    gint client_fd;
+
+    data = calloc (1, sizeof (test_data_t));
+    data->cache = object_cache_new (OBJECT_CACHE_MAX_ENTRIES_DEFAULT,
+                                    OBJECT_CACHE_PRIMARY | OBJECT_CACHE_LOAD);
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    data->connection = connection_new (iostream, 0, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+
+    *state = data;
+    return 0;
+}
+static int
+object_cache_teardown (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    g_object_unref (data->cache);
+    g_object_unref (data->connection);
+    free (data);
+    return 0;
+}
+/*
+ * Create a command with the given code on the provided handle with a
+ * single authorization using the provided session handle and a 4 byte
+ * password. There are no parameters.
+ */
+static Tpm2Command*
+command_new (Connection *connection,
+             TPM2_CC     command_code,
+             TPM2_HANDLE handle,
+             TPM2_HANDLE session,
+             guint8      password)
+{
+    guint8 *buf = calloc (1, CMD_SIZE);
+    size_t offset = TPM_HEADER_SIZE;
+
+    tpm2_header_init (buf, CMD_SIZE, TPM2_ST_SESSIONS, CMD_SIZE, command_code);
+    *(TPM2_HANDLE*)&buf [offset] = htobe32 (handle);
+    offset += 4;
+    *(UINT32*)&buf [offset] = htobe32 (4 + 2 + 1 + 2 + 4);
+    offset += 4;
+    *(TPM2_HANDLE*)&buf [offset] = htobe32 (session);
+    offset += 4 + 2 + 1;
+    *(UINT16*)&buf [offset] = htobe16 (4);
+    offset += 2;
+    memset (&buf [offset], password, 4);
+    return tpm2_command_new (connection,
+                             buf,
+                             CMD_SIZE,
+                             (1 << 25) + command_code);
+}
+/*
+ * Create a successful response to the given command carrying PHANDLE.
+ */
+static Tpm2Response*
+response_new (Connection *connection,
+              TPM2_CC     command_code)
+{
+    guint8 *buf = calloc (1, RSP_SIZE);
+
+    tpm2_header_init (buf, RSP_SIZE, TPM2_ST_SESSIONS, RSP_SIZE,
+                      TSS2_RC_SUCCESS);
+    *(TPM2_HANDLE*)&buf [TPM_HEADER_SIZE] = htobe32 (PHANDLE);
+    return tpm2_response_new (connection,
+                              buf,
+                              RSP_SIZE,
+                              TPMA_CC_RHANDLE + command_code);
+}
+/*
+ * Insert the result of a command with the given code on the given handle
+ * and password. The context is the password repeated.
+ */
+static void
+cache_object (test_data_t *data,
+              TPM2_CC      command_code,
+              TPM2_HANDLE  handle,
+              guint8       password)
+{
+    Tpm2Command *command;
+    Tpm2Response *response;
+    guint8 context_buf [8];
+    GBytes *context;
+
+    memset (context_buf, password, sizeof (context_buf));
+    context = g_bytes_new (context_buf, sizeof (context_buf));
+    command = command_new (data->connection, command_code,
+                           handle, TPM2_RS_PW, password);
+    response = response_new (data->connection, command_code);
+    object_cache_insert (data->cache, command, response, context);
+    g_bytes_unref (context);
+    g_object_unref (command);
+    g_object_unref (response);
+}
+static void
+cache_create_primary (test_data_t *data,
+                      guint8       password)
+{
+    cache_object (data, TPM2_CC_CreatePrimary, TPM2_RH_OWNER, password);
+}
+static void
+object_cache_type_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    assert_true (IS_OBJECT_CACHE (data->cache));
+    assert_int_equal (object_cache_size (data->cache), 0);
+}
+/*
+ * An identical command gets the cached response and context. A different
+ * password is a miss.
+ */
+static void
+object_cache_lookup_hit_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    Tpm2Response *response;
+    GBytes *context = NULL;
+
+    cache_create_primary (data, 0x11);
+    command = command_new (data->connection, TPM2_CC_CreatePrimary,
+                           TPM2_RH_OWNER, TPM2_RS_PW, 0x11);
+    response = object_cache_lookup (data->cache, command, &context);
+    assert_non_null (response);
+    assert_int_equal (tpm2_response_get_size (response), RSP_SIZE);
+    assert_int_equal (tpm2_response_get_handle (response), PHANDLE);
+    assert_non_null (context);
+    assert_int_equal (g_bytes_get_size (context), 8);
+    assert_int_equal (((guint8 const*)g_bytes_get_data (context, NULL)) [0],
+                      0x11);
+    g_bytes_unref (context);
+    g_object_unref (response);
+    g_object_unref (command);
+
+    command = command_new (data->connection, TPM2_CC_CreatePrimary,
+                           TPM2_RH_OWNER, TPM2_RS_PW, 0x22);
+    assert_null (object_cache_lookup (data->cache, command, &context));
+    g_object_unref (command);
+    assert_int_equal (data->cache->hits, 1);
+    assert_int_equal (data->cache->misses, 1);
+}
+/*
+ * CreatePrimary authorized with an HMAC session isn't cached.
+ */
+static void
+object_cache_insert_hmac_session_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    Tpm2Response *response;
+    GBytes *context = g_bytes_new (NULL, 0);
+
+    command = command_new (data->connection, TPM2_CC_CreatePrimary,
+                           TPM2_RH_OWNER, TPM2_HR_HMAC_SESSION + 1, 0x11);
+    assert_false (object_cache_cacheable (data->cache, command));
+    response = response_new (data->connection, TPM2_CC_CreatePrimary);
+    object_cache_insert (data->cache, command, response, context);
+    g_bytes_unref (context);
+    assert_int_equal (object_cache_size (data->cache), 0);
+    g_object_unref (response);
+    g_object_unref (command);
+}
+/*
+ * TPM2_Load is cached under persistent parents only: transient handles
+ * are virtual and differ between connections.
+ */
+static void
+object_cache_load_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    Tpm2Response *response;
+    GBytes *context = NULL;
+
+    command = command_new (data->connection, TPM2_CC_Load,
+                           TPM2_HR_TRANSIENT + 0xff, TPM2_RS_PW, 0x11);
+    assert_false (object_cache_cacheable (data->cache, command));
+    g_object_unref (command);
+
+    cache_object (data, TPM2_CC_Load, TPM2_HR_PERSISTENT + 1, 0x11);
+    assert_int_equal (object_cache_size (data->cache), 1);
+    command = command_new (data->connection, TPM2_CC_Load,
+                           TPM2_HR_PERSISTENT + 1, TPM2_RS_PW, 0x11);
+    response = object_cache_lookup (data->cache, command, &context);
+    assert_non_null (response);
+    assert_non_null (context);
+    g_bytes_unref (context);
+    g_object_unref (response);
+    g_object_unref (command);
+
+    command = command_new (data->connection, TPM2_CC_EvictControl,
+                           TPM2_RH_OWNER, TPM2_RS_PW, 0x11);
+    object_cache_invalidate (data->cache, command);
+    assert_int_equal (object_cache_size (data->cache), 0);
+    g_object_unref (command);
+}
+/*
+ * A cache without OBJECT_CACHE_LOAD doesn't take TPM2_Load.
+ */
+static void
+object_cache_flags_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    ObjectCache *cache;
+    Tpm2Command *command;
+
+    cache = object_cache_new (OBJECT_CACHE_MAX_ENTRIES_DEFAULT,
+                              OBJECT_CACHE_PRIMARY);
+    command = command_new (data->connection, TPM2_CC_Load,
+                           TPM2_HR_PERSISTENT + 1, TPM2_RS_PW, 0x11);
+    assert_false (object_cache_cacheable (cache, command));
+    g_object_unref (command);
+    command = command_new (data->connection, TPM2_CC_CreatePrimary,
+                           TPM2_RH_OWNER, TPM2_RS_PW, 0x11);
+    assert_true (object_cache_cacheable (cache, command));
+    g_object_unref (command);
+    g_object_unref (cache);
+}
+/*
+ * TPM2_Clear and TPM2_HierarchyChangeAuth drop all cached objects, other
+ * commands don't.
+ */
+static void
+object_cache_invalidate_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+
+    cache_create_primary (data, 0x11);
+    cache_create_primary (data, 0x22);
+    command = command_new (data->connection, TPM2_CC_Create,
+                           TPM2_RH_OWNER, TPM2_RS_PW, 0x11);
+    object_cache_invalidate (data->cache, command);
+    assert_int_equal (object_cache_size (data->cache), 2);
+    g_object_unref (command);
+
+    command = command_new (data->connection, TPM2_CC_HierarchyChangeAuth,
+                           TPM2_RH_OWNER, TPM2_RS_PW, 0x11);
+    object_cache_invalidate (data->cache, command);
+    assert_int_equal (object_cache_size (data->cache), 0);
+    g_object_unref (command);
+
+    cache_create_primary (data, 0x11);
+    command = command_new (data->connection, TPM2_CC_Clear,
+                           TPM2_RH_OWNER, TPM2_RS_PW, 0x11);
+    object_cache_invalidate (data->cache, command);
+    assert_int_equal (object_cache_size (data->cache), 0);
+    g_object_unref (command);
+}
+gint
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (object_cache_type_test,
+                                         object_cache_setup,
+                                         object_cache_teardown),
+        cmocka_unit_test_setup_teardown (object_cache_lookup_hit_test,
+                                         object_cache_setup,
+                                         object_cache_teardown),
+        cmocka_unit_test_setup_teardown (object_cache_insert_hmac_session_test,
+                                         object_cache_setup,
+                                         object_cache_teardown),
+        cmocka_unit_test_setup_teardown (object_cache_load_test,
+                                         object_cache_setup,
+                                         object_cache_teardown),
+        cmocka_unit_test_setup_teardown (object_cache_flags_test,
+                                         object_cache_setup,
+                                         object_cache_teardown),
+        cmocka_unit_test_setup_teardown (object_cache_invalidate_test,
+                                         object_cache_setup,
+                                         object_cache_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
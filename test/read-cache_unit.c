@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "read-cache.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+#define NV_INDEX   0x01000001
+#define NV_INDEX_2 0x01000002
+#define PERSISTENT 0x81000001
+
+typedef struct {
+    ReadCache  *cache;
+    Connection *connection;
+} test_data_t;
+
+static int
+read_cache_setup (void **state)
+{
+    test_data_t *data;
+    HandleMap *handle_map;
+    GIOStream *iostream;
+    gint client_fd;
+
+    data = calloc (1, sizeof (test_data_t));
+    data->cache = read_cache_new (READ_CACHE_MAX_ENTRIES_DEFAULT,
+                                  READ_CACHE_PUBLIC | READ_CACHE_PCR_READ);
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    data->connection = connection_new (iostream, 0, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+
+    *state = data;
+    return 0;
+}
+static int
+read_cache_teardown (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    g_object_unref (data->cache);
+    g_object_unref (data->connection);
+    free (data);
+    return 0;
+}
+/*
+ * Create a command with the given code and a single handle in the handle
+ * area.
+ */
+static Tpm2Command*
+command_new (Connection *connection,
+             TPM2_ST     tag,
+             TPM2_CC     command_code,
+             TPM2_HANDLE handle)
+{
+    size_t size = TPM_HEADER_SIZE + sizeof (TPM2_HANDLE);
+    guint8 *buf = calloc (1, size);
+
+    tpm2_header_init (buf, size, tag, size, command_code);
+    *(TPM2_HANDLE*)&buf [TPM_HEADER_SIZE] = htobe32 (handle);
+    return tpm2_command_new (connection, buf, size, (1 << 25) + command_code);
+}
+/*
+ * Create a PCR_Read command. There are no handles, the byte following the
+ * header stands in for the PCR selection.
+ */
+static Tpm2Command*
+pcr_read_new (Connection *connection,
+              guint8      selection)
+{
+    size_t size = TPM_HEADER_SIZE + 1;
+    guint8 *buf = calloc (1, size);
+
+    tpm2_header_init (buf, size, TPM2_ST_NO_SESSIONS, size, TPM2_CC_PCR_Read);
+    buf [TPM_HEADER_SIZE] = selection;
+    return tpm2_command_new (connection, buf, size, TPM2_CC_PCR_Read);
+}
+/*
+ * Create a response with the given RC and some data following the header.
+ */
+static Tpm2Response*
+response_new (Connection *connection,
+              TSS2_RC     rc)
+{
+    size_t size = TPM_HEADER_SIZE + 4;
+    guint8 *buf = calloc (1, size);
+
+    tpm2_header_init (buf, size, TPM2_ST_NO_SESSIONS, size, rc);
+    memcpy (&buf [TPM_HEADER_SIZE], "\xde\xad\xbe\xef", 4);
+    return tpm2_response_new (connection, buf, size, 0);
+}
+/*
+ * Insert the response to a ReadPublic on the provided handle.
+ */
+static void
+cache_read_public (test_data_t *data,
+                   TPM2_CC      command_code,
+                   TPM2_HANDLE  handle)
+{
+    Tpm2Command *command;
+    Tpm2Response *response;
+
+    command = command_new (data->connection, TPM2_ST_NO_SESSIONS,
+                           command_code, handle);
+    response = response_new (data->connection, TSS2_RC_SUCCESS);
+    read_cache_insert (data->cache, command, response);
+    g_object_unref (command);
+    g_object_unref (response);
+}
+static void
+read_cache_type_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    assert_true (IS_READ_CACHE (data->cache));
+    assert_int_equal (read_cache_size (data->cache), 0);
+}
+/*
+ * A cached response is returned for an identical command with the same
+ * content as the response that was inserted.
+ */
+static void
+read_cache_lookup_hit_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    Tpm2Response *response_in, *response_out;
+
+    command = command_new (data->connection, TPM2_ST_NO_SESSIONS,
+                           TPM2_CC_ReadPublic, PERSISTENT);
+    assert_null (read_cache_lookup (data->cache, command));
+    response_in = response_new (data->connection, TSS2_RC_SUCCESS);
+    read_cache_insert (data->cache, command, response_in);
+    response_out = read_cache_lookup (data->cache, command);
+    assert_non_null (response_out);
+    assert_int_equal (tpm2_response_get_size (response_out),
+                      tpm2_response_get_size (response_in));
+    assert_memory_equal (tpm2_response_get_buffer (response_out),
+                         tpm2_response_get_buffer (response_in),
+                         tpm2_response_get_size (response_in));
+    assert_int_equal (data->cache->hits, 1);
+    assert_int_equal (data->cache->misses, 1);
+    g_object_unref (response_out);
+    g_object_unref (response_in);
+    g_object_unref (command);
+}
+/*
+ * Error responses, commands with sessions and commands on transient
+ * handles are never cached.
+ */
+static void
+read_cache_insert_uncacheable_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    Tpm2Response *response;
+
+    command = command_new (data->connection, TPM2_ST_NO_SESSIONS,
+                           TPM2_CC_ReadPublic, PERSISTENT);
+    response = response_new (data->connection, TPM2_RC_HANDLE);
+    read_cache_insert (data->cache, command, response);
+    g_object_unref (response);
+    g_object_unref (command);
+
+    command = command_new (data->connection, TPM2_ST_SESSIONS,
+                           TPM2_CC_NV_ReadPublic, NV_INDEX);
+    response = response_new (data->connection, TSS2_RC_SUCCESS);
+    read_cache_insert (data->cache, command, response);
+    g_object_unref (response);
+    g_object_unref (command);
+
+    cache_read_public (data, TPM2_CC_ReadPublic, TPM2_HR_TRANSIENT + 1);
+    assert_int_equal (read_cache_size (data->cache), 0);
+}
+/*
+ * Writing an NV index drops the cached response for that index only.
+ */
+static void
+read_cache_invalidate_nv_write_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+
+    cache_read_public (data, TPM2_CC_NV_ReadPublic, NV_INDEX);
+    cache_read_public (data, TPM2_CC_NV_ReadPublic, NV_INDEX_2);
+    assert_int_equal (read_cache_size (data->cache), 2);
+    command = command_new (data->connection, TPM2_ST_SESSIONS,
+                           TPM2_CC_NV_Write, NV_INDEX);
+    read_cache_invalidate (data->cache, command);
+    assert_int_equal (read_cache_size (data->cache), 1);
+    g_object_unref (command);
+}
+/*
+ * TPM2_EvictControl drops all cached responses.
+ */
+static void
+read_cache_invalidate_evict_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+
+    cache_read_public (data, TPM2_CC_ReadPublic, PERSISTENT);
+    cache_read_public (data, TPM2_CC_NV_ReadPublic, NV_INDEX);
+    command = command_new (data->connection, TPM2_ST_SESSIONS,
+                           TPM2_CC_EvictControl, TPM2_RH_OWNER);
+    read_cache_invalidate (data->cache, command);
+    assert_int_equal (read_cache_size (data->cache), 0);
+    g_object_unref (command);
+}
+/*
+ * PCR_Read responses are keyed by the PCR selection and go stale once a
+ * PCR is extended.
+ */
+static void
+read_cache_pcr_read_extend_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *pcr_read, *pcr_read_2, *extend;
+    Tpm2Response *response;
+
+    pcr_read = pcr_read_new (data->connection, 0x01);
+    pcr_read_2 = pcr_read_new (data->connection, 0x02);
+    response = response_new (data->connection, TSS2_RC_SUCCESS);
+    read_cache_insert (data->cache, pcr_read, response);
+    g_object_unref (response);
+    assert_null (read_cache_lookup (data->cache, pcr_read_2));
+    response = read_cache_lookup (data->cache, pcr_read);
+    assert_non_null (response);
+    g_object_unref (response);
+
+    extend = command_new (data->connection, TPM2_ST_SESSIONS,
+                          TPM2_CC_PCR_Extend, 0);
+    read_cache_invalidate (data->cache, extend);
+    assert_int_equal (data->cache->pcr_generation, 1);
+    assert_null (read_cache_lookup (data->cache, pcr_read));
+    assert_int_equal (read_cache_size (data->cache), 0);
+
+    g_object_unref (extend);
+    g_object_unref (pcr_read_2);
+    g_object_unref (pcr_read);
+}
+/*
+ * A PCR extend leaves the ReadPublic responses alone, and a cache without
+ * READ_CACHE_PCR_READ doesn't cache PCR_Read.
+ */
+static void
+read_cache_pcr_read_flags_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    ReadCache *cache;
+    Tpm2Command *pcr_read, *extend;
+    Tpm2Response *response;
+
+    cache_read_public (data, TPM2_CC_ReadPublic, PERSISTENT);
+    extend = command_new (data->connection, TPM2_ST_SESSIONS,
+                          TPM2_CC_PCR_Extend, 0);
+    read_cache_invalidate (data->cache, extend);
+    assert_int_equal (read_cache_size (data->cache), 1);
+
+    cache = read_cache_new (READ_CACHE_MAX_ENTRIES_DEFAULT,
+                            READ_CACHE_PUBLIC);
+    pcr_read = pcr_read_new (data->connection, 0x01);
+    response = response_new (data->connection, TSS2_RC_SUCCESS);
+    read_cache_insert (cache, pcr_read, response);
+    assert_int_equal (read_cache_size (cache), 0);
+
+    g_object_unref (response);
+    g_object_unref (pcr_read);
+    g_object_unref (extend);
+    g_object_unref (cache);
+}
+/*
+ * PCR_Read responses are only served for 'pcr-lifetime' milliseconds
+ * since PCRs extended without going through the daemon aren't seen.
+ */
+static void
+read_cache_pcr_read_lifetime_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *pcr_read;
+    Tpm2Response *response;
+
+    g_object_set (data->cache, "pcr-lifetime", 1, NULL);
+    pcr_read = pcr_read_new (data->connection, 0x01);
+    response = response_new (data->connection, TSS2_RC_SUCCESS);
+    read_cache_insert (data->cache, pcr_read, response);
+    g_object_unref (response);
+    assert_int_equal (read_cache_size (data->cache), 1);
+
+    g_usleep (2 * G_TIME_SPAN_MILLISECOND);
+    assert_null (read_cache_lookup (data->cache, pcr_read));
+    assert_int_equal (read_cache_size (data->cache), 0);
+
+    g_object_unref (pcr_read);
+}
+gint
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (read_cache_type_test,
+                                         read_cache_setup,
+                                         read_cache_teardown),
+        cmocka_unit_test_setup_teardown (read_cache_lookup_hit_test,
+                                         read_cache_setup,
+                                         read_cache_teardown),
+        cmocka_unit_test_setup_teardown (read_cache_insert_uncacheable_test,
+                                         read_cache_setup,
+                                         read_cache_teardown),
+        cmocka_unit_test_setup_teardown (read_cache_invalidate_nv_write_test,
+                                         read_cache_setup,
+                                         read_cache_teardown),
+        cmocka_unit_test_setup_teardown (read_cache_invalidate_evict_test,
+                                         read_cache_setup,
+                                         read_cache_teardown),
+        cmocka_unit_test_setup_teardown (read_cache_pcr_read_extend_test,
+                                         read_cache_setup,
+                                         read_cache_teardown),
+        cmocka_unit_test_setup_teardown (read_cache_pcr_read_flags_test,
+                                         read_cache_setup,
+                                         read_cache_teardown),
+        cmocka_unit_test_setup_teardown (read_cache_pcr_read_lifetime_test,
+                                         read_cache_setup,
+                                         read_cache_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
@@ -27,6 +27,7 @@
 #include <assert.h>
 #include <glib.h>
 #include <inttypes.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <setjmp.h>
@@ -36,8 +37,10 @@
 #include "tcti-echo.h"
 #include "sink-interface.h"
 #include "source-interface.h"
+#include "tpm2-batch.h"
 #include "tpm2-command.h"
 #include "tpm2-header.h"
+#include "tss2-tcti-tabrmd.h"
 #include "util.h"
 
 typedef struct test_data {
@@ -92,7 +95,9 @@ __wrap_sink_enqueue (Sink      *self,
 {
     UNUSED_PARAM(self);
     test_data_t *data = mock_ptr_type (test_data_t*);
-    data->response = TPM2_RESPONSE (obj);
+    if (IS_TPM2_RESPONSE (obj)) {
+        data->response = TPM2_RESPONSE (obj);
+    }
 }
 TSS2_RC
 __wrap_access_broker_context_saveflush (AccessBroker *broker,
@@ -293,6 +298,69 @@ resource_manager_process_tpm2_command_success_test (void **state)
     assert_int_equal (data->response, response);
     g_object_unref (response);
 }
+/*
+ * When the TPM responds with TPM2_RC_OBJECT_MEMORY the ResourceManager must
+ * save / flush the least recently used resident object and send the
+ * command again. The client only sees the second response.
+ */
+static void
+resource_manager_process_tpm2_command_evict_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Response *response_nomem, *response;
+    HandleMapEntry *entry;
+    guint8 *buffer;
+
+    entry = handle_map_entry_new (TPM2_HR_TRANSIENT + 0x2,
+                                  TPM2_HR_TRANSIENT + 0x1);
+    resource_manager_resident_touch (data->resource_manager, entry);
+    buffer = calloc (1, TPM_HEADER_SIZE);
+    data->command = tpm2_command_new (data->connection, buffer, TPM_HEADER_SIZE, (TPMA_CC){ 0, });
+    response_nomem = tpm2_response_new_rc (data->connection,
+                                           TPM2_RC_OBJECT_MEMORY);
+    response = tpm2_response_new_rc (data->connection, TSS2_RC_SUCCESS);
+    g_object_ref (response);
+
+    will_return (__wrap_access_broker_send_command, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, response_nomem);
+    will_return (__wrap_access_broker_context_saveflush, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, response);
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_command (data->resource_manager,
+                                           data->command);
+    assert_int_equal (data->response, response);
+    assert_int_equal (handle_map_entry_get_phandle (entry), 0);
+    assert_int_equal (g_queue_get_length (data->resource_manager->resident), 0);
+    g_object_unref (response);
+    g_object_unref (entry);
+}
+/*
+ * Objects loaded for the command being processed must not be evicted.
+ */
+static void
+resource_manager_evict_in_use_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    HandleMapEntry *entry;
+    GSList *transient_slist;
+    guint8 *buffer;
+
+    entry = handle_map_entry_new (TPM2_HR_TRANSIENT + 0x2,
+                                  TPM2_HR_TRANSIENT + 0x1);
+    resource_manager_resident_touch (data->resource_manager, entry);
+    transient_slist = g_slist_prepend (NULL, entry);
+    buffer = calloc (1, TPM_HEADER_SIZE);
+    data->command = tpm2_command_new (data->connection, buffer, TPM_HEADER_SIZE, (TPMA_CC){ 0, });
+    assert_int_equal (resource_manager_evict (data->resource_manager,
+                                              data->command,
+                                              transient_slist,
+                                              TPM2_RC_OBJECT_MEMORY), 0);
+    assert_int_equal (handle_map_entry_get_phandle (entry),
+                      TPM2_HR_TRANSIENT + 0x2);
+    g_slist_free (transient_slist);
+    g_object_unref (entry);
+}
 static void
 resource_manager_flushsave_context_test (void **state)
 {
@@ -354,6 +422,528 @@ resource_manager_virt_to_phys_test (void **state)
     assert_int_equal (phandle, handle_ret);
 
 }
+/*
+ * An entry that's still resident must not be loaded again, its physical
+ * handle is used as is.
+ */
+static void
+resource_manager_virt_to_phys_resident_test (void **state)
+{
+    test_data_t    *data = (test_data_t*)*state;
+    HandleMapEntry *entry;
+    TPM2_HANDLE     phandle = TPM2_HR_TRANSIENT + 0x1;
+    TSS2_RC         rc;
+
+    entry = handle_map_entry_new (phandle, data->vhandles [0]);
+    resource_manager_resident_touch (data->resource_manager, entry);
+    rc = resource_manager_virt_to_phys (data->resource_manager,
+                                        data->command,
+                                        entry,
+                                        0);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (tpm2_command_get_handle (data->command, 0), phandle);
+    g_object_unref (entry);
+}
+/*
+ * When the next command in the queue comes from the same connection and
+ * uses a resident object, that object must not be saved / flushed after
+ * the current command. The command from the setup function is queued as
+ * the next command, no call to saveflush is expected.
+ */
+static void
+resource_manager_lookahead_keep_test (void **state)
+{
+    test_data_t    *data = (test_data_t*)*state;
+    HandleMapEntry *entry;
+    HandleMap      *map;
+    Tpm2Command    *command;
+    Tpm2Response   *response;
+    TPM2_HANDLE     phandle = TPM2_HR_TRANSIENT + 0x1;
+    guint8         *buffer;
+
+    entry = handle_map_entry_new (phandle, data->vhandles [0]);
+    map = connection_get_trans_map (data->connection);
+    handle_map_insert (map, data->vhandles [0], entry);
+    g_object_unref (map);
+    resource_manager_resident_touch (data->resource_manager, entry);
+    message_queue_enqueue (data->resource_manager->in_queue,
+                           G_OBJECT (data->command));
+
+    buffer = calloc (1, TPM_HEADER_SIZE);
+    command = tpm2_command_new (data->connection, buffer, TPM_HEADER_SIZE, (TPMA_CC){ 0, });
+    response = tpm2_response_new_rc (data->connection, TSS2_RC_SUCCESS);
+    g_object_ref (response);
+    will_return (__wrap_access_broker_send_command, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, response);
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_command (data->resource_manager, command);
+
+    assert_int_equal (handle_map_entry_get_phandle (entry), phandle);
+    assert_int_equal (g_queue_get_length (data->resource_manager->resident), 1);
+    g_object_unref (response);
+    g_object_unref (command);
+    g_object_unref (entry);
+}
+/*
+ * Sequence objects are kept loaded after the command that creates them so
+ * no call to saveflush is expected.
+ */
+static void
+resource_manager_sequence_resident_test (void **state)
+{
+    test_data_t    *data = (test_data_t*)*state;
+    HandleMapEntry *entry;
+    Tpm2Command    *command;
+    Tpm2Response   *response;
+    TPMA_CC         attrs = TPMA_CC_RHANDLE + TPM2_CC_HashSequenceStart;
+    guint8         *buffer;
+    size_t          buffer_size = TPM_HEADER_SIZE + sizeof (TPM2_HANDLE);
+
+    buffer = calloc (1, TPM_HEADER_SIZE);
+    command = tpm2_command_new (data->connection, buffer, TPM_HEADER_SIZE, attrs);
+    buffer = calloc (1, buffer_size);
+    *(TPM2_ST*)buffer = htobe16 (TPM2_ST_NO_SESSIONS);
+    *(UINT32*)&buffer [2] = htobe32 (buffer_size);
+    *(TPM2_HANDLE*)&buffer [TPM_HEADER_SIZE] = htobe32 (TPM2_HR_TRANSIENT + 0x1);
+    response = tpm2_response_new (data->connection, buffer, buffer_size, attrs);
+    g_object_ref (response);
+    will_return (__wrap_access_broker_send_command, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, response);
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_command (data->resource_manager, command);
+
+    assert_int_equal (g_queue_get_length (data->resource_manager->resident), 1);
+    entry = HANDLE_MAP_ENTRY (g_queue_peek_head (data->resource_manager->resident));
+    assert_true (handle_map_entry_is_sequence (entry));
+    assert_int_equal (handle_map_entry_get_phandle (entry),
+                      TPM2_HR_TRANSIENT + 0x1);
+    g_object_unref (response);
+    g_object_unref (command);
+}
+/*
+ * A session kept loaded for the next command must be flushed and dropped
+ * when its connection goes away, not treated as an impossible state.
+ */
+static void
+resource_manager_remove_connection_loaded_session_test (void **state)
+{
+    test_data_t  *data = (test_data_t*)*state;
+    SessionList  *list = data->resource_manager->session_list;
+    SessionEntry *entry;
+
+    entry = session_entry_new (data->connection, TPM2_HR_HMAC_SESSION + 1);
+    session_entry_set_state (entry, SESSION_ENTRY_LOADED);
+    session_list_insert (list, entry);
+    g_object_unref (entry);
+
+    resource_manager_remove_connection (data->resource_manager,
+                                        data->connection);
+    assert_int_equal (session_list_size (list), 0);
+}
+/*
+ * A TPM2_ContextSave for a transient object that isn't loaded is answered
+ * from the context held by the RM without sending anything to the TPM.
+ */
+static void
+resource_manager_save_context_transient_test (void **state)
+{
+    test_data_t    *data = (test_data_t*)*state;
+    HandleMapEntry *entry;
+    HandleMap      *map;
+    Tpm2Command    *command;
+    Tpm2Response   *response;
+    TPMS_CONTEXT    context = {
+        .savedHandle = 0x80000000,
+        .hierarchy = TPM2_RH_OWNER,
+    };
+    guint8         *buffer;
+    size_t          buffer_size = TPM_HEADER_SIZE + sizeof (TPM2_HANDLE);
+
+    entry = handle_map_entry_new (0, data->vhandles [0]);
+    handle_map_entry_set_context (entry, &context);
+    map = connection_get_trans_map (data->connection);
+    handle_map_insert (map, data->vhandles [0], entry);
+    g_object_unref (map);
+
+    buffer = calloc (1, buffer_size);
+    *(TPM2_ST*)buffer = htobe16 (TPM2_ST_NO_SESSIONS);
+    *(UINT32*)&buffer [2] = htobe32 (buffer_size);
+    *(TPM2_CC*)&buffer [6] = htobe32 (TPM2_CC_ContextSave);
+    *(TPM2_HANDLE*)&buffer [TPM_HEADER_SIZE] = htobe32 (data->vhandles [0]);
+    command = tpm2_command_new (data->connection,
+                                buffer,
+                                buffer_size,
+                                (1 << 25) + TPM2_CC_ContextSave);
+    response = resource_manager_save_context (data->resource_manager, command);
+    assert_non_null (response);
+    assert_int_equal (tpm2_response_get_code (response), TSS2_RC_SUCCESS);
+    assert_int_equal (tpm2_response_get_size (response),
+                      TPM_HEADER_SIZE + entry->context.size);
+    assert_memory_equal (&tpm2_response_get_buffer (response) [TPM_HEADER_SIZE],
+                         entry->context.buf,
+                         entry->context.size);
+    g_object_unref (response);
+    g_object_unref (command);
+    g_object_unref (entry);
+}
+/*
+ * A GetCapability query for the algorithms implemented by the TPM is
+ * answered from the AccessBroker cache, nothing is sent to the TPM.
+ */
+static void
+resource_manager_get_cap_cached_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    guint8      *buffer;
+    size_t       buffer_size = TPM_HEADER_SIZE + 3 * sizeof (UINT32);
+
+    data->access_broker->algs.capability = TPM2_CAP_ALGS;
+    data->access_broker->algs.data.algorithms.count = 1;
+    data->access_broker->algs.data.algorithms.algProperties [0].alg = TPM2_ALG_SHA256;
+    buffer = calloc (1, buffer_size);
+    *(TPM2_ST*)buffer = htobe16 (TPM2_ST_NO_SESSIONS);
+    *(UINT32*)&buffer [2] = htobe32 (buffer_size);
+    *(TPM2_CC*)&buffer [6] = htobe32 (TPM2_CC_GetCapability);
+    *(UINT32*)&buffer [TPM_HEADER_SIZE] = htobe32 (TPM2_CAP_ALGS);
+    *(UINT32*)&buffer [TPM_HEADER_SIZE + 4] = htobe32 (TPM2_ALG_FIRST);
+    *(UINT32*)&buffer [TPM_HEADER_SIZE + 8] = htobe32 (TPM2_MAX_CAP_ALGS);
+    command = tpm2_command_new (data->connection,
+                                buffer,
+                                buffer_size,
+                                TPM2_CC_GetCapability);
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_command (data->resource_manager, command);
+    assert_non_null (data->response);
+    g_object_unref (command);
+}
+/*
+ * A GetRandom command is answered from the AccessBroker's pool of TPM
+ * randomness. The bytes handed out are zeroed in the pool.
+ */
+static void
+resource_manager_get_random_pool_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    guint8      *buffer;
+    size_t       buffer_size = TPM_HEADER_SIZE + sizeof (UINT16);
+
+    access_broker_random_pool_init (data->access_broker, 32);
+    memset (data->access_broker->random_pool, 0xaa, 32);
+    data->access_broker->random_pool_count = 32;
+    data->access_broker->random_max = 32;
+    buffer = calloc (1, buffer_size);
+    *(TPM2_ST*)buffer = htobe16 (TPM2_ST_NO_SESSIONS);
+    *(UINT32*)&buffer [2] = htobe32 (buffer_size);
+    *(TPM2_CC*)&buffer [6] = htobe32 (TPM2_CC_GetRandom);
+    *(UINT16*)&buffer [TPM_HEADER_SIZE] = htobe16 (16);
+    command = tpm2_command_new (data->connection,
+                                buffer,
+                                buffer_size,
+                                TPM2_CC_GetRandom);
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_command (data->resource_manager, command);
+    assert_non_null (data->response);
+    assert_int_equal (data->access_broker->random_pool_count, 16);
+    assert_int_equal (data->access_broker->random_pool [16], 0);
+    assert_int_equal (data->access_broker->random_pool [15], 0xaa);
+    g_object_unref (command);
+}
+/*
+ * Create a PCR_Read command. The byte following the header stands in for
+ * the PCR selection.
+ */
+static Tpm2Command*
+pcr_read_new (Connection *connection,
+              guint8      selection)
+{
+    size_t  buffer_size = TPM_HEADER_SIZE + 1;
+    guint8 *buffer = calloc (1, buffer_size);
+
+    tpm2_header_init (buffer, buffer_size, TPM2_ST_NO_SESSIONS, buffer_size,
+                      TPM2_CC_PCR_Read);
+    buffer [TPM_HEADER_SIZE] = selection;
+    return tpm2_command_new (connection,
+                             buffer,
+                             buffer_size,
+                             TPM2_CC_PCR_Read);
+}
+/*
+ * A PCR_Read queued by another connection with the same bytes gets a copy
+ * of the response and is taken off the queue. Commands queued behind a
+ * different command from the same connection, and commands that differ,
+ * stay queued.
+ */
+static void
+resource_manager_shared_response_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    MessageQueue *queue = data->resource_manager->in_queue;
+    Connection *connection_b, *connection_c;
+    HandleMap *handle_map;
+    GIOStream *iostream;
+    Tpm2Command *command, *dup, *blocked, *other;
+    Tpm2Response *response;
+    GObject *obj;
+    gint client_fd;
+
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    connection_b = connection_new (iostream, 11, handle_map);
+    g_object_unref (iostream);
+    iostream = create_connection_iostream (&client_fd);
+    connection_c = connection_new (iostream, 12, handle_map);
+    g_object_unref (iostream);
+    g_object_unref (handle_map);
+
+    command = pcr_read_new (data->connection, 0x01);
+    other = pcr_read_new (connection_c, 0x02);
+    dup = pcr_read_new (connection_b, 0x01);
+    blocked = pcr_read_new (connection_c, 0x01);
+    message_queue_enqueue (queue, G_OBJECT (other));
+    message_queue_enqueue (queue, G_OBJECT (dup));
+    message_queue_enqueue (queue, G_OBJECT (blocked));
+
+    response = tpm2_response_new_rc (data->connection, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, response);
+    will_return (__wrap_sink_enqueue, data);
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_command (data->resource_manager, command);
+
+    obj = message_queue_dequeue (queue);
+    assert_int_equal (obj, other);
+    g_object_unref (obj);
+    obj = message_queue_dequeue (queue);
+    assert_int_equal (obj, blocked);
+    g_object_unref (obj);
+    assert_null (message_queue_peek (queue));
+
+    g_object_unref (command);
+    g_object_unref (other);
+    g_object_unref (dup);
+    g_object_unref (blocked);
+    g_object_unref (connection_b);
+    g_object_unref (connection_c);
+}
+/*
+ * A batch sent with STOP_ON_ERROR: the commands are executed in order
+ * until one fails, the ones after it are skipped. The responses are
+ * collected in the batch which is passed to the sink as a whole.
+ */
+static void
+resource_manager_batch_stop_on_error_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Batch *batch;
+    Tpm2Command *command;
+    Tpm2Response *response;
+    guint8 i;
+
+    batch = tpm2_batch_new (data->connection,
+                            TSS2_TCTI_TABRMD_BATCH_STOP_ON_ERROR);
+    for (i = 0; i < 3; ++i) {
+        command = pcr_read_new (data->connection, i);
+        tpm2_batch_add_command (batch, command);
+        g_object_unref (command);
+    }
+    response = tpm2_response_new_rc (data->connection, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, response);
+    response = tpm2_response_new_rc (data->connection, TPM2_RC_FAILURE);
+    will_return (__wrap_access_broker_send_command, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, response);
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_batch (data->resource_manager, batch);
+
+    assert_null (data->response);
+    assert_int_equal (tpm2_batch_get_response_count (batch), 2);
+    assert_int_equal (tpm2_response_get_code (tpm2_batch_get_response (batch, 0)),
+                      TSS2_RC_SUCCESS);
+    assert_int_equal (tpm2_response_get_code (tpm2_batch_get_response (batch, 1)),
+                      TPM2_RC_FAILURE);
+    g_object_unref (batch);
+}
+/*
+ * The session used by the second command in a stop-on-error batch is kept
+ * loaded while the first command runs. When the first command fails the
+ * second is skipped and the session must be saved, leaving nothing loaded
+ * for the connection when it's closed.
+ */
+static void
+resource_manager_batch_stop_on_error_session_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    SessionList *list = data->resource_manager->session_list;
+    SessionEntry *entry;
+    Tpm2Batch *batch;
+    Tpm2Command *command;
+    Tpm2Response *response;
+    TPM2_HANDLE handle = TPM2_HR_POLICY_SESSION + 1;
+    size_t buffer_size = TPM_HEADER_SIZE + sizeof (TPM2_HANDLE);
+    guint8 *buffer;
+
+    entry = session_entry_new (data->connection, handle);
+    session_entry_set_state (entry, SESSION_ENTRY_LOADED);
+    session_list_insert (list, entry);
+
+    batch = tpm2_batch_new (data->connection,
+                            TSS2_TCTI_TABRMD_BATCH_STOP_ON_ERROR);
+    command = pcr_read_new (data->connection, 0);
+    tpm2_batch_add_command (batch, command);
+    g_object_unref (command);
+    buffer = calloc (1, buffer_size);
+    tpm2_header_init (buffer, buffer_size, TPM2_ST_NO_SESSIONS, buffer_size,
+                      TPM2_CC_PolicyRestart);
+    *(TPM2_HANDLE*)&buffer [TPM_HEADER_SIZE] = htobe32 (handle);
+    command = tpm2_command_new (data->connection,
+                                buffer,
+                                buffer_size,
+                                (1 << 25) + TPM2_CC_PolicyRestart);
+    tpm2_batch_add_command (batch, command);
+    g_object_unref (command);
+
+    response = tpm2_response_new_rc (data->connection, TPM2_RC_FAILURE);
+    will_return (__wrap_access_broker_send_command, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, response);
+    /* the TPM2_ContextSave for the skipped command's session */
+    buffer_size = TPM_HEADER_SIZE + 8;
+    buffer = calloc (1, buffer_size);
+    tpm2_header_init (buffer, buffer_size, TPM2_ST_NO_SESSIONS, buffer_size,
+                      TSS2_RC_SUCCESS);
+    response = tpm2_response_new (data->connection, buffer, buffer_size, 0);
+    will_return (__wrap_access_broker_send_command, TSS2_RC_SUCCESS);
+    will_return (__wrap_access_broker_send_command, response);
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_batch (data->resource_manager, batch);
+
+    assert_int_equal (tpm2_batch_get_response_count (batch), 1);
+    assert_int_equal (session_entry_get_state (entry), SESSION_ENTRY_SAVED_RM);
+    resource_manager_remove_connection (data->resource_manager,
+                                        data->connection);
+    assert_int_equal (session_list_size (list), 0);
+    g_object_unref (entry);
+    g_object_unref (batch);
+}
+/*
+ * A CreatePrimary found in the ObjectCache is answered with a new virtual
+ * handle mapped to an entry backed by the shared context. Nothing is sent
+ * to the TPM.
+ */
+static void
+resource_manager_create_primary_cached_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    ObjectCache *cache;
+    Tpm2Command *command;
+    Tpm2Response *response;
+    HandleMap *map;
+    HandleMapEntry *entry;
+    TPMS_CONTEXT context = { .savedHandle = 0x80000001, .sequence = 7, };
+    GBytes *shared;
+    guint8 *buffer;
+    size_t buffer_size = TPM_HEADER_SIZE + 4 + 4 + 9;
+    size_t response_size = TPM_HEADER_SIZE + 4 + 4;
+    TPMA_CC attrs = TPMA_CC_RHANDLE + (1 << 25) + TPM2_CC_CreatePrimary;
+
+    buffer = calloc (1, buffer_size);
+    tpm2_header_init (buffer, buffer_size, TPM2_ST_SESSIONS, buffer_size,
+                      TPM2_CC_CreatePrimary);
+    *(TPM2_HANDLE*)&buffer [TPM_HEADER_SIZE] = htobe32 (TPM2_RH_OWNER);
+    *(UINT32*)&buffer [TPM_HEADER_SIZE + 4] = htobe32 (9);
+    *(TPM2_HANDLE*)&buffer [TPM_HEADER_SIZE + 8] = htobe32 (TPM2_RS_PW);
+    command = tpm2_command_new (data->connection, buffer, buffer_size, attrs);
+    buffer = calloc (1, response_size);
+    tpm2_header_init (buffer, response_size, TPM2_ST_SESSIONS, response_size,
+                      TSS2_RC_SUCCESS);
+    *(TPM2_HANDLE*)&buffer [TPM_HEADER_SIZE] = htobe32 (0x80000001);
+    response = tpm2_response_new (data->connection,
+                                  buffer,
+                                  response_size,
+                                  attrs);
+    entry = handle_map_entry_new (0x80000001, TPM2_HR_TRANSIENT + 1);
+    handle_map_entry_set_context (entry, &context);
+    shared = handle_map_entry_share_context (entry);
+    g_object_unref (entry);
+    cache = object_cache_new (OBJECT_CACHE_MAX_ENTRIES_DEFAULT,
+                              OBJECT_CACHE_PRIMARY);
+    object_cache_insert (cache, command, response, shared);
+    g_bytes_unref (shared);
+    g_object_unref (response);
+    g_object_set (data->resource_manager, "object-cache", cache, NULL);
+    g_object_unref (cache);
+
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_command (data->resource_manager, command);
+    assert_non_null (data->response);
+    map = connection_get_trans_map (data->connection);
+    assert_int_equal (handle_map_size (map), 1);
+    entry = handle_map_vlookup (map, TPM2_HR_TRANSIENT + 0xff);
+    assert_non_null (entry);
+    assert_int_equal (handle_map_entry_get_phandle (entry), 0);
+    assert_true (handle_map_entry_is_shared (entry));
+    memset (&context, 0, sizeof (context));
+    assert_int_equal (handle_map_entry_get_context (entry, &context),
+                      TSS2_RC_SUCCESS);
+    assert_int_equal (context.sequence, 7);
+    g_object_unref (entry);
+    g_object_unref (map);
+    g_object_unref (command);
+}
+/*
+ * An unbound, unsalted HMAC StartAuthSession is answered from the
+ * SessionPool. The connection owns the pooled session, saved by the RM.
+ * Nothing is sent to the TPM.
+ */
+static void
+resource_manager_start_auth_session_pooled_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    SessionPool *pool;
+    SessionEntry *entry;
+    Tpm2Command *command;
+    TPM2B_NONCE nonce = { .size = TPM2_SHA256_DIGEST_SIZE, };
+    TPM2_HANDLE handle = TPM2_HR_HMAC_SESSION + 1;
+    guint8 context [8] = { 0, };
+    guint8 *buffer;
+    size_t offset = TPM_HEADER_SIZE + 8;
+    size_t buffer_size = TPM_HEADER_SIZE + 8 + 2 + TPM2_SHA256_DIGEST_SIZE +
+                         2 + 1 + 2 + 2;
+    TPMA_CC attrs = TPMA_CC_RHANDLE + (2 << 25) + TPM2_CC_StartAuthSession;
+
+    buffer = calloc (1, buffer_size);
+    tpm2_header_init (buffer, buffer_size, TPM2_ST_NO_SESSIONS, buffer_size,
+                      TPM2_CC_StartAuthSession);
+    *(TPM2_HANDLE*)&buffer [TPM_HEADER_SIZE] = htobe32 (TPM2_RH_NULL);
+    *(TPM2_HANDLE*)&buffer [TPM_HEADER_SIZE + 4] = htobe32 (TPM2_RH_NULL);
+    *(UINT16*)&buffer [offset] = htobe16 (TPM2_SHA256_DIGEST_SIZE);
+    offset += 2 + TPM2_SHA256_DIGEST_SIZE + 2;
+    buffer [offset] = TPM2_SE_HMAC;
+    offset += 1;
+    *(UINT16*)&buffer [offset] = htobe16 (TPM2_ALG_NULL);
+    offset += 2;
+    *(UINT16*)&buffer [offset] = htobe16 (TPM2_ALG_SHA256);
+    command = tpm2_command_new (data->connection, buffer, buffer_size, attrs);
+
+    pool = session_pool_new (1);
+    session_pool_add (pool, 0, handle, &nonce, context, sizeof (context));
+    g_object_set (data->resource_manager, "session-pool", pool, NULL);
+
+    will_return (__wrap_sink_enqueue, data);
+    resource_manager_process_tpm2_command (data->resource_manager, command);
+    assert_non_null (data->response);
+    assert_int_equal (session_pool_count (pool), 0);
+    entry = session_list_lookup_handle (data->resource_manager->session_list,
+                                        handle);
+    assert_non_null (entry);
+    assert_int_equal (session_entry_get_state (entry), SESSION_ENTRY_SAVED_RM);
+    assert_int_equal (session_entry_get_context (entry)->size,
+                      sizeof (context));
+    g_object_unref (entry);
+    g_object_unref (pool);
+    g_object_unref (command);
+}
 /*
  */
 static void
@@ -411,6 +1001,12 @@ main (void)
         cmocka_unit_test_setup_teardown (resource_manager_process_tpm2_command_success_test,
                                          resource_manager_setup,
                                          resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_process_tpm2_command_evict_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_evict_in_use_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
         cmocka_unit_test_setup_teardown (resource_manager_flushsave_context_test,
                                          resource_manager_setup,
                                          resource_manager_teardown),
@@ -420,6 +1016,42 @@ main (void)
         cmocka_unit_test_setup_teardown (resource_manager_virt_to_phys_test,
                                          resource_manager_setup_two_transient_handles,
                                          resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_virt_to_phys_resident_test,
+                                         resource_manager_setup_two_transient_handles,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_lookahead_keep_test,
+                                         resource_manager_setup_two_transient_handles,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_sequence_resident_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_remove_connection_loaded_session_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_save_context_transient_test,
+                                         resource_manager_setup_two_transient_handles,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_get_cap_cached_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_get_random_pool_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_shared_response_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_batch_stop_on_error_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_batch_stop_on_error_session_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_create_primary_cached_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
+        cmocka_unit_test_setup_teardown (resource_manager_start_auth_session_pooled_test,
+                                         resource_manager_setup,
+                                         resource_manager_teardown),
         cmocka_unit_test_setup_teardown (resource_manager_load_handles_test,
                                          resource_manager_setup_two_transient_handles,
                                          resource_manager_teardown),
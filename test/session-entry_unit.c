@@ -26,6 +26,7 @@
  */
 #include <glib.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
@@ -108,6 +109,37 @@ session_entry_get_context_test (void **state)
     assert_non_null (size_buf);
 }
 
+/*
+ * The first context set on a SessionEntry becomes the 'context_client' blob
+ * as well. Setting a second context must replace only the 'context' blob.
+ * Both blobs are sized to the data, not to SIZE_BUF_MAX.
+ */
+static void
+session_entry_set_context_twice_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    uint8_t first [] = { 0x01, 0x02, 0x03, 0x04 };
+    uint8_t second [] = { 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a };
+    size_buf_t *context, *context_client;
+
+    session_entry_set_context (data->session_entry, first, sizeof (first));
+    session_entry_set_context (data->session_entry, second, sizeof (second));
+    context = session_entry_get_context (data->session_entry);
+    context_client = session_entry_get_context_client (data->session_entry);
+    assert_int_equal (context->size, sizeof (second));
+    assert_memory_equal (context->buf, second, sizeof (second));
+    assert_int_equal (context_client->size, sizeof (first));
+    assert_memory_equal (context_client->buf, first, sizeof (first));
+    assert_int_equal (session_entry_compare_on_context_client (data->session_entry,
+                                                               first,
+                                                               sizeof (first)),
+                      0);
+    assert_int_not_equal (session_entry_compare_on_context_client (data->session_entry,
+                                                                   second,
+                                                                   sizeof (second)),
+                          0);
+}
+
 static void
 session_entry_get_connection_test (void **state)
 {
@@ -139,6 +171,9 @@ main (void)
         cmocka_unit_test_setup_teardown (session_entry_get_context_test,
                                          session_entry_setup,
                                          session_entry_teardown),
+        cmocka_unit_test_setup_teardown (session_entry_set_context_twice_test,
+                                         session_entry_setup,
+                                         session_entry_teardown),
         cmocka_unit_test_setup_teardown (session_entry_get_connection_test,
                                          session_entry_setup,
                                          session_entry_teardown),
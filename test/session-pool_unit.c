@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "session-pool.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+#define CMD_SIZE_MAX 128
+#define SESSION_HANDLE (TPM2_HR_HMAC_SESSION + 1)
+#define SESSION_ATTRS \
+    (TPMA_CC_RHANDLE + (2 << 25) + TPM2_CC_StartAuthSession)
+
+typedef struct {
+    SessionPool *pool;
+    Connection  *connection;
+} test_data_t;
+
+static int
+session_pool_setup (void **state)
+{
+    test_data_t *data;
+    HandleMap *handle_map;
+    GIOStream *iostream;
+    gint client_fd;
+
+    data = calloc (1, sizeof (test_data_t));
+    data->pool = session_pool_new (1);
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    data->connection = connection_new (iostream, 0, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+
+    *state = data;
+    return 0;
+}
+static int
+session_pool_teardown (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    g_object_unref (data->pool);
+    g_object_unref (data->connection);
+    free (data);
+    return 0;
+}
+/*
+ * Create a TPM2_StartAuthSession command with the provided bind handle,
+ * nonceCaller size, salt size and parameters.
+ */
+static Tpm2Command*
+start_auth_session_new (Connection                  *connection,
+                        TPM2_HANDLE                  bind,
+                        UINT16                       nonce_size,
+                        UINT16                       salt_size,
+                        session_pool_params_t const *params)
+{
+    guint8 *buf = calloc (1, CMD_SIZE_MAX);
+    TPM2B_NONCE nonce = { .size = nonce_size, };
+    TPM2B_ENCRYPTED_SECRET salt = { .size = salt_size, };
+    size_t offset = TPM_HEADER_SIZE;
+
+    assert_int_equal (Tss2_MU_TPM2_HANDLE_Marshal (TPM2_RH_NULL, buf,
+                          CMD_SIZE_MAX, &offset), TSS2_RC_SUCCESS);
+    assert_int_equal (Tss2_MU_TPM2_HANDLE_Marshal (bind, buf,
+                          CMD_SIZE_MAX, &offset), TSS2_RC_SUCCESS);
+    assert_int_equal (Tss2_MU_TPM2B_NONCE_Marshal (&nonce, buf,
+                          CMD_SIZE_MAX, &offset), TSS2_RC_SUCCESS);
+    assert_int_equal (Tss2_MU_TPM2B_ENCRYPTED_SECRET_Marshal (&salt, buf,
+                          CMD_SIZE_MAX, &offset), TSS2_RC_SUCCESS);
+    assert_int_equal (Tss2_MU_TPM2_SE_Marshal (params->session_type, buf,
+                          CMD_SIZE_MAX, &offset), TSS2_RC_SUCCESS);
+    assert_int_equal (Tss2_MU_TPMT_SYM_DEF_Marshal (&params->symmetric, buf,
+                          CMD_SIZE_MAX, &offset), TSS2_RC_SUCCESS);
+    assert_int_equal (Tss2_MU_UINT16_Marshal (params->auth_hash, buf,
+                          CMD_SIZE_MAX, &offset), TSS2_RC_SUCCESS);
+    tpm2_header_init (buf, CMD_SIZE_MAX, TPM2_ST_NO_SESSIONS, offset,
+                      TPM2_CC_StartAuthSession);
+    return tpm2_command_new (connection, buf, offset, SESSION_ATTRS);
+}
+/*
+ * Add a session for the given set with a context of 8 bytes of 'fill'.
+ */
+static void
+pool_add (SessionPool *pool,
+          guint        set,
+          TPM2_HANDLE  handle,
+          guint8       fill)
+{
+    TPM2B_NONCE nonce = { .size = TPM2_SHA256_DIGEST_SIZE, };
+    guint8 context [8];
+
+    memset (nonce.buffer, fill, nonce.size);
+    memset (context, fill, sizeof (context));
+    session_pool_add (pool, set, handle, &nonce, context, sizeof (context));
+}
+/*
+ * Add a session for the given set with a context saved at 'sequence'.
+ */
+static void
+pool_add_sequence (SessionPool *pool,
+                   guint        set,
+                   TPM2_HANDLE  handle,
+                   UINT64       sequence)
+{
+    TPM2B_NONCE nonce = { .size = TPM2_SHA256_DIGEST_SIZE, };
+    guint8 context [8];
+    size_t offset = 0;
+
+    assert_int_equal (Tss2_MU_UINT64_Marshal (sequence, context,
+                          sizeof (context), &offset), TSS2_RC_SUCCESS);
+    session_pool_add (pool, set, handle, &nonce, context, sizeof (context));
+}
+static void
+session_pool_type_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    assert_true (IS_SESSION_POOL (data->pool));
+    assert_int_equal (session_pool_count (data->pool), 0);
+}
+/*
+ * Unbound, unsalted HMAC sessions with a SHA256 sized nonceCaller match the
+ * pooled parameter sets. Bound, salted and policy sessions and other nonce
+ * sizes, for which the TPM would size the session nonces differently,
+ * don't.
+ */
+static void
+session_pool_match_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    session_pool_params_t policy = *session_pool_get_params (0);
+    Tpm2Command *command;
+
+    command = start_auth_session_new (data->connection, TPM2_RH_NULL, 32, 0,
+                                      session_pool_get_params (0));
+    assert_int_equal (session_pool_match (command), 0);
+    g_object_unref (command);
+    command = start_auth_session_new (data->connection, TPM2_RH_NULL, 16, 0,
+                                      session_pool_get_params (0));
+    assert_int_equal (session_pool_match (command), -1);
+    g_object_unref (command);
+    command = start_auth_session_new (data->connection, TPM2_RH_NULL, 32, 0,
+                                      session_pool_get_params (1));
+    assert_int_equal (session_pool_match (command), 1);
+    g_object_unref (command);
+
+    command = start_auth_session_new (data->connection, TPM2_RH_OWNER, 32, 0,
+                                      session_pool_get_params (0));
+    assert_int_equal (session_pool_match (command), -1);
+    g_object_unref (command);
+    command = start_auth_session_new (data->connection, TPM2_RH_NULL, 32, 8,
+                                      session_pool_get_params (0));
+    assert_int_equal (session_pool_match (command), -1);
+    g_object_unref (command);
+    command = start_auth_session_new (data->connection, TPM2_RH_NULL, 8, 0,
+                                      session_pool_get_params (0));
+    assert_int_equal (session_pool_match (command), -1);
+    g_object_unref (command);
+    policy.session_type = TPM2_SE_POLICY;
+    command = start_auth_session_new (data->connection, TPM2_RH_NULL, 32, 0,
+                                      &policy);
+    assert_int_equal (session_pool_match (command), -1);
+    g_object_unref (command);
+}
+/*
+ * A matching command takes the pooled session: the response carries the
+ * handle and nonceTPM and the context is returned. The next one misses.
+ */
+static void
+session_pool_take_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    Tpm2Response *response;
+    GBytes *context = NULL;
+    guint set;
+
+    assert_true (session_pool_needs_fill (data->pool, &set));
+    assert_int_equal (set, 0);
+    pool_add (data->pool, 0, SESSION_HANDLE, 0x5a);
+    assert_true (session_pool_needs_fill (data->pool, &set));
+    assert_int_equal (set, 1);
+    pool_add (data->pool, 1, SESSION_HANDLE + 1, 0xa5);
+    assert_false (session_pool_needs_fill (data->pool, &set));
+
+    command = start_auth_session_new (data->connection, TPM2_RH_NULL, 32, 0,
+                                      session_pool_get_params (0));
+    response = session_pool_take (data->pool, command, &context);
+    assert_non_null (response);
+    assert_int_equal (tpm2_response_get_code (response), TSS2_RC_SUCCESS);
+    assert_int_equal (tpm2_response_get_size (response),
+                      TPM_HEADER_SIZE + 4 + 2 + TPM2_SHA256_DIGEST_SIZE);
+    assert_int_equal (tpm2_response_get_handle (response), SESSION_HANDLE);
+    assert_int_equal (tpm2_response_get_buffer (response) [TPM_HEADER_SIZE + 6],
+                      0x5a);
+    assert_int_equal (g_bytes_get_size (context), 8);
+    g_bytes_unref (context);
+    g_object_unref (response);
+
+    assert_null (session_pool_take (data->pool, command, &context));
+    g_object_unref (command);
+    assert_int_equal (data->pool->hits, 1);
+    assert_int_equal (data->pool->misses, 1);
+    assert_int_equal (session_pool_count (data->pool), 1);
+}
+/*
+ * After a failed fill the pool asks for no more sessions until one is
+ * handed out.
+ */
+static void
+session_pool_fill_failed_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    Tpm2Response *response;
+    GBytes *context = NULL;
+    guint set;
+
+    pool_add (data->pool, 0, SESSION_HANDLE, 0x5a);
+    session_pool_fill_failed (data->pool);
+    assert_false (session_pool_needs_fill (data->pool, &set));
+    command = start_auth_session_new (data->connection, TPM2_RH_NULL, 32, 0,
+                                      session_pool_get_params (0));
+    response = session_pool_take (data->pool, command, &context);
+    assert_non_null (response);
+    assert_true (session_pool_needs_fill (data->pool, &set));
+    g_bytes_unref (context);
+    g_object_unref (response);
+    g_object_unref (command);
+}
+/*
+ * Taking all sessions empties the pool and returns their handles.
+ */
+static void
+session_pool_take_all_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    GSList *handles;
+
+    pool_add (data->pool, 0, SESSION_HANDLE, 0x5a);
+    pool_add (data->pool, 1, SESSION_HANDLE + 1, 0xa5);
+    handles = session_pool_take_all (data->pool);
+    assert_int_equal (g_slist_length (handles), 2);
+    assert_non_null (g_slist_find (handles, GUINT_TO_POINTER (SESSION_HANDLE)));
+    assert_int_equal (session_pool_count (data->pool), 0);
+    g_slist_free (handles);
+}
+/*
+ * Sessions saved 'max_gap' or more contexts ago are removed from the pool
+ * and their handles returned, newer ones are kept.
+ */
+static void
+session_pool_take_stale_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    GSList *handles;
+
+    pool_add_sequence (data->pool, 0, SESSION_HANDLE, 1);
+    pool_add_sequence (data->pool, 1, SESSION_HANDLE + 1, 100);
+    handles = session_pool_take_stale (data->pool, 150, 100);
+    assert_int_equal (g_slist_length (handles), 1);
+    assert_int_equal (GPOINTER_TO_UINT (handles->data), SESSION_HANDLE);
+    assert_int_equal (session_pool_count (data->pool), 1);
+    g_slist_free (handles);
+    assert_null (session_pool_take_stale (data->pool, 150, 100));
+}
+gint
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (session_pool_type_test,
+                                         session_pool_setup,
+                                         session_pool_teardown),
+        cmocka_unit_test_setup_teardown (session_pool_match_test,
+                                         session_pool_setup,
+                                         session_pool_teardown),
+        cmocka_unit_test_setup_teardown (session_pool_take_test,
+                                         session_pool_setup,
+                                         session_pool_teardown),
+        cmocka_unit_test_setup_teardown (session_pool_fill_failed_test,
+                                         session_pool_setup,
+                                         session_pool_teardown),
+        cmocka_unit_test_setup_teardown (session_pool_take_stale_test,
+                                         session_pool_setup,
+                                         session_pool_teardown),
+        cmocka_unit_test_setup_teardown (session_pool_take_all_test,
+                                         session_pool_setup,
+                                         session_pool_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "startup-cache.h"
+#include "util.h"
+
+typedef struct {
+    gchar *filename;
+    StartupCache *cache;
+    TPMS_CAPABILITY_DATA properties_fixed;
+    TPMS_CAPABILITY_DATA commands;
+} test_data_t;
+
+static int
+startup_cache_setup (void **state)
+{
+    test_data_t *data;
+    gint fd;
+
+    data = calloc (1, sizeof (test_data_t));
+    assert_non_null (data);
+    fd = g_file_open_tmp ("startup-cache_unit-XXXXXX", &data->filename, NULL);
+    assert_true (fd != -1);
+    close (fd);
+    data->cache = startup_cache_new (data->filename);
+
+    data->properties_fixed.capability = TPM2_CAP_TPM_PROPERTIES;
+    data->properties_fixed.data.tpmProperties.count = 3;
+    data->properties_fixed.data.tpmProperties.tpmProperty [0].property =
+        TPM2_PT_MANUFACTURER;
+    data->properties_fixed.data.tpmProperties.tpmProperty [0].value =
+        0x494e5443;
+    data->properties_fixed.data.tpmProperties.tpmProperty [1].property =
+        TPM2_PT_FIRMWARE_VERSION_1;
+    data->properties_fixed.data.tpmProperties.tpmProperty [1].value =
+        0x00020000;
+    data->properties_fixed.data.tpmProperties.tpmProperty [2].property =
+        TPM2_PT_MAX_COMMAND_SIZE;
+    data->properties_fixed.data.tpmProperties.tpmProperty [2].value = 4096;
+    data->commands.capability = TPM2_CAP_COMMANDS;
+    data->commands.data.command.count = 2;
+    data->commands.data.command.commandAttributes [0] =
+        TPM2_CC_HierarchyControl + 0xff0000;
+    data->commands.data.command.commandAttributes [1] =
+        TPM2_CC_ChangePPS + 0xff0000;
+
+    *state = data;
+    return 0;
+}
+static int
+startup_cache_teardown (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    g_object_unref (data->cache);
+    g_unlink (data->filename);
+    g_free (data->filename);
+    free (data);
+    return 0;
+}
+/*
+ * Data saved to the cache file must be identical to what we load back
+ * from it with a new StartupCache object.
+ */
+static void
+startup_cache_save_load_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    StartupCache *cache;
+
+    startup_cache_set (data->cache, &data->properties_fixed, &data->commands);
+    assert_int_equal (startup_cache_save (data->cache), 0);
+
+    cache = startup_cache_new (data->filename);
+    assert_int_equal (startup_cache_load (cache), 0);
+    assert_true (cache->loaded);
+    assert_true (startup_cache_equal (cache,
+                                      &data->properties_fixed,
+                                      &data->commands));
+    g_object_unref (cache);
+}
+/*
+ * A missing cache file is reported as ENOENT and leaves the cache empty.
+ */
+static void
+startup_cache_load_missing_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    g_unlink (data->filename);
+    assert_int_equal (startup_cache_load (data->cache), ENOENT);
+    assert_false (data->cache->loaded);
+}
+/*
+ * A file that doesn't start with the magic value is rejected.
+ */
+static void
+startup_cache_load_bad_magic_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    const gchar junk [] = "not a startup cache file";
+
+    assert_true (g_file_set_contents (data->filename, junk, sizeof (junk),
+                                      NULL));
+    assert_int_equal (startup_cache_load (data->cache), EPROTO);
+    assert_false (data->cache->loaded);
+}
+/*
+ * A truncated cache file is rejected.
+ */
+static void
+startup_cache_load_truncated_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    gchar *contents = NULL;
+    gsize length = 0;
+
+    startup_cache_set (data->cache, &data->properties_fixed, &data->commands);
+    assert_int_equal (startup_cache_save (data->cache), 0);
+    assert_true (g_file_get_contents (data->filename, &contents, &length,
+                                      NULL));
+    assert_true (g_file_set_contents (data->filename, contents,
+                                      (gssize)length - 1, NULL));
+    g_free (contents);
+
+    assert_int_equal (startup_cache_load (data->cache), EPROTO);
+    assert_false (data->cache->loaded);
+}
+/*
+ * A change to any of the command attributes makes the cache unequal.
+ */
+static void
+startup_cache_not_equal_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    TPMS_CAPABILITY_DATA commands = data->commands;
+
+    startup_cache_set (data->cache, &data->properties_fixed, &data->commands);
+    commands.data.command.commandAttributes [1] ^= 0x01000000;
+    assert_false (startup_cache_equal (data->cache,
+                                       &data->properties_fixed,
+                                       &commands));
+}
+gint
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (startup_cache_save_load_test,
+                                         startup_cache_setup,
+                                         startup_cache_teardown),
+        cmocka_unit_test_setup_teardown (startup_cache_load_missing_test,
+                                         startup_cache_setup,
+                                         startup_cache_teardown),
+        cmocka_unit_test_setup_teardown (startup_cache_load_bad_magic_test,
+                                         startup_cache_setup,
+                                         startup_cache_teardown),
+        cmocka_unit_test_setup_teardown (startup_cache_load_truncated_test,
+                                         startup_cache_setup,
+                                         startup_cache_teardown),
+        cmocka_unit_test_setup_teardown (startup_cache_not_equal_test,
+                                         startup_cache_setup,
+                                         startup_cache_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
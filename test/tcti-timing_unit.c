@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tss2-tcti-echo.h"
+#include "tss2-tcti-timing.h"
+#include "tcti-timing-priv.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+#define TIMING_UNIT_CC TPM2_CC_GetRandom
+
+typedef struct {
+    TSS2_TCTI_CONTEXT *context;
+    FILE *log;
+} test_data_t;
+/*
+ * Setup function: wrap an instance of the echo TCTI in the timing TCTI.
+ * The log is an anonymous temp file that we can read back in the tests.
+ */
+static int
+tcti_timing_setup (void **state)
+{
+    test_data_t *data;
+    TSS2_TCTI_CONTEXT *child;
+    size_t size = 0;
+    TSS2_RC rc;
+    timing_conf_t timing_conf = TIMING_CONF_INIT_DEFAULT;
+
+    data = calloc (1, sizeof (test_data_t));
+    rc = tss2_tcti_echo_init (NULL, &size, TSS2_TCTI_ECHO_MIN_BUF);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    child = g_malloc0 (size);
+    rc = tss2_tcti_echo_init (child, &size, TSS2_TCTI_ECHO_MIN_BUF);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    data->log = tmpfile ();
+    assert_non_null (data->log);
+    data->context = g_malloc0 (sizeof (TSS2_TCTI_TIMING_CONTEXT));
+    tcti_timing_init_context (data->context, child, NULL, data->log, &timing_conf);
+
+    *state = data;
+    return 0;
+}
+static int
+tcti_timing_teardown (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    /* the timing context owns and closes the log */
+    Tss2_Tcti_Finalize (data->context);
+    g_free (data->context);
+    free (data);
+    return 0;
+}
+/*
+ * Parse a conf string with all keys. The conf string for the wrapped TCTI
+ * contains ',' and '=' characters that must not be consumed by the timing
+ * TCTI.
+ */
+static void
+tcti_timing_conf_parse_all_test (void **state)
+{
+    char conf [] = "log=/tmp/foo.csv,latency=100,jitter=20," \
+        "tcti=mssim:host=localhost,port=2321";
+    timing_conf_t timing_conf = TIMING_CONF_INIT_DEFAULT;
+    TSS2_RC rc;
+
+    UNUSED_PARAM (state);
+    rc = tcti_timing_conf_parse (conf, &timing_conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_string_equal (timing_conf.log, "/tmp/foo.csv");
+    assert_int_equal (timing_conf.latency_us, 100);
+    assert_int_equal (timing_conf.jitter_us, 20);
+    assert_string_equal (timing_conf.tcti_name, "mssim");
+    assert_string_equal (timing_conf.tcti_conf, "host=localhost,port=2321");
+}
+static void
+tcti_timing_conf_parse_tcti_only_test (void **state)
+{
+    char conf [] = "tcti=device";
+    timing_conf_t timing_conf = TIMING_CONF_INIT_DEFAULT;
+    TSS2_RC rc;
+
+    UNUSED_PARAM (state);
+    rc = tcti_timing_conf_parse (conf, &timing_conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_null (timing_conf.log);
+    assert_string_equal (timing_conf.tcti_name, "device");
+    assert_null (timing_conf.tcti_conf);
+}
+static void
+tcti_timing_conf_parse_bad_key_test (void **state)
+{
+    char conf [] = "foo=bar,tcti=device";
+    timing_conf_t timing_conf = TIMING_CONF_INIT_DEFAULT;
+    TSS2_RC rc;
+
+    UNUSED_PARAM (state);
+    rc = tcti_timing_conf_parse (conf, &timing_conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+}
+static void
+tcti_timing_conf_parse_bad_delay_test (void **state)
+{
+    char conf [] = "latency=12ab,tcti=device";
+    timing_conf_t timing_conf = TIMING_CONF_INIT_DEFAULT;
+    TSS2_RC rc;
+
+    UNUSED_PARAM (state);
+    rc = tcti_timing_conf_parse (conf, &timing_conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+}
+static void
+tcti_timing_conf_parse_empty_name_test (void **state)
+{
+    char conf [] = "log=foo,tcti=:conf";
+    timing_conf_t timing_conf = TIMING_CONF_INIT_DEFAULT;
+    TSS2_RC rc;
+
+    UNUSED_PARAM (state);
+    rc = tcti_timing_conf_parse (conf, &timing_conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+}
+static void
+tcti_timing_init_size_test (void **state)
+{
+    size_t size = 0;
+    TSS2_RC rc;
+
+    UNUSED_PARAM (state);
+    rc = Tss2_Tcti_Timing_Init (NULL, &size, NULL);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (size, sizeof (TSS2_TCTI_TIMING_CONTEXT));
+}
+static void
+tcti_timing_init_no_tcti_test (void **state)
+{
+    TSS2_TCTI_TIMING_CONTEXT context = { 0 };
+    size_t size = sizeof (context);
+    TSS2_RC rc;
+
+    UNUSED_PARAM (state);
+    rc = Tss2_Tcti_Timing_Init ((TSS2_TCTI_CONTEXT*)&context,
+                                &size,
+                                "latency=10");
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+}
+/*
+ * Send a command through the timing TCTI to the echo TCTI. We should get
+ * the command back unmodified and there should be one record in the log.
+ */
+static void
+tcti_timing_transmit_receive_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    uint8_t command [TPM_HEADER_SIZE] = { 0 };
+    uint8_t response [TPM_HEADER_SIZE] = { 0 };
+    char line [UTIL_BUF_SIZE];
+    guint64 sequence;
+    unsigned int cc, rc_logged;
+    size_t size = sizeof (response);
+    TSS2_RC rc;
+
+    tpm2_header_init (command,
+                      sizeof (command),
+                      TPM2_ST_NO_SESSIONS,
+                      TPM_HEADER_SIZE,
+                      TIMING_UNIT_CC);
+    rc = Tss2_Tcti_Transmit (data->context, sizeof (command), command);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    rc = Tss2_Tcti_Receive (data->context,
+                            &size,
+                            response,
+                            TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (size, sizeof (command));
+    assert_memory_equal (command, response, sizeof (command));
+
+    rewind (data->log);
+    assert_non_null (fgets (line, sizeof (line), data->log));
+    assert_int_equal (sscanf (line, "%" G_GUINT64_FORMAT ",0x%x,%*u,0x%x",
+                              &sequence, &cc, &rc_logged), 3);
+    assert_int_equal (sequence, 0);
+    assert_int_equal (cc, TIMING_UNIT_CC);
+    /* the echo TCTI sends back the command code in the RC field */
+    assert_int_equal (rc_logged, TIMING_UNIT_CC);
+    assert_null (fgets (line, sizeof (line), data->log));
+}
+/*
+ * A receive that fails (here: sent before any transmit) must not produce
+ * a record in the log.
+ */
+static void
+tcti_timing_receive_bad_sequence_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    uint8_t response [TPM_HEADER_SIZE] = { 0 };
+    char line [UTIL_BUF_SIZE];
+    size_t size = sizeof (response);
+    TSS2_RC rc;
+
+    rc = Tss2_Tcti_Receive (data->context,
+                            &size,
+                            response,
+                            TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_SEQUENCE);
+    fflush (data->log);
+    rewind (data->log);
+    assert_null (fgets (line, sizeof (line), data->log));
+}
+/*
+ * Calls on a context that has already been finalized must fail cleanly.
+ */
+static void
+tcti_timing_finalized_context_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    uint8_t command [TPM_HEADER_SIZE] = { 0 };
+    TSS2_RC rc;
+
+    Tss2_Tcti_Finalize (data->context);
+    rc = Tss2_Tcti_Transmit (data->context, sizeof (command), command);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_CONTEXT);
+}
+int
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test (tcti_timing_conf_parse_all_test),
+        cmocka_unit_test (tcti_timing_conf_parse_tcti_only_test),
+        cmocka_unit_test (tcti_timing_conf_parse_bad_key_test),
+        cmocka_unit_test (tcti_timing_conf_parse_bad_delay_test),
+        cmocka_unit_test (tcti_timing_conf_parse_empty_name_test),
+        cmocka_unit_test (tcti_timing_init_size_test),
+        cmocka_unit_test (tcti_timing_init_no_tcti_test),
+        cmocka_unit_test_setup_teardown (tcti_timing_transmit_receive_test,
+                                         tcti_timing_setup,
+                                         tcti_timing_teardown),
+        cmocka_unit_test_setup_teardown (tcti_timing_receive_bad_sequence_test,
+                                         tcti_timing_setup,
+                                         tcti_timing_teardown),
+        cmocka_unit_test_setup_teardown (tcti_timing_finalized_context_test,
+                                         tcti_timing_setup,
+                                         tcti_timing_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
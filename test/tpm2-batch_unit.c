@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <glib.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tabrmd.h"
+#include "tpm2-batch.h"
+#include "tpm2-header.h"
+#include "tss2-tcti-tabrmd.h"
+#include "util.h"
+
+/* batch frame holding two GetRandom commands */
+static uint8_t batch_buf [] = {
+    0xba, 0x7c, /* TABRMD_BATCH_TAG */
+    0x00, 0x00, 0x00, 0x22, /* frame size: 34 bytes */
+    0x00, 0x00, 0x00, 0x01, /* flags: STOP_ON_ERROR */
+    0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b,
+    0x00, 0x08,
+    0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b,
+    0x00, 0x10,
+};
+/* response to GetRandom with no random bytes */
+static uint8_t rsp_buf [] = {
+    0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00,
+};
+
+typedef struct {
+    Connection *connection;
+    Tpm2Batch  *batch;
+} test_data_t;
+
+/*
+ * Mock for the CommandAttrs lookup, the attributes don't matter here.
+ */
+TPMA_CC
+__wrap_command_attrs_from_cc (CommandAttrs *attrs,
+                              TPM2_CC       command_code)
+{
+    UNUSED_PARAM (attrs);
+    UNUSED_PARAM (command_code);
+    return 0;
+}
+static int
+tpm2_batch_setup (void **state)
+{
+    test_data_t *data;
+    gint client_fd;
+    GIOStream *iostream;
+    HandleMap *handle_map;
+
+    data = calloc (1, sizeof (test_data_t));
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    data->connection = connection_new (iostream, 0, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    *state = data;
+    return 0;
+}
+static int
+tpm2_batch_teardown (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    g_clear_object (&data->batch);
+    g_clear_object (&data->connection);
+    free (data);
+    return 0;
+}
+/*
+ * Parse a well formed batch frame: we get both commands in order and the
+ * flags from the header.
+ */
+static void
+tpm2_batch_from_buffer_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Command *command;
+    Connection *connection;
+
+    data->batch = tpm2_batch_new_from_buffer (data->connection,
+                                              NULL,
+                                              batch_buf,
+                                              sizeof (batch_buf));
+    assert_non_null (data->batch);
+    assert_int_equal (tpm2_batch_get_command_count (data->batch), 2);
+    assert_int_equal (tpm2_batch_get_flags (data->batch),
+                      TSS2_TCTI_TABRMD_BATCH_STOP_ON_ERROR);
+    command = tpm2_batch_get_command (data->batch, 1);
+    assert_non_null (command);
+    assert_int_equal (tpm2_command_get_code (command), TPM2_CC_GetRandom);
+    assert_memory_equal (tpm2_command_get_buffer (command),
+                         &batch_buf [TPM_HEADER_SIZE + 12],
+                         12);
+    connection = tpm2_command_get_connection (command);
+    assert_ptr_equal (connection, data->connection);
+    g_object_unref (connection);
+    assert_null (tpm2_batch_get_command (data->batch, 2));
+}
+/*
+ * A frame whose last command is cut short is rejected.
+ */
+static void
+tpm2_batch_from_buffer_truncated_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    uint8_t buf [sizeof (batch_buf) - 2];
+
+    memcpy (buf, batch_buf, sizeof (buf));
+    set_response_size (buf, sizeof (buf));
+    data->batch = tpm2_batch_new_from_buffer (data->connection,
+                                              NULL,
+                                              buf,
+                                              sizeof (buf));
+    assert_null (data->batch);
+}
+/*
+ * A frame with just the header holds no commands and is rejected.
+ */
+static void
+tpm2_batch_from_buffer_empty_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    uint8_t buf [TPM_HEADER_SIZE];
+
+    memcpy (buf, batch_buf, sizeof (buf));
+    set_response_size (buf, sizeof (buf));
+    data->batch = tpm2_batch_new_from_buffer (data->connection,
+                                              NULL,
+                                              buf,
+                                              sizeof (buf));
+    assert_null (data->batch);
+}
+/*
+ * The response frame holds the header with the response count followed
+ * by the responses in the order they were added.
+ */
+static void
+tpm2_batch_response_buffer_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    Tpm2Response *response;
+    guint8 *buf;
+    size_t size = 0;
+
+    data->batch = tpm2_batch_new (data->connection, 0);
+    response = tpm2_response_new (data->connection,
+                                  g_memdup (rsp_buf, sizeof (rsp_buf)),
+                                  sizeof (rsp_buf),
+                                  0);
+    tpm2_batch_add_response (data->batch, response);
+    g_object_unref (response);
+    response = tpm2_response_new_rc (data->connection, TPM2_RC_FAILURE);
+    tpm2_batch_add_response (data->batch, response);
+    g_object_unref (response);
+
+    buf = tpm2_batch_get_response_buffer (data->batch, &size);
+    assert_int_equal (size, TPM_HEADER_SIZE + sizeof (rsp_buf) +
+                      TPM_HEADER_SIZE);
+    assert_int_equal (get_response_tag (buf), TABRMD_BATCH_TAG);
+    assert_int_equal (get_response_size (buf), size);
+    assert_int_equal (get_response_code (buf), 2);
+    assert_memory_equal (&buf [TPM_HEADER_SIZE], rsp_buf, sizeof (rsp_buf));
+    assert_int_equal (get_response_code (&buf [TPM_HEADER_SIZE +
+                                                sizeof (rsp_buf)]),
+                      TPM2_RC_FAILURE);
+    g_free (buf);
+}
+gint
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (tpm2_batch_from_buffer_test,
+                                         tpm2_batch_setup,
+                                         tpm2_batch_teardown),
+        cmocka_unit_test_setup_teardown (tpm2_batch_from_buffer_truncated_test,
+                                         tpm2_batch_setup,
+                                         tpm2_batch_teardown),
+        cmocka_unit_test_setup_teardown (tpm2_batch_from_buffer_empty_test,
+                                         tpm2_batch_setup,
+                                         tpm2_batch_teardown),
+        cmocka_unit_test_setup_teardown (tpm2_batch_response_buffer_test,
+                                         tpm2_batch_setup,
+                                         tpm2_batch_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
@@ -31,6 +31,8 @@
 #include <setjmp.h>
 #include <cmocka.h>
 
+#include <tss2/tss2_mu.h>
+
 #include "tpm2-header.h"
 #include "tpm2-response.h"
 #include "util.h"
@@ -429,10 +431,54 @@ tpm2_response_set_handle_no_handle_test (void **state)
 
     assert_int_equal (handle_out, 0);
 }
+/*
+ * A TPM2_ContextSave response built from the context held in a
+ * HandleMapEntry has the marshalled context as its body.
+ */
+static void
+tpm2_response_new_context_save_transient_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    HandleMapEntry *entry;
+    TPMS_CONTEXT context_in = {
+        .sequence = 0x10,
+        .savedHandle = 0x80000000,
+        .hierarchy = TPM2_RH_OWNER,
+        .contextBlob = {
+            .size = 4,
+            .buffer = { 0xde, 0xad, 0xbe, 0xef },
+        },
+    }, context_out = { 0, };
+    size_t offset = TPM_HEADER_SIZE;
+    TSS2_RC rc;
+
+    entry = handle_map_entry_new (0, TPM2_HR_TRANSIENT + 0x1);
+    assert_null (tpm2_response_new_context_save_transient (data->connection,
+                                                           entry));
+    handle_map_entry_set_context (entry, &context_in);
+    data->response = tpm2_response_new_context_save_transient (data->connection,
+                                                               entry);
+    assert_non_null (data->response);
+    assert_int_equal (tpm2_response_get_code (data->response), TSS2_RC_SUCCESS);
+    assert_int_equal (tpm2_response_get_size (data->response),
+                      TPM_HEADER_SIZE + entry->context.size);
+    rc = Tss2_MU_TPMS_CONTEXT_Unmarshal (tpm2_response_get_buffer (data->response),
+                                         tpm2_response_get_size (data->response),
+                                         &offset,
+                                         &context_out);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (context_out.savedHandle, context_in.savedHandle);
+    assert_int_equal (context_out.contextBlob.size, context_in.contextBlob.size);
+    g_object_unref (entry);
+    free (data->buffer);
+}
 gint
 main (void)
 {
     const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (tpm2_response_new_context_save_transient_test,
+                                         tpm2_response_setup_base,
+                                         tpm2_response_teardown),
         cmocka_unit_test_setup_teardown (tpm2_response_type_test,
                                          tpm2_response_setup,
                                          tpm2_response_teardown),
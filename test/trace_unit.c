@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2018, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2-header.h"
+#include "trace.h"
+#include "util.h"
+
+#define CONNECTION_ID 0xdeadbeefcafebabe
+
+typedef struct {
+    gchar *filename;
+    Trace *trace;
+    guint8 command [TPM_HEADER_SIZE];
+    guint8 response [TPM_HEADER_SIZE];
+} test_data_t;
+
+static int
+trace_setup (void **state)
+{
+    test_data_t *data;
+    gint fd;
+
+    data = calloc (1, sizeof (test_data_t));
+    assert_non_null (data);
+    fd = g_file_open_tmp ("trace_unit-XXXXXX", &data->filename, NULL);
+    assert_true (fd != -1);
+    close (fd);
+    tpm2_header_init (data->command,
+                      sizeof (data->command),
+                      TPM2_ST_NO_SESSIONS,
+                      sizeof (data->command),
+                      TPM2_CC_GetRandom);
+    tpm2_header_init (data->response,
+                      sizeof (data->response),
+                      TPM2_ST_NO_SESSIONS,
+                      sizeof (data->response),
+                      TPM2_RC_SUCCESS);
+    data->trace = trace_new (data->filename);
+    *state = data;
+    return 0;
+}
+static int
+trace_teardown (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    g_clear_object (&data->trace);
+    g_unlink (data->filename);
+    g_free (data->filename);
+    free (data);
+    return 0;
+}
+static void
+trace_type_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    assert_true (IS_TRACE (data->trace));
+}
+/*
+ * Writing a record to a Trace that hasn't been opened must fail without
+ * touching the file.
+ */
+static void
+trace_write_record_not_open_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    gint ret;
+
+    ret = trace_write_record (data->trace,
+                              TRACE_RECORD_COMMAND,
+                              CONNECTION_ID,
+                              data->command,
+                              sizeof (data->command));
+    assert_int_equal (ret, EINVAL);
+}
+/*
+ * Write a command and a response record, close the trace then read both
+ * records back and check they match what we wrote.
+ */
+static void
+trace_write_read_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    trace_record_t record = { 0 };
+    FILE *file;
+    guint64 start_time = 0, timestamp;
+    gint ret;
+
+    assert_int_equal (trace_open (data->trace), 0);
+    ret = trace_write_record (data->trace,
+                              TRACE_RECORD_COMMAND,
+                              CONNECTION_ID,
+                              data->command,
+                              sizeof (data->command));
+    assert_int_equal (ret, 0);
+    ret = trace_write_record (data->trace,
+                              TRACE_RECORD_RESPONSE,
+                              CONNECTION_ID,
+                              data->response,
+                              sizeof (data->response));
+    assert_int_equal (ret, 0);
+    g_clear_object (&data->trace);
+
+    file = fopen (data->filename, "r");
+    assert_non_null (file);
+    assert_int_equal (trace_read_header (file, &start_time), 0);
+    assert_true (start_time > 0);
+
+    assert_int_equal (trace_read_record (file, &record), 0);
+    assert_int_equal (record.type, TRACE_RECORD_COMMAND);
+    assert_true (record.connection_id == CONNECTION_ID);
+    assert_int_equal (record.size, sizeof (data->command));
+    assert_memory_equal (record.buf, data->command, sizeof (data->command));
+    timestamp = record.timestamp;
+    trace_record_clear (&record);
+
+    assert_int_equal (trace_read_record (file, &record), 0);
+    assert_int_equal (record.type, TRACE_RECORD_RESPONSE);
+    assert_true (record.timestamp >= timestamp);
+    assert_memory_equal (record.buf, data->response, sizeof (data->response));
+    trace_record_clear (&record);
+
+    assert_int_equal (trace_read_record (file, &record), -1);
+    fclose (file);
+}
+/*
+ * A record must be readable from the file as soon as it's written, before
+ * the trace is finalized: a daemon that's killed never gets that far.
+ */
+static void
+trace_write_flushed_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    trace_record_t record = { 0 };
+    FILE *file;
+    gint ret;
+
+    assert_int_equal (trace_open (data->trace), 0);
+    ret = trace_write_record (data->trace,
+                              TRACE_RECORD_COMMAND,
+                              CONNECTION_ID,
+                              data->command,
+                              sizeof (data->command));
+    assert_int_equal (ret, 0);
+
+    file = fopen (data->filename, "r");
+    assert_non_null (file);
+    assert_int_equal (trace_read_header (file, NULL), 0);
+    assert_int_equal (trace_read_record (file, &record), 0);
+    assert_int_equal (record.size, sizeof (data->command));
+    assert_memory_equal (record.buf, data->command, sizeof (data->command));
+    trace_record_clear (&record);
+    fclose (file);
+}
+/*
+ * A file that doesn't start with the trace magic is rejected.
+ */
+static void
+trace_read_header_bad_magic_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    guint8 junk [TRACE_HEADER_SIZE] = { 0 };
+    FILE *file;
+
+    file = fopen (data->filename, "w+");
+    assert_non_null (file);
+    assert_int_equal (fwrite (junk, sizeof (junk), 1, file), 1);
+    rewind (file);
+    assert_int_equal (trace_read_header (file, NULL), EPROTO);
+    fclose (file);
+}
+gint
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (trace_type_test,
+                                         trace_setup,
+                                         trace_teardown),
+        cmocka_unit_test_setup_teardown (trace_write_record_not_open_test,
+                                         trace_setup,
+                                         trace_teardown),
+        cmocka_unit_test_setup_teardown (trace_write_read_test,
+                                         trace_setup,
+                                         trace_teardown),
+        cmocka_unit_test_setup_teardown (trace_write_flushed_test,
+                                         trace_setup,
+                                         trace_teardown),
+        cmocka_unit_test_setup_teardown (trace_read_header_bad_magic_test,
+                                         trace_setup,
+                                         trace_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
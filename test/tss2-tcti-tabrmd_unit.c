@@ -27,11 +27,13 @@
 #include <errno.h>
 #include <gio/gunixfdlist.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
@@ -202,6 +204,119 @@ tcti_tabrmd_kv_callback_type_bad_test (void **state)
     assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
     assert_int_equal (conf.bus_type, G_BUS_TYPE_NONE);
 }
+/*
+ * Ensure that when we pass the key "pipeline_depth" with a value in range
+ * that it returns success and sets the 'pipeline_depth' field.
+ */
+static void
+tcti_tabrmd_kv_callback_depth_good_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "pipeline_depth",
+        .value = "4",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (conf.pipeline_depth, 4);
+}
+/*
+ * Ensure that a "pipeline_depth" value of 0, one past the maximum or one
+ * that isn't a number is rejected with BAD_VALUE.
+ */
+static void
+tcti_tabrmd_kv_callback_depth_bad_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "pipeline_depth",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    key_value.value = "0";
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+    key_value.value = "65";
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+    key_value.value = "2x";
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+    assert_int_equal (conf.pipeline_depth, 1);
+}
+/*
+ * Ensure that the "socket" key sets the 'socket_path' field.
+ */
+static void
+tcti_tabrmd_kv_callback_socket_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "socket",
+        .value = "/run/tpm2-abrmd/tabrmd.sock",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    assert_null (conf.socket_path);
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_string_equal (conf.socket_path, "/run/tpm2-abrmd/tabrmd.sock");
+}
+/*
+ * Ensure that the "mode" key selects async mode for the value "async",
+ * blocking mode for "blocking" and rejects anything else with BAD_VALUE.
+ */
+static void
+tcti_tabrmd_kv_callback_mode_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "mode",
+        .value = "async",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    assert_false (conf.async);
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_true (conf.async);
+    key_value.value = "blocking";
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_false (conf.async);
+    key_value.value = "foo";
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+}
+static void
+tcti_tabrmd_kv_callback_transport_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "transport",
+        .value = "seqpacket",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    assert_false (conf.seqpacket);
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_true (conf.seqpacket);
+    key_value.value = "stream";
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_false (conf.seqpacket);
+    key_value.value = "datagram";
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+}
 /*
  * Ensure that when we pass an invalid key (not 'bus_type' or 'bus_name')
  * that it returns an RC indicating BAD_VALUE.
@@ -429,12 +544,14 @@ typedef struct {
     TSS2_TCTI_CONTEXT  *context;
 } data_t;
 /*
- * This is the setup function used to create the TCTI context structure for
- * tests that require the initialization be done before the test can be
- * executed. It *must* be paired with a call to the teardown function.
+ * Initialize a TCTI context with the given conf string. The dbus mock hands
+ * the TCTI one end of a socket pair of the given type, the test gets the
+ * other.
  */
 static int
-tcti_tabrmd_setup (void **state)
+tcti_tabrmd_setup_type (void      **state,
+                        int         type,
+                        const char *conf)
 {
     data_t *data;
     TSS2_RC ret = TSS2_RC_SUCCESS;
@@ -456,19 +573,29 @@ tcti_tabrmd_setup (void **state)
         return 1;
     }
     g_debug ("preparing g_dbus_proxy_call_with_unix_fd_list_sync mock wrapper");
-    assert_int_equal (socketpair (PF_LOCAL, SOCK_STREAM, 0, fds), 0);
+    assert_int_equal (socketpair (PF_LOCAL, type, 0, fds), 0);
     data->client_fd = fds [0];
     data->server_fd = fds [1];
     will_return (__wrap_g_dbus_proxy_call_with_unix_fd_list_sync,
                  data->client_fd);
     data->id = id;
     will_return (__wrap_g_dbus_proxy_call_with_unix_fd_list_sync, id);
-    ret = Tss2_Tcti_Tabrmd_Init (data->context, &tcti_size, "bus_type=session");
+    ret = Tss2_Tcti_Tabrmd_Init (data->context, &tcti_size, conf);
     assert_int_equal (ret, TSS2_RC_SUCCESS);
 
     *state = data;
     return 0;
 }
+/*
+ * This is the setup function used to create the TCTI context structure for
+ * tests that require the initialization be done before the test can be
+ * executed. It *must* be paired with a call to the teardown function.
+ */
+static int
+tcti_tabrmd_setup (void **state)
+{
+    return tcti_tabrmd_setup_type (state, SOCK_STREAM, "bus_type=session");
+}
 /*
  * This is a teardown function to deallocate / cleanup all resources
  * associated with these tests.
@@ -523,6 +650,80 @@ tcti_tabrmd_init_success_test (void **state)
     assert_int_equal (data->id, TSS2_TCTI_TABRMD_ID (data->context));
     tcti_tabrmd_teardown (state);
 }
+/*
+ * Initialize a context with the "socket" key. The TCTI connects to a
+ * listening socket (the kernel completes the connection without an
+ * accept) and reads the connection ID from it. No dbus proxy is created
+ * so setLocality isn't available.
+ */
+static void
+tcti_tabrmd_init_socket_test (void **state)
+{
+    TSS2_TCTI_CONTEXT *context;
+    struct sockaddr_un address = { .sun_family = AF_UNIX, };
+    guint64 id = 0x1122334455667788;
+    gchar *dir, *path, *conf;
+    size_t size = 0;
+    TSS2_RC rc;
+    gint fd;
+    UNUSED_PARAM(state);
+
+    dir = g_dir_make_tmp ("tss2-tcti-tabrmd_unit-XXXXXX", NULL);
+    assert_non_null (dir);
+    path = g_build_filename (dir, "tabrmd.sock", NULL);
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    assert_true (fd >= 0);
+    g_strlcpy (address.sun_path, path, sizeof (address.sun_path));
+    assert_int_equal (bind (fd, (struct sockaddr*)&address, sizeof (address)),
+                      0);
+    assert_int_equal (listen (fd, 1), 0);
+
+    rc = Tss2_Tcti_Tabrmd_Init (NULL, &size, NULL);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    context = calloc (1, size);
+    assert_non_null (context);
+    will_return (__wrap_read_data, &id);
+    will_return (__wrap_read_data, sizeof (id));
+    will_return (__wrap_read_data, 0);
+    conf = g_strdup_printf ("socket=%s", path);
+    rc = Tss2_Tcti_Tabrmd_Init (context, &size, conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (TSS2_TCTI_TABRMD_ID (context), id);
+    assert_null (TSS2_TCTI_TABRMD_PROXY (context));
+    rc = Tss2_Tcti_SetLocality (context, 1);
+    assert_int_equal (rc, TSS2_TCTI_RC_NOT_IMPLEMENTED);
+
+    Tss2_Tcti_Finalize (context);
+    free (context);
+    g_free (conf);
+    close (fd);
+    unlink (path);
+    g_rmdir (dir);
+    g_free (path);
+    g_free (dir);
+}
+/*
+ * Initializing a context with a "socket" key naming a socket that doesn't
+ * exist produces NO_CONNECTION.
+ */
+static void
+tcti_tabrmd_init_socket_missing_test (void **state)
+{
+    TSS2_TCTI_CONTEXT *context;
+    size_t size = 0;
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    rc = Tss2_Tcti_Tabrmd_Init (NULL, &size, NULL);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    context = calloc (1, size);
+    assert_non_null (context);
+    rc = Tss2_Tcti_Tabrmd_Init (context,
+                                &size,
+                                "socket=/nonexistent/tabrmd.sock");
+    assert_int_equal (rc, TSS2_TCTI_RC_NO_CONNECTION);
+    free (context);
+}
 /*
  * These are a series of tests to ensure that the exposed TCTI functions
  * return the appropriate RC when passed NULL contexts.
@@ -609,6 +810,39 @@ tcti_tabrmd_transmit_success_test (void **state)
                       TABRMD_STATE_RECEIVE);
     assert_memory_equal (command_in, command_out, size);
 }
+/*
+ * With a pipeline depth of 2 the caller may transmit a second command
+ * before receiving the first response. A third transmit must wait for a
+ * response and produces BAD_SEQUENCE.
+ */
+static void
+tcti_tabrmd_transmit_pipelined_test (void **state)
+{
+    data_t *data = *state;
+    uint8_t command_in [] = { 0x80, 0x02,
+                              0x00, 0x00, 0x00, 0x0c,
+                              0x00, 0x00, 0x00, 0x00,
+                              0x01, 0x02};
+    size_t size = sizeof (command_in);
+    uint8_t command_out [sizeof (command_in) * 2] = { 0 };
+    TSS2_RC rc;
+    ssize_t ret;
+
+    TSS2_TCTI_TABRMD_PIPELINE_DEPTH (data->context) = 2;
+    rc = Tss2_Tcti_Transmit (data->context, size, command_in);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    rc = Tss2_Tcti_Transmit (data->context, size, command_in);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    rc = Tss2_Tcti_Transmit (data->context, size, command_in);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_SEQUENCE);
+    assert_int_equal (TSS2_TCTI_TABRMD_OUTSTANDING (data->context), 2);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_RECEIVE);
+    ret = read (data->server_fd, command_out, sizeof (command_out));
+    assert_int_equal (ret, sizeof (command_out));
+    assert_memory_equal (command_in, command_out, size);
+    assert_memory_equal (command_in, &command_out [size], size);
+}
 /*
  * This test ensures that the magic value in the context structure is checked
  * before the transmit function executes and that the RC is what we expect.
@@ -696,6 +930,22 @@ tcti_tabrmd_receive_setup (void **state)
     TSS2_TCTI_TABRMD_STATE (data->context) = TABRMD_STATE_RECEIVE;
     return 0;
 }
+/*
+ * Same as tcti_tabrmd_receive_setup but the TCTI asks for and gets a
+ * SOCK_SEQPACKET socket.
+ */
+static int
+tcti_tabrmd_seqpacket_receive_setup (void **state)
+{
+    data_t *data = NULL;
+
+    tcti_tabrmd_setup_type (state,
+                            SOCK_SEQPACKET,
+                            "bus_type=session,transport=seqpacket");
+    data = *state;
+    TSS2_TCTI_TABRMD_STATE (data->context) = TABRMD_STATE_RECEIVE;
+    return 0;
+}
 /*
  * This is a mock function for 'read_data' from the util module. It expects:
  *   buf_in  : Input buffer to read from, this is how we simulate input data.
@@ -791,6 +1041,44 @@ tcti_tabrmd_receive_success_test (void **state)
     assert_int_equal (size, sizeof (command_in));
     assert_memory_equal (command_in, command_out, size);
 }
+/*
+ * With two pipelined commands outstanding, receiving the first response
+ * must leave the state machine in RECEIVE for the second one.
+ */
+static void
+tcti_tabrmd_receive_pipelined_test (void **state)
+{
+    data_t  *data = *state;
+    uint8_t command_in [] = { 0x80, 0x02,
+                              0x00, 0x00, 0x00, 0x0c,
+                              0x00, 0x00, 0x00, 0x00,
+                              0x01, 0x02};
+    size_t size = sizeof (command_in);
+    uint8_t command_out [sizeof (command_in)] = { 0 };
+    TSS2_RC rc;
+
+    TSS2_TCTI_TABRMD_PIPELINE_DEPTH (data->context) = 2;
+    TSS2_TCTI_TABRMD_OUTSTANDING (data->context) = 2;
+    will_return (__wrap_poll, POLLIN);
+    will_return (__wrap_poll, 0);
+    will_return (__wrap_poll, 1);
+    will_return (__wrap_read_data, command_in);
+    will_return (__wrap_read_data, TPM_HEADER_SIZE);
+    will_return (__wrap_read_data, 0);
+
+    will_return (__wrap_read_data, command_in);
+    will_return (__wrap_read_data, sizeof (command_in) - TPM_HEADER_SIZE);
+    will_return (__wrap_read_data, 0);
+    rc = Tss2_Tcti_Receive (data->context,
+                            &size,
+                            command_out,
+                            TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (TSS2_TCTI_TABRMD_OUTSTANDING (data->context), 1);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_RECEIVE);
+    assert_int_equal (size, sizeof (command_in));
+}
 /*
  * This test forces the poll system call to return EINTR indicating that
  * the function was interrupted and should be restarted.
@@ -1288,6 +1576,126 @@ tcti_tabrmd_receive_get_size_and_body_test (void **state)
     assert_memory_equal (buffer_in, buffer_out, sizeof (buffer_in));
     assert_int_equal (size, sizeof (buffer_in));
 }
+/*
+ * Two commands sent through the batch function: they must reach the
+ * daemon end of the socket in a single batch frame with the flags in the
+ * header. The batch response frame returned by the read_data mock is then
+ * split into the responses and their count.
+ */
+static void
+tcti_tabrmd_batch_success_test (void **state)
+{
+    data_t *data = *state;
+    uint8_t commands [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b,
+        0x00, 0x08,
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b,
+        0x00, 0x10,
+    };
+    uint8_t frame_in [] = {
+        0xba, 0x7c, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00, 0x02,
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0b, 0x00, 0x00, 0x00, 0x00,
+        0x01,
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0b, 0x00, 0x00, 0x00, 0x00,
+        0x02,
+    };
+    uint8_t frame_out [TPM_HEADER_SIZE + sizeof (commands)] = { 0 };
+    uint8_t responses [64] = { 0 };
+    size_t responses_size = sizeof (responses), count = 0;
+    ssize_t ret;
+    TSS2_RC rc;
+
+    will_return (__wrap_poll, POLLIN);
+    will_return (__wrap_poll, 0);
+    will_return (__wrap_poll, 1);
+    will_return (__wrap_read_data, frame_in);
+    will_return (__wrap_read_data, TPM_HEADER_SIZE);
+    will_return (__wrap_read_data, 0);
+    will_return (__wrap_poll, POLLIN);
+    will_return (__wrap_poll, 0);
+    will_return (__wrap_poll, 1);
+    will_return (__wrap_read_data, frame_in);
+    will_return (__wrap_read_data, sizeof (frame_in) - TPM_HEADER_SIZE);
+    will_return (__wrap_read_data, 0);
+    rc = Tss2_Tcti_Tabrmd_Batch (data->context,
+                                 commands,
+                                 sizeof (commands),
+                                 responses,
+                                 &responses_size,
+                                 &count,
+                                 TSS2_TCTI_TABRMD_BATCH_STOP_ON_ERROR);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    ret = read (data->server_fd, frame_out, sizeof (frame_out));
+    assert_int_equal (ret, sizeof (frame_out));
+    assert_int_equal (get_command_tag (frame_out), TABRMD_BATCH_TAG);
+    assert_int_equal (get_command_size (frame_out), sizeof (frame_out));
+    assert_int_equal (get_command_code (frame_out),
+                      TSS2_TCTI_TABRMD_BATCH_STOP_ON_ERROR);
+    assert_memory_equal (&frame_out [TPM_HEADER_SIZE],
+                         commands,
+                         sizeof (commands));
+    assert_int_equal (count, 2);
+    assert_int_equal (responses_size, sizeof (frame_in) - TPM_HEADER_SIZE);
+    assert_memory_equal (responses,
+                         &frame_in [TPM_HEADER_SIZE],
+                         responses_size);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_TRANSMIT);
+}
+/*
+ * A command whose size field runs past the end of the batch buffer must
+ * be rejected before anything is sent.
+ */
+static void
+tcti_tabrmd_batch_truncated_command_test (void **state)
+{
+    data_t *data = *state;
+    uint8_t commands [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b,
+        0x00, 0x08,
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b,
+    };
+    uint8_t responses [64] = { 0 };
+    size_t responses_size = sizeof (responses), count = 0;
+    TSS2_RC rc;
+
+    rc = Tss2_Tcti_Tabrmd_Batch (data->context,
+                                 commands,
+                                 sizeof (commands),
+                                 responses,
+                                 &responses_size,
+                                 &count,
+                                 0);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+    assert_int_equal (count, 0);
+}
+/*
+ * A batch can't be sent while a single command is waiting for its
+ * response.
+ */
+static void
+tcti_tabrmd_batch_bad_sequence_test (void **state)
+{
+    data_t *data = *state;
+    uint8_t commands [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b,
+        0x00, 0x08,
+    };
+    uint8_t responses [64] = { 0 };
+    size_t responses_size = sizeof (responses), count = 0;
+    TSS2_RC rc;
+
+    rc = Tss2_Tcti_Tabrmd_Batch (data->context,
+                                 commands,
+                                 sizeof (commands),
+                                 responses,
+                                 &responses_size,
+                                 &count,
+                                 0);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_SEQUENCE);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_RECEIVE);
+}
 /*
  * This test sets up the call_cancel mock function to return values
  * indicating success. It then ensures that an invocation of the cancel
@@ -1400,6 +1808,215 @@ tcti_tabrmd_get_poll_handles_handles_test (void **state)
     fd = TSS2_TCTI_TABRMD_FD (data->context);
     assert_int_equal (handles [0].fd, fd);
 }
+/*
+ * The poll handle asks for POLLIN while the context waits for a response
+ * and for POLLOUT while part of a command is still queued.
+ */
+static void
+tcti_tabrmd_get_poll_handles_events_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx =
+        (TSS2_TCTI_TABRMD_CONTEXT*)data->context;
+    TSS2_TCTI_POLL_HANDLE handle = TSS2_TCTI_POLL_HANDLE_ZERO_INIT;
+    size_t num_handles = 1;
+    TSS2_RC rc;
+
+    rc = Tss2_Tcti_GetPollHandles (data->context, &handle, &num_handles);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (handle.events, POLLIN);
+    tabrmd_ctx->tx_buf = g_malloc0 (1);
+    tabrmd_ctx->tx_size = 1;
+    rc = Tss2_Tcti_GetPollHandles (data->context, &handle, &num_handles);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (handle.events, POLLOUT);
+}
+/*
+ * In async mode a receive that finds only part of the response returns
+ * TRY_AGAIN without blocking and the next receive picks up where it left
+ * off.
+ */
+static void
+tcti_tabrmd_receive_async_partial_test (void **state)
+{
+    data_t *data = *state;
+    uint8_t response_in [] = { 0x80, 0x01,
+                               0x00, 0x00, 0x00, 0x0c,
+                               0x00, 0x00, 0x00, 0x00,
+                               0x01, 0x02};
+    uint8_t response_out [sizeof (response_in)] = { 0 };
+    size_t size = sizeof (response_out);
+    TSS2_RC rc;
+
+    ((TSS2_TCTI_TABRMD_CONTEXT*)data->context)->async = TRUE;
+    assert_int_equal (write (data->server_fd, response_in, TPM_HEADER_SIZE),
+                      TPM_HEADER_SIZE);
+    rc = Tss2_Tcti_Receive (data->context, &size, response_out, 0);
+    assert_int_equal (rc, TSS2_TCTI_RC_TRY_AGAIN);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_RECEIVE);
+    assert_int_equal (((TSS2_TCTI_TABRMD_CONTEXT*)data->context)->index,
+                      TPM_HEADER_SIZE);
+    assert_int_equal (write (data->server_fd,
+                             &response_in [TPM_HEADER_SIZE],
+                             sizeof (response_in) - TPM_HEADER_SIZE),
+                      sizeof (response_in) - TPM_HEADER_SIZE);
+    rc = Tss2_Tcti_Receive (data->context, &size, response_out, 0);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (size, sizeof (response_in));
+    assert_memory_equal (response_in, response_out, size);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_TRANSMIT);
+}
+/*
+ * In async mode a transmit on a socket that won't take any more data
+ * returns TRY_AGAIN and leaves the command untaken.
+ */
+static void
+tcti_tabrmd_transmit_async_full_test (void **state)
+{
+    data_t *data = *state;
+    uint8_t command [TPM_HEADER_SIZE] = { 0x80, 0x01,
+                                          0x00, 0x00, 0x00, 0x0a };
+    uint8_t fill [4096] = { 0 };
+    TSS2_RC rc;
+
+    ((TSS2_TCTI_TABRMD_CONTEXT*)data->context)->async = TRUE;
+    while (send (data->client_fd, fill, sizeof (fill), MSG_DONTWAIT) > 0);
+    while (send (data->client_fd, fill, 1, MSG_DONTWAIT) > 0);
+    assert_true (errno == EAGAIN || errno == EWOULDBLOCK);
+    rc = Tss2_Tcti_Transmit (data->context, sizeof (command), command);
+    assert_int_equal (rc, TSS2_TCTI_RC_TRY_AGAIN);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_TRANSMIT);
+    assert_null (((TSS2_TCTI_TABRMD_CONTEXT*)data->context)->tx_buf);
+}
+/*
+ * In async mode a receive while the tail of a command is still queued and
+ * the socket won't take it must still read a waiting response. The tail
+ * stays queued for a later call.
+ */
+static void
+tcti_tabrmd_receive_async_queued_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx =
+        (TSS2_TCTI_TABRMD_CONTEXT*)data->context;
+    uint8_t command [] = { 0x80, 0x01,
+                           0x00, 0x00, 0x00, 0x0c,
+                           0x00, 0x00, 0x00, 0x00,
+                           0x01, 0x02};
+    uint8_t response_in [] = { 0x80, 0x01,
+                               0x00, 0x00, 0x00, 0x0c,
+                               0x00, 0x00, 0x00, 0x00,
+                               0x01, 0x02};
+    uint8_t response_out [sizeof (response_in)] = { 0 };
+    uint8_t fill [4096] = { 0 };
+    size_t size = sizeof (response_out);
+    TSS2_RC rc;
+
+    tabrmd_ctx->async = TRUE;
+    TSS2_TCTI_TABRMD_PIPELINE_DEPTH (data->context) = 2;
+    TSS2_TCTI_TABRMD_OUTSTANDING (data->context) = 2;
+    while (send (data->client_fd, fill, sizeof (fill), MSG_DONTWAIT) > 0);
+    while (send (data->client_fd, fill, 1, MSG_DONTWAIT) > 0);
+    assert_true (errno == EAGAIN || errno == EWOULDBLOCK);
+    tabrmd_ctx->tx_buf = g_memdup (command, sizeof (command));
+    tabrmd_ctx->tx_size = sizeof (command);
+    tabrmd_ctx->tx_index = TPM_HEADER_SIZE;
+    assert_int_equal (write (data->server_fd, response_in, sizeof (response_in)),
+                      sizeof (response_in));
+    rc = Tss2_Tcti_Receive (data->context, &size, response_out, 0);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (size, sizeof (response_in));
+    assert_memory_equal (response_in, response_out, size);
+    assert_int_equal (TSS2_TCTI_TABRMD_OUTSTANDING (data->context), 1);
+    assert_non_null (tabrmd_ctx->tx_buf);
+    assert_int_equal (tabrmd_ctx->tx_index, TPM_HEADER_SIZE);
+}
+/*
+ * Over a SOCK_SEQPACKET socket the response is a single message: a size
+ * query or a buffer that's too small must leave it on the socket, the
+ * next receive with a big enough buffer takes the whole thing.
+ */
+static void
+tcti_tabrmd_receive_seqpacket_test (void **state)
+{
+    data_t *data = *state;
+    uint8_t response_in [] = { 0x80, 0x01,
+                               0x00, 0x00, 0x00, 0x0e,
+                               0x00, 0x00, 0x00, 0x00,
+                               0x01, 0x02, 0x03, 0x04 };
+    uint8_t response_out [sizeof (response_in)] = { 0 };
+    size_t size = 0;
+    TSS2_RC rc;
+
+    assert_true (((TSS2_TCTI_TABRMD_CONTEXT*)data->context)->seqpacket);
+    assert_int_equal (write (data->server_fd, response_in, sizeof (response_in)),
+                      sizeof (response_in));
+    will_return (__wrap_poll, POLLIN);
+    will_return (__wrap_poll, 0);
+    will_return (__wrap_poll, 1);
+    rc = Tss2_Tcti_Receive (data->context,
+                            &size,
+                            NULL,
+                            TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (size, sizeof (response_in));
+    will_return (__wrap_poll, POLLIN);
+    will_return (__wrap_poll, 0);
+    will_return (__wrap_poll, 1);
+    size = sizeof (response_in) - 1;
+    rc = Tss2_Tcti_Receive (data->context,
+                            &size,
+                            response_out,
+                            TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_TCTI_RC_INSUFFICIENT_BUFFER);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_RECEIVE);
+    will_return (__wrap_poll, POLLIN);
+    will_return (__wrap_poll, 0);
+    will_return (__wrap_poll, 1);
+    size = sizeof (response_out);
+    rc = Tss2_Tcti_Receive (data->context,
+                            &size,
+                            response_out,
+                            TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (size, sizeof (response_in));
+    assert_memory_equal (response_in, response_out, size);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_TRANSMIT);
+}
+/*
+ * A SOCK_SEQPACKET message shorter than the size in its header is a
+ * malformed response.
+ */
+static void
+tcti_tabrmd_receive_seqpacket_short_test (void **state)
+{
+    data_t *data = *state;
+    uint8_t response_in [] = { 0x80, 0x01,
+                               0x00, 0x00, 0x00, 0x0e,
+                               0x00, 0x00, 0x00, 0x00,
+                               0x01, 0x02 };
+    uint8_t response_out [0x0e] = { 0 };
+    size_t size = sizeof (response_out);
+    TSS2_RC rc;
+
+    assert_int_equal (write (data->server_fd, response_in, sizeof (response_in)),
+                      sizeof (response_in));
+    will_return (__wrap_poll, POLLIN);
+    will_return (__wrap_poll, 0);
+    will_return (__wrap_poll, 1);
+    rc = Tss2_Tcti_Receive (data->context,
+                            &size,
+                            response_out,
+                            TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_TCTI_RC_MALFORMED_RESPONSE);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (data->context),
+                      TABRMD_STATE_TRANSMIT);
+}
 /*
  * This test sets up the call_set_locality mock function to return values
  * indicating success. It then ensures that an invocation of the set_locality
@@ -1440,6 +2057,8 @@ main (void)
         cmocka_unit_test (tcti_tabrmd_init_success_return_value_test),
         cmocka_unit_test (tcti_tabrmd_init_allnull_is_bad_value_test),
         cmocka_unit_test (tcti_tabrmd_init_success_test),
+        cmocka_unit_test (tcti_tabrmd_init_socket_test),
+        cmocka_unit_test (tcti_tabrmd_init_socket_missing_test),
         cmocka_unit_test (tcti_tabrmd_info_test),
         cmocka_unit_test (tcti_tabrmd_bus_type_from_str_session_test),
         cmocka_unit_test (tcti_tabrmd_bus_type_from_str_system_test),
@@ -1447,6 +2066,11 @@ main (void)
         cmocka_unit_test (tcti_tabrmd_kv_callback_name_test),
         cmocka_unit_test (tcti_tabrmd_kv_callback_type_good_test),
         cmocka_unit_test (tcti_tabrmd_kv_callback_type_bad_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_depth_good_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_depth_bad_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_socket_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_mode_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_transport_test),
         cmocka_unit_test (tcti_tabrmd_kv_callback_bad_key_test),
         cmocka_unit_test (tcti_tabrmd_conf_parse_named_session_test),
         cmocka_unit_test (tcti_tabrmd_conf_parse_named_system_test),
@@ -1469,6 +2093,9 @@ main (void)
         cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_success_test,
                                          tcti_tabrmd_setup,
                                          tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_pipelined_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
         cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_bad_magic_test,
                                          tcti_tabrmd_setup,
                                          tcti_tabrmd_teardown),
@@ -1484,6 +2111,9 @@ main (void)
         cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_success_test,
                                          tcti_tabrmd_receive_setup,
                                          tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_pipelined_test,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
         cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_poll_eintr_test,
                                          tcti_tabrmd_receive_setup,
                                          tcti_tabrmd_teardown),
@@ -1535,6 +2165,15 @@ main (void)
         cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_get_size_and_body_test,
                                          tcti_tabrmd_receive_setup,
                                          tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_batch_success_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_batch_truncated_command_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_batch_bad_sequence_test,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
         cmocka_unit_test_setup_teardown (tcti_tabrmd_cancel_test,
                                          tcti_tabrmd_receive_setup,
                                          tcti_tabrmd_teardown),
@@ -1553,6 +2192,24 @@ main (void)
         cmocka_unit_test_setup_teardown (tcti_tabrmd_get_poll_handles_handles_test,
                                          tcti_tabrmd_setup,
                                          tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_get_poll_handles_events_test,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_async_partial_test,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_seqpacket_test,
+                                         tcti_tabrmd_seqpacket_receive_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_seqpacket_short_test,
+                                         tcti_tabrmd_seqpacket_receive_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_async_full_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_async_queued_test,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
         cmocka_unit_test_setup_teardown (tcti_tabrmd_set_locality_test,
                                          tcti_tabrmd_setup,
                                          tcti_tabrmd_teardown),
@@ -30,10 +30,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
 
+#include "tabrmd.h"
 #include "util.h"
 #include "tpm2-header.h"
 
@@ -685,6 +688,183 @@ read_tpm_buf_alloc_eof_test (void **state)
     buf = read_tpm_buffer_alloc ((GInputStream*)1, &buf_size);
     assert_null (buf);
 }
+/*
+ * Feed read_tpm_buffer_alloc a header with the given tag and size. The
+ * size is outside of the bounds for the tag so the header must be the only
+ * thing read before the buffer is rejected.
+ */
+static void
+read_tpm_buf_alloc_bad_size (uint16_t tag,
+                             uint32_t size)
+{
+    uint8_t header [TPM_HEADER_SIZE] = {
+        tag >> 8, tag & 0xff,
+        size >> 24, (size >> 16) & 0xff, (size >> 8) & 0xff, size & 0xff,
+        0x00, 0x00, 0x00, 0x00,
+    };
+    uint8_t *buf;
+    size_t   buf_size;
+
+    will_return (__wrap_g_input_stream_read, header);
+    will_return (__wrap_g_input_stream_read, 0);
+    will_return (__wrap_g_input_stream_read, 0);
+    will_return (__wrap_g_input_stream_read, TPM_HEADER_SIZE);
+
+    buf = read_tpm_buffer_alloc ((GInputStream*)1, &buf_size);
+    assert_null (buf);
+}
+/*
+ * A size from the header larger than UTIL_BUF_MAX is rejected before we
+ * allocate a buffer that large.
+ */
+static void
+read_tpm_buf_alloc_gt_max_test (void **state)
+{
+    UNUSED_PARAM(state);
+    read_tpm_buf_alloc_bad_size (TPM2_ST_NO_SESSIONS, UTIL_BUF_MAX + 1);
+    read_tpm_buf_alloc_bad_size (TPM2_ST_NO_SESSIONS, 0xffffffff);
+}
+/*
+ * A size from the header smaller than the header itself is rejected.
+ */
+static void
+read_tpm_buf_alloc_lt_header_test (void **state)
+{
+    UNUSED_PARAM(state);
+    read_tpm_buf_alloc_bad_size (TPM2_ST_NO_SESSIONS, TPM_HEADER_SIZE - 1);
+}
+/*
+ * A batch frame may be larger than UTIL_BUF_MAX but not larger than
+ * TABRMD_BATCH_SIZE_MAX.
+ */
+static void
+read_tpm_buf_alloc_batch_gt_max_test (void **state)
+{
+    UNUSED_PARAM(state);
+    read_tpm_buf_alloc_bad_size (TABRMD_BATCH_TAG, TABRMD_BATCH_SIZE_MAX + 1);
+}
+/*
+ * Write a TPM command as a single message to one end of a SOCK_SEQPACKET
+ * socket pair and read it from the other with read_tpm_message_alloc.
+ * 'buf_size' is the size of the message we write, if 'buf' is NULL
+ * nothing is written and if 'close_first' is set the writing end is closed
+ * before the read. Returns what read_tpm_message_alloc returns, the size
+ * read comes back through 'size_out' and the error through 'error'.
+ */
+static uint8_t*
+read_tpm_message_alloc_from_pair_full (uint8_t  *buf,
+                                       size_t    buf_size,
+                                       gboolean  close_first,
+                                       size_t   *size_out,
+                                       int      *error)
+{
+    GSocket *socket;
+    uint8_t *buf_out;
+    int ret, fds [2];
+
+    ret = create_socket_pair_type (&fds [0], &fds [1], SOCK_SEQPACKET, 0);
+    assert_int_equal (ret, 0);
+    if (buf != NULL) {
+        assert_int_equal (write (fds [0], buf, buf_size), buf_size);
+    }
+    if (close_first) {
+        close (fds [0]);
+    }
+    socket = g_socket_new_from_fd (fds [1], NULL);
+    assert_non_null (socket);
+    buf_out = read_tpm_message_alloc (socket, MAX_BUF, size_out, error);
+    g_object_unref (socket);
+    if (!close_first) {
+        close (fds [0]);
+    }
+    return buf_out;
+}
+static uint8_t*
+read_tpm_message_alloc_from_pair (uint8_t *buf,
+                                  size_t   buf_size,
+                                  size_t  *size_out)
+{
+    int error = 0;
+
+    return read_tpm_message_alloc_from_pair_full (buf,
+                                                  buf_size,
+                                                  FALSE,
+                                                  size_out,
+                                                  &error);
+}
+static void
+read_tpm_message_alloc_success_test (void **state)
+{
+    uint8_t buf [12] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b, 0xde, 0xad
+    };
+    uint8_t *buf_out;
+    size_t size = 0;
+    UNUSED_PARAM(state);
+
+    buf_out = read_tpm_message_alloc_from_pair (buf, sizeof (buf), &size);
+    assert_non_null (buf_out);
+    assert_int_equal (size, sizeof (buf));
+    assert_memory_equal (buf_out, buf, sizeof (buf));
+    g_free (buf_out);
+}
+/*
+ * The size in the header says 14 bytes but the message is only 12. This
+ * can't be a TPM command.
+ */
+static void
+read_tpm_message_alloc_size_mismatch_test (void **state)
+{
+    uint8_t buf [12] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x00, 0x01, 0x7b, 0xde, 0xad
+    };
+    size_t size = 0;
+    UNUSED_PARAM(state);
+
+    assert_null (read_tpm_message_alloc_from_pair (buf, sizeof (buf), &size));
+}
+/*
+ * A message shorter than a TPM header is rejected before we allocate
+ * anything.
+ */
+static void
+read_tpm_message_alloc_lt_header_test (void **state)
+{
+    uint8_t buf [4] = { 0x80, 0x01, 0x00, 0x00 };
+    size_t size = 0;
+    UNUSED_PARAM(state);
+
+    assert_null (read_tpm_message_alloc_from_pair (buf, sizeof (buf), &size));
+}
+/*
+ * With no message waiting the read would block: NULL is returned with
+ * EAGAIN so the caller keeps watching the socket.
+ */
+static void
+read_tpm_message_alloc_eagain_test (void **state)
+{
+    size_t size = 0;
+    int error = 0;
+    UNUSED_PARAM(state);
+
+    assert_null (read_tpm_message_alloc_from_pair_full (NULL, 0, FALSE,
+                                                        &size, &error));
+    assert_int_equal (error, EAGAIN);
+}
+/*
+ * Once the other end is closed NULL is returned with no error: EOF.
+ */
+static void
+read_tpm_message_alloc_eof_test (void **state)
+{
+    size_t size = 0;
+    int error = EAGAIN;
+    UNUSED_PARAM(state);
+
+    assert_null (read_tpm_message_alloc_from_pair_full (NULL, 0, TRUE,
+                                                        &size, &error));
+    assert_int_equal (error, 0);
+}
 
 gint
 main (void)
@@ -750,6 +930,15 @@ main (void)
         cmocka_unit_test_setup_teardown (read_tpm_buf_alloc_eof_test,
                                          read_data_setup,
                                          read_data_teardown),
+        cmocka_unit_test (read_tpm_buf_alloc_gt_max_test),
+        cmocka_unit_test (read_tpm_buf_alloc_lt_header_test),
+        cmocka_unit_test (read_tpm_buf_alloc_batch_gt_max_test),
+        /* read_tpm_message_alloc */
+        cmocka_unit_test (read_tpm_message_alloc_success_test),
+        cmocka_unit_test (read_tpm_message_alloc_size_mismatch_test),
+        cmocka_unit_test (read_tpm_message_alloc_lt_header_test),
+        cmocka_unit_test (read_tpm_message_alloc_eagain_test),
+        cmocka_unit_test (read_tpm_message_alloc_eof_test),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }